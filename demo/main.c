@@ -22,14 +22,22 @@ static float g_dx = 0.02;
 static int g_cell_count_i = 100;
 static int g_cell_count_j = 100;
 
+/* storage of all fields below, separate allocations without arena */
+#define FIELD_COUNT 21
+static fluids_arena_t* g_fields;
+static float* g_field_list[FIELD_COUNT];
+static int g_field_count;
+
 /* fluid quantities */
 static float* g_ignition_coordinate[2];
 static float* g_temperatures[2];
 static float* g_smoke_densities[2];
 static float* g_us[2];
 static float* g_vs[2];
-static float* g_pressures;
+static float* g_pressures[2];		/* warm start for each projection */
+static float* g_pressure_prevs[2];	/* of the previous step */
 static float* g_vel_divs;
+static const fluids_tolerance_t g_pressure_tolerance = { 0.0, 1e-3, 8, 1 };
 
 /* vorticity confinement */
 static float* g_vorticity;
@@ -122,37 +130,53 @@ static float eval_alph_dist(float x)
 	return powf(x, 1.2);
 }
 
+static float* field_malloc(float c)
+{
+	if (g_fields) {
+		return fluids_arena_malloc(g_fields, c);
+	}
+
+	g_field_list[g_field_count] = fluids_malloc(c);
+	return g_field_list[g_field_count++];
+}
+
 static void initialize()
 {
 	/* init fluids and set grid */
 	fluids_initialize();
 	fluids_set_grid(g_origin_x, g_origin_y, g_dx, g_cell_count_i,
 		g_cell_count_j);
-
-	/* init fluid quantities */
-	g_ignition_coordinate[0] = fluids_malloc(0.0);
-	g_ignition_coordinate[1] = fluids_malloc(0.0);
-	g_temperatures[0] = fluids_malloc(273.0);
-	g_temperatures[1] = fluids_malloc(273.0);
-	g_smoke_densities[0] = fluids_malloc(0.0);
-	g_smoke_densities[1] = fluids_malloc(0.0);
-	g_ignition_coord_source = fluids_malloc(0.0);
-	g_us[0] = fluids_malloc(0.0);
-	g_us[1] = fluids_malloc(0.0);
-	g_vs[0] = fluids_malloc(0.0);
-	g_vs[1] = fluids_malloc(0.0);
-	g_pressures = fluids_malloc(0.0);
-	g_vel_divs = fluids_malloc(0.0);
+	fluids_set_pressure_solver(FLUIDS_SOLVER_MULTIGRID);
+	fluids_set_multigrid(0, 2, FLUIDS_MULTIGRID_V_CYCLE);
+	fluids_set_warm_start(1);
+
+	/* init fluid quantities, one by one if the arena cannot be mapped */
+	g_fields = fluids_arena_create(FIELD_COUNT, FLUIDS_ARENA_HUGE_PAGES);
+	g_ignition_coordinate[0] = field_malloc(0.0);
+	g_ignition_coordinate[1] = field_malloc(0.0);
+	g_temperatures[0] = field_malloc(273.0);
+	g_temperatures[1] = field_malloc(273.0);
+	g_smoke_densities[0] = field_malloc(0.0);
+	g_smoke_densities[1] = field_malloc(0.0);
+	g_us[0] = field_malloc(0.0);
+	g_us[1] = field_malloc(0.0);
+	g_vs[0] = field_malloc(0.0);
+	g_vs[1] = field_malloc(0.0);
+	g_pressures[0] = field_malloc(0.0);
+	g_pressures[1] = field_malloc(0.0);
+	g_pressure_prevs[0] = field_malloc(0.0);
+	g_pressure_prevs[1] = field_malloc(0.0);
+	g_vel_divs = field_malloc(0.0);
 	
 	/* init vort. conf. variables */
-	g_vorticity = fluids_malloc(0.0);
-	g_nvg_x = fluids_malloc(0.0);
-	g_nvg_y = fluids_malloc(0.0);
+	g_vorticity = field_malloc(0.0);
+	g_nvg_x = field_malloc(0.0);
+	g_nvg_y = field_malloc(0.0);
 	
 	/* init sources */
-	g_temp_source = fluids_malloc(0);
-	g_smoke_dens_source = fluids_malloc(0);
-	g_ignition_coord_source = fluids_malloc(0);
+	g_temp_source = field_malloc(0);
+	g_smoke_dens_source = field_malloc(0);
+	g_ignition_coord_source = field_malloc(0);
 
 	/* init particles */
 	particles_initialize();
@@ -187,36 +211,39 @@ static void do_ignition_coord_step()
 
 static void do_smoke_dens_step()
 {
-	if (g_is_clicked) {
-		fluids_add_source_clamped(g_smoke_densities[0],
-			g_smoke_dens_source, 1.0, 0.0, 1.0);
-	}
-	
-	swap(g_smoke_densities);
-	fluids_advect(g_smoke_densities[0], g_smoke_densities[1], g_us[0],
-		g_vs[0], FLUIDS_BOUNDARY_NN, g_dt);
+	fluids_source_t source;
+
+	source.type = FLUIDS_SOURCE_CLAMPED;
+	source.source = g_smoke_dens_source;
+	source.alpha = 1.0;
+	source.q_min = 0.0;
+	source.q_max = 1.0;
 	swap(g_smoke_densities);
-	fluids_diffuse(g_smoke_densities[0], g_smoke_densities[1], 10.8, 60,
+	fluids_transport(g_smoke_densities[0], g_smoke_densities[1],
+		g_is_clicked ? &source : NULL, g_us[0], g_vs[0], 10.8, 60,
 		FLUIDS_BOUNDARY_NN, g_dt);
 }
 
 static void do_temp_step()
 {
-	if (g_is_clicked) {
-		fluids_add_source_with_target(g_temperatures[0], g_temp_source,
-			g_temp_target);
-	}
+	fluids_source_t source;
 
+	source.type = FLUIDS_SOURCE_TARGET;
+	source.source = g_temp_source;
+	source.q_target = g_temp_target;
 	swap(g_temperatures);
-	fluids_advect(g_temperatures[0], g_temperatures[1], g_us[0], g_vs[0],
-		FLUIDS_BOUNDARY_NN, g_dt);
-	swap(g_temperatures);
-	fluids_diffuse(g_temperatures[0], g_temperatures[1], 10.8, 20,
+	fluids_transport(g_temperatures[0], g_temperatures[1],
+		g_is_clicked ? &source : NULL, g_us[0], g_vs[0], 10.8, 20,
 		FLUIDS_BOUNDARY_NN, g_dt);
 }
 
 static void do_vel_step()
 {
+	float* qs[2];
+	const float* q_prevs[2];
+	int boundaries[2] = { FLUIDS_BOUNDARY_REFLECT_U,
+		FLUIDS_BOUNDARY_REFLECT_V };
+
 //	printf("(%f, %f)\n", fluids_sample(g_us[0], 0.0, 0.0),
 //		fluids_sample(g_vs[0], 0.0, 0.0));
 		
@@ -230,21 +257,27 @@ static void do_vel_step()
 	}
 	
 	swap(g_us);
-	fluids_diffuse(g_us[0], g_us[1], 10.5, 20, FLUIDS_BOUNDARY_REFLECT_U,
-		g_dt);
 	swap(g_vs);
-	fluids_diffuse(g_vs[0], g_vs[1], 10.5, 20, FLUIDS_BOUNDARY_REFLECT_V,
-		g_dt);
-	fluids_project(g_us[0], g_vs[0], FLUIDS_BOUNDARY_REFLECT_U,
-		FLUIDS_BOUNDARY_REFLECT_V, g_pressures, g_vel_divs, 300);
+	qs[0] = g_us[0];
+	qs[1] = g_vs[0];
+	q_prevs[0] = g_us[1];
+	q_prevs[1] = g_vs[1];
+	fluids_diffuse_many(qs, q_prevs, 2, 10.5, 20, boundaries, g_dt);
+	fluids_extrapolate(g_pressures[0], g_pressure_prevs[0]);
+	fluids_project_to_tolerance(g_us[0], g_vs[0],
+		FLUIDS_BOUNDARY_REFLECT_U, FLUIDS_BOUNDARY_REFLECT_V,
+		g_pressures[0], g_vel_divs, &g_pressure_tolerance);
 	swap(g_us);
 	swap(g_vs);
-	fluids_advect(g_us[0], g_us[1] , g_us[1], g_vs[1],
-		FLUIDS_BOUNDARY_REFLECT_U, g_dt);
-	fluids_advect(g_vs[0], g_vs[1] , g_us[1], g_vs[1],
-		FLUIDS_BOUNDARY_REFLECT_V, g_dt);
-	fluids_project(g_us[0], g_vs[0], FLUIDS_BOUNDARY_REFLECT_U,
-		FLUIDS_BOUNDARY_REFLECT_V, g_pressures, g_vel_divs, 300);
+	qs[0] = g_us[0];
+	qs[1] = g_vs[0];
+	q_prevs[0] = g_us[1];
+	q_prevs[1] = g_vs[1];
+	fluids_advect_many(qs, q_prevs, 2, g_us[1], g_vs[1], boundaries, g_dt);
+	fluids_extrapolate(g_pressures[1], g_pressure_prevs[1]);
+	fluids_project_to_tolerance(g_us[0], g_vs[0],
+		FLUIDS_BOUNDARY_REFLECT_U, FLUIDS_BOUNDARY_REFLECT_V,
+		g_pressures[1], g_vel_divs, &g_pressure_tolerance);
 }
 
 
@@ -281,28 +314,29 @@ static void update()
 	
 	
 //	printf("%u\n", particles_get_count());
-//	particle_renderer_render(particles_get_positions(),
-//		particles_get_lifetimes(), particles_get_count());
+//	particle_renderer_render(particles_get_x_positions(),
+//		particles_get_y_positions(), particles_get_lifetimes(),
+//		particles_get_count());
 //	printf("%f %f\n", fluids_sample(g_temperatures[0], -0.75, -0.75),
 //			fluids_sample(g_us[0], -0.75, -0.75));
 }
 
 static void finalize()
 {
-	free(g_ignition_coord_source);
-	free(g_ignition_coordinate[0]);
-	free(g_ignition_coordinate[1]);
-	free(g_temperatures[0]);
-	free(g_temperatures[1]);
-	free(g_us[0]);
-	free(g_us[1]);
-	free(g_vs[0]);
-	free(g_vs[1]);
+	if (g_fields) {
+		fluids_arena_destroy(g_fields);
+	}
+
+	while (g_field_count > 0) {
+		free(g_field_list[--g_field_count]);
+	}
+
 	quantity_renderer_finalize();
 	velocity_renderer_finalize();
 //	particle_renderer_finalize();
 //	particles_finalize();
 	fire_renderer_finalize();
+	fluids_finalize();
 }
 
 static void update_particle_emitter()
@@ -17,7 +17,8 @@ TO_STRING(
 	uniform float u_y_min;
 	uniform float u_x_max;
 	uniform float u_y_max;
-	in vec2 v_position;
+	in float v_x;
+	in float v_y;
 	in float v_lifetime;
 	out float vo_lifetime;
 
@@ -26,8 +27,8 @@ TO_STRING(
 		vo_lifetime = v_lifetime;
 		float ext_x = u_x_max - u_x_min;
 		float ext_y = u_y_max - u_y_min;
-		float x_ndc = 2.0 * (v_position.x - u_x_min) / ext_x - 1.0;
-		float y_ndc = 2.0 * (v_position.y - u_y_min) / ext_y - 1.0;
+		float x_ndc = 2.0 * (v_x - u_x_min) / ext_x - 1.0;
+		float y_ndc = 2.0 * (v_y - u_y_min) / ext_y - 1.0;
 		gl_PointSize = 2.0;
 		gl_Position = vec4(x_ndc, y_ndc, 0.0, 1.0);
 	}
@@ -54,7 +55,8 @@ TO_STRING(
 ******************************************************************************/
 static GLuint g_program = 0;
 static GLuint g_vao = 0;
-static GLuint g_positions_buffer = 0;
+static GLuint g_x_buffer = 0;
+static GLuint g_y_buffer = 0;
 static GLuint g_lifetime_buffer = 0;
 static GLuint g_particle_capacity = 0;
 
@@ -65,8 +67,9 @@ void init_program()
 		g_vertex_shader);
 	glueProgramAttachShaderWithSource(g_program, GL_FRAGMENT_SHADER,
 		g_fragment_shader);
-	glBindAttribLocation(g_program, 0, "v_position");
+	glBindAttribLocation(g_program, 0, "v_x");
 	glBindAttribLocation(g_program, 1, "v_lifetime");
+	glBindAttribLocation(g_program, 2, "v_y");
 	glBindFragDataLocation(g_program, 0, "f_fragment_color");
 	glueProgramLink(g_program);
 	assert(GL_NO_ERROR == glGetError());
@@ -76,10 +79,14 @@ void init_geometry()
 {
 	glGenVertexArrays(1, &g_vao);
 	glBindVertexArray(g_vao);
-	glGenBuffers(1, &g_positions_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, g_positions_buffer);
+	glGenBuffers(1, &g_x_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, g_x_buffer);
 	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, 0, 0);
+	glGenBuffers(1, &g_y_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, g_y_buffer);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 0, 0);
 	glGenBuffers(1, &g_lifetime_buffer);
 	glBindBuffer(GL_ARRAY_BUFFER, g_lifetime_buffer);
 	glEnableVertexAttribArray(1);
@@ -104,22 +111,26 @@ void particle_renderer_initialize(float x_min, float y_min, float x_max,
 
 }
 
-void particle_renderer_render(const float* const positions,
+void particle_renderer_render(const float* const xs, const float* const ys,
 	const float* const lifetimes, unsigned int count)
 {
 	/* copy particle positions to the buffer */
 	if (count > g_particle_capacity) {
-		glBindBuffer(GL_ARRAY_BUFFER, g_positions_buffer);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(*positions) * 2 * count,
-			positions, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, g_x_buffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(*xs) * count, xs,
+			GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, g_y_buffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(*ys) * count, ys,
+			GL_DYNAMIC_DRAW);
 		glBindBuffer(GL_ARRAY_BUFFER, g_lifetime_buffer);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(*lifetimes) * count,
 			lifetimes, GL_DYNAMIC_DRAW);
 		g_particle_capacity = count;
 	} else {
-		glBindBuffer(GL_ARRAY_BUFFER, g_positions_buffer);
-		glBufferSubData(GL_ARRAY_BUFFER, 0,
-			sizeof(*positions) * 2 * count, positions);
+		glBindBuffer(GL_ARRAY_BUFFER, g_x_buffer);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(*xs) * count, xs);
+		glBindBuffer(GL_ARRAY_BUFFER, g_y_buffer);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(*ys) * count, ys);
 		glBindBuffer(GL_ARRAY_BUFFER, g_lifetime_buffer);
 		glBufferSubData(GL_ARRAY_BUFFER, 0,
 			sizeof(*lifetimes) * count, lifetimes);
@@ -136,7 +147,9 @@ void particle_renderer_render(const float* const positions,
 
 void particle_renderer_finalize()
 {
-	glDeleteBuffers(1, &g_positions_buffer);
+	glDeleteBuffers(1, &g_x_buffer);
+	glDeleteBuffers(1, &g_y_buffer);
+	glDeleteBuffers(1, &g_lifetime_buffer);
 	glDeleteVertexArrays(1, &g_vao);
 	glDeleteProgram(g_program);
 }
@@ -12,8 +12,10 @@ extern "C"
 void particle_renderer_initialize(float x_min, float y_min, float x_max, 
 	float y_max);
 
-/* Renders the first [count] [positions] of the particle system. */
-void particle_renderer_render(const float* const positions,
+/* Renders the first [count] particles of the particle system at the
+** positions ([xs], [ys]). Only these are copied to the buffers, particles
+** with a lifetime <= 0 are discarded. */
+void particle_renderer_render(const float* const xs, const float* const ys,
 	const float* const lifetimes, unsigned int count);
 
 /* cleans up once the particle renderer is done. */
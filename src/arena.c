@@ -0,0 +1,120 @@
+/* MAP_ANONYMOUS and the huge page flags of glibc in strict ISO C modes */
+#define _DEFAULT_SOURCE
+
+#include "arena.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+struct arena {
+	char* base;		/* first block, as mapped */
+	size_t size;		/* mapped bytes */
+	size_t block_size;
+	int block_count;
+	int used_count;		/* blocks handed out */
+};
+
+/* maps [size] bytes at a huge page boundary by mapping a huge page more and
+** unmapping the excess at both ends. returns MAP_FAILED on failure */
+static void* map_huge_aligned(size_t size)
+{
+	size_t head = 0;
+	uintptr_t start = 0;
+	char* p = mmap(NULL, size + ARENA_HUGE_PAGE_SIZE,
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED) {
+		return p;
+	}
+
+	start = ((uintptr_t)p + ARENA_HUGE_PAGE_SIZE - 1) &
+		~(uintptr_t)(ARENA_HUGE_PAGE_SIZE - 1);
+	head = start - (uintptr_t)p;
+
+	if (head > 0) {
+		munmap(p, head);
+	}
+
+	munmap((char*)start + size, ARENA_HUGE_PAGE_SIZE - head);
+	return (void*)start;
+}
+
+arena_t* arena_create(size_t block_size, int block_count, int huge_pages)
+{
+	arena_t* arena = malloc(sizeof(*arena));
+	size_t size = 0;
+	void* p = MAP_FAILED;
+
+	if (!arena) {
+		return NULL;
+	}
+
+	arena->block_size = (block_size + ARENA_ALIGNMENT - 1) /
+		ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+	arena->block_count = block_count;
+	arena->used_count = 0;
+	size = arena->block_size * block_count;
+
+	if (huge_pages) {
+		size = (size + ARENA_HUGE_PAGE_SIZE - 1) /
+			ARENA_HUGE_PAGE_SIZE * ARENA_HUGE_PAGE_SIZE;
+
+#ifdef MAP_HUGETLB
+		/* reserved huge pages (Linux hugetlbfs), if any are left */
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+		/* otherwise transparent huge pages, which need the
+		** alignment */
+		if (p == MAP_FAILED) {
+			p = map_huge_aligned(size);
+#ifdef MADV_HUGEPAGE
+			if (p != MAP_FAILED) {
+				madvise(p, size, MADV_HUGEPAGE);
+			}
+#endif
+		}
+	} else {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+
+	if (p == MAP_FAILED) {
+		free(arena);
+		return NULL;
+	}
+
+	arena->base = p;
+	arena->size = size;
+	return arena;
+}
+
+void arena_destroy(arena_t* const arena)
+{
+	munmap(arena->base, arena->size);
+	free(arena);
+}
+
+void* arena_alloc(arena_t* const arena)
+{
+	if (arena->used_count == arena->block_count) {
+		return NULL;
+	}
+
+	return arena->base + arena->block_size * arena->used_count++;
+}
+
+void arena_reset(arena_t* const arena)
+{
+	arena->used_count = 0;
+}
+
+size_t arena_get_block_size(const arena_t* const arena)
+{
+	return arena->block_size;
+}
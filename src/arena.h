@@ -0,0 +1,43 @@
+/* fixed size blocks carved from a single mapping, optionally backed by huge
+** pages. blocks are handed out in order and released all at once */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define ARENA_ALIGNMENT 64		/* bytes, a cache line */
+#define ARENA_HUGE_PAGE_SIZE (2 << 20)
+
+typedef struct arena arena_t;
+
+/* Creates an arena of [block_count] blocks of at least [block_size] bytes.
+** Each block starts at an ARENA_ALIGNMENT boundary, the block size is
+** rounded up accordingly. With [huge_pages], the mapping is aligned to and
+** padded to ARENA_HUGE_PAGE_SIZE and backed by huge pages if the system
+** provides them. Returns NULL if the memory cannot be allocated or
+** mapped. */
+arena_t* arena_create(size_t block_size, int block_count, int huge_pages);
+
+/* Releases an arena and all its blocks. */
+void arena_destroy(arena_t* const arena);
+
+/* Returns the next free block, NULL if all blocks are in use. */
+void* arena_alloc(arena_t* const arena);
+
+/* Marks all blocks free. Blocks handed out before are reused by the next
+** calls to arena_alloc. */
+void arena_reset(arena_t* const arena);
+
+/* Gets the (rounded) size of a block in bytes. */
+size_t arena_get_block_size(const arena_t* const arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard: ARENA_H */
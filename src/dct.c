@@ -0,0 +1,267 @@
+#include "dct.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+
+#define MAX_FACTOR_COUNT 32
+#define PI 3.14159265358979323846
+
+typedef struct complex {
+	float re;
+	float im;
+} complex_t;
+
+struct dct_plan {
+	int n;
+	int factors[2 * MAX_FACTOR_COUNT];	/* pairs of radix p and the
+						** remaining length m */
+	complex_t* twiddles;	/* exp(-2 pi i k / n) */
+	complex_t* shifts;	/* exp(-pi i k / 2n) */
+	complex_t* in;		/* reordered input of the FFT */
+	complex_t* out;		/* FFT output */
+	complex_t* scratch;	/* generic butterfly storage */
+};
+
+/* splits [n] into radix 4, 2, 3, 5, ... factors. */
+static int factorize(int n, int* factors)
+{
+	int p = 4, max_p = 1;
+
+	do {
+		while (n % p) {
+			switch (p) {
+			case 4: p = 2; break;
+			case 2: p = 3; break;
+			default: p += 2; break;
+			}
+			if (p * p > n) {
+				p = n;
+			}
+		}
+		n /= p;
+		*factors++ = p;
+		*factors++ = n;
+		max_p = p > max_p ? p : max_p;
+	} while (n > 1);
+
+	return max_p;
+}
+
+/* radix 2 butterflies of [m] pairs */
+static void butterfly_2(complex_t* const out, const complex_t* tw,
+	int fstride, int m)
+{
+	int k = 0;
+	complex_t t;
+	complex_t* a = out;
+	complex_t* b = out + m;
+
+	for (k = 0; k < m; k++) {
+		t.re = b[k].re * tw->re - b[k].im * tw->im;
+		t.im = b[k].re * tw->im + b[k].im * tw->re;
+		b[k].re = a[k].re - t.re;
+		b[k].im = a[k].im - t.im;
+		a[k].re += t.re;
+		a[k].im += t.im;
+		tw += fstride;
+	}
+}
+
+/* radix 4 butterflies of [m] quadruples */
+static void butterfly_4(complex_t* const out, const complex_t* const tw,
+	int fstride, int m)
+{
+	int k = 0;
+	complex_t s[6];
+	complex_t* a = out;
+	const complex_t* tw1 = tw;
+	const complex_t* tw2 = tw;
+	const complex_t* tw3 = tw;
+
+	for (k = 0; k < m; k++) {
+		s[0].re = a[m].re * tw1->re - a[m].im * tw1->im;
+		s[0].im = a[m].re * tw1->im + a[m].im * tw1->re;
+		s[1].re = a[2 * m].re * tw2->re - a[2 * m].im * tw2->im;
+		s[1].im = a[2 * m].re * tw2->im + a[2 * m].im * tw2->re;
+		s[2].re = a[3 * m].re * tw3->re - a[3 * m].im * tw3->im;
+		s[2].im = a[3 * m].re * tw3->im + a[3 * m].im * tw3->re;
+
+		s[5].re = a->re - s[1].re;
+		s[5].im = a->im - s[1].im;
+		a->re += s[1].re;
+		a->im += s[1].im;
+		s[3].re = s[0].re + s[2].re;
+		s[3].im = s[0].im + s[2].im;
+		s[4].re = s[0].re - s[2].re;
+		s[4].im = s[0].im - s[2].im;
+
+		a[2 * m].re = a->re - s[3].re;
+		a[2 * m].im = a->im - s[3].im;
+		a->re += s[3].re;
+		a->im += s[3].im;
+		a[m].re = s[5].re + s[4].im;
+		a[m].im = s[5].im - s[4].re;
+		a[3 * m].re = s[5].re - s[4].im;
+		a[3 * m].im = s[5].im + s[4].re;
+
+		tw1 += fstride;
+		tw2 += 2 * fstride;
+		tw3 += 3 * fstride;
+		a++;
+	}
+}
+
+/* radix [p] butterflies of [m] tuples by direct summation */
+static void butterfly_generic(const dct_plan_t* const plan,
+	complex_t* const out, int fstride, int m, int p)
+{
+	int u = 0, k = 0, q = 0, q1 = 0, t = 0;
+	complex_t* scratch = plan->scratch;
+	const complex_t* tw = plan->twiddles;
+
+	for (u = 0; u < m; u++) {
+		for (q1 = 0, k = u; q1 < p; q1++, k += m) {
+			scratch[q1] = out[k];
+		}
+
+		for (q1 = 0, k = u; q1 < p; q1++, k += m) {
+			t = 0;
+			out[k] = scratch[0];
+			for (q = 1; q < p; q++) {
+				t += fstride * k;
+				if (t >= plan->n) {
+					t -= plan->n;
+				}
+				out[k].re += scratch[q].re * tw[t].re -
+					scratch[q].im * tw[t].im;
+				out[k].im += scratch[q].re * tw[t].im +
+					scratch[q].im * tw[t].re;
+			}
+		}
+	}
+}
+
+/* recursive decimation in time FFT of the [in] values strided by [fstride].
+** [factors] holds the radix of this stage followed by the remaining
+** length. */
+static void fft(const dct_plan_t* const plan, complex_t* out,
+	const complex_t* in, int fstride, const int* const factors)
+{
+	int p = factors[0], m = factors[1];
+	int q = 0;
+
+	if (m == 1) {
+		for (q = 0; q < p; q++) {
+			out[q] = *in;
+			in += fstride;
+		}
+	} else {
+		for (q = 0; q < p; q++) {
+			fft(plan, out + q * m, in, fstride * p, factors + 2);
+			in += fstride;
+		}
+	}
+
+	switch (p) {
+	case 2: butterfly_2(out, plan->twiddles, fstride, m); break;
+	case 4: butterfly_4(out, plan->twiddles, fstride, m); break;
+	default: butterfly_generic(plan, out, fstride, m, p); break;
+	}
+}
+
+dct_plan_t* dct_plan_create(int n)
+{
+	int k = 0, max_p = 0;
+	double a = 0.0;
+	dct_plan_t* plan = NULL;
+
+	assert(n > 0);
+	plan = calloc(1, sizeof(*plan));
+	assert(plan);
+	plan->n = n;
+	max_p = factorize(n, plan->factors);
+	plan->twiddles = malloc(n * sizeof(*plan->twiddles));
+	plan->shifts = malloc(n * sizeof(*plan->shifts));
+	plan->in = malloc(n * sizeof(*plan->in));
+	plan->out = malloc(n * sizeof(*plan->out));
+	plan->scratch = malloc(max_p * sizeof(*plan->scratch));
+	assert(plan->twiddles && plan->shifts && plan->in && plan->out);
+	assert(plan->scratch);
+
+	for (k = 0; k < n; k++) {
+		a = -2.0 * PI * k / n;
+		plan->twiddles[k].re = cos(a);
+		plan->twiddles[k].im = sin(a);
+		a = -0.5 * PI * k / n;
+		plan->shifts[k].re = cos(a);
+		plan->shifts[k].im = sin(a);
+	}
+
+	return plan;
+}
+
+void dct_plan_destroy(dct_plan_t* const plan)
+{
+	if (!plan) {
+		return;
+	}
+
+	free(plan->twiddles);
+	free(plan->shifts);
+	free(plan->in);
+	free(plan->out);
+	free(plan->scratch);
+	free(plan);
+}
+
+/* DCT-II by a single FFT of the even-odd reordered input (Makhoul 1980) */
+void dct_forward(dct_plan_t* const plan, float* const x, int stride)
+{
+	int k = 0, n = plan->n;
+	complex_t* in = plan->in;
+	complex_t* out = plan->out;
+	const complex_t* s = plan->shifts;
+
+	for (k = 0; 2 * k < n; k++) {
+		in[k].re = x[2 * k * stride];
+		in[k].im = 0.0;
+	}
+	for (k = 0; 2 * k + 1 < n; k++) {
+		in[n - 1 - k].re = x[(2 * k + 1) * stride];
+		in[n - 1 - k].im = 0.0;
+	}
+
+	fft(plan, out, in, 1, plan->factors);
+
+	for (k = 0; k < n; k++) {
+		x[k * stride] = out[k].re * s[k].re - out[k].im * s[k].im;
+	}
+}
+
+/* reverses dct_forward. with X_n = 0 the spectrum of the reordered input is
+** V_k = exp(pi i k / 2n) (X_k - i X_(n-k)), which is inverted by a forward
+** FFT of its complex conjugate. */
+void dct_inverse(dct_plan_t* const plan, float* const x, int stride)
+{
+	int k = 0, n = plan->n;
+	float xr = 0.0, xi = 0.0;
+	complex_t* in = plan->in;
+	complex_t* out = plan->out;
+	const complex_t* s = plan->shifts;
+
+	for (k = 0; k < n; k++) {
+		xr = x[k * stride];
+		xi = k ? x[(n - k) * stride] : 0.0;
+		in[k].re = xr * s[k].re - xi * s[k].im;
+		in[k].im = xr * s[k].im + xi * s[k].re;
+	}
+
+	fft(plan, out, in, 1, plan->factors);
+
+	for (k = 0; 2 * k < n; k++) {
+		x[2 * k * stride] = out[k].re / n;
+	}
+	for (k = 0; 2 * k + 1 < n; k++) {
+		x[(2 * k + 1) * stride] = out[n - 1 - k].re / n;
+	}
+}
@@ -0,0 +1,35 @@
+/* dependency free discrete cosine transform. transforms are computed by a
+** mixed radix FFT of the same length. lengths with a large prime factor p are
+** supported but cost O(n * p). */
+#ifndef DCT_H
+#define DCT_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct dct_plan dct_plan_t;
+
+/* Creates a plan for transforms of [n] values. Precomputes the twiddle
+** factors. */
+dct_plan_t* dct_plan_create(int n);
+
+/* Releases a plan created with dct_plan_create. */
+void dct_plan_destroy(dct_plan_t* const plan);
+
+/* Replaces the values x[0], x[stride], ..., x[(n - 1) * stride] by their
+** (unnormalized) DCT-II
+**
+** 	X_k = sum_m x_m cos(pi k (2m + 1) / 2n).
+*/
+void dct_forward(dct_plan_t* const plan, float* const x, int stride);
+
+/* Inverse of dct_forward, i.e. a DCT-III scaled by 1 / n. */
+void dct_inverse(dct_plan_t* const plan, float* const x, int stride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard: DCT_H */
@@ -1,485 +1,5763 @@
+/* posix_memalign in strict ISO C modes */
+#define _POSIX_C_SOURCE 200112L
+
 #include "fluids.h"
+#include "dct.h"
+#include "threads.h"
+#include "simd.h"
+#include "arena.h"
+#include "numeric.h"
 #include <stdio.h>
 #include <stdlib.h>
-#include <float.h>
 #include <math.h>
+#include <string.h>
 
-/* a small float. mainly to avoid division by zero */
-#define EPS FLT_MIN
+#define PI 3.14159265358979323846
 
 /* grid */
 
-static float g_origin_x = 0.0;
-static float g_origin_y = 0.0;
-static float g_dx = 0.01;
-static int g_cell_count_i = 100;
-static int g_cell_count_j = 100;
-
-#define IDX(i, j) g_cell_count_i * (j) + (i)
+#define IDX(i, j) (ctx->origin_index + ctx->pitch * (j) + (i))
+#define IDXN(n, i, j) (n) * (j) + (i)
+#define VALUE_COUNT ((size_t)ctx->pitch * (ctx->cell_count_j + 2 * ctx->halo))
 #define CLAMP(i, j) 						\
 	i = i < 0 ? 0 : i; 					\
-	i = i >= g_cell_count_i ? g_cell_count_i - 1 : i; 	\
+	i = i >= ctx->cell_count_i ? ctx->cell_count_i - 1 : i; 	\
 	j = j < 0 ? 0 : j; 					\
-	j = j >= g_cell_count_j ? g_cell_count_j - 1 : j;
+	j = j >= ctx->cell_count_j ? ctx->cell_count_j - 1 : j;
+
+/* Jacobi iterations */
+
+#define SWEEP_WINDOW_ROW_COUNT 16	/* rows buffered per intermediate 
+					** iterate of blocked Jacobi sweeps */
+
+/* alternating direction implicit diffusion */
+
+#define ADI_BLOCK_ROW_COUNT 16	/* rows eliminated together */
+
+/* multigrid */
+
+#define MULTIGRID_MAX_LEVEL_COUNT 16
+
+struct multigrid_level {
+	int cell_count_i;
+	int cell_count_j;
+	float k;	/* diagonal shift of the operator (4 + k) x - sum(x_nb) */
+	float* x;	/* solution on the finest, correction on coarser levels */
+	float* b;	/* right hand side */
+	float* r;	/* residual */
+	int pitch;	/* floats per row */
+	int halo;	/* cells around the level, 0 below the finest */
+	const float* fluid;	/* 1 on the fluid cells of a masked solve,
+				** NULL otherwise, see masked_operator */
+	const float* unknowns;	/* 1 on the cells a masked solve updates */
+	float* masks;	/* storage of both below the finest */
+};
+
+/* preconditioned conjugate gradients */
+
+#define PCG_DEFAULT_TOLERANCE 1e-5	/* relative tolerance fluids_project
+					** uses with FLUIDS_SOLVER_PCG */
+
+/* obstacles */
+
+/* a run of [n] cells of row [j], starting at cell [i] */
+struct span {
+	int i;
+	int j;
+	int n;
+};
+
+/* runs of cells in row order, growing as needed */
+struct span_list {
+	struct span* spans;
+	int span_count;
+	int cell_count;
+	int capacity;
+};
+
+/* a work array kept between calls, growing as needed */
+struct scratch {
+	void* p;
+	size_t size;	/* bytes */
+};
+
+/* a solid cell next to fluid cells, [sides] has a SIDE_* bit for each */
+struct obstacle_face {
+	int i;
+	int j;
+	int sides;
+};
+
+#define SIDE_LEFT 1	/* fluid cell (i - 1, j) */
+#define SIDE_RIGHT 2	/* fluid cell (i + 1, j) */
+#define SIDE_BOTTOM 4	/* fluid cell (i, j - 1) */
+#define SIDE_TOP 8	/* fluid cell (i, j + 1) */
+
+/* context */
+
+/* The state of a simulation. All routines read the grid and the solver
+** settings from a context and keep their work arrays in it, so each 
+** simulation can run on a thread of its own. */
+struct fluids_context {
+	/* grid */
+	float origin_x;
+	float origin_y;
+	float dx;
+	int cell_count_i;
+	int cell_count_j;
+	int halo;		/* cells around the grid */
+	int pitch;		/* floats per row of a field */
+	int origin_index;	/* of cell (0, 0) in a field */
+
+	/* solvers */
+	int pressure_solver;
+	int diffusion_solver;
+	int warm_start;		/* keep pressure between projections */
+	int sweep_block;	/* sweeps per pass over the grid */
+	float sor_omega;	/* 0 = optimal for the grid */
+	int mg_max_level_count;
+	int mg_smooth_count;
+	int mg_cycle;
+
+	/* advection */
+	int advection;		/* scheme, FLUIDS_ADVECTION_* */
+	float* advect_tmp;	/* forward step of MacCormack */
+	struct scratch weight_indices;	/* departure points, rows per
+					** thread */
+	struct scratch weight_fractions;
+	struct scratch transport_rings;	/* advected rows of the fused
+					** transport per thread */
+
+	/* mixed precision pressure solve, off without rounds */
+	int mixed_round_count;
+	int mixed_format;
+	fluids_half_t* mixed_r;	/* scaled residual */
+	fluids_half_t* mixed_e;	/* correction */
+
+	/* Jacobi iterations */
+	float* jacobi_tmp;	/* previous iterate */
+	struct scratch sweep_windows;	/* rows of the intermediate iterates
+					** of a wavefront */
+	struct scratch sweep_bases;	/* first row of each window */
+
+	/* multigrid */
+	struct multigrid_level mg_levels[MULTIGRID_MAX_LEVEL_COUNT];
+	int mg_level_count;	/* number of allocated levels */
+	float* mg_rhs;		/* right hand side storage of the finest 
+				** level */
+
+	/* preconditioned conjugate gradients */
+	float* pcg_precon;	/* inverse diagonal of MIC(0) factor */
+	float* pcg_r;		/* residual */
+	float* pcg_z;		/* preconditioned residual */
+	float* pcg_s;		/* search direction */
+	float* pcg_as;		/* A times search direction */
+
+	/* spectral pressure solve */
+	dct_plan_t* dct_i;	/* transforms of the inner cells */
+	dct_plan_t* dct_j;
+	float* spectral_eigen_i;	/* eigenvalues of the 1d Neumann 
+					** operators */
+	float* spectral_eigen_j;
+	float* spectral_coeffs;	/* inner cells, densely packed */
+
+	/* alternating direction implicit diffusion */
+	float* adi_inv_i;	/* inverse pivots of the tridiagonal systems */
+	float* adi_inv_j;	/* along i and j */
+	struct scratch adi_blocks;	/* transposed rows (or pivots of the
+					** runs) per thread */
+	struct scratch adi_begins;	/* of the open runs along the columns */
+	struct span_list adi_columns;	/* runs of the active cells along the
+					** columns */
+	struct scratch many_fields;	/* arguments per field of
+					** diffuse_many */
+	struct scratch many_pivots;	/* ADI pivots per field */
+
+	/* masked solves, with obstacles or sparse tiles */
+	float* fluid_weights;	/* 1 on inner fluid cells, 0 elsewhere */
+	float* unknown_weights;	/* 1 on the active cells of a solve */
+
+	/* obstacles, the spans and faces are NULL without */
+	struct span_list fluid;		/* inner fluid cells */
+	struct obstacle_face* obstacle_faces;
+	int obstacle_face_count;
+
+	/* sparse tiles, tile_active is NULL without */
+	int tile_size;		/* cells along i and j */
+	int tile_count_i;
+	int tile_count_j;
+	unsigned char* tile_active;	/* per tile */
+	unsigned char* tile_marks;	/* tiles above the threshold */
+	int active_tile_count;
+	struct span_list active;	/* inner (fluid) cells of active
+					** tiles */
+};
+
+/* a 100 x 100 grid of spacing 0.01 at the origin, no work arrays */
+#define CONTEXT_DEFAULTS { 0.0, 0.0, 0.01, 100, 100, 0, 100, 0,		\
+	FLUIDS_SOLVER_GAUSS_SEIDEL, FLUIDS_SOLVER_JACOBI, 0, 1, 0.0, 0, 2,	\
+	FLUIDS_MULTIGRID_V_CYCLE, FLUIDS_ADVECTION_SEMI_LAGRANGIAN }
+
+static const fluids_context_t g_context_defaults = CONTEXT_DEFAULTS;
 
-/* boundary handler definitions */
+/* the context of the routines without context argument */
+static fluids_context_t g_context = CONTEXT_DEFAULTS;
 
-static void set_boundary_nn(float* const q)
+/* vector kernels, chosen by fluids_initialize */
+
+static const struct simd_kernels* g_kernels = &simd_scalar_kernels;
+
+/* threading */
+
+#define PARALLEL_MIN_CELL_COUNT 40000	/* smaller grids run serially */
+
+typedef void (*band_fn_t)(fluids_context_t* const ctx, int begin, int end, 
+	int thread, void* const vp);
+
+/* a band function of a context, as passed to the thread pool */
+struct band_job {
+	band_fn_t fn;
+	fluids_context_t* ctx;
+	void* vp;
+};
+
+static void run_band_job(int begin, int end, int thread, void* const vp)
 {
-	int i = 0, j = 0;	
+	const struct band_job* const job = vp;
 
-	for (i = 1; i < g_cell_count_i - 1; i++) {
-		q[IDX(i, 0)] = q[IDX(i, 1)];
-		q[IDX(i, g_cell_count_j - 1)] = q[IDX(i, g_cell_count_j - 2)];
-	}
+	(*job->fn)(job->ctx, begin, end, thread, job->vp);
+}
 
-	for (j = 1; j < g_cell_count_j - 1; j++) {
-		q[IDX(0, j)] = q[IDX(1, j)];
-		q[IDX(g_cell_count_i - 1, j)] = 
-			q[IDX(g_cell_count_i - 2, j)];
+/* Runs [fn] for bands of the rows (or cells) [begin, end) on the worker
+** threads. Grids of less than PARALLEL_MIN_CELL_COUNT cells do not amortize
+** the dispatch and run on the calling thread. */
+static void parallel_for(fluids_context_t* const ctx, band_fn_t fn,
+	void* const vp, int begin, int end, int cell_count)
+{
+	struct band_job job = { fn, ctx, vp };
+
+	if (cell_count < PARALLEL_MIN_CELL_COUNT) {
+		(*fn)(ctx, begin, end, 0, vp);
+		return;
 	}
 
-	q[IDX(0, 0)] = 0.5 * (q[IDX(0, 1)] + q[IDX(1, 0)]);
-	q[IDX(g_cell_count_i - 1, 0)] = 0.5 * (q[IDX(g_cell_count_i - 1, 1)] + 
-		q[IDX(g_cell_count_i - 2, 0)]);
-	q[IDX(0, g_cell_count_j - 1)] = 0.5 * (q[IDX(0, g_cell_count_j - 2)] + 
-		q[IDX(1, g_cell_count_j - 1)]);
-	q[IDX(g_cell_count_i - 1, g_cell_count_j - 1)] = 0.5 * (
-		q[IDX(g_cell_count_i - 2, g_cell_count_j - 1)] + 
-		q[IDX(g_cell_count_i - 1, g_cell_count_j - 2)]);
+	threads_for(run_band_job, &job, begin, end);
 }
 
-static void set_boundary_no_stick_u(float* const q)
+/* A function of the cells (i, j), ..., (i + n - 1, j). */
+typedef void (*cells_fn_t)(fluids_context_t* const ctx, int i, int j, int n,
+	int thread, void* const vp);
+
+struct cells_job {
+	cells_fn_t fn;
+	void* vp;
+	const struct span_list* list;
+};
+
+static void run_cells_rows(fluids_context_t* const ctx, int j_begin, 
+	int j_end, int thread, void* const vp)
 {
-	int i = 0, j = 0;	
+	const struct cells_job* const job = vp;
+	int j = 0;
 
-	for (i = 1; i < g_cell_count_i - 1; i++) {
-		q[IDX(i, 0)] = q[IDX(i, 1)];
-		q[IDX(i, g_cell_count_j - 1)] = q[IDX(i, g_cell_count_j - 2)];
+	for (j = j_begin; j < j_end; j++) {
+		(*job->fn)(ctx, 1, j, ctx->cell_count_i - 2, thread, job->vp);
 	}
+}
 
-	for (j = 1; j < g_cell_count_j - 1; j++) {
-		q[IDX(0, j)] = 0.0; 
-		q[IDX(g_cell_count_i - 1, j)] = 0.0;
-	}
+static void run_cells_spans(fluids_context_t* const ctx, int s_begin, 
+	int s_end, int thread, void* const vp)
+{
+	const struct cells_job* const job = vp;
+	const struct span* span = NULL;
+	int s = 0;
 
-	q[IDX(0, 0)] = 0.5 * (q[IDX(0, 1)] + q[IDX(1, 0)]);
-	q[IDX(g_cell_count_i - 1, 0)] = 0.5 * (q[IDX(g_cell_count_i - 1, 1)] + 
-		q[IDX(g_cell_count_i - 2, 0)]);
-	q[IDX(0, g_cell_count_j - 1)] = 0.5 * (q[IDX(0, g_cell_count_j - 2)] + 
-		q[IDX(1, g_cell_count_j - 1)]);
-	q[IDX(g_cell_count_i - 1, g_cell_count_j - 1)] = 0.5 * (
-		q[IDX(g_cell_count_i - 2, g_cell_count_j - 1)] + 
-		q[IDX(g_cell_count_i - 1, g_cell_count_j - 2)]);
+	for (s = s_begin; s < s_end; s++) {
+		span = &job->list->spans[s];
+		(*job->fn)(ctx, span->i, span->j, span->n, thread, job->vp);
+	}
 }
 
-static void set_boundary_reflect_u(float* const q)
+/* Runs [fn] for the spans of [list] in parallel, or row by row for the
+** inner cells of the grid if [list] has no spans. [field_count] is the
+** number of fields [fn] processes per cell. */
+static void parallel_for_spans(fluids_context_t* const ctx,
+	const struct span_list* const list, cells_fn_t fn, void* const vp,
+	int field_count)
 {
-	int i = 0, j = 0;	
+	struct cells_job job = { fn, vp, list };
 
-	for (i = 1; i < g_cell_count_i - 1; i++) {
-		q[IDX(i, 0)] = q[IDX(i, 1)];
-		q[IDX(i, g_cell_count_j - 1)] = q[IDX(i, g_cell_count_j - 2)];
+	if (list->spans) {
+		parallel_for(ctx, run_cells_spans, &job, 0, list->span_count,
+			list->cell_count * field_count);
+		return;
 	}
 
-	for (j = 1; j < g_cell_count_j - 1; j++) {
-		q[IDX(0, j)] = -q[IDX(1, j)];
-		q[IDX(g_cell_count_i - 1, j)] = 
-			-q[IDX(g_cell_count_i - 2, j)];
-	}
+	parallel_for(ctx, run_cells_rows, &job, 1, ctx->cell_count_j - 1, 
+		ctx->cell_count_i * ctx->cell_count_j * field_count);
+}
+
+/* the inner cells, the fluid ones only if there are obstacles */
+static void parallel_for_cells(fluids_context_t* const ctx, cells_fn_t fn,
+	void* const vp, int field_count)
+{
+	parallel_for_spans(ctx, &ctx->fluid, fn, vp, field_count);
+}
+
+/* Whether sparse mode leaves tiles out. With all tiles active, the
+** routines take their dense paths. */
+static int tiles_sparse(fluids_context_t* const ctx)
+{
+	return ctx->tile_active &&
+		ctx->active_tile_count < ctx->tile_count_i * ctx->tile_count_j;
+}
 
-	q[IDX(0, 0)] = 0.5 * (q[IDX(0, 1)] + q[IDX(1, 0)]);
-	q[IDX(g_cell_count_i - 1, 0)] = 0.5 * (q[IDX(g_cell_count_i - 1, 1)] + 
-		q[IDX(g_cell_count_i - 2, 0)]);
-	q[IDX(0, g_cell_count_j - 1)] = 0.5 * (q[IDX(0, g_cell_count_j - 2)] + 
-		q[IDX(1, g_cell_count_j - 1)]);
-	q[IDX(g_cell_count_i - 1, g_cell_count_j - 1)] = 0.5 * (
-		q[IDX(g_cell_count_i - 2, g_cell_count_j - 1)] + 
-		q[IDX(g_cell_count_i - 1, g_cell_count_j - 2)]);
+/* The cells advection, diffusion and the sources update: those of the
+** active tiles if sparse mode leaves tiles out, see parallel_for_cells
+** otherwise. */
+static const struct span_list* active_cells(fluids_context_t* const ctx)
+{
+	return tiles_sparse(ctx) ? &ctx->active : &ctx->fluid;
+}
+
+static void parallel_for_active(fluids_context_t* const ctx, cells_fn_t fn,
+	void* const vp, int field_count)
+{
+	parallel_for_spans(ctx, active_cells(ctx), fn, vp, field_count);
 }
 
-static void set_boundary_no_stick_v(float* const q)
+struct copy_args {
+	float* dst;
+	const float* src;
+};
+
+static void copy_cells(fluids_context_t* const ctx, int i, int j, int n,
+	int thread, void* const vp)
 {
-	int i = 0, j = 0;	
+	const struct copy_args* const a = vp;
+	int k = 0;
+	int idx = IDX(i, j);
 
-	for (i = 1; i < g_cell_count_i - 1; i++) {
-		q[IDX(i, 0)] = 0.0;
-		q[IDX(i, g_cell_count_j - 1)] = 0.0; 
+	for (k = 0; k < n; k++) {
+		a->dst[idx + k] = a->src[idx + k];
 	}
+}
+
+/* copies the cells of [src] that advection, diffusion and the sources
+** update to [dst] */
+static void copy_active(fluids_context_t* const ctx, float* const dst,
+	const float* const src)
+{
+	struct copy_args a = { dst, src };
 
-	for (j = 1; j < g_cell_count_j - 1; j++) {
-		q[IDX(0, j)] = q[IDX(1, j)];
-		q[IDX(g_cell_count_i - 1, j)] = 
-			q[IDX(g_cell_count_i - 2, j)];
+	parallel_for_active(ctx, copy_cells, &a, 1);
+}
+
+/* Empties [list], its storage is kept (or allocated, so the spans are not
+** NULL afterwards). */
+static void span_list_clear(struct span_list* const list)
+{
+	if (!list->spans) {
+		list->capacity = 64;
+		list->spans = malloc(list->capacity * sizeof(struct span));
 	}
 
-	q[IDX(0, 0)] = 0.5 * (q[IDX(0, 1)] + q[IDX(1, 0)]);
-	q[IDX(g_cell_count_i - 1, 0)] = 0.5 * (q[IDX(g_cell_count_i - 1, 1)] + 
-		q[IDX(g_cell_count_i - 2, 0)]);
-	q[IDX(0, g_cell_count_j - 1)] = 0.5 * (q[IDX(0, g_cell_count_j - 2)] + 
-		q[IDX(1, g_cell_count_j - 1)]);
-	q[IDX(g_cell_count_i - 1, g_cell_count_j - 1)] = 0.5 * (
-		q[IDX(g_cell_count_i - 2, g_cell_count_j - 1)] + 
-		q[IDX(g_cell_count_i - 1, g_cell_count_j - 2)]);
+	list->span_count = 0;
+	list->cell_count = 0;
 }
 
-static void set_boundary_reflect_v(float* const q)
+/* Appends the cells (i_begin, j), ..., (i_end - 1, j) to [list], extending
+** its last span if they continue it. */
+static void span_list_append(struct span_list* const list, int i_begin,
+	int i_end, int j)
 {
-	int i = 0, j = 0;	
+	struct span* span = list->span_count > 0 ?
+		&list->spans[list->span_count - 1] : NULL;
+
+	list->cell_count += i_end - i_begin;
 
-	for (i = 1; i < g_cell_count_i - 1; i++) {
-		q[IDX(i, 0)] = -q[IDX(i, 1)];
-		q[IDX(i, g_cell_count_j - 1)] = -q[IDX(i, g_cell_count_j - 2)];
+	if (span && span->j == j && span->i + span->n == i_begin) {
+		span->n += i_end - i_begin;
+		return;
 	}
 
-	for (j = 1; j < g_cell_count_j - 1; j++) {
-		q[IDX(0, j)] = q[IDX(1, j)];
-		q[IDX(g_cell_count_i - 1, j)] = 
-			q[IDX(g_cell_count_i - 2, j)];
+	if (list->span_count == list->capacity) {
+		list->capacity *= 2;
+		list->spans = realloc(list->spans,
+			list->capacity * sizeof(struct span));
 	}
 
-	q[IDX(0, 0)] = 0.5 * (q[IDX(0, 1)] + q[IDX(1, 0)]);
-	q[IDX(g_cell_count_i - 1, 0)] = 0.5 * (q[IDX(g_cell_count_i - 1, 1)] + 
-		q[IDX(g_cell_count_i - 2, 0)]);
-	q[IDX(0, g_cell_count_j - 1)] = 0.5 * (q[IDX(0, g_cell_count_j - 2)] + 
-		q[IDX(1, g_cell_count_j - 1)]);
-	q[IDX(g_cell_count_i - 1, g_cell_count_j - 1)] = 0.5 * (
-		q[IDX(g_cell_count_i - 2, g_cell_count_j - 1)] + 
-		q[IDX(g_cell_count_i - 1, g_cell_count_j - 2)]);
+	span = &list->spans[list->span_count++];
+	span->i = i_begin;
+	span->j = j;
+	span->n = i_end - i_begin;
 }
 
-#define BOUNDARY_HANDLER_COUNT 12
-static void (*set_boundary[BOUNDARY_HANDLER_COUNT])(float* const q);
+static void span_list_free(struct span_list* const list)
+{
+	free(list->spans);
+	list->spans = NULL;
+	list->span_count = 0;
+	list->cell_count = 0;
+	list->capacity = 0;
+}
 
-void fluids_initialize()
+/* Grows [s] to at least [size] bytes, its contents are not kept. Returns
+** the array, NULL if it cannot be allocated (the old one is released
+** then). */
+static void* scratch_reserve(struct scratch* const s, size_t size)
 {
-	/* set boundary handling functions */
-	set_boundary[FLUIDS_BOUNDARY_NN] = set_boundary_nn;
-	set_boundary[FLUIDS_BOUNDARY_NO_STICK_U] = set_boundary_no_stick_u;
-	set_boundary[FLUIDS_BOUNDARY_NO_STICK_V] = set_boundary_no_stick_v;
-	set_boundary[FLUIDS_BOUNDARY_REFLECT_U] = set_boundary_reflect_u;
-	set_boundary[FLUIDS_BOUNDARY_REFLECT_V] = set_boundary_reflect_v;
+	if (s->size >= size && s->p) {
+		return s->p;
+	}
+
+	free(s->p);
+	s->p = malloc(size);
+	s->size = s->p ? size : 0;
+	return s->p;
 }
 
-void fluids_set_grid(float origin_x, float origin_y, float dx, 
-	int cell_count_i, int cell_count_j)
+static void scratch_free(struct scratch* const s)
 {
-	g_origin_x = origin_x;
-	g_origin_y = origin_y;
-	g_dx = dx;
-	g_cell_count_i = cell_count_i;
-	g_cell_count_j = cell_count_j;
+	free(s->p);
+	s->p = NULL;
+	s->size = 0;
 }
 
-float fluids_sample(const float* const quantities, float x, float y)
+/* boundary handling */
+
+/* Factors the nearest inner value is scaled with when filling the boundary
+** rows (j = 0, count_j - 1) and columns (i = 0, count_i - 1). */
+static const float g_boundary_factors[][2] = {
+	{ 1.0, 1.0 },	/* FLUIDS_BOUNDARY_NN */
+	{ 1.0, 0.0 },	/* FLUIDS_BOUNDARY_NO_STICK_U */
+	{ 0.0, 1.0 },	/* FLUIDS_BOUNDARY_NO_STICK_V */
+	{ 1.0, -1.0 },	/* FLUIDS_BOUNDARY_REFLECT_U */
+	{ -1.0, 1.0 }	/* FLUIDS_BOUNDARY_REFLECT_V */
+};
+
+/* Sets the [halo] cells around a grid of [ni] x [nj] cells to the nearest
+** cell of the grid. [q] points at cell (0, 0), rows are [pitch] floats 
+** apart. The halo rows are copied whole, corners included. */
+static void set_halo(float* const q, int ni, int nj, int pitch, int halo)
 {
-	int i, j, ip1, jp1;
-	int idx_ij, idx_ip1j, idx_ijp1, idx_ip1jp1;
-	float dx, dy;
-	float q_i, q_i2;
-	float x0 = x - g_origin_x;
-	float y0 = y - g_origin_y;
+	int i = 0, j = 0;
+	float* row = NULL;
 
-	/* Compute coordinates of the grid cell (x, y) lies in */
-	i = x0 / g_dx;
-	j = y0 / g_dx;
-	CLAMP(i, j);
+	if (halo == 0) {
+		return;
+	}
 
-	/* Compute offset of (x, y) in grid cell (i, j). The offset is relative
-	** to the grid spacing [g_dx], i.e. in [0, 1] */
-	dx = (x0 - i * g_dx) / g_dx;
-	dy = (y0 - j * g_dx) / g_dx;
-	ip1 = i + 1;
-	jp1 = j + 1;
-	CLAMP(ip1, jp1);
+	for (j = 0; j < nj; j++) {
+		row = q + IDXN(pitch, 0, j);
 
-	/* get indices for coordinates */
-	idx_ij = IDX(i, j);
-	idx_ip1j = IDX(ip1, j);
-	idx_ijp1 = IDX(i, jp1);
-	idx_ip1jp1 = IDX(ip1, jp1);
+		for (i = 1; i <= halo; i++) {
+			row[-i] = row[0];
+			row[ni - 1 + i] = row[ni - 1];
+		}
+	}
 
-	q_i = (1.0 - dx) * quantities[idx_ij] + dx * quantities[idx_ip1j];
-	q_i2 = (1.0 - dx) * quantities[idx_ijp1] + dx * quantities[idx_ip1jp1];
-	return (1.0 - dy) * q_i + dy * q_i2;
+	for (j = 1; j <= halo; j++) {
+		for (i = -halo; i < ni + halo; i++) {
+			q[IDXN(pitch, i, -j)] = q[IDXN(pitch, i, 0)];
+			q[IDXN(pitch, i, nj - 1 + j)] = 
+				q[IDXN(pitch, i, nj - 1)];
+		}
+	}
 }
 
-
-float* fluids_malloc(float c)
+/* Sets the boundary cells of a grid of [ni] x [nj] cells from their inner
+** neighbors, then its halo, see set_halo. */
+static void set_boundary_sized(float* const q, int ni, int nj, int pitch,
+	int halo, int boundary)
 {
-	size_t cell_count = g_cell_count_i * g_cell_count_j;
-	size_t i = 0;
-	float* qp = malloc(sizeof(*qp) * cell_count);	
+	int i = 0, j = 0;
+	float f_row = g_boundary_factors[boundary][0];
+	float f_col = g_boundary_factors[boundary][1];
 
-	for (i = 0; i < cell_count; i++) {
-		qp[i] = c;
+	for (i = 1; i < ni - 1; i++) {
+		q[IDXN(pitch, i, 0)] = f_row * q[IDXN(pitch, i, 1)];
+		q[IDXN(pitch, i, nj - 1)] = f_row * q[IDXN(pitch, i, nj - 2)];
 	}
-	
-	return qp;
+
+	for (j = 1; j < nj - 1; j++) {
+		q[IDXN(pitch, 0, j)] = f_col * q[IDXN(pitch, 1, j)];
+		q[IDXN(pitch, ni - 1, j)] = f_col * q[IDXN(pitch, ni - 2, j)];
+	}
+
+	q[IDXN(pitch, 0, 0)] = 0.5 * (q[IDXN(pitch, 0, 1)] + 
+		q[IDXN(pitch, 1, 0)]);
+	q[IDXN(pitch, ni - 1, 0)] = 0.5 * (q[IDXN(pitch, ni - 1, 1)] + 
+		q[IDXN(pitch, ni - 2, 0)]);
+	q[IDXN(pitch, 0, nj - 1)] = 0.5 * (q[IDXN(pitch, 0, nj - 2)] + 
+		q[IDXN(pitch, 1, nj - 1)]);
+	q[IDXN(pitch, ni - 1, nj - 1)] = 0.5 * (
+		q[IDXN(pitch, ni - 2, nj - 1)] + 
+		q[IDXN(pitch, ni - 1, nj - 2)]);
+	set_halo(q, ni, nj, pitch, halo);
 }
 
-void fluids_set(float* const q, float c)
+/* Sets the obstacle faces of [q] to the mean of their fluid neighbors, each
+** scaled as if the face were the boundary cell next to it. */
+static void set_obstacle_faces(fluids_context_t* const ctx, float* const q,
+	int boundary)
 {
-	size_t cell_count = g_cell_count_i * g_cell_count_j;
-	int i = 0;
+	int k = 0, n = 0;
+	int idx = 0;
+	float f_row = g_boundary_factors[boundary][0];
+	float f_col = g_boundary_factors[boundary][1];
+	float sum = 0.0;
+	const struct obstacle_face* face = NULL;
 
-	for (i = 0; i < cell_count; i++) {
-		q[i] = c;
+	for (k = 0; k < ctx->obstacle_face_count; k++) {
+		face = &ctx->obstacle_faces[k];
+		idx = IDX(face->i, face->j);
+		sum = 0.0;
+		n = 0;
+
+		if (face->sides & SIDE_LEFT) {
+			sum += f_col * q[idx - 1];
+			n++;
+		}
+
+		if (face->sides & SIDE_RIGHT) {
+			sum += f_col * q[idx + 1];
+			n++;
+		}
+
+		if (face->sides & SIDE_BOTTOM) {
+			sum += f_row * q[idx - ctx->pitch];
+			n++;
+		}
+
+		if (face->sides & SIDE_TOP) {
+			sum += f_row * q[idx + ctx->pitch];
+			n++;
+		}
+
+		q[idx] = sum / n;
 	}
 }
 
-void fluids_set_with_function(float* const q,
-	float (*fn)(float x, float y, void* const vp), void* const vp)
+/* the obstacle faces, boundary and halo of a field of the context */
+static void set_boundary(fluids_context_t* const ctx, float* const q,
+	int boundary)
 {
-	int i = 0, j = 0;
-	float x = 0.0, y = 0.0;
+	if (ctx->obstacle_faces) {
+		set_obstacle_faces(ctx, q, boundary);
+	}
 
-	for (j = 0; j < g_cell_count_j; j++) {
-		for (i = 0; i < g_cell_count_i; i++) {
-			x = g_origin_x  + i * g_dx;
-			y = g_origin_y  + j * g_dx;
-			q[IDX(i, j)] = (*fn)(x, y, vp);
+	set_boundary_sized(q + IDX(0, 0), ctx->cell_count_i, ctx->cell_count_j,
+		ctx->pitch, ctx->halo, boundary);
+}
+
+/* Sets the boundary cells of the inner row [row] of a grid [ni] cells wide
+** after its inner cells were updated. For the first and last inner row, 
+** [outer] is the adjacent boundary row, NULL otherwise. Corner cells are
+** left alone, no stencil reads them. */
+static void set_boundary_row(float* const row, float* const outer, int ni,
+	int boundary)
+{
+	int i = 0;
+	float f_row = g_boundary_factors[boundary][0];
+	float f_col = g_boundary_factors[boundary][1];
+
+	row[0] = f_col * row[1];
+	row[ni - 1] = f_col * row[ni - 2];
+
+	if (outer) {
+		for (i = 1; i < ni - 1; i++) {
+			outer[i] = f_row * row[i];
 		}
 	}
 }
 
-void fluids_add_source_uniform(float* const q, float s, float alpha)
+/* the boundary row next to the inner row [j] of a grid, if any. [q] 
+** points at cell (0, 0) */
+static float* outer_row(float* const q, int pitch, int nj, int j)
 {
-	int i = 0, j = 0;
-	int idx = 0;
+	if (j == 1) {
+		return q;
+	}
 
-	for (j = 0; j < g_cell_count_j; j++) {
-		for (i = 0; i < g_cell_count_i; i++) {
-			idx = IDX(i, j);
-			q[idx] += alpha * s;
-		}
+	return j == nj - 2 ? q + IDXN(pitch, 0, nj - 1) : NULL;
+}
+
+/* row band reductions, each thread stores its partial result */
+
+struct reduce_args {
+	float* q;
+	const float* b;
+	int ni;
+	int pitch;
+	double sum;
+	double sums[THREADS_MAX_COUNT];
+	float maxs[THREADS_MAX_COUNT];
+};
+
+static double reduce_sum(const struct reduce_args* const a)
+{
+	int t = 0;
+	double sum = 0.0;
+
+	for (t = 0; t < THREADS_MAX_COUNT; t++) {
+		sum += a->sums[t];
 	}
+
+	return sum;
 }
 
-void fluids_add_source_clamped(float* const q, const float* const source,
-	float alpha, float q_min, float q_max)
+static float reduce_max(const struct reduce_args* const a)
 {
-	int i = 0, j = 0;
-	int idx = 0;
+	int t = 0;
+	float m = 0.0;
 
-	for (j = 0; j < g_cell_count_j; j++) {
-		for (i = 0; i < g_cell_count_i; i++) {
-			idx = IDX(i, j);	
-			q[idx] += alpha * source[idx];
-			
-			q[idx] = q[idx] > q_max ? q_max : q[idx];
-			q[idx] = q[idx] < q_min ? q_min : q[idx];
-		}
+	for (t = 0; t < THREADS_MAX_COUNT; t++) {
+		m = a->maxs[t] > m ? a->maxs[t] : m;
 	}
+
+	return m;
 }
-	
-void fluids_add_source(float* const q, const float* const source, 
-	float alpha)
+
+static void sum_rows(fluids_context_t* const ctx, int j_begin, int j_end,
+	int thread, void* const vp)
 {
-	int i = 0, j = 0;
-	int idx = 0;
+	struct reduce_args* const a = vp;
+	const float* const q = a->q;
+	int i = 0, j = 0, ni = a->ni;
+	double sum = 0.0;
 
-	for (j = 0; j < g_cell_count_j; j++) {
-		for (i = 0; i < g_cell_count_i; i++) {
-			idx = IDX(i, j);	
-			q[idx] += alpha * source[idx];
+	for (j = j_begin; j < j_end; j++) {
+		for (i = 1; i < ni - 1; i++) {
+			sum += a->b ? a->b[IDXN(a->pitch, i, j)] *
+				q[IDXN(a->pitch, i, j)] :
+				q[IDXN(a->pitch, i, j)];
 		}
 	}
+
+	a->sums[thread] = sum;
 }
 
-void fluids_add_source_with_target(float* const q, const float* const source,
-	float q_target)
+static void subtract_rows(fluids_context_t* const ctx, int j_begin, int j_end,
+	int thread, void* const vp)
 {
-	int i = 0, j = 0;
-	int idx = 0;
+	const struct reduce_args* const a = vp;
+	float* const q = a->q;
+	int i = 0, j = 0, ni = a->ni;
+	double mean = a->sum;
 
-	for (j = 0; j < g_cell_count_j; j++) {
-		for (i = 0; i < g_cell_count_i; i++) {
-			idx = IDX(i, j);	
-			q[idx] += (q_target - q[idx])*  source[idx];
+	for (j = j_begin; j < j_end; j++) {
+		for (i = 1; i < ni - 1; i++) {
+			q[IDXN(a->pitch, i, j)] -= a->b ?
+				a->b[IDXN(a->pitch, i, j)] * mean : mean;
 		}
-	}	
+	}
 }
-	
-void fluids_advect(float* const q, const float* const q_prev, 
-	const float* const u, const float* v, int boundary, float dt)
+
+/* Removes the mean of the inner cells of [q], which points at cell (0, 0),
+** or of the cells [mask] is 1 on unless it is NULL. The pure Neumann
+** pressure system is singular, the mean of its right hand side has no
+** solution. */
+static void remove_mean(fluids_context_t* const ctx, float* const q,
+	const float* const mask, int ni, int nj, int pitch)
 {
-	int i = 0, j = 0;
-	int idx = 0;
-	float x = 0.0, y = 0.0;
-	float x0 = g_origin_x;
-	float y0 = g_origin_y;
+	struct reduce_args a = { q, mask, ni, pitch };
+	struct reduce_args m = { (float*)mask, NULL, ni, pitch };
+	double count = (ni - 2) * (nj - 2);
 
-	for (j = 1; j < g_cell_count_j - 1; j++) {
-		for (i = 1; i < g_cell_count_i - 1; i++) {
-			idx = IDX(i, j);	
-			x = x0 + i * g_dx - dt * u[idx];
-			y = y0 + j * g_dx - dt * v[idx];
-			q[idx] = fluids_sample(q_prev, x, y);
-		}
+	if (mask) {
+		parallel_for(ctx, sum_rows, &m, 1, nj - 1, ni * nj);
+		count = reduce_sum(&m);
+	}
+
+	if (count == 0.0) {
+		return;
 	}
 
-	(*set_boundary[boundary])(q);
+	parallel_for(ctx, sum_rows, &a, 1, nj - 1, ni * nj);
+	a.sum = reduce_sum(&a) / count;
+	parallel_for(ctx, subtract_rows, &a, 1, nj - 1, ni * nj);
 }
 
-void fluids_diffuse(float* const q, const float* const q_prev,  float diff, 
-	int iteration_count, int boundary, float dt) 
+static void sum_cells(fluids_context_t* const ctx, int i, int j, int n,
+	int thread, void* const vp)
 {
-	int i = 0, j = 0, k = 0;
-	int idx_ij, idx_ip1j, idx_im1j, idx_ijp1, idx_ijm1;
-	float r = diff * dt / (g_dx * g_dx);
-	float a = 1.0 / (1.0 + 4.0 * r);
-	float tmp = 0.0;
+	struct reduce_args* const a = vp;
+	const float* const q = a->q + IDX(i, j);
+	int k = 0;
+	double sum = 0.0;
 
-	for (k = 0; k < iteration_count; k++) {
-		for (j = 1; j < g_cell_count_j - 1; j++) {
-			for (i = 1; i < g_cell_count_i - 1; i++) {
-				idx_ij = IDX(i, j);		
-				idx_ip1j = IDX(i + 1, j);		
-				idx_im1j = IDX(i - 1, j);		
-				idx_ijp1 = IDX(i, j + 1);
-				idx_ijm1 = IDX(i, j - 1);
-				tmp = q_prev[idx_ip1j] + q_prev[idx_im1j] +
-					q_prev[idx_ijp1] + q_prev[idx_ijm1];
-				q[idx_ij] = a * (q_prev[idx_ij] + r * tmp);
-			}
-		}		
+	for (k = 0; k < n; k++) {
+		sum += q[k];
 	}
 
-	(*set_boundary[boundary])(q);
+	a->sums[thread] += sum;
 }
 
-void fluids_project(float* const u, float* const v, int boundary_u, 
-	int boundary_v, float* const p, float* const div, int iteration_count)
+static void subtract_cells(fluids_context_t* const ctx, int i, int j, int n,
+	int thread, void* const vp)
 {
-	int i = 0, j = 0, k = 0;
+	const struct reduce_args* const a = vp;
+	float* const q = a->q + IDX(i, j);
+	int k = 0;
+	double mean = a->sum;
 
-	/* compute divergence of the velocity field and set pressure to 0 */
-	for (j = 1; j < g_cell_count_j - 1; j++) {
-		for (i = 1; i < g_cell_count_i - 1; i++) {
-			div[IDX(i, j)] = -0.5 * g_dx * (
-				u[IDX(i + 1, j)] -
-				u[IDX(i - 1, j)] +
-				v[IDX(i, j + 1)] -
-				v[IDX(i, j - 1)]); 	
-			p[IDX(i, j)] = 0.0;
-		}
+	for (k = 0; k < n; k++) {
+		q[k] -= mean;
 	}
+}
 
-	(*set_boundary[FLUIDS_BOUNDARY_NN])(div);
-	(*set_boundary[FLUIDS_BOUNDARY_NN])(p);
+/* Removes the mean of the inner cells of the field [q], or of its fluid 
+** cells if there are obstacles, see remove_mean. */
+static void remove_field_mean(fluids_context_t* const ctx, float* const q)
+{
+	struct reduce_args a = { q };
 
-	/* compute pressure */
-	for (k = 0; k < iteration_count; k++) {
-		for (j = 1; j < g_cell_count_j - 1; j++) {
-			for (i = 1; i < g_cell_count_i - 1; i++) {
-				p[IDX(i, j)] = (div[IDX(i, j)] + 
-					p[IDX(i + 1, j)] +
-					p[IDX(i - 1, j)] +
-					p[IDX(i, j + 1)] +
-					p[IDX(i, j - 1)]) / 4.0;
-			}
-		}
-		
-		(*set_boundary[FLUIDS_BOUNDARY_NN])(p);
+	if (!ctx->fluid.spans) {
+		remove_mean(ctx, q + IDX(0, 0), NULL, ctx->cell_count_i,
+			ctx->cell_count_j, ctx->pitch);
+		return;
 	}
 
-	/* substract the pressure gradient from the velocity field */
-	for (j = 1; j < g_cell_count_j - 1; j++) {
-		for (i = 1; i < g_cell_count_i - 1; i++) {
-			u[IDX(i, j)] -= 0.5 / g_dx * (p[IDX(i + 1, j)] - 
-				p[IDX(i - 1, j)]);
-			v[IDX(i, j)] -= 0.5 / g_dx * (p[IDX(i, j + 1)] - 
-				p[IDX(i, j - 1)]);
-		}	
+	if (ctx->fluid.cell_count == 0) {
+		return;
 	}
-	
-	(*set_boundary[boundary_u])(u);
-	(*set_boundary[boundary_v])(v);
+
+	parallel_for_cells(ctx, sum_cells, &a, 1);
+	a.sum = reduce_sum(&a) / ctx->fluid.cell_count;
+	parallel_for_cells(ctx, subtract_cells, &a, 1);
 }
 
-void fluids_add_buoyancy(float* const v, const float* const smoke_dens, 
-	const float* const temperatures, float alpha, float beta, 
-	float temp_ambient, float dt)
+static void max_abs_rows(fluids_context_t* const ctx, int j_begin, int j_end,
+	int thread, void* const vp)
 {
-	int i = 0, j = 0;
+	struct reduce_args* const a = vp;
+	int j = 0;
+	float m = 0.0, m_row = 0.0;
 
-//	for (j = 1; j < g_cell_count_j - 1; j++) {
-//		for (i = 1; i < g_cell_count_i - 1; i++) {
-//			v[IDX(i,j)] -= dt * (alpha * smoke_dens[IDX(i,j)] -
-//				beta * (temperatures[IDX(i, j)] - temp_ambient));
-//		}
-//	}
+	for (j = j_begin; j < j_end; j++) {
+		m_row = g_kernels->max_abs(a->q + IDX(1, j), 
+			ctx->cell_count_i - 2);
+		m = m_row > m ? m_row : m;
+	}
 
-	for (j = 0; j < g_cell_count_j; j++) {
-		for (i = 0; i < g_cell_count_i; i++) {
-			v[IDX(i,j)] -= dt * (alpha * smoke_dens[IDX(i,j)] -
-				beta * (temperatures[IDX(i, j)] - temp_ambient));
-		}
+	a->maxs[thread] = m;
+}
+
+/* Returns the max. norm of the inner cells of [q] */
+static float max_abs(fluids_context_t* const ctx, const float* const q)
+{
+	struct reduce_args a = { (float*)q, NULL, ctx->cell_count_i };
+
+	parallel_for(ctx, max_abs_rows, &a, 1, ctx->cell_count_j - 1, 
+		ctx->cell_count_i * ctx->cell_count_j);
+	return reduce_max(&a);
+}
+
+/* masked operator */
+
+/* The operator (4 + k) x - sum(x_nb) of the cells [unknowns] marks, for
+** solves over the fluid cells or the active ones. A neighbor [fluid] marks
+** enters with its value, those of the unknowns being solved for and the
+** others fixed. Any other neighbor, a solid or a boundary cell, stands for
+** f x with the boundary factor f of its side, as if it had been set by the
+** boundary handling. The diagonal is hence 4 + k - f_col (2 - fluid_left -
+** fluid_right) - f_row (2 - fluid_bottom - fluid_top), and the operator
+** stays symmetric. The masks point at cell (0, 0) of a grid of [pitch]
+** floats per row whose boundary cells are 0. */
+struct masked_operator {
+	const float* fluid;
+	const float* unknowns;	/* NULL if given by spans */
+	int pitch;
+	float k;
+	float f_row;
+	float f_col;
+};
+
+static float masked_diagonal(const struct masked_operator* const op,
+	int idx)
+{
+	const float* const w = op->fluid;
+
+	return 4.0 + op->k -
+		op->f_col * (2.0 - w[idx - 1] - w[idx + 1]) -
+		op->f_row * (2.0 - w[idx - op->pitch] - w[idx + op->pitch]);
+}
+
+/* sum(x_nb) over the fluid neighbors of the cell [idx] */
+static float masked_neighbors(const struct masked_operator* const op,
+	const float* const x, int idx)
+{
+	const float* const w = op->fluid;
+	int pitch = op->pitch;
+
+	return w[idx - 1] * x[idx - 1] + w[idx + 1] * x[idx + 1] +
+		w[idx - pitch] * x[idx - pitch] +
+		w[idx + pitch] * x[idx + pitch];
+}
+
+static void masked_operator_init(struct masked_operator* const op,
+	const float* const fluid, const float* const unknowns, int pitch,
+	float k, int boundary)
+{
+	op->fluid = fluid;
+	op->unknowns = unknowns;
+	op->pitch = pitch;
+	op->k = k;
+	op->f_row = g_boundary_factors[boundary][0];
+	op->f_col = g_boundary_factors[boundary][1];
+}
+
+struct fill_args {
+	float* q;
+	float c;
+};
+
+static void fill_cells(fluids_context_t* const ctx, int i, int j, int n,
+	int thread, void* const vp)
+{
+	const struct fill_args* const a = vp;
+	int k = 0;
+	int idx = IDX(i, j);
+
+	for (k = 0; k < n; k++) {
+		a->q[idx + k] = a->c;
 	}
 }
 
-void fluids_add_vorticity_confinement(float* const u, float* const v,
-	float* const vorticity, float* const nvg_x, float* const nvg_y,
-	float eps, float dt)
+/* Returns a field of 1 on the inner fluid cells and 0 elsewhere, built on
+** first use. NULL if it cannot be allocated. */
+static const float* fluid_weights(fluids_context_t* const ctx)
 {
-	int i = 0, j = 0;
-	float gx, gy, gm;
-	float a = 1.0 / (2.0 * g_dx);
-	float b = eps * dt * g_dx;
+	struct fill_args a = { NULL, 1.0 };
 
-	/* compute vorticity */
-	for (j = 1; j < g_cell_count_j - 1; j++) {
-		for (i = 1; i < g_cell_count_i - 1; i++) {
-			vorticity[IDX(i, j)] =
-				a * ((v[IDX(i + 1, j)] - v[IDX(i - 1, j)]) -
-				(u[IDX(i, j + 1)] - u[IDX(i, j - 1)]));
+	if (!ctx->fluid_weights) {
+		ctx->fluid_weights = calloc(VALUE_COUNT, sizeof(float));
+		a.q = ctx->fluid_weights;
+
+		if (a.q) {
+			parallel_for_cells(ctx, fill_cells, &a, 1);
 		}
 	}
-	
-	/* compute normalized vorticity gradient */
-	for (j = 1; j < g_cell_count_j - 1; j++) {
-		for (i = 1; i < g_cell_count_i - 1; i++) {
-			gx = a * (fabs(vorticity[IDX(i + 1, j)]) -
-				fabs(vorticity[IDX(i - 1, j)]));
-			gy = a * (fabs(vorticity[IDX(i, j + 1)]) -
-				fabs(vorticity[IDX(i, j - 1)]));
-			gm = sqrtf(gx * gx + gy * gy);
-			nvg_x[IDX(i, j)] = gx / (gm + EPS);
-			nvg_y[IDX(i, j)] = gy / (gm + EPS);
-		}
+
+	return ctx->fluid_weights;
+}
+
+/* Returns a field of 1 on the cells of [list] and 0 elsewhere, NULL if it
+** cannot be allocated. The active cells change between steps, their field
+** is rebuilt on each call. */
+static const float* unknown_weights(fluids_context_t* const ctx,
+	const struct span_list* const list)
+{
+	struct fill_args a = { NULL, 1.0 };
+
+	if (list == &ctx->fluid) {
+		return fluid_weights(ctx);
 	}
 
-	/* add contribution of vorticity confinement to the velocity */
-	for (j = 1; j < g_cell_count_j - 1; j++) {
-		for (i = 1; i < g_cell_count_i - 1; i++) {
-			u[IDX(i, j)] += b * vorticity[IDX(i, j)] *
-				nvg_y[IDX(i, j)];
-			v[IDX(i, j)] -= b * vorticity[IDX(i, j)] *
-				nvg_x[IDX(i, j)];
-		}
+	if (!ctx->unknown_weights) {
+		ctx->unknown_weights = malloc(VALUE_COUNT * sizeof(float));
+	}
+
+	if (!ctx->unknown_weights) {
+		return NULL;
 	}
+
+	memset(ctx->unknown_weights, 0, VALUE_COUNT * sizeof(float));
+	a.q = ctx->unknown_weights;
+	parallel_for_spans(ctx, list, fill_cells, &a, 1);
+	return ctx->unknown_weights;
 }
 
-float fluids_get_max_divergence(const float* const u, const float* const v,
-	float* const div)
+void fluids_initialize()
 {
-	int i = 0, j = 0;
-	float avg_div = 0.0;
+	g_kernels = simd_select();
+}
+
+static void multigrid_free(fluids_context_t* const ctx)
+{
+	int l = 0;
 
-	/* compute divergence of the velocity field and set pressure to 0 */
-	for (j = 1; j < g_cell_count_j - 1; j++) {
-		for (i = 1; i < g_cell_count_i - 1; i++) {
-			div[IDX(i, j)] =  (
-				u[IDX(i + 1, j)] -
-				u[IDX(i - 1, j)] +
-				v[IDX(i, j + 1)] -
-				v[IDX(i, j - 1)]) / (2.0 * g_dx);
-				
-			avg_div = div[IDX(i, j)] > avg_div ? div[IDX(i, j)] : avg_div;
+	for (l = 0; l < ctx->mg_level_count; l++) {
+		if (l > 0) {
+			free(ctx->mg_levels[l].x);
+			free(ctx->mg_levels[l].b);
+			free(ctx->mg_levels[l].masks);
+			ctx->mg_levels[l].masks = NULL;
 		}
+
+		free(ctx->mg_levels[l].r);
 	}
-	
-	return avg_div;
+
+	free(ctx->mg_rhs);
+	ctx->mg_rhs = NULL;
+	ctx->mg_level_count = 0;
 }
 
+static void pcg_free(fluids_context_t* const ctx)
+{
+	free(ctx->pcg_precon);
+	free(ctx->pcg_r);
+	free(ctx->pcg_z);
+	free(ctx->pcg_s);
+	free(ctx->pcg_as);
+	ctx->pcg_precon = NULL;
+	ctx->pcg_r = NULL;
+	ctx->pcg_z = NULL;
+	ctx->pcg_s = NULL;
+	ctx->pcg_as = NULL;
+}
+
+static void spectral_free(fluids_context_t* const ctx)
+{
+	dct_plan_destroy(ctx->dct_i);
+	dct_plan_destroy(ctx->dct_j);
+	free(ctx->spectral_eigen_i);
+	free(ctx->spectral_eigen_j);
+	free(ctx->spectral_coeffs);
+	ctx->dct_i = NULL;
+	ctx->dct_j = NULL;
+	ctx->spectral_eigen_i = NULL;
+	ctx->spectral_eigen_j = NULL;
+	ctx->spectral_coeffs = NULL;
+}
+
+static void masks_free(fluids_context_t* const ctx)
+{
+	free(ctx->fluid_weights);
+	free(ctx->unknown_weights);
+	ctx->fluid_weights = NULL;
+	ctx->unknown_weights = NULL;
+}
+
+static void obstacles_free(fluids_context_t* const ctx)
+{
+	span_list_free(&ctx->fluid);
+	free(ctx->obstacle_faces);
+	ctx->obstacle_faces = NULL;
+	ctx->obstacle_face_count = 0;
+}
+
+static void tiles_free(fluids_context_t* const ctx)
+{
+	span_list_free(&ctx->active);
+	free(ctx->tile_active);
+	free(ctx->tile_marks);
+	ctx->tile_active = NULL;
+	ctx->tile_marks = NULL;
+	ctx->active_tile_count = 0;
+}
+
+const char* fluids_get_simd_path()
+{
+	return g_kernels->name;
+}
+
+void fluids_set_thread_count(int thread_count)
+{
+	threads_set_count(thread_count);
+}
+
+static void solvers_free(fluids_context_t* const ctx)
+{
+	multigrid_free(ctx);
+	pcg_free(ctx);
+	spectral_free(ctx);
+	free(ctx->adi_inv_i);
+	free(ctx->adi_inv_j);
+	ctx->adi_inv_i = NULL;
+	ctx->adi_inv_j = NULL;
+	scratch_free(&ctx->adi_blocks);
+	scratch_free(&ctx->adi_begins);
+	span_list_free(&ctx->adi_columns);
+	scratch_free(&ctx->many_fields);
+	scratch_free(&ctx->many_pivots);
+	masks_free(ctx);
+	free(ctx->jacobi_tmp);
+	ctx->jacobi_tmp = NULL;
+	scratch_free(&ctx->sweep_windows);
+	scratch_free(&ctx->sweep_bases);
+	free(ctx->advect_tmp);
+	ctx->advect_tmp = NULL;
+	scratch_free(&ctx->weight_indices);
+	scratch_free(&ctx->weight_fractions);
+	scratch_free(&ctx->transport_rings);
+	free(ctx->mixed_r);
+	free(ctx->mixed_e);
+	ctx->mixed_r = NULL;
+	ctx->mixed_e = NULL;
+}
+
+void fluids_finalize()
+{
+	solvers_free(&g_context);
+	obstacles_free(&g_context);
+	tiles_free(&g_context);
+	threads_set_count(1);
+}
+
+fluids_context_t* fluids_context_create()
+{
+	fluids_context_t* ctx = malloc(sizeof(*ctx));
+
+	if (!ctx) {
+		return NULL;
+	}
+
+	*ctx = g_context_defaults;
+	return ctx;
+}
+
+void fluids_context_destroy(fluids_context_t* const ctx)
+{
+	solvers_free(ctx);
+	obstacles_free(ctx);
+	tiles_free(ctx);
+	free(ctx);
+}
+
+fluids_context_t* fluids_get_context()
+{
+	return &g_context;
+}
+
+void fluids_context_set_pressure_solver(fluids_context_t* const ctx, int solver)
+{
+	ctx->pressure_solver = solver;
+}
+
+void fluids_context_set_diffusion_solver(fluids_context_t* const ctx,
+	int solver)
+{
+	ctx->diffusion_solver = solver;
+}
+
+void fluids_context_set_warm_start(fluids_context_t* const ctx, int enabled)
+{
+	ctx->warm_start = enabled;
+}
+
+void fluids_context_set_temporal_blocking(fluids_context_t* const ctx,
+	int sweep_count)
+{
+	ctx->sweep_block = sweep_count > 1 ? sweep_count : 1;
+}
+
+void fluids_context_set_advection(fluids_context_t* const ctx, int scheme)
+{
+	ctx->advection = scheme;
+}
+
+void fluids_context_set_mixed_precision(fluids_context_t* const ctx,
+	int round_count, int format)
+{
+	ctx->mixed_round_count = round_count > 0 ? round_count : 0;
+	ctx->mixed_format = format;
+}
+
+void fluids_context_set_sor_omega(fluids_context_t* const ctx, float omega)
+{
+	ctx->sor_omega = omega;
+}
+
+void fluids_context_set_multigrid(fluids_context_t* const ctx, int level_count,
+	int smooth_count, int cycle)
+{
+	if (level_count > MULTIGRID_MAX_LEVEL_COUNT) {
+		level_count = MULTIGRID_MAX_LEVEL_COUNT;
+	}
+
+	ctx->mg_max_level_count = level_count;
+	ctx->mg_smooth_count = smooth_count;
+	ctx->mg_cycle = cycle;
+	multigrid_free(ctx);
+}
+
+void fluids_context_set_grid(fluids_context_t* const ctx, float origin_x,
+	float origin_y, float dx, int cell_count_i, int cell_count_j)
+{
+	ctx->origin_x = origin_x;
+	ctx->origin_y = origin_y;
+	ctx->dx = dx;
+	ctx->cell_count_i = cell_count_i;
+	ctx->cell_count_j = cell_count_j;
+	ctx->pitch = cell_count_i + 2 * ctx->halo;
+	ctx->origin_index = ctx->halo * (ctx->pitch + 1);
+	solvers_free(ctx);
+	obstacles_free(ctx);
+	fluids_context_set_tiles(ctx, ctx->tile_size);
+}
+
+void fluids_context_set_halo(fluids_context_t* const ctx, int width)
+{
+	ctx->halo = width > 0 ? width : 0;
+	ctx->pitch = ctx->cell_count_i + 2 * ctx->halo;
+	ctx->origin_index = ctx->halo * (ctx->pitch + 1);
+	solvers_free(ctx);
+}
+
+int fluids_context_get_index(fluids_context_t* const ctx, int i, int j)
+{
+	return IDX(i, j);
+}
+
+/* whether the cell (i, j) is an inner cell not marked solid in [mask] */
+static int is_fluid(const fluids_context_t* const ctx, 
+	const unsigned char* const mask, int i, int j)
+{
+	int n = IDXN(ctx->cell_count_i, i, j);
+
+	if (i < 1 || i > ctx->cell_count_i - 2 || j < 1 || 
+		j > ctx->cell_count_j - 2) {
+		return 0;
+	}
+
+	return !(mask[n / 8] >> (n % 8) & 1);
+}
+
+/* the SIDE_* bits of the fluid neighbors of the cell (i, j) */
+static int fluid_sides(const fluids_context_t* const ctx, 
+	const unsigned char* const mask, int i, int j)
+{
+	return (is_fluid(ctx, mask, i - 1, j) ? SIDE_LEFT : 0) |
+		(is_fluid(ctx, mask, i + 1, j) ? SIDE_RIGHT : 0) |
+		(is_fluid(ctx, mask, i, j - 1) ? SIDE_BOTTOM : 0) |
+		(is_fluid(ctx, mask, i, j + 1) ? SIDE_TOP : 0);
+}
+
+/* gathers the fluid spans and obstacle faces of [mask] */
+static void obstacles_build(fluids_context_t* const ctx,
+	const unsigned char* const mask)
+{
+	int i = 0, j = 0;
+	int ni = ctx->cell_count_i, nj = ctx->cell_count_j;
+	int sides = 0;
+	struct obstacle_face* face = NULL;
+
+	/* at most every inner cell is a face */
+	span_list_clear(&ctx->fluid);
+	ctx->obstacle_faces = malloc(((ni - 2) * (nj - 2) + 1) * 
+		sizeof(struct obstacle_face));
+
+	for (j = 1; j < nj - 1; j++) {
+		for (i = 1; i < ni - 1; i++) {
+			if (is_fluid(ctx, mask, i, j)) {
+				span_list_append(&ctx->fluid, i, i + 1, j);
+				continue;
+			}
+
+			sides = fluid_sides(ctx, mask, i, j);
+
+			if (sides) {
+				face = &ctx->obstacle_faces[
+					ctx->obstacle_face_count++];
+				face->i = i;
+				face->j = j;
+				face->sides = sides;
+			}
+		}
+	}
+
+	ctx->obstacle_faces = realloc(ctx->obstacle_faces,
+		(ctx->obstacle_face_count + 1) * sizeof(struct obstacle_face));
+}
+
+/* Appends the cells (i_begin, j), ..., (i_end - 1, j) within active tiles
+** to the active spans. [tiles] is the row of tiles j lies in. */
+static void tiles_clip(fluids_context_t* const ctx,
+	const unsigned char* const tiles, int i_begin, int i_end, int j)
+{
+	int i = 0, i_next = 0, size = ctx->tile_size;
+
+	for (i = i_begin; i < i_end; i = i_next) {
+		i_next = (i / size + 1) * size;
+		i_next = i_next < i_end ? i_next : i_end;
+
+		if (tiles[i / size]) {
+			span_list_append(&ctx->active, i, i_next, j);
+		}
+	}
+}
+
+/* Gathers the inner cells of the active tiles into the active spans, only
+** the fluid cells if there are obstacles. Rows of inactive tiles are
+** skipped. */
+static void tiles_build_spans(fluids_context_t* const ctx)
+{
+	int j = 0, s = 0, tj = 0;
+	int j_begin = 0, j_end = 0, size = ctx->tile_size;
+	const unsigned char* tiles = NULL;
+	const struct span* const spans = ctx->fluid.spans;
+
+	span_list_clear(&ctx->active);
+
+	for (tj = 0; tj < ctx->tile_count_j; tj++) {
+		tiles = ctx->tile_active + tj * ctx->tile_count_i;
+		j_begin = tj * size > 1 ? tj * size : 1;
+		j_end = (tj + 1) * size < ctx->cell_count_j - 1 ?
+			(tj + 1) * size : ctx->cell_count_j - 1;
+
+		if (!memchr(tiles, 1, ctx->tile_count_i)) {
+			while (s < ctx->fluid.span_count &&
+				spans[s].j < j_end) {
+				s++;
+			}
+
+			continue;
+		}
+
+		for (j = j_begin; j < j_end; j++) {
+			if (!spans) {
+				tiles_clip(ctx, tiles, 1, ctx->cell_count_i - 1,
+					j);
+				continue;
+			}
+
+			for (; s < ctx->fluid.span_count && spans[s].j == j;
+				s++) {
+				tiles_clip(ctx, tiles, spans[s].i,
+					spans[s].i + spans[s].n, j);
+			}
+		}
+	}
+}
+
+void fluids_context_set_obstacles(fluids_context_t* const ctx,
+	const unsigned char* const mask)
+{
+	obstacles_free(ctx);
+
+	/* the masked solvers and the preconditioner follow the fluid cells */
+	masks_free(ctx);
+	pcg_free(ctx);
+
+	if (mask) {
+		obstacles_build(ctx, mask);
+	}
+
+	/* the active spans lie within the fluid ones */
+	if (ctx->tile_active) {
+		tiles_build_spans(ctx);
+	}
+}
+
+void fluids_context_set_tiles(fluids_context_t* const ctx, int size)
+{
+	int tile_count = 0;
+
+	tiles_free(ctx);
+	ctx->tile_size = size > 0 ? size : 0;
+
+	if (ctx->tile_size == 0) {
+		return;
+	}
+
+	ctx->tile_count_i = (ctx->cell_count_i + size - 1) / size;
+	ctx->tile_count_j = (ctx->cell_count_j + size - 1) / size;
+	tile_count = ctx->tile_count_i * ctx->tile_count_j;
+	ctx->tile_active = malloc(tile_count);
+	ctx->tile_marks = malloc(tile_count);
+	memset(ctx->tile_active, 1, tile_count);
+	ctx->active_tile_count = tile_count;
+	tiles_build_spans(ctx);
+}
+
+struct tiles_args {
+	const float* const* qs;
+	int field_count;
+	const float* u;
+	const float* v;
+	float threshold;
+};
+
+/* whether a value of a field or the velocity in tile (ti, tj) exceeds the
+** threshold in magnitude */
+static int tile_above(fluids_context_t* const ctx,
+	const struct tiles_args* const a, int ti, int tj)
+{
+	int f = 0, j = 0;
+	int idx = 0, size = ctx->tile_size;
+	int n = ctx->cell_count_i - ti * size < size ?
+		ctx->cell_count_i - ti * size : size;
+	int j_end = (tj + 1) * size < ctx->cell_count_j ?
+		(tj + 1) * size : ctx->cell_count_j;
+	float t = a->threshold;
+
+	for (j = tj * size; j < j_end; j++) {
+		idx = IDX(ti * size, j);
+
+		for (f = 0; f < a->field_count; f++) {
+			if (g_kernels->max_abs(a->qs[f] + idx, n) > t) {
+				return 1;
+			}
+		}
+
+		if ((a->u && g_kernels->max_abs(a->u + idx, n) > t) ||
+			(a->v && g_kernels->max_abs(a->v + idx, n) > t)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void tiles_mark_rows(fluids_context_t* const ctx, int tj_begin,
+	int tj_end, int thread, void* const vp)
+{
+	const struct tiles_args* const a = vp;
+	int ti = 0, tj = 0;
+	int t = 0;
+
+	for (tj = tj_begin; tj < tj_end; tj++) {
+		for (ti = 0; ti < ctx->tile_count_i; ti++) {
+			t = tj * ctx->tile_count_i + ti;
+			ctx->tile_marks[t] = ctx->tile_active[t] &&
+				tile_above(ctx, a, ti, tj);
+		}
+	}
+}
+
+/* Activates the tiles next to a marked tile, diagonals included. */
+static void tiles_dilate(fluids_context_t* const ctx)
+{
+	int ti = 0, tj = 0, di = 0, dj = 0;
+	int ni = ctx->tile_count_i, nj = ctx->tile_count_j;
+	unsigned char active = 0;
+
+	ctx->active_tile_count = 0;
+
+	for (tj = 0; tj < nj; tj++) {
+		for (ti = 0; ti < ni; ti++) {
+			active = 0;
+
+			for (dj = -1; dj <= 1; dj++) {
+				for (di = -1; di <= 1; di++) {
+					if (ti + di >= 0 && ti + di < ni &&
+						tj + dj >= 0 && tj + dj < nj) {
+						active |= ctx->tile_marks[
+							IDXN(ni, ti + di,
+							tj + dj)];
+					}
+				}
+			}
+
+			ctx->tile_active[IDXN(ni, ti, tj)] = active;
+			ctx->active_tile_count += active;
+		}
+	}
+}
+
+void fluids_context_update_tiles(fluids_context_t* const ctx,
+	const float* const* const qs, int field_count, const float* const u,
+	const float* const v, float threshold)
+{
+	struct tiles_args a = { qs, field_count, u, v, threshold };
+
+	if (!ctx->tile_active) {
+		return;
+	}
+
+	/* inactive tiles are not updated, only scan the active ones */
+	parallel_for(ctx, tiles_mark_rows, &a, 0, ctx->tile_count_j,
+		ctx->active.cell_count * (field_count + 2));
+	tiles_dilate(ctx);
+	tiles_build_spans(ctx);
+}
+
+int fluids_context_get_active_tile_count(fluids_context_t* const ctx)
+{
+	return ctx->active_tile_count;
+}
+
+float fluids_context_sample(fluids_context_t* const ctx,
+	const float* const quantities, float x, float y)
+{
+	int i, j, ip1, jp1;
+	int idx_ij, idx_ip1j, idx_ijp1, idx_ip1jp1;
+	float dx, dy;
+	float q_i, q_i2;
+	float x0 = x - ctx->origin_x;
+	float y0 = y - ctx->origin_y;
+
+	/* Points within the halo are sampled like points in the grid, points
+	** beyond it are moved onto it */
+	if (ctx->halo > 0) {
+		x0 = fminf(fmaxf(x0, -ctx->halo * ctx->dx), 
+			(ctx->cell_count_i - 2 + ctx->halo) * ctx->dx);
+		y0 = fminf(fmaxf(y0, -ctx->halo * ctx->dx), 
+			(ctx->cell_count_j - 2 + ctx->halo) * ctx->dx);
+	}
+
+	/* Compute coordinates of the grid cell (x, y) lies in, rounded down
+	** to reach the halo cells left of and below the grid */
+	i = floorf(x0 / ctx->dx);
+	j = floorf(y0 / ctx->dx);
+
+	if (ctx->halo == 0) {
+		CLAMP(i, j);
+	}
+
+	/* Compute offset of (x, y) in grid cell (i, j). The offset is relative
+	** to the grid spacing, i.e. in [0, 1] */
+	dx = (x0 - i * ctx->dx) / ctx->dx;
+	dy = (y0 - j * ctx->dx) / ctx->dx;
+	ip1 = i + 1;
+	jp1 = j + 1;
+
+	if (ctx->halo == 0) {
+		CLAMP(ip1, jp1);
+	}
+
+	/* get indices for coordinates */
+	idx_ij = IDX(i, j);
+	idx_ip1j = IDX(ip1, j);
+	idx_ijp1 = IDX(i, jp1);
+	idx_ip1jp1 = IDX(ip1, jp1);
+
+	/* interpolate in float, same as the advection kernels */
+	q_i = quantities[idx_ij] + dx * (quantities[idx_ip1j] - 
+		quantities[idx_ij]);
+	q_i2 = quantities[idx_ijp1] + dx * (quantities[idx_ip1jp1] - 
+		quantities[idx_ijp1]);
+	return q_i + dy * (q_i2 - q_i);
+}
+
+struct sample_args {
+	float* q;
+	float* r;
+	const float* q_prev;
+	const float* r_prev;
+	const float* x;
+	const float* y;
+};
+
+static void sample_points(fluids_context_t* const ctx, int begin, int end,
+	int thread, void* const vp)
+{
+	const struct sample_args* const a = vp;
+	struct simd_grid grid = { ctx->origin_x, ctx->origin_y, ctx->dx,
+		ctx->cell_count_i, ctx->cell_count_j, ctx->pitch, ctx->halo };
+
+	g_kernels->sample(a->q + begin, a->r ? a->r + begin : NULL,
+		a->q_prev + IDX(0, 0), a->r_prev ? a->r_prev + IDX(0, 0) : NULL,
+		a->x + begin, a->y + begin, end - begin, &grid);
+}
+
+void fluids_context_sample_batch(fluids_context_t* const ctx,
+	const float* const q, const float* const xs, const float* const ys,
+	float* const out, int n)
+{
+	struct sample_args a = { out, NULL, q, NULL, xs, ys };
+
+	parallel_for(ctx, sample_points, &a, 0, n, n);
+}
+
+void fluids_context_sample_vector_batch(fluids_context_t* const ctx,
+	const float* const u, const float* const v, const float* const xs,
+	const float* const ys, float* const out_u, float* const out_v, int n)
+{
+	struct sample_args a = { out_u, out_v, u, v, xs, ys };
+
+	parallel_for(ctx, sample_points, &a, 0, n, n);
+}
+
+
+float* fluids_context_malloc(fluids_context_t* const ctx, float c)
+{
+	size_t value_count = VALUE_COUNT;
+	size_t i = 0;
+	void* vp = NULL;
+	float* qp;
+
+	if (posix_memalign(&vp, ARENA_ALIGNMENT, sizeof(*qp) * value_count)) {
+		return NULL;
+	}
+
+	qp = vp;
+
+	for (i = 0; i < value_count; i++) {
+		qp[i] = c;
+	}
+	
+	return qp;
+}
+
+/* field arenas */
+
+struct fluids_arena {
+	arena_t* fields;
+	size_t value_count;	/* floats per field, including the padding */
+};
+
+fluids_arena_t* fluids_context_arena_create(fluids_context_t* const ctx,
+	int field_count, int flags)
+{
+	fluids_arena_t* arena = malloc(sizeof(*arena));
+
+	if (!arena) {
+		return NULL;
+	}
+
+	arena->fields = arena_create(sizeof(float) * VALUE_COUNT, field_count,
+		flags & FLUIDS_ARENA_HUGE_PAGES);
+
+	if (!arena->fields) {
+		free(arena);
+		return NULL;
+	}
+
+	arena->value_count = arena_get_block_size(arena->fields) / 
+		sizeof(float);
+	return arena;
+}
+
+void fluids_arena_destroy(fluids_arena_t* const arena)
+{
+	arena_destroy(arena->fields);
+	free(arena);
+}
+
+float* fluids_arena_malloc(fluids_arena_t* const arena, float c)
+{
+	size_t i = 0;
+	float* qp = arena_alloc(arena->fields);
+
+	if (!qp) {
+		return NULL;
+	}
+
+	for (i = 0; i < arena->value_count; i++) {
+		qp[i] = c;
+	}
+
+	return qp;
+}
+
+void fluids_arena_reset(fluids_arena_t* const arena)
+{
+	arena_reset(arena->fields);
+}
+
+void fluids_context_set(fluids_context_t* const ctx, float* const q, float c)
+{
+	size_t value_count = VALUE_COUNT;
+	int i = 0;
+
+	for (i = 0; i < value_count; i++) {
+		q[i] = c;
+	}
+}
+
+void fluids_context_set_with_function(fluids_context_t* const ctx,
+	float* const q, float (*fn)(float x, float y, void* const vp),
+	void* const vp)
+{
+	int i = 0, j = 0;
+	float x = 0.0, y = 0.0;
+
+	for (j = 0; j < ctx->cell_count_j; j++) {
+		for (i = 0; i < ctx->cell_count_i; i++) {
+			x = ctx->origin_x  + i * ctx->dx;
+			y = ctx->origin_y  + j * ctx->dx;
+			q[IDX(i, j)] = (*fn)(x, y, vp);
+		}
+	}
+
+	set_halo(q + IDX(0, 0), ctx->cell_count_i, ctx->cell_count_j, 
+		ctx->pitch, ctx->halo);
+}
+
+void fluids_context_extrapolate(fluids_context_t* const ctx, float* const q,
+	float* const q_prev)
+{
+	size_t value_count = VALUE_COUNT;
+	size_t i = 0;
+	float tmp = 0.0;
+
+	for (i = 0; i < value_count; i++) {
+		tmp = q[i];
+		q[i] = 2.0 * q[i] - q_prev[i];
+		q_prev[i] = tmp;
+	}
+}
+
+/* the sources run over whole rows of a field, including the halo, which 
+** keeps it a copy of the boundary. in sparse mode they run over the active
+** cells only */
+
+struct source_args {
+	float* q;
+	const float* source;
+	float s;
+	float alpha;
+	float q_min;
+	float q_max;
+};
+
+static void add_source_uniform_cells(fluids_context_t* const ctx, int i,
+	int j, int n, int thread, void* const vp)
+{
+	const struct source_args* const a = vp;
+
+	g_kernels->add_scalar(a->q + IDX(i, j), n, a->alpha * a->s);
+}
+
+static void add_source_uniform_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	const struct source_args* const a = vp;
+
+	g_kernels->add_scalar(a->q + IDX(-ctx->halo, j_begin), 
+		ctx->pitch * (j_end - j_begin), a->alpha * a->s);
+}
+
+void fluids_context_add_source_uniform(fluids_context_t* const ctx,
+	float* const q, float s, float alpha)
+{
+	struct source_args a = { q, NULL, s, alpha };
+
+	if (tiles_sparse(ctx)) {
+		parallel_for_active(ctx, add_source_uniform_cells, &a, 1);
+		return;
+	}
+
+	parallel_for(ctx, add_source_uniform_rows, &a, -ctx->halo, 
+		ctx->cell_count_j + ctx->halo, 
+		ctx->cell_count_i * ctx->cell_count_j);
+}
+
+static void add_source_clamped_cells(fluids_context_t* const ctx, int i,
+	int j, int n, int thread, void* const vp)
+{
+	const struct source_args* const a = vp;
+	int idx = IDX(i, j);
+
+	g_kernels->add_source_clamped(a->q + idx, a->source + idx, n, a->alpha,
+		a->q_min, a->q_max);
+}
+
+static void add_source_clamped_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	const struct source_args* const a = vp;
+	int idx = IDX(-ctx->halo, j_begin);
+
+	g_kernels->add_source_clamped(a->q + idx, a->source + idx,
+		ctx->pitch * (j_end - j_begin), a->alpha, a->q_min, 
+		a->q_max);
+}
+
+void fluids_context_add_source_clamped(fluids_context_t* const ctx,
+	float* const q, const float* const source, float alpha, float q_min,
+	float q_max)
+{
+	struct source_args a = { q, source, 0.0, alpha, q_min, q_max };
+
+	if (tiles_sparse(ctx)) {
+		parallel_for_active(ctx, add_source_clamped_cells, &a, 1);
+		return;
+	}
+
+	parallel_for(ctx, add_source_clamped_rows, &a, -ctx->halo, 
+		ctx->cell_count_j + ctx->halo, 
+		ctx->cell_count_i * ctx->cell_count_j);
+}
+
+static void add_source_cells(fluids_context_t* const ctx, int i, int j,
+	int n, int thread, void* const vp)
+{
+	const struct source_args* const a = vp;
+	int idx = IDX(i, j);
+
+	g_kernels->add_source(a->q + idx, a->source + idx, n, a->alpha);
+}
+
+static void add_source_rows(fluids_context_t* const ctx, int j_begin, int j_end,
+	int thread, void* const vp)
+{
+	const struct source_args* const a = vp;
+	int idx = IDX(-ctx->halo, j_begin);
+
+	g_kernels->add_source(a->q + idx, a->source + idx, 
+		ctx->pitch * (j_end - j_begin), a->alpha);
+}
+	
+void fluids_context_add_source(fluids_context_t* const ctx, float* const q,
+	const float* const source, float alpha)
+{
+	struct source_args a = { q, source, 0.0, alpha };
+
+	if (tiles_sparse(ctx)) {
+		parallel_for_active(ctx, add_source_cells, &a, 1);
+		return;
+	}
+
+	parallel_for(ctx, add_source_rows, &a, -ctx->halo, 
+		ctx->cell_count_j + ctx->halo, 
+		ctx->cell_count_i * ctx->cell_count_j);
+}
+
+static void add_source_with_target_cells(fluids_context_t* const ctx, int i,
+	int j, int n, int thread, void* const vp)
+{
+	const struct source_args* const a = vp;
+	int idx = IDX(i, j);
+
+	g_kernels->add_source_with_target(a->q + idx, a->source + idx, n,
+		a->s);
+}
+
+static void add_source_with_target_rows(fluids_context_t* const ctx,
+	int j_begin, int j_end, int thread, void* const vp)
+{
+	const struct source_args* const a = vp;
+	int idx = IDX(-ctx->halo, j_begin);
+
+	g_kernels->add_source_with_target(a->q + idx, a->source + idx,
+		ctx->pitch * (j_end - j_begin), a->s);
+}
+
+void fluids_context_add_source_with_target(fluids_context_t* const ctx,
+	float* const q, const float* const source, float q_target)
+{
+	struct source_args a = { q, source, q_target };
+
+	if (tiles_sparse(ctx)) {
+		parallel_for_active(ctx, add_source_with_target_cells, &a, 1);
+		return;
+	}
+
+	parallel_for(ctx, add_source_with_target_rows, &a, -ctx->halo, 
+		ctx->cell_count_j + ctx->halo, 
+		ctx->cell_count_i * ctx->cell_count_j);
+}
+	
+struct advect_args {
+	float* q;
+	const float* q_prev;
+	const float* u;
+	const float* v;
+	float dt;
+};
+
+/* Advects the cells (i, j), ..., (i + n - 1, j) into [q]. With a halo, 
+** the departure points are kept within it and the stencil is not 
+** clamped. */
+static void advect_run(fluids_context_t* const ctx, float* const q,
+	const float* const q_prev, const float* const u, const float* const v,
+	int i, int j, int n, float dt)
+{
+	int idx = IDX(i, j);
+	struct simd_grid grid = { ctx->origin_x, ctx->origin_y, ctx->dx, 
+		ctx->cell_count_i, ctx->cell_count_j, ctx->pitch, ctx->halo };
+
+	if (ctx->halo > 0) {
+		g_kernels->advect_halo(q, q_prev + IDX(0, 0), u + idx, v + idx,
+			n, i, j, &grid, dt);
+		return;
+	}
+
+	g_kernels->advect(q, q_prev, u + idx, v + idx, n, i, j, &grid, dt);
+}
+
+static void advect_cells(fluids_context_t* const ctx, int i, int j, int n,
+	int thread, void* const vp)
+{
+	const struct advect_args* const a = vp;
+
+	advect_run(ctx, a->q + IDX(i, j), a->q_prev, a->u, a->v, i, j, n, 
+		a->dt);
+}
+
+/* Points [w] at the [n] indices and fractions of [indices], [fractions]. */
+static void weights_assign(struct simd_weights* const w, int* const indices,
+	float* const fractions, int n)
+{
+	w->idx = indices;
+	w->di = indices + n;
+	w->dj = indices + 2 * n;
+	w->fx = fractions;
+	w->fy = fractions + n;
+}
+
+/* Reserves [index_count] indices and [fraction_count] fractions of
+** departure points. Returns 0 if they cannot be allocated. */
+static int weights_reserve(fluids_context_t* const ctx, int** const indices,
+	float** const fractions, size_t index_count, size_t fraction_count)
+{
+	*indices = scratch_reserve(&ctx->weight_indices,
+		index_count * sizeof(int));
+	*fractions = scratch_reserve(&ctx->weight_fractions,
+		fraction_count * sizeof(float));
+	return *indices && *fractions;
+}
+
+/* Computes the departure points of the cells (i, j), ..., (i + n - 1, j).
+** With a halo, they are relative to cell (0, 0). */
+static void backtrace_run(fluids_context_t* const ctx,
+	const struct simd_weights* const w, const float* const u,
+	const float* const v, int i, int j, int n, float dt)
+{
+	int idx = IDX(i, j);
+	struct simd_grid grid = { ctx->origin_x, ctx->origin_y, ctx->dx, 
+		ctx->cell_count_i, ctx->cell_count_j, ctx->pitch, ctx->halo };
+
+	if (ctx->halo > 0) {
+		g_kernels->backtrace_halo(w, u + idx, v + idx, n, i, j, &grid,
+			dt);
+		return;
+	}
+
+	g_kernels->backtrace(w, u + idx, v + idx, n, i, j, &grid, dt);
+}
+
+struct maccormack_args {
+	float* q;
+	const float* q_prev;
+	const float* q_fwd;	/* forward step */
+	const float* u;
+	const float* v;
+	float dt;
+	struct simd_weights weights[THREADS_MAX_COUNT];	/* per thread */
+	struct simd_weights arrivals[THREADS_MAX_COUNT];
+	float* q_backs[THREADS_MAX_COUNT];		/* a row each */
+};
+
+/* Steps back from the forward step and corrects it by half the difference
+** to [q_prev], limited to the stencil of the forward step. */
+static void maccormack_cells(fluids_context_t* const ctx, int i, int j,
+	int n, int thread, void* const vp)
+{
+	const struct maccormack_args* const a = vp;
+	int idx = IDX(i, j);
+
+	backtrace_run(ctx, &a->weights[thread], a->u, a->v, i, j, n, a->dt);
+	backtrace_run(ctx, &a->arrivals[thread], a->u, a->v, i, j, n, -a->dt);
+	g_kernels->interpolate(a->q_backs[thread], a->q_fwd + IDX(0, 0),
+		&a->arrivals[thread], n);
+	g_kernels->maccormack(a->q + idx, a->q_fwd + idx, a->q_backs[thread],
+		a->q_prev + idx, a->q_prev + IDX(0, 0), &a->weights[thread],
+		n);
+}
+
+static void advect_maccormack(fluids_context_t* const ctx, float* const q,
+	const float* const q_prev, const float* const u, const float* v,
+	int boundary, float dt)
+{
+	int t = 0;
+	int n = ctx->cell_count_i - 2;
+	int thread_count = threads_get_count();
+	struct maccormack_args a = { q, q_prev, NULL, u, v, dt };
+	struct advect_args fwd = { NULL, q_prev, u, v, dt };
+	int* indices = NULL;
+	float* fractions = NULL;
+
+	if (!ctx->advect_tmp) {
+		ctx->advect_tmp = fluids_context_malloc(ctx, 0.0);
+	}
+
+	/* two rows of departure points and a row of values per thread,
+	** without them a semi-Lagrangian step */
+	if (!ctx->advect_tmp || !weights_reserve(ctx, &indices, &fractions,
+		6 * thread_count * n, 5 * thread_count * n)) {
+		fwd.q = q;
+		parallel_for_active(ctx, advect_cells, &fwd, 1);
+		set_boundary(ctx, q, boundary);
+		return;
+	}
+
+	/* the cells left out keep their values in both steps */
+	if (active_cells(ctx)->spans) {
+		memcpy(ctx->advect_tmp, q_prev, sizeof(float) * VALUE_COUNT);
+	}
+
+	fwd.q = ctx->advect_tmp;
+	parallel_for_active(ctx, advect_cells, &fwd, 1);
+	set_boundary(ctx, ctx->advect_tmp, boundary);
+
+	for (t = 0; t < thread_count; t++) {
+		weights_assign(&a.weights[t], indices + 6 * t * n,
+			fractions + 5 * t * n, n);
+		weights_assign(&a.arrivals[t], indices + (6 * t + 3) * n,
+			fractions + (5 * t + 2) * n, n);
+		a.q_backs[t] = fractions + (5 * t + 4) * n;
+	}
+
+	a.q_fwd = ctx->advect_tmp;
+	parallel_for_active(ctx, maccormack_cells, &a, 3);
+	set_boundary(ctx, q, boundary);
+}
+
+void fluids_context_advect(fluids_context_t* const ctx, float* const q,
+	const float* const q_prev, const float* const u, const float* v,
+	int boundary, float dt)
+{
+	struct advect_args a = { q, q_prev, u, v, dt };
+
+	if (ctx->advection == FLUIDS_ADVECTION_MACCORMACK) {
+		advect_maccormack(ctx, q, q_prev, u, v, boundary, dt);
+		return;
+	}
+
+	parallel_for_active(ctx, advect_cells, &a, 1);
+	set_boundary(ctx, q, boundary);
+}
+
+struct advect_many_args {
+	float* const* qs;
+	const float* const* q_prevs;
+	int field_count;
+	const float* u;
+	const float* v;
+	float dt;
+	struct simd_weights weights[THREADS_MAX_COUNT];	/* per thread */
+};
+
+static void advect_many_cells(fluids_context_t* const ctx, int i, int j,
+	int n, int thread, void* const vp)
+{
+	const struct advect_many_args* const a = vp;
+	const struct simd_weights* const w = &a->weights[thread];
+	int f = 0;
+	int idx = IDX(i, j);
+
+	backtrace_run(ctx, w, a->u, a->v, i, j, n, a->dt);
+
+	for (f = 0; f < a->field_count; f++) {
+		g_kernels->interpolate(a->qs[f] + idx, 
+			a->q_prevs[f] + IDX(0, 0), w, n);
+	}
+}
+
+void fluids_context_advect_many(fluids_context_t* const ctx,
+	float* const* const qs, const float* const* const q_prevs,
+	int field_count, const float* const u, const float* const v,
+	const int* const boundaries, float dt)
+{
+	int f = 0, t = 0;
+	int n = ctx->cell_count_i - 2;
+	int thread_count = threads_get_count();
+	struct advect_many_args a = { qs, q_prevs, field_count, u, v, dt };
+	int* indices = NULL;
+	float* fractions = NULL;
+
+	/* the correction of MacCormack depends on the field, without
+	** shared departure points the fields are advected one by one */
+	if (ctx->advection == FLUIDS_ADVECTION_MACCORMACK ||
+		!weights_reserve(ctx, &indices, &fractions,
+		3 * thread_count * n, 2 * thread_count * n)) {
+		for (f = 0; f < field_count; f++) {
+			fluids_context_advect(ctx, qs[f], q_prevs[f], u, v,
+				boundaries[f], dt);
+		}
+		return;
+	}
+
+	/* one row of departure points per thread */
+	for (t = 0; t < thread_count; t++) {
+		weights_assign(&a.weights[t], indices + 3 * t * n,
+			fractions + 2 * t * n, n);
+	}
+
+	parallel_for_active(ctx, advect_many_cells, &a, field_count);
+
+	for (f = 0; f < field_count; f++) {
+		set_boundary(ctx, qs[f], boundaries[f]);
+	}
+}
+
+struct sor_args {
+	float* x;
+	const float* b;
+	float c;
+	float a;	/* omega / (4 + k) */
+	float w;	/* 1 - omega */
+	int ni;
+	int pitch;
+	int color;
+	const struct span* spans;	/* of sor_spans */
+	const struct masked_operator* op;	/* NULL for the whole grid */
+	float omega;
+};
+
+/* sor_cells on the masked operator, a cell without fluid neighbors and
+** diagonal shift has no equation and keeps its value */
+static void sor_masked_cells(const struct sor_args* const sa, int i,
+	int i_end, int j)
+{
+	const struct masked_operator* const op = sa->op;
+	float* const x = sa->x;
+	float c = sa->c, w = sa->w, omega = sa->omega;
+	float d = 0.0;
+	int idx = 0;
+
+	for (; i < i_end; i += 2) {
+		idx = IDXN(sa->pitch, i, j);
+
+		if (op->unknowns && op->unknowns[idx] == 0.0) {
+			continue;
+		}
+
+		d = masked_diagonal(op, idx);
+
+		if (d <= 0.0) {
+			continue;
+		}
+
+		x[idx] = w * x[idx] + omega / d * (c * sa->b[idx] +
+			masked_neighbors(op, x, idx));
+	}
+}
+
+/* updates the cells of the current color among (i_begin, j), ..., 
+** (i_end - 1, j), i.e. those with i + j = color mod 2 */
+static void sor_cells(const struct sor_args* const sa, int i_begin, 
+	int i_end, int j)
+{
+	float* const x = sa->x;
+	const float* const b = sa->b;
+	float a = sa->a, c = sa->c, w = sa->w;
+	int i = i_begin + (i_begin + j + sa->color) % 2;
+	int pitch = sa->pitch;
+
+	if (sa->op) {
+		sor_masked_cells(sa, i, i_end, j);
+		return;
+	}
+
+	for (; i < i_end; i += 2) {
+		x[IDXN(pitch, i, j)] = w * x[IDXN(pitch, i, j)] +
+			a * (c * b[IDXN(pitch, i, j)] + 
+			x[IDXN(pitch, i + 1, j)] +
+			x[IDXN(pitch, i - 1, j)] +
+			x[IDXN(pitch, i, j + 1)] +
+			x[IDXN(pitch, i, j - 1)]);
+	}
+}
+
+static void sor_rows(fluids_context_t* const ctx, int j_begin, int j_end,
+	int thread, void* const vp)
+{
+	const struct sor_args* const sa = vp;
+	int j = 0;
+
+	for (j = j_begin; j < j_end; j++) {
+		sor_cells(sa, 1, sa->ni - 1, j);
+	}
+}
+
+static void sor_spans(fluids_context_t* const ctx, int s_begin, int s_end,
+	int thread, void* const vp)
+{
+	const struct sor_args* const sa = vp;
+	const struct span* span = NULL;
+	int s = 0;
+
+	for (s = s_begin; s < s_end; s++) {
+		span = &sa->spans[s];
+		sor_cells(sa, span->i, span->i + span->n, span->j);
+	}
+}
+
+/* [half_sweep_count] half-sweeps of red-black SOR in one pass over the 
+** grid. In each step, a half-sweep updates the row below the one the 
+** previous half-sweep updates. The rows a half-sweep reads are then done 
+** by the previous half-sweep and not yet touched by the next one, the 
+** result equals the one of consecutive half-sweeps. */
+static void sor_wavefront(fluids_context_t* const ctx, struct sor_args* const a,
+	int nj, int boundary, int half_sweep_count)
+{
+	int h = 0, j = 0, s = 0;
+	int ni = a->ni, pitch = a->pitch;
+
+	for (s = 1; s < nj - 2 + half_sweep_count; s++) {
+		for (h = 0; h < half_sweep_count; h++) {
+			j = s - h;
+
+			if (j < 1 || j > nj - 2) {
+				continue;
+			}
+
+			a->color = h % 2;
+			sor_rows(ctx, j, j + 1, 0, a);
+			set_boundary_row(a->x + IDXN(pitch, 0, j), 
+				outer_row(a->x, pitch, nj, j), ni, boundary);
+		}
+	}
+}
+
+/* Red-black successive over-relaxation on the system 
+** (4 + k) x - sum(x_nb) = c b for a grid of [ni] x [nj] cells, [pitch] 
+** floats per row and surrounded by [halo] cells. [x] and [b] point at cell
+** (0, 0). Cells of one color only depend on cells of the other color, so 
+** the cells of a half-sweep can be updated in any order, i.e. by row bands
+** in parallel. With temporal blocking, blocks of sweeps run on the calling
+** thread in one pass each. */
+static void sor_red_black(fluids_context_t* const ctx, float* const x,
+	const float* const b, float c, float k, float omega, int ni, int nj,
+	int pitch, int halo, int boundary, int sweep_count)
+{
+	int n = 0, s = 0;
+	struct sor_args a = { x, b, c, omega / (4.0 + k), 1.0 - omega, ni,
+		pitch };
+
+	if (ctx->sweep_block > 1) {
+		for (s = 0; s < sweep_count; s += n) {
+			n = sweep_count - s < ctx->sweep_block ? 
+				sweep_count - s : ctx->sweep_block;
+			sor_wavefront(ctx, &a, nj, boundary, 2 * n);
+		}
+
+		set_boundary_sized(x, ni, nj, pitch, halo, boundary);
+		return;
+	}
+
+	for (s = 0; s < sweep_count; s++) {
+		for (a.color = 0; a.color < 2; a.color++) {
+			parallel_for(ctx, sor_rows, &a, 1, nj - 1, ni * nj);
+			set_boundary_sized(x, ni, nj, pitch, halo, boundary);
+		}
+	}
+}
+
+/* Returns the over-relaxation factor used for the system 
+** (4 + k) x - sum(x_nb) = b on the current grid. If none is set, the optimal
+** factor of the pressure system (k = 0) is derived from the spectral radius
+** of the Jacobi iteration. The diffusion systems (k > 0) get 1: for large
+** time steps their radius is close to the one of the pressure system, and 
+** the factor it gives overshoots the solution by far within the few sweeps
+** of a step. */
+static float sor_omega(fluids_context_t* const ctx, float k)
+{
+	float rho = 0.0;
+
+	if (ctx->sor_omega > 0.0) {
+		return ctx->sor_omega;
+	}
+
+	if (k > 0.0) {
+		return 1.0;
+	}
+
+	rho = 2.0 * (cosf(PI / (ctx->cell_count_i - 2)) + 
+		cosf(PI / (ctx->cell_count_j - 2))) / (4.0 + k);
+	return 2.0 / (1.0 + sqrtf(1.0 - rho * rho));
+}
+
+/* Red-black SOR on the masked operator over the spans of [list], see
+** masked_operator, the fluid cells outside the spans are fixed. Without
+** temporal blocking. Sets the obstacle faces and the boundary of [x]
+** afterwards. */
+static void sor_masked(fluids_context_t* const ctx,
+	const struct span_list* const list, float* const x,
+	const float* const b, float c, float k, float omega, int boundary,
+	int sweep_count)
+{
+	int s = 0;
+	struct masked_operator op;
+	struct sor_args a = { x + IDX(0, 0), b + IDX(0, 0), c, 0.0,
+		1.0 - omega, ctx->cell_count_i, ctx->pitch, 0, list->spans,
+		&op, omega };
+
+	masked_operator_init(&op, fluid_weights(ctx) + IDX(0, 0), NULL,
+		ctx->pitch, k, boundary);
+
+	for (s = 0; s < sweep_count; s++) {
+		for (a.color = 0; a.color < 2; a.color++) {
+			parallel_for(ctx, sor_spans, &a, 0, list->span_count,
+				list->cell_count);
+		}
+	}
+
+	set_boundary(ctx, x, boundary);
+}
+
+/* Allocates the multigrid hierarchy for the current grid if needed. Each
+** coarser level halves the number of inner cells in both dimensions. */
+static void multigrid_allocate(fluids_context_t* const ctx)
+{
+	int l = 0;
+	int ni = ctx->cell_count_i, nj = ctx->cell_count_j;
+	int max = ctx->mg_max_level_count > 0 ? ctx->mg_max_level_count : 
+		MULTIGRID_MAX_LEVEL_COUNT;
+	size_t size = 0;
+
+	if (ctx->mg_level_count > 0) {
+		return;
+	}
+
+	/* the finest level has the layout of the fields, the right hand side
+	** storage of fluids_diffuse is a field */
+	for (l = 0; l < max; l++) {
+		ctx->mg_levels[l].cell_count_i = ni;
+		ctx->mg_levels[l].cell_count_j = nj;
+		ctx->mg_levels[l].pitch = l > 0 ? ni : ctx->pitch;
+		ctx->mg_levels[l].halo = l > 0 ? 0 : ctx->halo;
+		size = ctx->mg_levels[l].pitch * nj;
+		ctx->mg_levels[l].r = calloc(size, sizeof(float));
+
+		if (l > 0) {
+			ctx->mg_levels[l].x = calloc(size, sizeof(float));
+			ctx->mg_levels[l].b = calloc(size, sizeof(float));
+		} else {
+			ctx->mg_rhs = malloc(sizeof(float) * VALUE_COUNT);
+		}
+
+		ctx->mg_level_count++;
+
+		/* stop once a level is too small to be coarsened further */
+		if (ni - 2 < 4 || nj - 2 < 4) {
+			break;
+		}
+
+		ni = (ni - 2) / 2 + 2;
+		nj = (nj - 2) / 2 + 2;
+	}
+}
+
+static void multigrid_operator(struct masked_operator* const op,
+	const struct multigrid_level* const lvl, int boundary)
+{
+	masked_operator_init(op, lvl->fluid, lvl->unknowns, lvl->pitch,
+		lvl->k, boundary);
+}
+
+/* Red-black Gauss-Seidel sweeps on the system (4 + k) x - sum(x_nb) = b,
+** on the masked operator of a masked solve. */
+static void multigrid_smooth(fluids_context_t* const ctx,
+	struct multigrid_level* const lvl, int boundary, int sweep_count)
+{
+	int s = 0;
+	int ni = lvl->cell_count_i, nj = lvl->cell_count_j;
+	struct masked_operator op;
+	struct sor_args a = { lvl->x, lvl->b, 1.0, 0.0, 0.0, ni, lvl->pitch,
+		0, NULL, &op, 1.0 };
+
+	if (!lvl->fluid) {
+		sor_red_black(ctx, lvl->x, lvl->b, 1.0, lvl->k, 1.0, ni, nj,
+			lvl->pitch, lvl->halo, boundary, sweep_count);
+		return;
+	}
+
+	multigrid_operator(&op, lvl, boundary);
+
+	for (s = 0; s < sweep_count; s++) {
+		for (a.color = 0; a.color < 2; a.color++) {
+			parallel_for(ctx, sor_rows, &a, 1, nj - 1, ni * nj);
+		}
+	}
+}
+
+static void multigrid_residual_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	const struct multigrid_level* const lvl = vp;
+	int i = 0, j = 0;
+	int ni = lvl->cell_count_i, pitch = lvl->pitch;
+	float d = 4.0 + lvl->k;
+	const float* const x = lvl->x;
+	const float* const b = lvl->b;
+	float* const r = lvl->r;
+
+	for (j = j_begin; j < j_end; j++) {
+		for (i = 1; i < ni - 1; i++) {
+			r[IDXN(pitch, i, j)] = b[IDXN(pitch, i, j)] -
+				d * x[IDXN(pitch, i, j)] + 
+				x[IDXN(pitch, i + 1, j)] +
+				x[IDXN(pitch, i - 1, j)] +
+				x[IDXN(pitch, i, j + 1)] +
+				x[IDXN(pitch, i, j - 1)];
+		}
+	}
+}
+
+struct multigrid_masked_args {
+	struct multigrid_level* lvl;
+	struct masked_operator op;
+};
+
+/* the residual of the masked operator, 0 on the cells not solved for */
+static void multigrid_masked_residual_rows(fluids_context_t* const ctx,
+	int j_begin, int j_end, int thread, void* const vp)
+{
+	const struct multigrid_masked_args* const a = vp;
+	const struct multigrid_level* const lvl = a->lvl;
+	int i = 0, j = 0, idx = 0;
+	float d = 0.0;
+
+	for (j = j_begin; j < j_end; j++) {
+		for (i = 1; i < lvl->cell_count_i - 1; i++) {
+			idx = IDXN(lvl->pitch, i, j);
+			d = lvl->unknowns[idx] != 0.0 ?
+				masked_diagonal(&a->op, idx) : 0.0;
+			lvl->r[idx] = d > 0.0 ? lvl->b[idx] - d * lvl->x[idx] +
+				masked_neighbors(&a->op, lvl->x, idx) : 0.0;
+		}
+	}
+}
+
+static void multigrid_residual(fluids_context_t* const ctx,
+	struct multigrid_level* const lvl, int boundary)
+{
+	struct multigrid_masked_args a = { lvl };
+
+	if (lvl->fluid) {
+		multigrid_operator(&a.op, lvl, boundary);
+		parallel_for(ctx, multigrid_masked_residual_rows, &a, 1,
+			lvl->cell_count_j - 1,
+			lvl->cell_count_i * lvl->cell_count_j);
+		return;
+	}
+
+	parallel_for(ctx, multigrid_residual_rows, lvl, 1,
+		lvl->cell_count_j - 1, lvl->cell_count_i * lvl->cell_count_j);
+}
+
+/* Restricts the residual of [fine] to the right hand side of [coarse]. A
+** coarse cell averages its children, the last coarse cell of a row or column
+** also takes the remaining fine cell if the fine cell count is odd. The 
+** factor 4 accounts for the doubled grid spacing of the coarse operator.
+** In a masked solve, only the children solved for count. */
+struct multigrid_transfer_args {
+	struct multigrid_level* fine;
+	struct multigrid_level* coarse;
+};
+
+static void multigrid_restrict_rows(fluids_context_t* const ctx, int cj_begin,
+	int cj_end, int thread, void* const vp)
+{
+	const struct multigrid_transfer_args* const a = vp;
+	const struct multigrid_level* const fine = a->fine;
+	struct multigrid_level* const coarse = a->coarse;
+	int ci = 0, cj = 0, fi = 0, fj = 0, fi_end = 0, fj_end = 0, n = 0;
+	int fni = fine->cell_count_i;
+	int cni = coarse->cell_count_i, cnj = coarse->cell_count_j;
+	float sum = 0.0;
+
+	/* the coarse correction starts from zero, including its boundary */
+	for (ci = cni * cj_begin; ci < cni * cj_end; ci++) {
+		coarse->x[ci] = 0.0;
+	}
+
+	for (cj = cj_begin; cj < cj_end; cj++) {
+		if (cj == 0 || cj == cnj - 1) {
+			continue;
+		}
+
+		fj_end = cj == cnj - 2 ? fine->cell_count_j - 2 : 2 * cj;
+
+		for (ci = 1; ci < cni - 1; ci++) {
+			fi_end = ci == cni - 2 ? fni - 2 : 2 * ci;
+			sum = 0.0;
+			n = 0;
+
+			for (fj = 2 * cj - 1; fj <= fj_end; fj++) {
+				for (fi = 2 * ci - 1; fi <= fi_end; fi++) {
+					sum += fine->r[IDXN(fine->pitch, fi, 
+						fj)];
+					n += !fine->unknowns ||
+						fine->unknowns[IDXN(
+						fine->pitch, fi, fj)] != 0.0;
+				}
+			}
+
+			coarse->b[IDXN(cni, ci, cj)] = n > 0 ?
+				4.0 * sum / n : 0.0;
+		}
+	}
+}
+
+static void multigrid_restrict(fluids_context_t* const ctx,
+	struct multigrid_level* const fine,
+	struct multigrid_level* const coarse)
+{
+	struct multigrid_transfer_args a = { fine, coarse };
+
+	parallel_for(ctx, multigrid_restrict_rows, &a, 0, coarse->cell_count_j,
+		fine->cell_count_i * fine->cell_count_j);
+}
+
+/* Sets the masks of [coarse] for a masked solve: a coarse cell is fluid if
+** one of its children is, and solved for if one of its children is. */
+static void multigrid_restrict_masks(const struct multigrid_level* const fine,
+	struct multigrid_level* const coarse)
+{
+	int ci = 0, cj = 0, fi = 0, fj = 0, fi_end = 0, fj_end = 0;
+	int idx = 0, fidx = 0;
+	int cni = coarse->cell_count_i, cnj = coarse->cell_count_j;
+	size_t size = (size_t)cni * cnj;
+	float* const fluid = coarse->masks;
+	float* const unknowns = coarse->masks + size;
+
+	memset(coarse->masks, 0, 2 * size * sizeof(float));
+
+	for (cj = 1; cj < cnj - 1; cj++) {
+		fj_end = cj == cnj - 2 ? fine->cell_count_j - 2 : 2 * cj;
+
+		for (ci = 1; ci < cni - 1; ci++) {
+			fi_end = ci == cni - 2 ? fine->cell_count_i - 2 : 2 * ci;
+			idx = IDXN(cni, ci, cj);
+
+			for (fj = 2 * cj - 1; fj <= fj_end; fj++) {
+				for (fi = 2 * ci - 1; fi <= fi_end; fi++) {
+					fidx = IDXN(fine->pitch, fi, fj);
+					fluid[idx] = fine->fluid[fidx] != 0.0 ?
+						1.0 : fluid[idx];
+					unknowns[idx] = fine->unknowns[fidx] !=
+						0.0 ? 1.0 : unknowns[idx];
+				}
+			}
+		}
+	}
+
+	coarse->fluid = fluid;
+	coarse->unknowns = unknowns;
+}
+
+/* Bilinearly interpolates the correction of [coarse] and adds it to the 
+** solution of [fine]. */
+static void multigrid_prolongate_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	const struct multigrid_transfer_args* const a = vp;
+	struct multigrid_level* const fine = a->fine;
+	const struct multigrid_level* const coarse = a->coarse;
+	int i = 0, j = 0, ci = 0, cj = 0, di = 0, dj = 0;
+	int fni = fine->cell_count_i, fpitch = fine->pitch;
+	int cni = coarse->cell_count_i, cnj = coarse->cell_count_j;
+	const float* const e = coarse->x;
+
+	for (j = j_begin; j < j_end; j++) {
+		cj = (j + 1) / 2 < cnj - 2 ? (j + 1) / 2 : cnj - 2;
+		dj = j == 2 * cj - 1 ? -1 : 1;
+
+		for (i = 1; i < fni - 1; i++) {
+			ci = (i + 1) / 2 < cni - 2 ? (i + 1) / 2 : cni - 2;
+			di = i == 2 * ci - 1 ? -1 : 1;
+			fine->x[IDXN(fpitch, i, j)] += 
+				0.5625 * e[IDXN(cni, ci, cj)] +
+				0.1875 * e[IDXN(cni, ci + di, cj)] +
+				0.1875 * e[IDXN(cni, ci, cj + dj)] +
+				0.0625 * e[IDXN(cni, ci + di, cj + dj)];
+		}
+	}
+}
+
+/* multigrid_prolongate_rows for a masked solve. The weights of the coarse
+** cells that are not fluid are dropped and the others renormalized, the
+** fluid coarse cells not solved for hold a zero correction. */
+static void multigrid_prolongate_masked_rows(fluids_context_t* const ctx,
+	int j_begin, int j_end, int thread, void* const vp)
+{
+	const struct multigrid_transfer_args* const a = vp;
+	struct multigrid_level* const fine = a->fine;
+	const struct multigrid_level* const coarse = a->coarse;
+	int i = 0, j = 0, ci = 0, cj = 0, di = 0, dj = 0, idx = 0;
+	int cni = coarse->cell_count_i, cnj = coarse->cell_count_j;
+	const float* const e = coarse->x;
+	const float* const f = coarse->fluid;
+	float w00 = 0.0, w10 = 0.0, w01 = 0.0, w11 = 0.0, sum = 0.0;
+
+	for (j = j_begin; j < j_end; j++) {
+		cj = (j + 1) / 2 < cnj - 2 ? (j + 1) / 2 : cnj - 2;
+		dj = j == 2 * cj - 1 ? -1 : 1;
+
+		for (i = 1; i < fine->cell_count_i - 1; i++) {
+			if (fine->unknowns[IDXN(fine->pitch, i, j)] == 0.0) {
+				continue;
+			}
+
+			ci = (i + 1) / 2 < cni - 2 ? (i + 1) / 2 : cni - 2;
+			di = i == 2 * ci - 1 ? -1 : 1;
+			idx = IDXN(cni, ci, cj);
+			w00 = 0.5625 * f[idx];
+			w10 = 0.1875 * f[idx + di];
+			w01 = 0.1875 * f[idx + dj * cni];
+			w11 = 0.0625 * f[idx + di + dj * cni];
+			sum = w00 + w10 + w01 + w11;
+
+			if (sum > 0.0) {
+				fine->x[IDXN(fine->pitch, i, j)] += (
+					w00 * e[idx] + w10 * e[idx + di] +
+					w01 * e[idx + dj * cni] +
+					w11 * e[idx + di + dj * cni]) / sum;
+			}
+		}
+	}
+}
+
+static void multigrid_prolongate(fluids_context_t* const ctx,
+	struct multigrid_level* const fine,
+	struct multigrid_level* const coarse)
+{
+	struct multigrid_transfer_args a = { fine, coarse };
+
+	parallel_for(ctx, fine->fluid ? multigrid_prolongate_masked_rows :
+		multigrid_prolongate_rows, &a, 1, fine->cell_count_j - 1,
+		fine->cell_count_i * fine->cell_count_j);
+}
+
+static void multigrid_cycle(fluids_context_t* const ctx, int l, int boundary)
+{
+	int c = 0;
+	struct multigrid_level* const lvl = &ctx->mg_levels[l];
+	int ni = lvl->cell_count_i, nj = lvl->cell_count_j;
+	int singular = lvl->k == 0.0 && boundary == FLUIDS_BOUNDARY_NN;
+
+	if (l == ctx->mg_level_count - 1) {
+		if (singular) {
+			remove_mean(ctx, lvl->b, lvl->unknowns, ni, nj,
+				lvl->pitch);
+		}
+
+		multigrid_smooth(ctx, lvl, boundary, ni + nj);
+		return;
+	}
+
+	multigrid_smooth(ctx, lvl, boundary, ctx->mg_smooth_count);
+	multigrid_residual(ctx, lvl, boundary);
+
+	/* keep coarse right hand sides of a singular system in the range of
+	** their operators, the coarse cells are not all of the same size */
+	if (singular) {
+		remove_mean(ctx, lvl->r, lvl->unknowns, ni, nj, lvl->pitch);
+	}
+
+	multigrid_restrict(ctx, lvl, &ctx->mg_levels[l + 1]);
+
+	for (c = 0; c < ctx->mg_cycle; c++) {
+		multigrid_cycle(ctx, l + 1, boundary);
+	}
+
+	multigrid_prolongate(ctx, lvl, &ctx->mg_levels[l + 1]);
+	set_boundary_sized(lvl->x, ni, nj, lvl->pitch, lvl->halo, boundary);
+	multigrid_smooth(ctx, lvl, boundary, ctx->mg_smooth_count);
+}
+
+/* Solves (4 + [k]) x - sum(x_nb) = [b] on the current grid with 
+** [cycle_count] multigrid cycles. [x] holds the initial guess. If [list]
+** has spans, the cells of [list] are solved for with the masked operator,
+** see masked_operator, on all levels. */
+static void multigrid_solve(fluids_context_t* const ctx,
+	const struct span_list* const list, float* const x, float* const b,
+	float k, int boundary, int cycle_count)
+{
+	int l = 0, c = 0;
+	struct multigrid_level* lvl = NULL;
+
+	multigrid_allocate(ctx);
+
+	for (l = 0; l < ctx->mg_level_count; l++) {
+		lvl = &ctx->mg_levels[l];
+		lvl->k = k;
+		lvl->fluid = NULL;
+		lvl->unknowns = NULL;
+		k *= 4.0;
+
+		if (!list->spans) {
+			continue;
+		}
+
+		if (l == 0) {
+			lvl->fluid = fluid_weights(ctx) + IDX(0, 0);
+			lvl->unknowns = unknown_weights(ctx, list) + IDX(0, 0);
+			continue;
+		}
+
+		if (!lvl->masks) {
+			lvl->masks = malloc(2 * sizeof(float) *
+				lvl->cell_count_i * lvl->cell_count_j);
+		}
+
+		multigrid_restrict_masks(lvl - 1, lvl);
+	}
+
+	ctx->mg_levels[0].x = x + IDX(0, 0);
+	ctx->mg_levels[0].b = b + IDX(0, 0);
+	set_boundary(ctx, x, boundary);
+
+	for (c = 0; c < cycle_count; c++) {
+		multigrid_cycle(ctx, 0, boundary);
+	}
+
+	if (list->spans) {
+		set_boundary(ctx, x, boundary);
+	}
+}
+
+struct diffuse_args {
+	float* q;
+	const float* q_prev;
+	float r;
+	const float* inv;	/* ADI pivots */
+	float* blocks;		/* ADI row blocks, per thread */
+	const struct span* spans;	/* ADI lines of a masked solve */
+	const float* fluid;
+	float f;		/* their boundary factor */
+};
+
+static void diffuse_jacobi_cells(fluids_context_t* const ctx, int i, int j,
+	int n, int thread, void* const vp)
+{
+	const struct diffuse_args* const da = vp;
+	int idx = IDX(i, j);
+	float r = da->r;
+	float a = 1.0 / (1.0 + 4.0 * r);
+
+	g_kernels->diffuse(da->q + idx, da->q_prev + idx, n, ctx->pitch, a, r);
+}
+
+static void diffuse_jacobi_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	int j = 0;
+
+	for (j = j_begin; j < j_end; j++) {
+		diffuse_jacobi_cells(ctx, 1, j, ctx->cell_count_i - 2, thread,
+			vp);
+	}
+}
+
+/* A single Jacobi step from [q_prev]. Further iterations would read the
+** same values and reproduce this step. */
+static void diffuse_jacobi(fluids_context_t* const ctx, float* const q,
+	const float* const q_prev, float diff, float dt)
+{
+	struct diffuse_args a = { q, q_prev, diff * dt / (ctx->dx * ctx->dx) };
+
+	parallel_for_active(ctx, diffuse_jacobi_cells, &a, 1);
+}
+
+/* q = q_prev on the cells diffusion updates, on the whole field without
+** obstacles and sparse tiles */
+static void diffuse_copy(fluids_context_t* const ctx, float* const q,
+	const float* const q_prev)
+{
+	int i = 0;
+	int value_count = VALUE_COUNT;
+
+	if (active_cells(ctx)->spans) {
+		copy_active(ctx, q, q_prev);
+		return;
+	}
+
+	for (i = 0; i < value_count; i++) {
+		q[i] = q_prev[i];
+	}
+}
+
+/* Solves the implicit diffusion system (1 + 4r) q - r sum(q_nb) = q_prev,
+** scaled by 1 / r, with multigrid. */
+static void diffuse_multigrid(fluids_context_t* const ctx, float* const q,
+	const float* const q_prev, float diff, int cycle_count, int boundary,
+	float dt)
+{
+	int i = 0;
+	int value_count = VALUE_COUNT;
+	float r = diff * dt / (ctx->dx * ctx->dx);
+
+	diffuse_copy(ctx, q, q_prev);
+
+	if (r <= 0.0) {
+		return;
+	}
+
+	multigrid_allocate(ctx);
+
+	for (i = 0; i < value_count; i++) {
+		ctx->mg_rhs[i] = q_prev[i] / r;
+	}
+
+	multigrid_solve(ctx, active_cells(ctx), q, ctx->mg_rhs, 1.0 / r,
+		boundary, cycle_count);
+}
+
+/* Solves the implicit diffusion system (1 + 4r) q - r sum(q_nb) = q_prev,
+** scaled by 1 / r, with red-black SOR. */
+static void diffuse_sor(fluids_context_t* const ctx, float* const q,
+	const float* const q_prev, float diff, int iteration_count,
+	int boundary, float dt)
+{
+	float r = diff * dt / (ctx->dx * ctx->dx);
+
+	diffuse_copy(ctx, q, q_prev);
+
+	if (r <= 0.0) {
+		return;
+	}
+
+	if (active_cells(ctx)->spans) {
+		sor_masked(ctx, active_cells(ctx), q, q_prev, 1.0 / r, 1.0 / r,
+			sor_omega(ctx, 1.0 / r), boundary, iteration_count);
+		return;
+	}
+
+	sor_red_black(ctx, q + IDX(0, 0), q_prev + IDX(0, 0), 1.0 / r, 1.0 / r,
+		sor_omega(ctx, 1.0 / r), ctx->cell_count_i, ctx->cell_count_j,
+		ctx->pitch, ctx->halo, boundary, iteration_count);
+}
+
+/* Computes the inverse pivots [inv] of the Thomas algorithm for the system
+** -r x_(m-1) + (1 + 2r) x_m - r x_(m+1) = d_m, m = 1, ..., n - 2, whose
+** boundary values are x_0 = f_begin x_1 and x_(n-1) = f_end x_(n-2). The
+** pivots are the same for all lines of a grid. */
+static void adi_factor(float* const inv, int n, float r, float f_begin,
+	float f_end)
+{
+	int m = 0;
+	float b = 0.0;
+
+	for (m = 1; m < n - 1; m++) {
+		b = 1.0 + 2.0 * r;
+		b -= m == 1 ? r * f_begin : r * r * inv[m - 1];
+		b -= m == n - 2 ? r * f_end : 0.0;
+		inv[m] = 1.0 / b;
+	}
+}
+
+/* forward elimination and back substitution along [n] cells of
+** [line_count] adjacent lines, the cells m of all lines at [x] + m [stride]
+** one after the other. A step of the elimination updates the cells m of
+** all lines at once, the lines hide each other's latency. */
+static void adi_eliminate(float* const x, int n, int stride, int line_count,
+	const float* const inv, float r)
+{
+	int l = 0, m = 0;
+
+	for (l = 0; l < line_count; l++) {
+		x[stride + l] *= inv[1];
+	}
+
+	for (m = 2; m < n - 1; m++) {
+		g_kernels->thomas_forward(x + m * stride, x + (m - 1) * stride,
+			line_count, r, inv[m]);
+	}
+
+	for (m = n - 3; m > 0; m--) {
+		g_kernels->thomas_backward(x + m * stride,
+			x + (m + 1) * stride, line_count, r * inv[m]);
+	}
+}
+
+/* forward elimination and back substitution along the rows,
+** ADI_BLOCK_ROW_COUNT rows at once. A block is transposed into the buffer
+** of the thread, so its rows are eliminated like adjacent columns. Without
+** buffers, the rows are eliminated in place one by one. */
+static void adi_rows(fluids_context_t* const ctx, int j_begin, int j_end,
+	int thread, void* const vp)
+{
+	const struct diffuse_args* const a = vp;
+	float* const q = a->q;
+	float* const block = a->blocks ? a->blocks +
+		thread * ADI_BLOCK_ROW_COUNT * ctx->cell_count_i : NULL;
+	int i = 0, j = 0, k = 0, n = 0;
+	int ni = ctx->cell_count_i;
+
+	if (!block) {
+		for (j = j_begin; j < j_end; j++) {
+			adi_eliminate(q + IDX(0, j), ni, 1, 1, a->inv, a->r);
+		}
+
+		return;
+	}
+
+	for (j = j_begin; j < j_end; j += n) {
+		n = j_end - j < ADI_BLOCK_ROW_COUNT ?
+			j_end - j : ADI_BLOCK_ROW_COUNT;
+
+		for (k = 0; k < n; k++) {
+			for (i = 1; i < ni - 1; i++) {
+				block[n * i + k] = q[IDX(i, j + k)];
+			}
+		}
+
+		adi_eliminate(block, ni, n, n, a->inv, a->r);
+
+		for (k = 0; k < n; k++) {
+			for (i = 1; i < ni - 1; i++) {
+				q[IDX(i, j + k)] = block[n * i + k];
+			}
+		}
+	}
+}
+
+/* forward elimination and back substitution along the columns 
+** [i_begin, i_end), all columns at once row by row */
+static void adi_columns(fluids_context_t* const ctx, int i_begin, int i_end,
+	int thread, void* const vp)
+{
+	const struct diffuse_args* const a = vp;
+
+	adi_eliminate(a->q + IDX(i_begin, 0), ctx->cell_count_j, ctx->pitch,
+		i_end - i_begin, a->inv, a->r);
+}
+
+/* Forward elimination and back substitution along a run of [n] cells
+** [stride] floats apart, starting at [x]. A cell next to either end of the
+** run is fixed if [fluid] marks it, otherwise it is a boundary cell scaled
+** by [f]. [inv] holds n + 2 pivots. */
+static void adi_line(float* const x, const float* const fluid, int n,
+	int stride, float r, float f, float* const inv)
+{
+	float f_begin = fluid[-stride] != 0.0 ? 0.0 : f;
+	float f_end = fluid[n * stride] != 0.0 ? 0.0 : f;
+
+	x[0] += r * fluid[-stride] * x[-stride];
+	x[(n - 1) * stride] += r * fluid[n * stride] * x[n * stride];
+	adi_factor(inv, n + 2, r, f_begin, f_end);
+	adi_eliminate(x - stride, n + 2, stride, 1, inv, r);
+}
+
+static void adi_span_rows(fluids_context_t* const ctx, int s_begin,
+	int s_end, int thread, void* const vp)
+{
+	const struct diffuse_args* const a = vp;
+	const struct span* span = NULL;
+	int s = 0;
+
+	for (s = s_begin; s < s_end; s++) {
+		span = &a->spans[s];
+		adi_line(a->q + IDX(span->i, span->j),
+			a->fluid + IDX(span->i, span->j), span->n, 1, a->r,
+			a->f, a->blocks + thread * (ctx->cell_count_i +
+			ctx->cell_count_j));
+	}
+}
+
+/* the spans are those of the transposed grid, see adi_column_spans */
+static void adi_span_columns(fluids_context_t* const ctx, int s_begin,
+	int s_end, int thread, void* const vp)
+{
+	const struct diffuse_args* const a = vp;
+	const struct span* span = NULL;
+	int s = 0;
+
+	for (s = s_begin; s < s_end; s++) {
+		span = &a->spans[s];
+		adi_line(a->q + IDX(span->j, span->i),
+			a->fluid + IDX(span->j, span->i), span->n, ctx->pitch,
+			a->r, a->f, a->blocks + thread * (ctx->cell_count_i +
+			ctx->cell_count_j));
+	}
+}
+
+/* Gathers the runs of the cells [unknowns] marks along the columns into
+** [list], as spans of the transposed grid: i is the first row of a run, j
+** its column. Returns 0 if the open runs cannot be allocated. */
+static int adi_column_spans(fluids_context_t* const ctx,
+	struct span_list* const list, const float* const unknowns)
+{
+	int i = 0, j = 0;
+	int ni = ctx->cell_count_i, nj = ctx->cell_count_j;
+	int* const begins = scratch_reserve(&ctx->adi_begins,
+		ni * sizeof(int));
+
+	if (!begins) {
+		return 0;
+	}
+
+	span_list_clear(list);
+
+	for (i = 0; i < ni; i++) {
+		begins[i] = -1;
+	}
+
+	/* the last boundary row closes the runs */
+	for (j = 1; j < nj; j++) {
+		for (i = 1; i < ni - 1; i++) {
+			if (unknowns[IDX(i, j)] != 0.0) {
+				begins[i] = begins[i] < 0 ? j : begins[i];
+				continue;
+			}
+
+			if (begins[i] >= 0) {
+				span_list_append(list, begins[i], j, i);
+				begins[i] = -1;
+			}
+		}
+	}
+
+	return 1;
+}
+
+/* diffuse_adi over the fluid (or active) cells: the lines are the runs of
+** these cells along the rows and columns, the fluid cells outside them are
+** fixed and the solid ones boundary cells. */
+static void diffuse_adi_spans(fluids_context_t* const ctx,
+	struct diffuse_args* const a, int substep_count, int boundary)
+{
+	int s = 0;
+	const struct span_list* const list = active_cells(ctx);
+	const struct span_list* const columns = &ctx->adi_columns;
+	const float* unknowns = NULL;
+
+	a->fluid = fluid_weights(ctx);
+	a->blocks = scratch_reserve(&ctx->adi_blocks, threads_get_count() *
+		(ctx->cell_count_i + ctx->cell_count_j) * sizeof(float));
+	unknowns = unknown_weights(ctx, list);
+
+	if (!a->fluid || !a->blocks || !unknowns ||
+		!adi_column_spans(ctx, &ctx->adi_columns, unknowns)) {
+		return;
+	}
+
+	diffuse_copy(ctx, a->q, a->q_prev);
+
+	for (s = 0; s < substep_count; s++) {
+		a->spans = list->spans;
+		a->f = g_boundary_factors[boundary][1];
+		parallel_for(ctx, adi_span_rows, a, 0, list->span_count,
+			list->cell_count);
+		a->spans = columns->spans;
+		a->f = g_boundary_factors[boundary][0];
+		parallel_for(ctx, adi_span_columns, a, 0, columns->span_count,
+			columns->cell_count);
+	}
+}
+
+/* Solves (1 - r d2/dx2) q = q_prev along each row, then 
+** (1 - r d2/dy2) q = q along each column (locally one-dimensional splitting
+** of the implicit diffusion system), [substep_count] times with r divided
+** accordingly. Columns are eliminated together row by row, rows in
+** transposed blocks, so the inner loops run over contiguous memory. */
+static void diffuse_adi(fluids_context_t* const ctx, float* const q,
+	const float* const q_prev, float diff, int substep_count, int boundary,
+	float dt)
+{
+	int s = 0;
+	int ni = ctx->cell_count_i, nj = ctx->cell_count_j;
+	struct diffuse_args a = { q, q_prev };
+
+	substep_count = substep_count > 0 ? substep_count : 1;
+	a.r = diff * dt / (ctx->dx * ctx->dx * substep_count);
+
+	if (a.r <= 0.0) {
+		diffuse_copy(ctx, q, q_prev);
+		return;
+	}
+
+	if (active_cells(ctx)->spans) {
+		diffuse_adi_spans(ctx, &a, substep_count, boundary);
+		return;
+	}
+
+	if (!ctx->adi_inv_i || !ctx->adi_inv_j) {
+		free(ctx->adi_inv_i);
+		free(ctx->adi_inv_j);
+		ctx->adi_inv_i = malloc(ni * sizeof(float));
+		ctx->adi_inv_j = malloc(nj * sizeof(float));
+	}
+
+	if (!ctx->adi_inv_i || !ctx->adi_inv_j) {
+		return;
+	}
+
+	diffuse_copy(ctx, q, q_prev);
+	adi_factor(ctx->adi_inv_i, ni, a.r, g_boundary_factors[boundary][1],
+		g_boundary_factors[boundary][1]);
+	adi_factor(ctx->adi_inv_j, nj, a.r, g_boundary_factors[boundary][0],
+		g_boundary_factors[boundary][0]);
+	a.blocks = scratch_reserve(&ctx->adi_blocks, threads_get_count() *
+		ADI_BLOCK_ROW_COUNT * ni * sizeof(float));
+
+	for (s = 0; s < substep_count; s++) {
+		a.inv = ctx->adi_inv_i;
+		parallel_for(ctx, adi_rows, &a, 1, nj - 1, ni * nj);
+		a.inv = ctx->adi_inv_j;
+		parallel_for(ctx, adi_columns, &a, 1, ni - 1, ni * nj);
+	}
+}
+
+/* a band function applied to several fields */
+struct diffuse_many_args {
+	band_fn_t fn;
+	struct diffuse_args* fields;
+	int field_count;
+};
+
+static void diffuse_many_bands(fluids_context_t* const ctx, int begin, int end,
+	int thread, void* const vp)
+{
+	const struct diffuse_many_args* const a = vp;
+	int f = 0;
+
+	for (f = 0; f < a->field_count; f++) {
+		(*a->fn)(ctx, begin, end, thread, &a->fields[f]);
+	}
+}
+
+/* diffuse_adi for several fields, each row and column sweep handles all 
+** fields in one dispatch. The pivots depend on the boundary of a field.
+** Returns 0 if the arguments or pivots of the fields cannot be
+** allocated. */
+static int diffuse_many_adi(fluids_context_t* const ctx,
+	float* const* const qs, const float* const* const q_prevs,
+	int field_count, float diff, int substep_count,
+	const int* const boundaries, float dt)
+{
+	int f = 0, i = 0, s = 0;
+	int ni = ctx->cell_count_i, nj = ctx->cell_count_j;
+	float r = 0.0;
+	struct diffuse_args* const fields = scratch_reserve(&ctx->many_fields,
+		field_count * sizeof(struct diffuse_args));
+	float* const inv = scratch_reserve(&ctx->many_pivots,
+		field_count * (ni + nj) * sizeof(float));
+	float* const blocks = scratch_reserve(&ctx->adi_blocks,
+		threads_get_count() * ADI_BLOCK_ROW_COUNT * ni * sizeof(float));
+	struct diffuse_many_args a = { NULL, fields, field_count };
+
+	if (!fields || !inv) {
+		return 0;
+	}
+
+	substep_count = substep_count > 0 ? substep_count : 1;
+	r = diff * dt / (ctx->dx * ctx->dx * substep_count);
+
+	for (f = 0; f < field_count; f++) {
+		for (i = 0; i < VALUE_COUNT; i++) {
+			qs[f][i] = q_prevs[f][i];
+		}
+
+		fields[f].q = qs[f];
+		fields[f].q_prev = q_prevs[f];
+		fields[f].r = r;
+		fields[f].blocks = blocks;
+		adi_factor(inv + f * (ni + nj), ni, r, 
+			g_boundary_factors[boundaries[f]][1],
+			g_boundary_factors[boundaries[f]][1]);
+		adi_factor(inv + f * (ni + nj) + ni, nj, r, 
+			g_boundary_factors[boundaries[f]][0],
+			g_boundary_factors[boundaries[f]][0]);
+	}
+
+	for (s = 0; s < substep_count && r > 0.0; s++) {
+		for (f = 0; f < field_count; f++) {
+			fields[f].inv = inv + f * (ni + nj);
+		}
+
+		a.fn = adi_rows;
+		parallel_for(ctx, diffuse_many_bands, &a, 1, nj - 1, 
+			ni * nj * field_count);
+
+		for (f = 0; f < field_count; f++) {
+			fields[f].inv = inv + f * (ni + nj) + ni;
+		}
+
+		a.fn = adi_columns;
+		parallel_for(ctx, diffuse_many_bands, &a, 1, ni - 1, 
+			ni * nj * field_count);
+	}
+
+	return 1;
+}
+
+/* fluids_context_diffuse_many one field after the other */
+static void diffuse_each(fluids_context_t* const ctx,
+	float* const* const qs, const float* const* const q_prevs,
+	int field_count, float diff, int iteration_count,
+	const int* const boundaries, float dt)
+{
+	int f = 0;
+
+	for (f = 0; f < field_count; f++) {
+		fluids_context_diffuse(ctx, qs[f], q_prevs[f], diff,
+			iteration_count, boundaries[f], dt);
+	}
+}
+
+void fluids_context_diffuse_many(fluids_context_t* const ctx,
+	float* const* const qs, const float* const* const q_prevs,
+	int field_count, float diff, int iteration_count,
+	const int* const boundaries, float dt)
+{
+	int f = 0;
+	struct diffuse_args* fields = NULL;
+	struct diffuse_many_args a = { diffuse_jacobi_rows };
+
+	/* the fields are diffused over the fluid (or active) cells one after
+	** the other */
+	if (active_cells(ctx)->spans) {
+		diffuse_each(ctx, qs, q_prevs, field_count, diff,
+			iteration_count, boundaries, dt);
+		return;
+	}
+
+	switch (ctx->diffusion_solver) {
+	case FLUIDS_SOLVER_ADI:
+		/* one field after the other without work arrays per field */
+		if (diffuse_many_adi(ctx, qs, q_prevs, field_count, diff,
+			iteration_count, boundaries, dt)) {
+			break;
+		}
+
+		/* falls through */
+	case FLUIDS_SOLVER_SOR:
+	case FLUIDS_SOLVER_MULTIGRID:
+		/* the solvers keep a single set of work arrays */
+		diffuse_each(ctx, qs, q_prevs, field_count, diff,
+			iteration_count, boundaries, dt);
+		return;
+	default:
+		fields = scratch_reserve(&ctx->many_fields,
+			field_count * sizeof(struct diffuse_args));
+
+		if (!fields) {
+			diffuse_each(ctx, qs, q_prevs, field_count, diff,
+				iteration_count, boundaries, dt);
+			return;
+		}
+
+		for (f = 0; f < field_count; f++) {
+			fields[f].q = qs[f];
+			fields[f].q_prev = q_prevs[f];
+			fields[f].r = diff * dt / (ctx->dx * ctx->dx);
+		}
+
+		a.fields = fields;
+		a.field_count = field_count;
+		parallel_for(ctx, diffuse_many_bands, &a, 1,
+			ctx->cell_count_j - 1,
+			ctx->cell_count_i * ctx->cell_count_j * field_count);
+		break;
+	}
+
+	for (f = 0; f < field_count; f++) {
+		set_boundary(ctx, qs[f], boundaries[f]);
+	}
+}
+
+void fluids_context_diffuse(fluids_context_t* const ctx, float* const q,
+	const float* const q_prev, float diff, int iteration_count,
+	int boundary, float dt)
+{
+	switch (ctx->diffusion_solver) {
+	case FLUIDS_SOLVER_ADI:
+		diffuse_adi(ctx, q, q_prev, diff, iteration_count, boundary,
+			dt);
+		break;
+	case FLUIDS_SOLVER_SOR:
+		diffuse_sor(ctx, q, q_prev, diff, iteration_count, boundary,
+			dt);
+		break;
+	case FLUIDS_SOLVER_MULTIGRID:
+		diffuse_multigrid(ctx, q, q_prev, diff, iteration_count,
+			boundary, dt);
+		break;
+	default:
+		diffuse_jacobi(ctx, q, q_prev, diff, dt);
+		break;
+	}
+
+	set_boundary(ctx, q, boundary);
+}
+
+/* fused transport */
+
+#define TRANSPORT_RING_ROW_COUNT 16	/* advected rows buffered per thread */
+
+struct transport_args {
+	float* q;
+	float* q_prev;
+	const float* u;
+	const float* v;
+	int boundary;
+	float dt;
+	int fused;		/* diffuse from the buffered rows */
+	float r;
+	band_fn_t source_fn;	/* NULL without source */
+	struct source_args source;
+	int lead;		/* the advection of row j reads rows 
+				** (j - lead, j + lead) of q_prev */
+	float* rings[THREADS_MAX_COUNT];	/* per thread */
+};
+
+static void transport_source(fluids_context_t* const ctx,
+	const struct transport_args* const a, int j_begin, int j_end)
+{
+	if (a->source_fn && j_begin < j_end) {
+		(*a->source_fn)(ctx, j_begin, j_end, 0, (void*)&a->source);
+	}
+}
+
+/* Applies the source to the rows of q_prev within [lead] rows of the band
+** [j_begin, j_end) ends, which the neighboring bands read as well. The band
+** itself does the rest. */
+static void transport_source_ends(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	const struct transport_args* const a = vp;
+	int lo_end = j_begin + a->lead < j_end ? j_begin + a->lead : j_end;
+	int hi_begin = j_end - a->lead > lo_end ? j_end - a->lead : lo_end;
+
+	transport_source(ctx, a, j_begin == 1 ? -ctx->halo : j_begin, lo_end);
+	transport_source(ctx, a, hi_begin, j_end == ctx->cell_count_j - 1 ? 
+		ctx->cell_count_j + ctx->halo : j_end);
+}
+
+/* Applies the source to the rows [sourced, source_end) of q_prev that 
+** the advection of row [j] reads. Returns the first row without source. */
+static int transport_source_ahead(fluids_context_t* const ctx,
+	const struct transport_args* const a, int sourced, int source_end,
+	int j)
+{
+	int end = j + a->lead < source_end ? j + a->lead : source_end;
+
+	if (sourced < end) {
+		transport_source(ctx, a, sourced, end);
+		return end;
+	}
+
+	return sourced;
+}
+
+/* Stores row [j] of the advected field with its boundary values in [row].
+** Rows 0 and n - 1 are boundary rows and set from the adjacent inner row 
+** [inner]. */
+static void transport_row(fluids_context_t* const ctx,
+	const struct transport_args* const a, float* const row,
+	const float* const inner, int j)
+{
+	int i = 0, ni = ctx->cell_count_i;
+	float f_row = g_boundary_factors[a->boundary][0];
+	float f_col = g_boundary_factors[a->boundary][1];
+
+	if (j == 0 || j == ctx->cell_count_j - 1) {
+		for (i = 1; i < ni - 1; i++) {
+			row[i] = f_row * inner[i];
+		}
+
+		return;
+	}
+
+	advect_run(ctx, row + 1, a->q_prev, a->u, a->v, 1, j, ni - 2, a->dt);
+	row[0] = f_col * row[1];
+	row[ni - 1] = f_col * row[ni - 2];
+}
+
+/* Advects the rows [j_begin, j_end), applying the source to the rows of 
+** q_prev [lead] rows ahead, and, if fused, takes the Jacobi step of each 
+** row as soon as the advected rows below and above it are buffered. The 
+** rows next to the band are advected by both neighboring threads. */
+static void transport_rows(fluids_context_t* const ctx, int j_begin, int j_end,
+	int thread, void* const vp)
+{
+	const struct transport_args* const a = vp;
+	float* const ring = a->rings[thread];
+	int i = 0, j = 0, ni = ctx->cell_count_i;
+	int slot = 0;			/* ring row of row j - 1 */
+	int sourced = j_begin + a->lead;	/* first row without source */
+	int source_end = j_end - a->lead;
+	float r = a->r;
+
+	if (!a->fused) {
+		for (j = j_begin; j < j_end; j++) {
+			sourced = transport_source_ahead(ctx, a, sourced, 
+				source_end, j);
+			transport_row(ctx, a, a->q + IDX(0, j), NULL, j);
+		}
+
+		return;
+	}
+
+	sourced = transport_source_ahead(ctx, a, sourced, source_end, j_begin);
+	transport_row(ctx, a, ring + ni, NULL, j_begin);
+	transport_row(ctx, a, ring, ring + ni, j_begin - 1);
+
+	for (j = j_begin; j < j_end; j++) {
+		if (slot + 2 == TRANSPORT_RING_ROW_COUNT) {
+			for (i = 0; i < 2 * ni; i++) {
+				ring[i] = ring[slot * ni + i];
+			}
+
+			slot = 0;
+		}
+
+		sourced = transport_source_ahead(ctx, a, sourced, source_end, 
+			j + 1);
+		transport_row(ctx, a, ring + (slot + 2) * ni, 
+			ring + (slot + 1) * ni, j + 1);
+		g_kernels->diffuse(a->q + IDX(1, j), ring + (slot + 1) * ni + 1,
+			ni - 2, ni, 1.0 / (1.0 + 4.0 * r), r);
+		slot++;
+	}
+}
+
+/* the stages of fluids_context_transport one after the other, each over
+** the fluid (or active) cells */
+static void transport_spans(fluids_context_t* const ctx, float* const q,
+	float* const q_prev, const fluids_source_t* const source,
+	const float* const u, const float* const v, float diff,
+	int iteration_count, int boundary, float dt)
+{
+	if (source) {
+		switch (source->type) {
+		case FLUIDS_SOURCE_UNIFORM:
+			fluids_context_add_source_uniform(ctx, q_prev, 
+				source->s, source->alpha);
+			break;
+		case FLUIDS_SOURCE_CLAMPED:
+			fluids_context_add_source_clamped(ctx, q_prev, 
+				source->source, source->alpha, source->q_min,
+				source->q_max);
+			break;
+		case FLUIDS_SOURCE_TARGET:
+			fluids_context_add_source_with_target(ctx, q_prev,
+				source->source, source->q_target);
+			break;
+		default:
+			fluids_context_add_source(ctx, q_prev, source->source,
+				source->alpha);
+			break;
+		}
+	}
+
+	fluids_context_advect(ctx, q, q_prev, u, v, boundary, dt);
+	copy_active(ctx, q_prev, q);
+	set_boundary(ctx, q_prev, boundary);
+	fluids_context_diffuse(ctx, q, q_prev, diff, iteration_count, boundary,
+		dt);
+}
+
+void fluids_context_transport(fluids_context_t* const ctx, float* const q,
+	float* const q_prev, const fluids_source_t* const source,
+	const float* const u, const float* const v, float diff,
+	int iteration_count, int boundary, float dt)
+{
+	int i = 0, t = 0;
+	int thread_count = threads_get_count();
+	int cell_count = ctx->cell_count_i * ctx->cell_count_j;
+	int value_count = VALUE_COUNT;
+	float d = 0.0;
+	struct transport_args a = { q, q_prev, u, v, boundary, dt };
+	float* rings = NULL;
+
+	/* obstacles and sparse tiles break the rows the stages pass on,
+	** MacCormack needs its forward step of the whole field */
+	if (active_cells(ctx)->spans ||
+		ctx->advection == FLUIDS_ADVECTION_MACCORMACK) {
+		transport_spans(ctx, q, q_prev, source, u, v, diff,
+			iteration_count, boundary, dt);
+		return;
+	}
+
+	if (source) {
+		a.source.q = q_prev;
+		a.source.source = source->source;
+		a.source.s = source->s;
+		a.source.alpha = source->alpha;
+		a.source.q_min = source->q_min;
+		a.source.q_max = source->q_max;
+
+		switch (source->type) {
+		case FLUIDS_SOURCE_UNIFORM:
+			a.source_fn = add_source_uniform_rows;
+			break;
+		case FLUIDS_SOURCE_CLAMPED:
+			a.source_fn = add_source_clamped_rows;
+			break;
+		case FLUIDS_SOURCE_TARGET:
+			a.source.s = source->q_target;
+			a.source_fn = add_source_with_target_rows;
+			break;
+		default:
+			a.source_fn = add_source_rows;
+			break;
+		}
+
+		/* a departure point is less than d + 1 rows away from its 
+		** cell and interpolates the next row as well */
+		d = max_abs(ctx, v) * dt / ctx->dx;
+		a.lead = d < ctx->cell_count_j ? (int)d + 2 : ctx->cell_count_j;
+		parallel_for(ctx, transport_source_ends, &a, 1,
+			ctx->cell_count_j - 1, cell_count);
+	}
+
+	a.r = diff * dt / (ctx->dx * ctx->dx);
+
+	/* without rings, the Jacobi step follows the pass */
+	if (ctx->diffusion_solver == FLUIDS_SOLVER_JACOBI) {
+		rings = scratch_reserve(&ctx->transport_rings, thread_count *
+			TRANSPORT_RING_ROW_COUNT * ctx->cell_count_i *
+			sizeof(float));
+	}
+
+	a.fused = rings != NULL;
+
+	if (a.fused) {
+		for (t = 0; t < thread_count; t++) {
+			a.rings[t] = rings + t * TRANSPORT_RING_ROW_COUNT * 
+				ctx->cell_count_i;
+		}
+	}
+
+	parallel_for(ctx, transport_rows, &a, 1, ctx->cell_count_j - 1,
+		cell_count);
+	set_boundary(ctx, q, boundary);
+
+	if (!a.fused) {
+		/* the other solvers read the right hand side from q_prev */
+		for (i = 0; i < value_count; i++) {
+			q_prev[i] = q[i];
+		}
+
+		fluids_context_diffuse(ctx, q, q_prev, diff, iteration_count,
+			boundary, dt);
+	}
+}
+
+/* half precision fields. the values are converted to float by the kernels
+** and rounded back once per routine, the boundary cells convert one by
+** one. */
+
+#define HALF(h, idx) simd_half_to_float((h)[idx], format)
+
+/* set_boundary for a half precision field of [format] */
+static void set_boundary_half(fluids_context_t* const ctx,
+	fluids_half_t* const h, int boundary, int format)
+{
+	int i = 0, j = 0, k = 0, n = 0;
+	int idx = 0;
+	int ni = ctx->cell_count_i, nj = ctx->cell_count_j;
+	float f_row = g_boundary_factors[boundary][0];
+	float f_col = g_boundary_factors[boundary][1];
+	float sum = 0.0;
+	const struct obstacle_face* face = NULL;
+	fluids_half_t* row = NULL;
+
+	for (k = 0; k < ctx->obstacle_face_count; k++) {
+		face = &ctx->obstacle_faces[k];
+		idx = IDX(face->i, face->j);
+		sum = 0.0;
+		n = 0;
+
+		if (face->sides & SIDE_LEFT) {
+			sum += f_col * HALF(h, idx - 1);
+			n++;
+		}
+
+		if (face->sides & SIDE_RIGHT) {
+			sum += f_col * HALF(h, idx + 1);
+			n++;
+		}
+
+		if (face->sides & SIDE_BOTTOM) {
+			sum += f_row * HALF(h, idx - ctx->pitch);
+			n++;
+		}
+
+		if (face->sides & SIDE_TOP) {
+			sum += f_row * HALF(h, idx + ctx->pitch);
+			n++;
+		}
+
+		h[idx] = simd_float_to_half(sum / n, format);
+	}
+
+	for (i = 1; i < ni - 1; i++) {
+		h[IDX(i, 0)] = simd_float_to_half(f_row * HALF(h, IDX(i, 1)),
+			format);
+		h[IDX(i, nj - 1)] = simd_float_to_half(
+			f_row * HALF(h, IDX(i, nj - 2)), format);
+	}
+
+	for (j = 1; j < nj - 1; j++) {
+		h[IDX(0, j)] = simd_float_to_half(f_col * HALF(h, IDX(1, j)),
+			format);
+		h[IDX(ni - 1, j)] = simd_float_to_half(
+			f_col * HALF(h, IDX(ni - 2, j)), format);
+	}
+
+	h[IDX(0, 0)] = simd_float_to_half(0.5 * (HALF(h, IDX(0, 1)) +
+		HALF(h, IDX(1, 0))), format);
+	h[IDX(ni - 1, 0)] = simd_float_to_half(0.5 * (
+		HALF(h, IDX(ni - 1, 1)) + HALF(h, IDX(ni - 2, 0))), format);
+	h[IDX(0, nj - 1)] = simd_float_to_half(0.5 * (
+		HALF(h, IDX(0, nj - 2)) + HALF(h, IDX(1, nj - 1))), format);
+	h[IDX(ni - 1, nj - 1)] = simd_float_to_half(0.5 * (
+		HALF(h, IDX(ni - 2, nj - 1)) + HALF(h, IDX(ni - 1, nj - 2))),
+		format);
+
+	/* the halo copies the values as they are, see set_halo */
+	for (j = 0; j < nj; j++) {
+		row = h + IDX(0, j);
+
+		for (i = 1; i <= ctx->halo; i++) {
+			row[-i] = row[0];
+			row[ni - 1 + i] = row[ni - 1];
+		}
+	}
+
+	for (j = 1; j <= ctx->halo; j++) {
+		for (i = -ctx->halo; i < ni + ctx->halo; i++) {
+			h[IDX(i, -j)] = h[IDX(i, 0)];
+			h[IDX(i, nj - 1 + j)] = h[IDX(i, nj - 1)];
+		}
+	}
+}
+
+fluids_half_t* fluids_context_malloc_half(fluids_context_t* const ctx,
+	float c, int format)
+{
+	size_t value_count = VALUE_COUNT;
+	size_t i = 0;
+	void* vp = NULL;
+	fluids_half_t* hp;
+	fluids_half_t h = simd_float_to_half(c, format);
+
+	if (posix_memalign(&vp, ARENA_ALIGNMENT, sizeof(*hp) * value_count)) {
+		return NULL;
+	}
+
+	hp = vp;
+
+	for (i = 0; i < value_count; i++) {
+		hp[i] = h;
+	}
+
+	return hp;
+}
+
+struct half_args {
+	fluids_half_t* h;
+	const fluids_half_t* h_prev;
+	float* q;
+	const float* source;
+	const float* u;
+	const float* v;
+	float alpha;	/* source amount or diffusion rate r */
+	float dt;
+	int format;
+	struct simd_weights weights[THREADS_MAX_COUNT];	/* per thread */
+};
+
+static void half_to_float_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	const struct half_args* const a = vp;
+	int idx = IDX(-ctx->halo, j_begin);
+
+	g_kernels->half_to_float(a->q + idx, a->h + idx,
+		ctx->pitch * (j_end - j_begin), a->format);
+}
+
+static void float_to_half_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	const struct half_args* const a = vp;
+	int idx = IDX(-ctx->halo, j_begin);
+
+	g_kernels->float_to_half(a->h + idx, a->q + idx,
+		ctx->pitch * (j_end - j_begin), a->format);
+}
+
+void fluids_context_half_to_float(fluids_context_t* const ctx,
+	float* const q, const fluids_half_t* const h, int format)
+{
+	struct half_args a = { (fluids_half_t*)h, NULL, q };
+
+	a.format = format;
+	parallel_for(ctx, half_to_float_rows, &a, -ctx->halo,
+		ctx->cell_count_j + ctx->halo,
+		ctx->cell_count_i * ctx->cell_count_j);
+}
+
+void fluids_context_float_to_half(fluids_context_t* const ctx,
+	fluids_half_t* const h, const float* const q, int format)
+{
+	struct half_args a = { h, NULL, (float*)q };
+
+	a.format = format;
+	parallel_for(ctx, float_to_half_rows, &a, -ctx->halo,
+		ctx->cell_count_j + ctx->halo,
+		ctx->cell_count_i * ctx->cell_count_j);
+}
+
+static void add_source_half_cells(fluids_context_t* const ctx, int i, int j,
+	int n, int thread, void* const vp)
+{
+	const struct half_args* const a = vp;
+	int idx = IDX(i, j);
+
+	g_kernels->add_source_half(a->h + idx, a->source + idx, n, a->alpha,
+		a->format);
+}
+
+static void add_source_half_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	const struct half_args* const a = vp;
+	int idx = IDX(-ctx->halo, j_begin);
+
+	g_kernels->add_source_half(a->h + idx, a->source + idx,
+		ctx->pitch * (j_end - j_begin), a->alpha, a->format);
+}
+
+void fluids_context_add_source_half(fluids_context_t* const ctx,
+	fluids_half_t* const q, const float* const source, float alpha,
+	int format)
+{
+	struct half_args a = { q, NULL, NULL, source, NULL, NULL, alpha };
+
+	a.format = format;
+
+	if (tiles_sparse(ctx)) {
+		parallel_for_active(ctx, add_source_half_cells, &a, 1);
+		return;
+	}
+
+	parallel_for(ctx, add_source_half_rows, &a, -ctx->halo,
+		ctx->cell_count_j + ctx->halo,
+		ctx->cell_count_i * ctx->cell_count_j);
+}
+
+static void advect_half_cells(fluids_context_t* const ctx, int i, int j,
+	int n, int thread, void* const vp)
+{
+	const struct half_args* const a = vp;
+	const struct simd_weights* const w = &a->weights[thread];
+
+	backtrace_run(ctx, w, a->u, a->v, i, j, n, a->dt);
+	g_kernels->interpolate_half(a->h + IDX(i, j), a->h_prev + IDX(0, 0),
+		w, n, a->format);
+}
+
+void fluids_context_advect_half(fluids_context_t* const ctx,
+	fluids_half_t* const q, const fluids_half_t* const q_prev,
+	const float* const u, const float* const v, int format, int boundary,
+	float dt)
+{
+	int t = 0;
+	int n = ctx->cell_count_i - 2;
+	int thread_count = threads_get_count();
+	struct half_args a = { q, q_prev, NULL, NULL, u, v, 0.0, dt, format };
+	int* indices = NULL;
+	float* fractions = NULL;
+
+	if (!weights_reserve(ctx, &indices, &fractions, 3 * thread_count * n,
+		2 * thread_count * n)) {
+		return;
+	}
+
+	/* one row of departure points per thread */
+	for (t = 0; t < thread_count; t++) {
+		weights_assign(&a.weights[t], indices + 3 * t * n,
+			fractions + 2 * t * n, n);
+	}
+
+	parallel_for_active(ctx, advect_half_cells, &a, 1);
+	set_boundary_half(ctx, q, boundary, format);
+}
+
+static void diffuse_half_cells(fluids_context_t* const ctx, int i, int j,
+	int n, int thread, void* const vp)
+{
+	const struct half_args* const a = vp;
+	int idx = IDX(i, j);
+
+	g_kernels->diffuse_half(a->h + idx, a->h_prev + idx, n, ctx->pitch,
+		1.0 / (1.0 + 4.0 * a->alpha), a->alpha, a->format);
+}
+
+void fluids_context_diffuse_half(fluids_context_t* const ctx,
+	fluids_half_t* const q, const fluids_half_t* const q_prev, float diff,
+	int format, int boundary, float dt)
+{
+	struct half_args a = { q, q_prev, NULL, NULL, NULL, NULL,
+		diff * dt / (ctx->dx * ctx->dx), dt, format };
+
+	parallel_for_active(ctx, diffuse_half_cells, &a, 1);
+	set_boundary_half(ctx, q, boundary, format);
+}
+
+#undef HALF
+
+static void gauss_seidel_row(fluids_context_t* const ctx, float* const p,
+	const float* const div, int j)
+{
+	int i = 0;
+
+	for (i = 1; i < ctx->cell_count_i - 1; i++) {
+		p[IDX(i, j)] = (div[IDX(i, j)] + 
+			p[IDX(i + 1, j)] +
+			p[IDX(i - 1, j)] +
+			p[IDX(i, j + 1)] +
+			p[IDX(i, j - 1)]) / 4.0;
+	}
+}
+
+/* [sweep_count] Gauss-Seidel sweeps in one pass over the grid, each sweep
+** one row behind the previous one. A row then sees the rows above it 
+** already updated by the same sweep and the rows below it updated by the
+** previous sweep only, as with consecutive sweeps. */
+static void gauss_seidel_wavefront(fluids_context_t* const ctx, float* const p,
+	const float* const div, int sweep_count)
+{
+	int j = 0, s = 0, t = 0;
+	int ni = ctx->cell_count_i, nj = ctx->cell_count_j;
+
+	for (s = 1; s < nj - 2 + sweep_count; s++) {
+		for (t = 0; t < sweep_count; t++) {
+			j = s - t;
+
+			if (j < 1 || j > nj - 2) {
+				continue;
+			}
+
+			gauss_seidel_row(ctx, p, div, j);
+			set_boundary_row(p + IDX(0, j), outer_row(p + IDX(0, 0),
+				ctx->pitch, nj, j), ni, FLUIDS_BOUNDARY_NN);
+		}
+	}
+}
+
+static void solve_pressure_gauss_seidel(fluids_context_t* const ctx,
+	float* const p, const float* const div, int iteration_count)
+{
+	int j = 0, k = 0, n = 0;
+
+	if (ctx->sweep_block > 1) {
+		for (k = 0; k < iteration_count; k += n) {
+			n = iteration_count - k < ctx->sweep_block ? 
+				iteration_count - k : ctx->sweep_block;
+			gauss_seidel_wavefront(ctx, p, div, n);
+		}
+
+		set_boundary(ctx, p, FLUIDS_BOUNDARY_NN);
+		return;
+	}
+
+	for (k = 0; k < iteration_count; k++) {
+		for (j = 1; j < ctx->cell_count_j - 1; j++) {
+			gauss_seidel_row(ctx, p, div, j);
+		}
+		
+		set_boundary(ctx, p, FLUIDS_BOUNDARY_NN);
+	}
+}
+
+/* Precomputes the transforms and eigenvalues of the pressure matrix for the
+** current grid. */
+static void spectral_allocate(fluids_context_t* const ctx)
+{
+	int k = 0;
+	int mi = ctx->cell_count_i - 2, mj = ctx->cell_count_j - 2;
+	float s = 0.0;
+
+	if (ctx->spectral_coeffs) {
+		return;
+	}
+
+	ctx->dct_i = dct_plan_create(mi);
+	ctx->dct_j = dct_plan_create(mj);
+	ctx->spectral_eigen_i = malloc(mi * sizeof(float));
+	ctx->spectral_eigen_j = malloc(mj * sizeof(float));
+	ctx->spectral_coeffs = malloc(mi * mj * sizeof(float));
+
+	/* 2 - 2 cos(x) without cancellation for small x */
+	for (k = 0; k < mi; k++) {
+		s = sin(0.5 * PI * k / mi);
+		ctx->spectral_eigen_i[k] = 4.0 * s * s;
+	}
+
+	for (k = 0; k < mj; k++) {
+		s = sin(0.5 * PI * k / mj);
+		ctx->spectral_eigen_j[k] = 4.0 * s * s;
+	}
+}
+
+/* Solves the pressure equation A p = div directly. With Neumann boundaries
+** the 5-point operator is diagonalized by the DCT-II of the inner cells, 
+** its eigenvalues are the sums of the eigenvalues of the 1d operators. The
+** constant mode has no solution and is dropped, i.e. [p] has zero mean. */
+static void solve_pressure_spectral(fluids_context_t* const ctx, float* const p,
+	const float* const div)
+{
+	int i = 0, j = 0;
+	int mi = ctx->cell_count_i - 2, mj = ctx->cell_count_j - 2;
+	float* c = NULL;
+	const float* ei = NULL;
+	const float* ej = NULL;
+
+	spectral_allocate(ctx);
+	c = ctx->spectral_coeffs;
+	ei = ctx->spectral_eigen_i;
+	ej = ctx->spectral_eigen_j;
+
+	for (j = 0; j < mj; j++) {
+		for (i = 0; i < mi; i++) {
+			c[IDXN(mi, i, j)] = div[IDX(i + 1, j + 1)];
+		}
+
+		dct_forward(ctx->dct_i, c + IDXN(mi, 0, j), 1);
+	}
+
+	for (i = 0; i < mi; i++) {
+		dct_forward(ctx->dct_j, c + i, mi);
+	}
+
+	for (j = 0; j < mj; j++) {
+		for (i = 0; i < mi; i++) {
+			c[IDXN(mi, i, j)] = i || j ? 
+				c[IDXN(mi, i, j)] / (ei[i] + ej[j]) : 0.0;
+		}
+	}
+
+	for (i = 0; i < mi; i++) {
+		dct_inverse(ctx->dct_j, c + i, mi);
+	}
+
+	for (j = 0; j < mj; j++) {
+		dct_inverse(ctx->dct_i, c + IDXN(mi, 0, j), 1);
+
+		for (i = 0; i < mi; i++) {
+			p[IDX(i + 1, j + 1)] = c[IDXN(mi, i, j)];
+		}
+	}
+
+	set_boundary(ctx, p, FLUIDS_BOUNDARY_NN);
+}
+
+/* Builds the MIC(0) preconditioner of the pressure matrix. Inner cells are
+** unknowns, boundary cells mirror their inner neighbor, so the diagonal of a
+** row equals the number of inner neighbors and off-diagonals are -1. The
+** inverse diagonal of the factor is zero on boundary cells, which lets the
+** triangular solves run without edge cases. With obstacles, the unknowns
+** are the fluid cells, see masked_operator, and the factor is zero on the
+** solid cells as well. */
+static void pcg_allocate(fluids_context_t* const ctx)
+{
+	int i = 0, j = 0, idx = 0;
+	int ni = ctx->cell_count_i, nj = ctx->cell_count_j;
+	float diag = 0.0, e = 0.0, pi = 0.0, pj = 0.0;
+	const float* const w = ctx->fluid.spans ? fluid_weights(ctx) : NULL;
+
+	if (ctx->pcg_precon) {
+		return;
+	}
+
+	ctx->pcg_precon = calloc(VALUE_COUNT, sizeof(float));
+	ctx->pcg_r = calloc(VALUE_COUNT, sizeof(float));
+	ctx->pcg_z = calloc(VALUE_COUNT, sizeof(float));
+	ctx->pcg_s = calloc(VALUE_COUNT, sizeof(float));
+	ctx->pcg_as = calloc(VALUE_COUNT, sizeof(float));
+
+	for (j = 1; j < nj - 1; j++) {
+		for (i = 1; i < ni - 1; i++) {
+			idx = IDX(i, j);
+
+			if (w && w[idx] == 0.0) {
+				continue;
+			}
+
+			pi = ctx->pcg_precon[IDX(i - 1, j)];
+			pj = ctx->pcg_precon[IDX(i, j - 1)];
+
+			if (w) {
+				diag = w[idx - 1] + w[idx + 1] +
+					w[idx - ctx->pitch] +
+					w[idx + ctx->pitch];
+				e = diag - pi * pi - pj * pj - MIC_TUNING * (
+					w[IDX(i - 1, j + 1)] * pi * pi +
+					w[IDX(i + 1, j - 1)] * pj * pj);
+			} else {
+				diag = (i > 1) + (i < ni - 2) + (j > 1) +
+					(j < nj - 2);
+				e = diag - pi * pi - pj * pj - MIC_TUNING * (
+					(j < nj - 2) * pi * pi +
+					(i < ni - 2) * pj * pj);
+			}
+
+			if (e < MIC_SAFETY * diag) {
+				e = diag;
+			}
+
+			ctx->pcg_precon[IDX(i, j)] = e > 0.0 ? 
+				1.0 / sqrtf(e) : 0.0;
+		}
+	}
+}
+
+/* z = M^-1 r with M = L L^T the MIC(0) factorization */
+static void pcg_apply_precon(fluids_context_t* const ctx, float* const z,
+	const float* const r)
+{
+	int i = 0, j = 0;
+	const float* const pc = ctx->pcg_precon;
+
+	for (j = 1; j < ctx->cell_count_j - 1; j++) {
+		for (i = 1; i < ctx->cell_count_i - 1; i++) {
+			z[IDX(i, j)] = pc[IDX(i, j)] * (r[IDX(i, j)] + 
+				pc[IDX(i - 1, j)] * z[IDX(i - 1, j)] +
+				pc[IDX(i, j - 1)] * z[IDX(i, j - 1)]);
+		}
+	}
+
+	for (j = ctx->cell_count_j - 2; j > 0; j--) {
+		for (i = ctx->cell_count_i - 2; i > 0; i--) {
+			z[IDX(i, j)] = pc[IDX(i, j)] * (z[IDX(i, j)] + 
+				pc[IDX(i, j)] * (z[IDX(i + 1, j)] + 
+				z[IDX(i, j + 1)]));
+		}
+	}
+}
+
+struct pcg_args {
+	float* p;
+	float* r;
+	float* s;
+	float* as;
+	const float* z;
+	float alpha;
+	float beta;
+	const float* fluid;	/* with obstacles */
+};
+
+static void pcg_apply_matrix_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	const struct pcg_args* const a = vp;
+	float* const as = a->as;
+	const float* const s = a->s;
+	const float* const w = a->fluid;
+	int i = 0, j = 0, idx = 0;
+
+	/* the masked operator of the pressure, zero on solid cells */
+	if (w) {
+		for (j = j_begin; j < j_end; j++) {
+			for (i = 1; i < ctx->cell_count_i - 1; i++) {
+				idx = IDX(i, j);
+				as[idx] = w[idx] * ((w[idx - 1] + w[idx + 1] +
+					w[idx - ctx->pitch] +
+					w[idx + ctx->pitch]) * s[idx] -
+					w[idx - 1] * s[idx - 1] -
+					w[idx + 1] * s[idx + 1] -
+					w[idx - ctx->pitch] *
+					s[idx - ctx->pitch] -
+					w[idx + ctx->pitch] *
+					s[idx + ctx->pitch]);
+			}
+		}
+
+		return;
+	}
+
+	for (j = j_begin; j < j_end; j++) {
+		for (i = 1; i < ctx->cell_count_i - 1; i++) {
+			as[IDX(i, j)] = 4.0 * s[IDX(i, j)] - 
+				s[IDX(i + 1, j)] -
+				s[IDX(i - 1, j)] -
+				s[IDX(i, j + 1)] -
+				s[IDX(i, j - 1)];
+		}
+	}
+}
+
+/* as = A s, expects boundary cells of [s] to mirror their inner neighbor */
+static void pcg_apply_matrix(fluids_context_t* const ctx, float* const as,
+	const float* const s)
+{
+	struct pcg_args a = { NULL, NULL, (float*)s, as };
+
+	a.fluid = ctx->fluid.spans ? fluid_weights(ctx) : NULL;
+
+	parallel_for(ctx, pcg_apply_matrix_rows, &a, 1, ctx->cell_count_j - 1,
+		ctx->cell_count_i * ctx->cell_count_j);
+}
+
+static void pcg_dot_rows(fluids_context_t* const ctx, int j_begin, int j_end,
+	int thread, void* const vp)
+{
+	struct reduce_args* const ra = vp;
+	const float* const a = ra->q;
+	const float* const b = ra->b;
+	int i = 0, j = 0;
+	double sum = 0.0;
+
+	for (j = j_begin; j < j_end; j++) {
+		for (i = 1; i < ctx->cell_count_i - 1; i++) {
+			sum += a[IDX(i, j)] * b[IDX(i, j)];
+		}
+	}
+
+	ra->sums[thread] = sum;
+}
+
+static double pcg_dot(fluids_context_t* const ctx, const float* const a,
+	const float* const b)
+{
+	struct reduce_args ra = { (float*)a, b, ctx->cell_count_i };
+
+	parallel_for(ctx, pcg_dot_rows, &ra, 1, ctx->cell_count_j - 1,
+		ctx->cell_count_i * ctx->cell_count_j);
+	return reduce_sum(&ra);
+}
+
+/* p += alpha s, r -= alpha as */
+static void pcg_step_rows(fluids_context_t* const ctx, int j_begin, int j_end,
+	int thread, void* const vp)
+{
+	const struct pcg_args* const a = vp;
+	float* const p = a->p;
+	float* const r = a->r;
+	const float* const s = a->s;
+	const float* const as = a->as;
+	float alpha = a->alpha;
+	int i = 0, j = 0;
+
+	for (j = j_begin; j < j_end; j++) {
+		for (i = 1; i < ctx->cell_count_i - 1; i++) {
+			p[IDX(i, j)] += alpha * s[IDX(i, j)];
+			r[IDX(i, j)] -= alpha * as[IDX(i, j)];
+		}
+	}
+}
+
+/* s = z + beta s */
+static void pcg_search_rows(fluids_context_t* const ctx, int j_begin, int j_end,
+	int thread, void* const vp)
+{
+	const struct pcg_args* const a = vp;
+	float* const s = a->s;
+	const float* const z = a->z;
+	float beta = a->beta;
+	int i = 0, j = 0;
+
+	for (j = j_begin; j < j_end; j++) {
+		for (i = 1; i < ctx->cell_count_i - 1; i++) {
+			s[IDX(i, j)] = z[IDX(i, j)] + beta * s[IDX(i, j)];
+		}
+	}
+}
+
+/* z = M^-1 r, by the spectral solve of the whole box for [solver]
+** FLUIDS_SOLVER_SPECTRAL, restricted to the cells with an equation */
+static void pcg_precondition(fluids_context_t* const ctx, float* const z,
+	const float* const r, int solver)
+{
+	int i = 0, j = 0;
+
+	if (solver != FLUIDS_SOLVER_SPECTRAL) {
+		pcg_apply_precon(ctx, z, r);
+		return;
+	}
+
+	solve_pressure_spectral(ctx, z, r);
+
+	for (j = 1; j < ctx->cell_count_j - 1; j++) {
+		for (i = 1; i < ctx->cell_count_i - 1; i++) {
+			z[IDX(i, j)] = ctx->pcg_precon[IDX(i, j)] > 0.0 ?
+				z[IDX(i, j)] : 0.0;
+		}
+	}
+}
+
+/* Solves the pressure equation A p = div with preconditioned conjugate
+** gradients, starting from the values in [p]. The preconditioner is the
+** MIC(0) factorization, or the spectral solve of the whole box for
+** [solver] FLUIDS_SOLVER_SPECTRAL, which is exact without obstacles and
+** close to it around small ones. With obstacles, A is the masked operator
+** of the fluid cells, see masked_operator. */
+static fluids_solver_result_t solve_pressure_pcg(fluids_context_t* const ctx,
+	float* const p, const float* const div, float tolerance,
+	int max_iteration_count, int solver)
+{
+	int i = 0, j = 0, k = 0, n = 0, idx = 0;
+	double rho = 0.0, rho_new = 0.0, sas = 0.0, mean = 0.0;
+	float *r, *z, *s, *as;
+	const float* w = NULL;
+	struct pcg_args a;
+	fluids_solver_result_t result = { 0, 0.0 };
+
+	pcg_allocate(ctx);
+	w = ctx->fluid.spans ? fluid_weights(ctx) : NULL;
+	r = ctx->pcg_r;
+	z = ctx->pcg_z;
+	s = ctx->pcg_s;
+	as = ctx->pcg_as;
+	a.p = p;
+	a.r = r;
+	a.s = s;
+	a.as = as;
+	a.z = z;
+
+	/* initial residual. all pressure boundaries are Neumann, the constant
+	** part of the right hand side has no solution and is removed */
+	set_boundary(ctx, p, FLUIDS_BOUNDARY_NN);
+	pcg_apply_matrix(ctx, as, p);
+
+	for (j = 1; j < ctx->cell_count_j - 1; j++) {
+		for (i = 1; i < ctx->cell_count_i - 1; i++) {
+			if (!w || w[IDX(i, j)] != 0.0) {
+				mean += div[IDX(i, j)];
+				n++;
+			}
+		}
+	}
+
+	mean /= n > 0 ? n : 1;
+
+	/* cells without equation, solid or without fluid neighbors, keep a
+	** zero residual */
+	for (j = 1; j < ctx->cell_count_j - 1; j++) {
+		for (i = 1; i < ctx->cell_count_i - 1; i++) {
+			idx = IDX(i, j);
+			r[idx] = ctx->pcg_precon[idx] > 0.0 ?
+				div[idx] - mean - as[idx] : 0.0;
+		}
+	}
+
+	result.residual = max_abs(ctx, r);
+
+	if (result.residual <= tolerance) {
+		return result;
+	}
+
+	pcg_precondition(ctx, z, r, solver);
+	rho = pcg_dot(ctx, r, z);
+
+	for (i = 0; i < VALUE_COUNT; i++) {
+		s[i] = z[i];
+	}
+
+	for (k = 0; k < max_iteration_count; k++) {
+		set_boundary(ctx, s, FLUIDS_BOUNDARY_NN);
+		pcg_apply_matrix(ctx, as, s);
+		sas = pcg_dot(ctx, s, as);
+
+		if (rho == 0.0 || sas == 0.0) {
+			break;
+		}
+
+		a.alpha = rho / sas;
+		parallel_for(ctx, pcg_step_rows, &a, 1, ctx->cell_count_j - 1,
+			ctx->cell_count_i * ctx->cell_count_j);
+
+		result.iteration_count++;
+		result.residual = max_abs(ctx, r);
+
+		if (result.residual <= tolerance) {
+			break;
+		}
+
+		pcg_precondition(ctx, z, r, solver);
+		rho_new = pcg_dot(ctx, r, z);
+		a.beta = rho_new / rho;
+		rho = rho_new;
+		parallel_for(ctx, pcg_search_rows, &a, 1, ctx->cell_count_j - 1,
+			ctx->cell_count_i * ctx->cell_count_j);
+	}
+
+	set_boundary(ctx, p, FLUIDS_BOUNDARY_NN);
+	return result;
+}
+
+struct project_args {
+	float* u;
+	float* v;
+	float* p;
+	float* div;
+};
+
+static void project_prepare_cells(fluids_context_t* const ctx, int i, int j,
+	int n, int thread, void* const vp)
+{
+	const struct project_args* const a = vp;
+	int k = 0;
+	int idx = IDX(i, j);
+	float* const p = a->p + idx;
+
+	g_kernels->divergence(a->div + idx, a->u + idx, a->v + idx, n, 
+		ctx->pitch, -0.5 * ctx->dx);
+
+	if (!ctx->warm_start) {
+		for (k = 0; k < n; k++) {
+			p[k] = 0.0;
+		}
+	}
+}
+
+/* computes the (scaled) divergence of the velocity field and sets the 
+** pressure to 0 unless warm starts are enabled */
+static void project_prepare(fluids_context_t* const ctx, const float* const u,
+	const float* const v, float* const p, float* const div)
+{
+	struct project_args a = { (float*)u, (float*)v, p, div };
+
+	parallel_for_cells(ctx, project_prepare_cells, &a, 1);
+
+	/* the pressure is only defined up to a constant, keep it from
+	** drifting across steps */
+	if (ctx->warm_start) {
+		remove_field_mean(ctx, p);
+	}
+
+	set_boundary(ctx, div, FLUIDS_BOUNDARY_NN);
+	set_boundary(ctx, p, FLUIDS_BOUNDARY_NN);
+}
+
+static void project_finish_cells(fluids_context_t* const ctx, int i, int j,
+	int n, int thread, void* const vp)
+{
+	const struct project_args* const a = vp;
+	int idx = IDX(i, j);
+
+	g_kernels->subtract_gradient(a->u + idx, a->v + idx, a->p + idx, n,
+		ctx->pitch, 0.5 / ctx->dx);
+}
+
+/* substracts the pressure gradient from the velocity field */
+static void project_finish(fluids_context_t* const ctx, float* const u,
+	float* const v, int boundary_u, int boundary_v, const float* const p)
+{
+	struct project_args a = { u, v, (float*)p };
+
+	parallel_for_cells(ctx, project_finish_cells, &a, 1);
+	set_boundary(ctx, u, boundary_u);
+	set_boundary(ctx, v, boundary_v);
+}
+
+struct mixed_args {
+	float* p;
+	const float* div;
+	fluids_half_t* r;
+	fluids_half_t* e;
+	int format;
+	float s;	/* scale of the residual */
+	float a;	/* omega / 4 */
+	float w;	/* 1 - omega */
+	int color;
+	float maxs[THREADS_MAX_COUNT];
+};
+
+/* stores the scaled residual of the pressure and clears the correction */
+static void mixed_residual_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	struct mixed_args* const a = vp;
+	int j = 0;
+	int idx = 0;
+	float m = 0.0, m_row = 0.0;
+
+	for (j = j_begin; j < j_end; j++) {
+		idx = IDX(1, j);
+		m_row = g_kernels->residual_half(a->r + idx, a->p + idx,
+			a->div + idx, ctx->cell_count_i - 2, ctx->pitch, 1.0,
+			4.0, a->s, a->format);
+		m = m_row > m ? m_row : m;
+		memset(a->e + IDX(-ctx->halo, j), 0,
+			sizeof(fluids_half_t) * ctx->pitch);
+	}
+
+	a->maxs[thread] = m;
+}
+
+static float mixed_residual(fluids_context_t* const ctx,
+	struct mixed_args* const a)
+{
+	int t = 0;
+	float m = 0.0;
+
+	memset(a->maxs, 0, sizeof(a->maxs));
+	parallel_for(ctx, mixed_residual_rows, a, 1, ctx->cell_count_j - 1,
+		ctx->cell_count_i * ctx->cell_count_j);
+
+	for (t = 0; t < THREADS_MAX_COUNT; t++) {
+		m = a->maxs[t] > m ? a->maxs[t] : m;
+	}
+
+	return m;
+}
+
+static void mixed_sweep_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	const struct mixed_args* const a = vp;
+	int j = 0;
+
+	for (j = j_begin; j < j_end; j++) {
+		g_kernels->sor_half(a->e + IDX(1, j), a->r + IDX(1, j),
+			ctx->cell_count_i - 2, ctx->pitch,
+			(1 + j + a->color) % 2, a->a, 1.0, a->w, a->format);
+	}
+}
+
+static void mixed_correct_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	const struct mixed_args* const a = vp;
+	int j = 0;
+
+	for (j = j_begin; j < j_end; j++) {
+		g_kernels->add_half(a->p + IDX(1, j), a->e + IDX(1, j),
+			ctx->cell_count_i - 2, 1.0 / a->s, a->format);
+	}
+}
+
+/* Iterative refinement of the pressure: each round solves for a correction
+** of the pressure by its residual with red-black sweeps in half precision.
+** The residual is scaled to a max. of about 1, which keeps it within the
+** range of fp16, the scale of the last round serves as the guess for the
+** next one. Returns 0 without changing [p] if the half precision fields
+** cannot be allocated. */
+static int solve_pressure_mixed(fluids_context_t* const ctx, float* const p,
+	const float* const div, float omega, int iteration_count)
+{
+	int k = 0, n = 0, s = 0;
+	int round_count = ctx->mixed_round_count;
+	int cell_count = ctx->cell_count_i * ctx->cell_count_j;
+	float m = 0.0;
+	struct mixed_args a = { p, div };
+
+	if (!ctx->mixed_r || !ctx->mixed_e) {
+		free(ctx->mixed_r);
+		free(ctx->mixed_e);
+		ctx->mixed_r = fluids_context_malloc_half(ctx, 0.0, 0);
+		ctx->mixed_e = fluids_context_malloc_half(ctx, 0.0, 0);
+
+		if (!ctx->mixed_r || !ctx->mixed_e) {
+			return 0;
+		}
+	}
+
+	m = max_abs(ctx, div);
+
+	a.r = ctx->mixed_r;
+	a.e = ctx->mixed_e;
+	a.format = ctx->mixed_format;
+	a.a = omega / 4.0;
+	a.w = 1.0 - omega;
+
+	for (k = 0; k < round_count && m > 0.0; k++) {
+		a.s = 1.0 / m;
+		m = mixed_residual(ctx, &a);
+
+		/* too far off the guess for the precision of fp16 */
+		if (m > 0.0 && (m * a.s < 1.0 / 64.0 || m * a.s > 64.0)) {
+			a.s = 1.0 / m;
+			mixed_residual(ctx, &a);
+		}
+
+		set_boundary_half(ctx, a.e, FLUIDS_BOUNDARY_NN, a.format);
+		n = iteration_count / round_count +
+			(k < iteration_count % round_count);
+
+		for (s = 0; s < n && m > 0.0; s++) {
+			for (a.color = 0; a.color < 2; a.color++) {
+				parallel_for(ctx, mixed_sweep_rows, &a, 1,
+					ctx->cell_count_j - 1, cell_count);
+				set_boundary_half(ctx, a.e, FLUIDS_BOUNDARY_NN,
+					a.format);
+			}
+		}
+
+		parallel_for(ctx, mixed_correct_rows, &a, 1,
+			ctx->cell_count_j - 1, cell_count);
+		set_boundary(ctx, p, FLUIDS_BOUNDARY_NN);
+	}
+
+	return 1;
+}
+
+void fluids_context_project(fluids_context_t* const ctx, float* const u,
+	float* const v, int boundary_u, int boundary_v, float* const p,
+	float* const div, int iteration_count)
+{
+	project_prepare(ctx, u, v, p, div);
+
+	/* the rounds stand in for the sweeps of both solvers, they do not
+	** know obstacles. without their fields the sweeps stay float */
+	if (ctx->mixed_round_count > 0 && !ctx->fluid.spans &&
+		(ctx->pressure_solver == FLUIDS_SOLVER_GAUSS_SEIDEL ||
+		ctx->pressure_solver == FLUIDS_SOLVER_SOR) &&
+		solve_pressure_mixed(ctx, p, div,
+		ctx->pressure_solver == FLUIDS_SOLVER_SOR ?
+		sor_omega(ctx, 0.0) : 1.0, iteration_count)) {
+		project_finish(ctx, u, v, boundary_u, boundary_v, p);
+		return;
+	}
+
+	/* compute pressure, on the fluid cells if there are obstacles */
+	switch (ctx->pressure_solver) {
+	case FLUIDS_SOLVER_MULTIGRID:
+		multigrid_solve(ctx, &ctx->fluid, p, div, 0.0,
+			FLUIDS_BOUNDARY_NN, iteration_count);
+		break;
+	case FLUIDS_SOLVER_SOR:
+		if (ctx->fluid.spans) {
+			sor_masked(ctx, &ctx->fluid, p, div, 1.0, 0.0,
+				sor_omega(ctx, 0.0), FLUIDS_BOUNDARY_NN,
+				iteration_count);
+			break;
+		}
+
+		sor_red_black(ctx, p + IDX(0, 0), div + IDX(0, 0), 1.0, 0.0,
+			sor_omega(ctx, 0.0), ctx->cell_count_i, 
+			ctx->cell_count_j, ctx->pitch, ctx->halo,
+			FLUIDS_BOUNDARY_NN, iteration_count);
+		break;
+	case FLUIDS_SOLVER_PCG:
+		/* iterating beyond float precision lets conjugate gradients 
+		** drift, stop relative to the right hand side */
+		solve_pressure_pcg(ctx, p, div, PCG_DEFAULT_TOLERANCE * 
+			max_abs(ctx, div), iteration_count, FLUIDS_SOLVER_PCG);
+		break;
+	case FLUIDS_SOLVER_SPECTRAL:
+		/* obstacles break the diagonalization, the spectral solve
+		** preconditions conjugate gradients instead */
+		if (ctx->fluid.spans) {
+			solve_pressure_pcg(ctx, p, div, PCG_DEFAULT_TOLERANCE *
+				max_abs(ctx, div), ctx->cell_count_i +
+				ctx->cell_count_j, FLUIDS_SOLVER_SPECTRAL);
+			break;
+		}
+
+		solve_pressure_spectral(ctx, p, div);
+		break;
+	default:
+		if (ctx->fluid.spans) {
+			sor_masked(ctx, &ctx->fluid, p, div, 1.0, 0.0, 1.0,
+				FLUIDS_BOUNDARY_NN, iteration_count);
+			break;
+		}
+
+		solve_pressure_gauss_seidel(ctx, p, div, iteration_count);
+		break;
+	}
+
+	project_finish(ctx, u, v, boundary_u, boundary_v, p);
+}
+
+fluids_solver_result_t fluids_context_project_pcg(fluids_context_t* const ctx,
+	float* const u, float* const v, int boundary_u, int boundary_v,
+	float* const p, float* const div, float tolerance,
+	int max_iteration_count)
+{
+	fluids_solver_result_t result;
+
+	project_prepare(ctx, u, v, p, div);
+	result = solve_pressure_pcg(ctx, p, div, tolerance,
+		max_iteration_count, FLUIDS_SOLVER_PCG);
+	project_finish(ctx, u, v, boundary_u, boundary_v, p);
+	return result;
+}
+
+struct jacobi_args {
+	float* x;
+	const float* b;
+	float* tmp;
+	float c;
+	float k;
+	float maxs[THREADS_MAX_COUNT];
+	const struct masked_operator* op;	/* NULL for the whole grid */
+};
+
+/* residual_max_cells on the masked operator, which points at the fields'
+** cell (0, 0) like its masks */
+static void residual_max_masked_cells(fluids_context_t* const ctx,
+	int i_begin, int j, int n, int thread, void* const vp)
+{
+	struct jacobi_args* const a = vp;
+	const float* const x = a->x + IDX(0, 0);
+	const float* const b = a->b + IDX(0, 0);
+	int i = 0, idx = 0;
+	float d = 0.0, r = 0.0, r_max = a->maxs[thread];
+
+	for (i = i_begin; i < i_begin + n; i++) {
+		idx = IDXN(ctx->pitch, i, j);
+		d = masked_diagonal(a->op, idx);
+
+		if (d <= 0.0) {
+			continue;
+		}
+
+		r = fabsf(a->c * b[idx] - d * x[idx] +
+			masked_neighbors(a->op, x, idx));
+		r_max = r > r_max ? r : r_max;
+	}
+
+	a->maxs[thread] = r_max;
+}
+
+static void residual_max_cells(fluids_context_t* const ctx, int i_begin,
+	int j, int n, int thread, void* const vp)
+{
+	struct jacobi_args* const a = vp;
+	const float* const x = a->x;
+	const float* const b = a->b;
+	int i = 0;
+	float c = a->c, d = 4.0 + a->k;
+	float r = 0.0, r_max = a->maxs[thread];
+
+	if (a->op) {
+		residual_max_masked_cells(ctx, i_begin, j, n, thread, vp);
+		return;
+	}
+
+	for (i = i_begin; i < i_begin + n; i++) {
+		r = fabsf(c * b[IDX(i, j)] - d * x[IDX(i, j)] + 
+			x[IDX(i + 1, j)] +
+			x[IDX(i - 1, j)] +
+			x[IDX(i, j + 1)] +
+			x[IDX(i, j - 1)]);
+		r_max = r > r_max ? r : r_max;
+	}
+
+	a->maxs[thread] = r_max;
+}
+
+/* Returns the max. norm of the residual c b - ((4 + k) x - sum(x_nb)) on
+** the current grid, or of the masked operator on the cells of [list] if it
+** has spans. */
+static float residual_max(fluids_context_t* const ctx,
+	const struct span_list* const list, const float* const x,
+	const float* const b, float c, float k, int boundary)
+{
+	int t = 0;
+	float r_max = 0.0;
+	struct masked_operator op;
+	struct jacobi_args a = { (float*)x, b, NULL, c, k };
+
+	if (list->spans) {
+		masked_operator_init(&op, fluid_weights(ctx) + IDX(0, 0), NULL,
+			ctx->pitch, k, boundary);
+		a.op = &op;
+	}
+
+	parallel_for_spans(ctx, list, residual_max_cells, &a, 1);
+
+	for (t = 0; t < THREADS_MAX_COUNT; t++) {
+		r_max = a.maxs[t] > r_max ? a.maxs[t] : r_max;
+	}
+
+	return r_max;
+}
+
+/* copies the rows [j_begin, j_end) of x, including the boundary rows */
+static void jacobi_copy_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	const struct jacobi_args* const a = vp;
+	const float* const x = a->x;
+	float* const tmp = a->tmp;
+	int i = 0;
+
+	for (i = IDX(0, j_begin); i < IDX(0, j_end); i++) {
+		tmp[i] = x[i];
+	}
+}
+
+/* a Jacobi step on the inner cells of a row, [tmp] is the row of the 
+** previous iterate, its neighbor rows are [pitch] floats away */
+static void jacobi_row(float* const x, const float* const b, 
+	const float* const tmp, int ni, int pitch, float a, float c)
+{
+	int i = 0;
+
+	for (i = 1; i < ni - 1; i++) {
+		x[i] = a * (c * b[i] + tmp[i + 1] + tmp[i - 1] + 
+			tmp[i + pitch] + tmp[i - pitch]);
+	}
+}
+
+static void jacobi_rows(fluids_context_t* const ctx, int j_begin, int j_end,
+	int thread, void* const vp)
+{
+	const struct jacobi_args* const ja = vp;
+	float a = 1.0 / (4.0 + ja->k);
+	int j = 0;
+
+	for (j = j_begin; j < j_end; j++) {
+		jacobi_row(ja->x + IDX(0, j), ja->b + IDX(0, j), 
+			ja->tmp + IDX(0, j), ctx->cell_count_i, ctx->pitch, a,
+			ja->c);
+	}
+}
+
+/* [sweep_count] Jacobi iterations in one pass over the grid, each 
+** iteration one row behind the previous one. The intermediate iterates 
+** keep their last rows in windows of SWEEP_WINDOW_ROW_COUNT rows, the last
+** iterate overwrites rows of [x] the first one has read for the last 
+** time. Window rows are as long as field rows. Returns 0 if the windows
+** cannot be allocated, [x] is not touched then. */
+static int jacobi_wavefront(fluids_context_t* const ctx, float* const x,
+	const float* const b, float c, float k, int boundary, int sweep_count)
+{
+	int j = 0, s = 0, t = 0;
+	int ni = ctx->cell_count_i, nj = ctx->cell_count_j, pitch = ctx->pitch;
+	float a = 1.0 / (4.0 + k);
+	float* const windows = scratch_reserve(&ctx->sweep_windows,
+		(sweep_count - 1) * SWEEP_WINDOW_ROW_COUNT * pitch *
+		sizeof(float));
+	int* const bases = scratch_reserve(&ctx->sweep_bases,
+		sweep_count * sizeof(int));
+	float* window = NULL;
+	float* row = NULL;
+	const float* src = NULL;
+
+	if (!windows || !bases) {
+		return 0;
+	}
+
+	for (t = 0; t < sweep_count; t++) {
+		bases[t] = 0;
+	}
+
+	for (s = 1; s < nj - 2 + sweep_count; s++) {
+		for (t = 1; t <= sweep_count; t++) {
+			j = s - t + 1;
+
+			if (j < 1 || j > nj - 2) {
+				continue;
+			}
+
+			/* row j of iterate t - 1 */
+			src = x + IDX(0, j);
+
+			if (t > 1) {
+				src = windows + ((t - 2) * SWEEP_WINDOW_ROW_COUNT +
+					j - bases[t - 2]) * pitch;
+			}
+
+			if (t == sweep_count) {
+				row = x + IDX(0, j);
+				jacobi_row(row, b + IDX(0, j), src, ni, 
+					pitch, a, c);
+				set_boundary_row(row, outer_row(x + IDX(0, 0), 
+					pitch, nj, j), ni, boundary);
+				continue;
+			}
+
+			/* keep the two rows the next iterate still reads */
+			window = windows + (t - 1) * SWEEP_WINDOW_ROW_COUNT * 
+				pitch;
+
+			if (j + 1 - bases[t - 1] >= SWEEP_WINDOW_ROW_COUNT) {
+				for (row = window; row < window + 2 * pitch; 
+					row++) {
+					*row = row[(j - 2 - bases[t - 1]) * 
+						pitch];
+				}
+
+				bases[t - 1] = j - 2;
+			}
+
+			row = window + (j - bases[t - 1]) * pitch;
+			jacobi_row(row, b + IDX(0, j), src, ni, pitch, a, c);
+			set_boundary_row(row, j == 1 ? row - pitch : 
+				(j == nj - 2 ? row + pitch : NULL), ni, 
+				boundary);
+		}
+	}
+
+	return 1;
+}
+
+/* Jacobi iterations on (4 + k) x - sum(x_nb) = c b. */
+static void jacobi(fluids_context_t* const ctx, float* const x,
+	const float* const b, float c, float k, int boundary,
+	int iteration_count)
+{
+	int m = 0, n = 0;
+	int cell_count = ctx->cell_count_i * ctx->cell_count_j;
+	struct jacobi_args a = { x, b, NULL, c, k };
+
+	for (n = 0; n < iteration_count; n += m) {
+		m = iteration_count - n < ctx->sweep_block ? 
+			iteration_count - n : ctx->sweep_block;
+
+		/* a single iterate has no earlier one to trail, without
+		** windows the iterates take a pass each */
+		if (m > 1 && jacobi_wavefront(ctx, x, b, c, k, boundary, m)) {
+			set_boundary(ctx, x, boundary);
+			continue;
+		}
+
+		m = 1;
+
+		if (!ctx->jacobi_tmp) {
+			ctx->jacobi_tmp = malloc(sizeof(float) * VALUE_COUNT);
+		}
+
+		if (!ctx->jacobi_tmp) {
+			return;
+		}
+
+		a.tmp = ctx->jacobi_tmp;
+		parallel_for(ctx, jacobi_copy_rows, &a, 0, ctx->cell_count_j, 
+			cell_count);
+		parallel_for(ctx, jacobi_rows, &a, 1, ctx->cell_count_j - 1, 
+			cell_count);
+		set_boundary(ctx, x, boundary);
+	}
+}
+
+/* a Jacobi step of the masked operator on the cells (i, j), ...,
+** (i + n - 1, j) from the previous iterate [tmp] */
+static void jacobi_masked_cells(fluids_context_t* const ctx, int i, int j,
+	int n, int thread, void* const vp)
+{
+	const struct jacobi_args* const a = vp;
+	float* const x = a->x + IDX(0, 0);
+	const float* const b = a->b + IDX(0, 0);
+	const float* const tmp = a->tmp + IDX(0, 0);
+	int idx = 0, idx_end = IDXN(ctx->pitch, i + n, j);
+	float d = 0.0;
+
+	for (idx = IDXN(ctx->pitch, i, j); idx < idx_end; idx++) {
+		d = masked_diagonal(a->op, idx);
+
+		if (d > 0.0) {
+			x[idx] = (a->c * b[idx] +
+				masked_neighbors(a->op, tmp, idx)) / d;
+		}
+	}
+}
+
+/* Jacobi iterations on the masked operator over the cells of [list], see
+** masked_operator. */
+static void jacobi_masked(fluids_context_t* const ctx,
+	const struct span_list* const list, float* const x,
+	const float* const b, float c, float k, int boundary,
+	int iteration_count)
+{
+	int n = 0;
+	struct masked_operator op;
+	struct jacobi_args a = { x, b, NULL, c, k };
+
+	if (!ctx->jacobi_tmp) {
+		ctx->jacobi_tmp = malloc(sizeof(float) * VALUE_COUNT);
+	}
+
+	if (!ctx->jacobi_tmp) {
+		return;
+	}
+
+	masked_operator_init(&op, fluid_weights(ctx) + IDX(0, 0), NULL,
+		ctx->pitch, k, boundary);
+	a.tmp = ctx->jacobi_tmp;
+	a.op = &op;
+
+	for (n = 0; n < iteration_count; n++) {
+		parallel_for(ctx, jacobi_copy_rows, &a, 0, ctx->cell_count_j,
+			ctx->cell_count_i * ctx->cell_count_j);
+		parallel_for_spans(ctx, list, jacobi_masked_cells, &a, 1);
+	}
+
+	set_boundary(ctx, x, boundary);
+}
+
+/* Runs [solver] on (4 + k) x - sum(x_nb) = c b until [tolerance] is met. 
+** The residual is evaluated every check_interval iterations. If [list] has
+** spans, the solvers run on the masked operator of its cells, see
+** masked_operator. */
+static fluids_solver_result_t solve_to_tolerance(fluids_context_t* const ctx,
+	const struct span_list* const list, int solver, float* const x,
+	const float* const b, float c, float k, int boundary,
+	const fluids_tolerance_t* const tolerance)
+{
+	int i = 0, n = 0;
+	int interval = tolerance->check_interval > 0 ? 
+		tolerance->check_interval : 1;
+	float target = 0.0;
+	fluids_solver_result_t result = { 0, 0.0 };
+
+	set_boundary(ctx, x, boundary);
+	result.residual = residual_max(ctx, list, x, b, c, k, boundary);
+	target = tolerance->relative * fabsf(c) * max_abs(ctx, b);
+	target = tolerance->absolute > target ? tolerance->absolute : target;
+
+	if (solver == FLUIDS_SOLVER_PCG) {
+		return solve_pressure_pcg(ctx, x, b, target, 
+			tolerance->max_iteration_count, FLUIDS_SOLVER_PCG);
+	}
+
+	/* direct solve, a second pass would not reduce the residual. With
+	** obstacles, it preconditions conjugate gradients */
+	if (solver == FLUIDS_SOLVER_SPECTRAL) {
+		if (list->spans) {
+			return solve_pressure_pcg(ctx, x, b, target,
+				tolerance->max_iteration_count,
+				FLUIDS_SOLVER_SPECTRAL);
+		}
+
+		if (result.residual > target) {
+			solve_pressure_spectral(ctx, x, b);
+			result.iteration_count = 1;
+			result.residual = residual_max(ctx, list, x, b, c, k,
+				boundary);
+		}
+
+		return result;
+	}
+
+	if (solver == FLUIDS_SOLVER_MULTIGRID) {
+		multigrid_allocate(ctx);
+
+		for (i = 0; i < VALUE_COUNT; i++) {
+			ctx->mg_rhs[i] = c * b[i];
+		}
+	}
+
+	while (result.iteration_count < tolerance->max_iteration_count &&
+		result.residual > target) {
+		n = tolerance->max_iteration_count - result.iteration_count;
+		n = n < interval ? n : interval;
+
+		switch (solver) {
+		case FLUIDS_SOLVER_GAUSS_SEIDEL:
+			/* red-black order on the fluid cells */
+			if (list->spans) {
+				sor_masked(ctx, list, x, b, c, k, 1.0,
+					boundary, n);
+				break;
+			}
+
+			solve_pressure_gauss_seidel(ctx, x, b, n);
+			break;
+		case FLUIDS_SOLVER_SOR:
+			if (list->spans) {
+				sor_masked(ctx, list, x, b, c, k,
+					sor_omega(ctx, k), boundary, n);
+				break;
+			}
+
+			sor_red_black(ctx, x + IDX(0, 0), b + IDX(0, 0), c, k,
+				sor_omega(ctx, k), ctx->cell_count_i, 
+				ctx->cell_count_j, ctx->pitch, ctx->halo, 
+				boundary, n);
+			break;
+		case FLUIDS_SOLVER_MULTIGRID:
+			multigrid_solve(ctx, list, x, ctx->mg_rhs, k, boundary,
+				n);
+			break;
+		default:
+			if (list->spans) {
+				jacobi_masked(ctx, list, x, b, c, k, boundary,
+					n);
+				break;
+			}
+
+			jacobi(ctx, x, b, c, k, boundary, n);
+			break;
+		}
+
+		result.iteration_count += n;
+		result.residual = residual_max(ctx, list, x, b, c, k, boundary);
+	}
+
+	return result;
+}
+
+fluids_solver_result_t fluids_context_project_to_tolerance(
+	fluids_context_t* const ctx, float* const u, float* const v, 
+	int boundary_u, int boundary_v, float* const p, float* const div, 
+	const fluids_tolerance_t* const tolerance)
+{
+	int solver = ctx->pressure_solver;
+	fluids_solver_result_t result;
+
+	/* Jacobi and ADI are not pressure solvers */
+	solver = solver == FLUIDS_SOLVER_JACOBI || 
+		solver == FLUIDS_SOLVER_ADI ? FLUIDS_SOLVER_GAUSS_SEIDEL : solver;
+
+	project_prepare(ctx, u, v, p, div);
+
+	/* the part of the divergence without solution would stall the 
+	** residual above the tolerance */
+	remove_field_mean(ctx, div);
+	result = solve_to_tolerance(ctx, &ctx->fluid, solver, p, div, 1.0,
+		0.0, FLUIDS_BOUNDARY_NN, tolerance);
+	project_finish(ctx, u, v, boundary_u, boundary_v, p);
+	return result;
+}
+
+fluids_solver_result_t fluids_context_diffuse_to_tolerance(
+	fluids_context_t* const ctx, float* const q, const float* const q_prev,
+	float diff, const fluids_tolerance_t* const tolerance, int boundary, 
+	float dt)
+{
+	int solver = ctx->diffusion_solver;
+	float r = diff * dt / (ctx->dx * ctx->dx);
+	fluids_solver_result_t result = { 0, 0.0 };
+
+	/* only the pressure system has Gauss-Seidel, PCG and spectral 
+	** solvers. ADI solves a split system, not the one measured here */
+	solver = solver == FLUIDS_SOLVER_GAUSS_SEIDEL || 
+		solver == FLUIDS_SOLVER_PCG || 
+		solver == FLUIDS_SOLVER_SPECTRAL || 
+		solver == FLUIDS_SOLVER_ADI ? FLUIDS_SOLVER_JACOBI : solver;
+
+	diffuse_copy(ctx, q, q_prev);
+
+	if (r > 0.0) {
+		result = solve_to_tolerance(ctx, active_cells(ctx), solver, q,
+			q_prev, 1.0 / r, 1.0 / r, boundary, tolerance);
+	}
+
+	set_boundary(ctx, q, boundary);
+	return result;
+}
+
+struct buoyancy_args {
+	float* v;
+	const float* smoke_dens;
+	const float* temperatures;
+	float alpha;
+	float beta;
+	float temp_ambient;
+	float dt;
+};
+
+static void add_buoyancy_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	const struct buoyancy_args* const a = vp;
+	int idx = IDX(-ctx->halo, j_begin);
+
+	g_kernels->buoyancy(a->v + idx, a->smoke_dens + idx, 
+		a->temperatures + idx, ctx->pitch * (j_end - j_begin),
+		a->alpha, a->beta, a->temp_ambient, a->dt);
+}
+
+void fluids_context_add_buoyancy(fluids_context_t* const ctx, float* const v,
+	const float* const smoke_dens, const float* const temperatures,
+	float alpha, float beta, float temp_ambient, float dt)
+{
+	struct buoyancy_args a = { v, smoke_dens, temperatures, alpha, beta,
+		temp_ambient, dt };
+
+	parallel_for(ctx, add_buoyancy_rows, &a, -ctx->halo, 
+		ctx->cell_count_j + ctx->halo, 
+		ctx->cell_count_i * ctx->cell_count_j);
+}
+
+struct vorticity_args {
+	float* u;
+	float* v;
+	float* vorticity;
+	float* nvg_x;
+	float* nvg_y;
+	float a;
+	float b;
+};
+
+static void vorticity_rows(fluids_context_t* const ctx, int j_begin, int j_end,
+	int thread, void* const vp)
+{
+	const struct vorticity_args* const a = vp;
+	int j = 0;
+	int idx = 0;
+
+	for (j = j_begin; j < j_end; j++) {
+		idx = IDX(1, j);
+		g_kernels->vorticity(a->vorticity + idx, a->u + idx, a->v + idx,
+			ctx->cell_count_i - 2, ctx->pitch, a->a);
+	}
+}
+
+static void vorticity_gradient_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	const struct vorticity_args* const a = vp;
+	int j = 0;
+	int idx = 0;
+
+	for (j = j_begin; j < j_end; j++) {
+		idx = IDX(1, j);
+		g_kernels->vorticity_gradient(a->nvg_x + idx, a->nvg_y + idx,
+			a->vorticity + idx, ctx->cell_count_i - 2, ctx->pitch,
+			a->a);
+	}
+}
+
+static void vorticity_force_rows(fluids_context_t* const ctx, int j_begin,
+	int j_end, int thread, void* const vp)
+{
+	const struct vorticity_args* const a = vp;
+	int j = 0;
+	int idx = 0;
+
+	for (j = j_begin; j < j_end; j++) {
+		idx = IDX(1, j);
+		g_kernels->vorticity_force(a->u + idx, a->v + idx, 
+			a->vorticity + idx, a->nvg_x + idx, a->nvg_y + idx,
+			ctx->cell_count_i - 2, a->b);
+	}
+}
+
+void fluids_context_add_vorticity_confinement(fluids_context_t* const ctx,
+	float* const u, float* const v, float* const vorticity,
+	float* const nvg_x, float* const nvg_y, float eps, float dt)
+{
+	int cell_count = ctx->cell_count_i * ctx->cell_count_j;
+	struct vorticity_args a = { u, v, vorticity, nvg_x, nvg_y, 
+		1.0 / (2.0 * ctx->dx), eps * dt * ctx->dx };
+
+	/* compute vorticity */
+	parallel_for(ctx, vorticity_rows, &a, 1, ctx->cell_count_j - 1,
+		cell_count);
+	
+	/* compute normalized vorticity gradient */
+	parallel_for(ctx, vorticity_gradient_rows, &a, 1, ctx->cell_count_j - 1,
+		cell_count);
+
+	/* add contribution of vorticity confinement to the velocity */
+	parallel_for(ctx, vorticity_force_rows, &a, 1, ctx->cell_count_j - 1, 
+		cell_count);
+}
+
+struct divergence_args {
+	const float* u;
+	const float* v;
+	float* div;
+	float maxs[THREADS_MAX_COUNT];
+};
+
+static void max_divergence_cells(fluids_context_t* const ctx, int i, int j,
+	int n, int thread, void* const vp)
+{
+	struct divergence_args* const a = vp;
+	int idx = IDX(i, j);
+	float div = 0.0;
+
+	div = g_kernels->divergence(a->div + idx, a->u + idx, a->v + idx, n,
+		ctx->pitch, 0.5 / ctx->dx);
+	a->maxs[thread] = div > a->maxs[thread] ? div : a->maxs[thread];
+}
+
+float fluids_context_get_max_divergence(fluids_context_t* const ctx,
+	const float* const u, const float* const v, float* const div)
+{
+	int t = 0;
+	float avg_div = 0.0;
+	struct divergence_args a = { u, v, div };
+
+	parallel_for_cells(ctx, max_divergence_cells, &a, 1);
+
+	for (t = 0; t < THREADS_MAX_COUNT; t++) {
+		avg_div = a.maxs[t] > avg_div ? a.maxs[t] : avg_div;
+	}
+	
+	return avg_div;
+}
+
+/* ensembles */
+
+struct fluids_ensemble {
+	fluids_context_t* ctx;	/* grid and threads of all instances */
+	int instance_count;
+	int group_count;	/* groups of FLUIDS_ENSEMBLE_LANE_COUNT */
+	float* lane_a;		/* per-lane parameters of the running */
+	float* lane_b;		/* routine, 0 in the padding lanes */
+};
+
+#define LANES FLUIDS_ENSEMBLE_LANE_COUNT	/* a multiple of SIMD_MAX_WIDTH */
+
+/* index of the first lane of cell (i, j) in group g. the groups have no 
+** halo */
+#define LANE_IDX(g, i, j) 						\
+	LANES * (ctx->cell_count_i * ctx->cell_count_j * (g) + 		\
+	IDXN(ctx->cell_count_i, i, j))
+
+fluids_ensemble_t* fluids_ensemble_create(fluids_context_t* const ctx,
+	int instance_count)
+{
+	fluids_ensemble_t* ens = malloc(sizeof(*ens));
+
+	if (!ens) {
+		return NULL;
+	}
+
+	ens->ctx = ctx;
+	ens->instance_count = instance_count;
+	ens->group_count = (instance_count + LANES - 1) / LANES;
+	ens->lane_a = calloc(LANES * ens->group_count, sizeof(*ens->lane_a));
+	ens->lane_b = calloc(LANES * ens->group_count, sizeof(*ens->lane_b));
+
+	if (!ens->lane_a || !ens->lane_b) {
+		fluids_ensemble_destroy(ens);
+		return NULL;
+	}
+
+	return ens;
+}
+
+void fluids_ensemble_destroy(fluids_ensemble_t* const ens)
+{
+	free(ens->lane_a);
+	free(ens->lane_b);
+	free(ens);
+}
+
+float* fluids_ensemble_malloc(const fluids_ensemble_t* const ens, float c)
+{
+	const fluids_context_t* const ctx = ens->ctx;
+	size_t value_count = (size_t)LANES * ens->group_count * 
+		ctx->cell_count_i * ctx->cell_count_j;
+	size_t k = 0;
+	float* qp = malloc(sizeof(*qp) * value_count);
+
+	for (k = 0; k < value_count; k++) {
+		qp[k] = c;
+	}
+
+	return qp;
+}
+
+void fluids_ensemble_set_instance(const fluids_ensemble_t* const ens,
+	float* const q, int instance, const float* const q_instance)
+{
+	const fluids_context_t* const ctx = ens->ctx;
+	int i = 0, j = 0;
+	float* const lane = q + LANE_IDX(instance / LANES, 0, 0) + 
+		instance % LANES;
+
+	for (j = 0; j < ctx->cell_count_j; j++) {
+		for (i = 0; i < ctx->cell_count_i; i++) {
+			lane[LANE_IDX(0, i, j)] = q_instance[IDX(i, j)];
+		}
+	}
+}
+
+void fluids_ensemble_get_instance(const fluids_ensemble_t* const ens,
+	const float* const q, int instance, float* const q_instance)
+{
+	const fluids_context_t* const ctx = ens->ctx;
+	int i = 0, j = 0;
+	const float* const lane = q + LANE_IDX(instance / LANES, 0, 0) + 
+		instance % LANES;
+
+	for (j = 0; j < ctx->cell_count_j; j++) {
+		for (i = 0; i < ctx->cell_count_i; i++) {
+			q_instance[IDX(i, j)] = lane[LANE_IDX(0, i, j)];
+		}
+	}
+
+	set_halo(q_instance + IDX(0, 0), ctx->cell_count_i, ctx->cell_count_j,
+		ctx->pitch, ctx->halo);
+}
+
+/* the boundary handlers for all lanes of group [g], see 
+** set_boundary_sized */
+static void ensemble_set_boundary(fluids_context_t* const ctx, float* const q,
+	int g, int boundary)
+{
+	int i = 0, j = 0, e = 0;
+	int ni = ctx->cell_count_i, nj = ctx->cell_count_j;
+	float f_row = g_boundary_factors[boundary][0];
+	float f_col = g_boundary_factors[boundary][1];
+	float* c;
+	const float* c1;
+	const float* c2;
+
+	for (i = 1; i < ni - 1; i++) {
+		for (e = 0; e < LANES; e++) {
+			q[LANE_IDX(g, i, 0) + e] = f_row * 
+				q[LANE_IDX(g, i, 1) + e];
+			q[LANE_IDX(g, i, nj - 1) + e] = f_row * 
+				q[LANE_IDX(g, i, nj - 2) + e];
+		}
+	}
+
+	for (j = 1; j < nj - 1; j++) {
+		for (e = 0; e < LANES; e++) {
+			q[LANE_IDX(g, 0, j) + e] = f_col * 
+				q[LANE_IDX(g, 1, j) + e];
+			q[LANE_IDX(g, ni - 1, j) + e] = f_col * 
+				q[LANE_IDX(g, ni - 2, j) + e];
+		}
+	}
+
+	/* corners, from their neighbors along j and i */
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < 2; i++) {
+			c = q + LANE_IDX(g, i * (ni - 1), j * (nj - 1));
+			c1 = q + LANE_IDX(g, i * (ni - 1), j ? nj - 2 : 1);
+			c2 = q + LANE_IDX(g, i ? ni - 2 : 1, j * (nj - 1));
+
+			for (e = 0; e < LANES; e++) {
+				c[e] = 0.5 * (c1[e] + c2[e]);
+			}
+		}
+	}
+}
+
+/* sets the [lane_values] of the instances to [values] and of the padding 
+** lanes to 0 */
+static void ensemble_set_lanes(const fluids_ensemble_t* const ens,
+	float* const lane_values, const float* const values)
+{
+	int e = 0;
+
+	for (e = 0; e < LANES * ens->group_count; e++) {
+		lane_values[e] = e < ens->instance_count ? values[e] : 0.0;
+	}
+}
+
+/* Runs [fn] for bands of the groups of [ens]. Each group is processed as a
+** whole, which keeps its fields in cache across the passes of a routine. */
+static void ensemble_for(const fluids_ensemble_t* const ens, band_fn_t fn,
+	void* const vp)
+{
+	fluids_context_t* const ctx = ens->ctx;
+
+	parallel_for(ctx, fn, vp, 0, ens->group_count, LANES * 
+		ens->group_count * ctx->cell_count_i * ctx->cell_count_j);
+}
+
+struct ensemble_field_args {
+	const fluids_ensemble_t* ens;
+	float* q;
+	const float* q_prev;	/* source of fluids_ensemble_add_source */
+	const float* u;
+	const float* v;
+	int boundary;
+	float dt;
+};
+
+static void ensemble_add_source_groups(fluids_context_t* const ctx, 
+	int g_begin, int g_end, int thread, void* const vp)
+{
+	const struct ensemble_field_args* const a = vp;
+	int g = 0, j = 0;
+
+	/* the source is a field of the context, row by row */
+	for (g = g_begin; g < g_end; g++) {
+		for (j = 0; j < ctx->cell_count_j; j++) {
+			g_kernels->lanes_add_source(a->q + LANE_IDX(g, 0, j), 
+				a->q_prev + IDX(0, j), ctx->cell_count_i, 
+				LANES, a->ens->lane_a + LANES * g);
+		}
+	}
+}
+
+void fluids_ensemble_add_source(fluids_ensemble_t* const ens, float* const q,
+	const float* const source, const float* const alpha)
+{
+	struct ensemble_field_args a = { ens, q, source };
+
+	ensemble_set_lanes(ens, ens->lane_a, alpha);
+	ensemble_for(ens, ensemble_add_source_groups, &a);
+}
+
+static void ensemble_advect_groups(fluids_context_t* const ctx, int g_begin,
+	int g_end, int thread, void* const vp)
+{
+	const struct ensemble_field_args* const a = vp;
+	int g = 0, j = 0;
+	int idx = 0;
+	struct simd_grid grid = { ctx->origin_x, ctx->origin_y, ctx->dx, 
+		ctx->cell_count_i, ctx->cell_count_j, ctx->cell_count_i, 0 };
+
+	for (g = g_begin; g < g_end; g++) {
+		for (j = 1; j < ctx->cell_count_j - 1; j++) {
+			idx = LANE_IDX(g, 1, j);
+			g_kernels->lanes_advect(a->q + idx, 
+				a->q_prev + LANE_IDX(g, 0, 0), a->u + idx,
+				a->v + idx, ctx->cell_count_i - 2, LANES, 1, 
+				j, &grid, a->dt);
+		}
+
+		ensemble_set_boundary(ctx, a->q, g, a->boundary);
+	}
+}
+
+void fluids_ensemble_advect(fluids_ensemble_t* const ens, float* const q,
+	const float* const q_prev, const float* const u, const float* const v,
+	int boundary, float dt)
+{
+	struct ensemble_field_args a = { ens, q, q_prev, u, v, boundary, dt };
+
+	ensemble_for(ens, ensemble_advect_groups, &a);
+}
+
+static void ensemble_diffuse_groups(fluids_context_t* const ctx, int g_begin,
+	int g_end, int thread, void* const vp)
+{
+	const struct ensemble_field_args* const a = vp;
+	int g = 0, j = 0;
+	int idx = 0;
+
+	for (g = g_begin; g < g_end; g++) {
+		for (j = 1; j < ctx->cell_count_j - 1; j++) {
+			idx = LANE_IDX(g, 1, j);
+			g_kernels->lanes_diffuse(a->q + idx, a->q_prev + idx, 
+				ctx->cell_count_i - 2, LANES, 
+				ctx->cell_count_i, a->ens->lane_a + LANES * g,
+				a->ens->lane_b + LANES * g);
+		}
+
+		ensemble_set_boundary(ctx, a->q, g, a->boundary);
+	}
+}
+
+void fluids_ensemble_diffuse(fluids_ensemble_t* const ens, float* const q,
+	const float* const q_prev, const float* const diff, int boundary,
+	float dt)
+{
+	fluids_context_t* const ctx = ens->ctx;
+	struct ensemble_field_args a = { ens, q, q_prev, NULL, NULL, 
+		boundary };
+	int e = 0;
+	float r = 0.0;
+
+	/* the Jacobi step of diffuse_jacobi with a rate per lane */
+	for (e = 0; e < LANES * ens->group_count; e++) {
+		r = e < ens->instance_count ? 
+			diff[e] * dt / (ctx->dx * ctx->dx) : 0.0;
+		ens->lane_a[e] = 1.0 / (1.0 + 4.0 * r);
+		ens->lane_b[e] = r;
+	}
+
+	ensemble_for(ens, ensemble_diffuse_groups, &a);
+}
+
+struct ensemble_project_args {
+	float* u;
+	float* v;
+	int boundary_u;
+	int boundary_v;
+	float* p;
+	float* div;
+	int iteration_count;
+};
+
+/* fluids_context_project with Gauss-Seidel sweeps, all lanes of a cell at
+** once */
+static void ensemble_project_groups(fluids_context_t* const ctx, int g_begin,
+	int g_end, int thread, void* const vp)
+{
+	const struct ensemble_project_args* const a = vp;
+	int g = 0, j = 0, k = 0;
+	int idx = 0;
+	int ni = ctx->cell_count_i, nj = ctx->cell_count_j;
+
+	for (g = g_begin; g < g_end; g++) {
+		for (j = 1; j < nj - 1; j++) {
+			idx = LANE_IDX(g, 1, j);
+			g_kernels->lanes_divergence(a->div + idx, a->u + idx, 
+				a->v + idx, ni - 2, LANES, ni, -0.5 * ctx->dx);
+
+			for (k = 0; k < LANES * (ni - 2); k++) {
+				a->p[idx + k] = 0.0;
+			}
+		}
+
+		ensemble_set_boundary(ctx, a->div, g, FLUIDS_BOUNDARY_NN);
+		ensemble_set_boundary(ctx, a->p, g, FLUIDS_BOUNDARY_NN);
+
+		for (k = 0; k < a->iteration_count; k++) {
+			for (j = 1; j < nj - 1; j++) {
+				idx = LANE_IDX(g, 1, j);
+				g_kernels->lanes_gauss_seidel(a->p + idx, 
+					a->div + idx, ni - 2, LANES, ni);
+			}
+
+			ensemble_set_boundary(ctx, a->p, g, 
+				FLUIDS_BOUNDARY_NN);
+		}
+
+		for (j = 1; j < nj - 1; j++) {
+			idx = LANE_IDX(g, 1, j);
+			g_kernels->lanes_subtract_gradient(a->u + idx, 
+				a->v + idx, a->p + idx, ni - 2, LANES, ni, 
+				0.5 / ctx->dx);
+		}
+
+		ensemble_set_boundary(ctx, a->u, g, a->boundary_u);
+		ensemble_set_boundary(ctx, a->v, g, a->boundary_v);
+	}
+}
+
+void fluids_ensemble_project(fluids_ensemble_t* const ens, float* const u,
+	float* const v, int boundary_u, int boundary_v, float* const p,
+	float* const div, int iteration_count)
+{
+	struct ensemble_project_args a = { u, v, boundary_u, boundary_v, p, 
+		div, iteration_count };
+
+	ensemble_for(ens, ensemble_project_groups, &a);
+}
+
+struct ensemble_buoyancy_args {
+	const fluids_ensemble_t* ens;
+	float* v;
+	const float* smoke_dens;
+	const float* temperatures;
+	float temp_ambient;
+	float dt;
+};
+
+static void ensemble_add_buoyancy_groups(fluids_context_t* const ctx,
+	int g_begin, int g_end, int thread, void* const vp)
+{
+	const struct ensemble_buoyancy_args* const a = vp;
+	int g = 0;
+	int idx = 0;
+
+	for (g = g_begin; g < g_end; g++) {
+		idx = LANE_IDX(g, 0, 0);
+		g_kernels->lanes_buoyancy(a->v + idx, a->smoke_dens + idx, 
+			a->temperatures + idx, 
+			ctx->cell_count_i * ctx->cell_count_j, LANES, 
+			a->ens->lane_a + LANES * g, a->ens->lane_b + LANES * g,
+			a->temp_ambient, a->dt);
+	}
+}
+
+void fluids_ensemble_add_buoyancy(fluids_ensemble_t* const ens, 
+	float* const v, const float* const smoke_dens, 
+	const float* const temperatures, const float* const alpha, 
+	const float* const beta, float temp_ambient, float dt)
+{
+	struct ensemble_buoyancy_args a = { ens, v, smoke_dens, temperatures,
+		temp_ambient, dt };
+
+	ensemble_set_lanes(ens, ens->lane_a, alpha);
+	ensemble_set_lanes(ens, ens->lane_b, beta);
+	ensemble_for(ens, ensemble_add_buoyancy_groups, &a);
+}
+
+struct ensemble_vorticity_args {
+	const fluids_ensemble_t* ens;
+	float* u;
+	float* v;
+	float* vorticity;
+	float* nvg_x;
+	float* nvg_y;
+	float a;
+};
+
+/* the three passes of fluids_context_add_vorticity_confinement */
+static void ensemble_vorticity_groups(fluids_context_t* const ctx,
+	int g_begin, int g_end, int thread, void* const vp)
+{
+	const struct ensemble_vorticity_args* const a = vp;
+	int g = 0, j = 0;
+	int idx = 0;
+	int ni = ctx->cell_count_i, nj = ctx->cell_count_j;
+
+	for (g = g_begin; g < g_end; g++) {
+		for (j = 1; j < nj - 1; j++) {
+			idx = LANE_IDX(g, 1, j);
+			g_kernels->lanes_vorticity(a->vorticity + idx, 
+				a->u + idx, a->v + idx, ni - 2, LANES, ni, 
+				a->a);
+		}
+
+		for (j = 1; j < nj - 1; j++) {
+			idx = LANE_IDX(g, 1, j);
+			g_kernels->lanes_vorticity_gradient(a->nvg_x + idx, 
+				a->nvg_y + idx, a->vorticity + idx, ni - 2,
+				LANES, ni, a->a);
+		}
+
+		for (j = 1; j < nj - 1; j++) {
+			idx = LANE_IDX(g, 1, j);
+			g_kernels->lanes_vorticity_force(a->u + idx, 
+				a->v + idx, a->vorticity + idx, 
+				a->nvg_x + idx, a->nvg_y + idx, ni - 2, 
+				LANES, a->ens->lane_a + LANES * g);
+		}
+	}
+}
+
+void fluids_ensemble_add_vorticity_confinement(fluids_ensemble_t* const ens,
+	float* const u, float* const v, float* const vorticity,
+	float* const nvg_x, float* const nvg_y, const float* const eps,
+	float dt)
+{
+	fluids_context_t* const ctx = ens->ctx;
+	struct ensemble_vorticity_args a = { ens, u, v, vorticity, nvg_x, 
+		nvg_y, 1.0 / (2.0 * ctx->dx) };
+	int e = 0;
+
+	for (e = 0; e < LANES * ens->group_count; e++) {
+		ens->lane_a[e] = e < ens->instance_count ? 
+			eps[e] * dt * ctx->dx : 0.0;
+	}
+
+	ensemble_for(ens, ensemble_vorticity_groups, &a);
+}
+
+/* default context */
+
+void fluids_set_pressure_solver(int solver)
+{
+	fluids_context_set_pressure_solver(&g_context, solver);
+}
+
+void fluids_set_advection(int scheme)
+{
+	fluids_context_set_advection(&g_context, scheme);
+}
+
+void fluids_set_diffusion_solver(int solver)
+{
+	fluids_context_set_diffusion_solver(&g_context, solver);
+}
+
+void fluids_set_mixed_precision(int round_count, int format)
+{
+	fluids_context_set_mixed_precision(&g_context, round_count, format);
+}
+
+void fluids_set_warm_start(int enabled)
+{
+	fluids_context_set_warm_start(&g_context, enabled);
+}
+
+void fluids_set_temporal_blocking(int sweep_count)
+{
+	fluids_context_set_temporal_blocking(&g_context, sweep_count);
+}
+
+void fluids_set_sor_omega(float omega)
+{
+	fluids_context_set_sor_omega(&g_context, omega);
+}
+
+void fluids_set_multigrid(int level_count, int smooth_count, int cycle)
+{
+	fluids_context_set_multigrid(&g_context, level_count, smooth_count, 
+		cycle);
+}
+
+void fluids_set_grid(float origin_x, float origin_y, float dx, 
+	int cell_count_i, int cell_count_j)
+{
+	fluids_context_set_grid(&g_context, origin_x, origin_y, dx, 
+		cell_count_i, cell_count_j);
+}
+
+void fluids_set_halo(int width)
+{
+	fluids_context_set_halo(&g_context, width);
+}
+
+int fluids_get_index(int i, int j)
+{
+	return fluids_context_get_index(&g_context, i, j);
+}
+
+void fluids_set_obstacles(const unsigned char* const mask)
+{
+	fluids_context_set_obstacles(&g_context, mask);
+}
+
+void fluids_set_tiles(int size)
+{
+	fluids_context_set_tiles(&g_context, size);
+}
+
+void fluids_update_tiles(const float* const* const qs, int field_count,
+	const float* const u, const float* const v, float threshold)
+{
+	fluids_context_update_tiles(&g_context, qs, field_count, u, v,
+		threshold);
+}
+
+int fluids_get_active_tile_count()
+{
+	return fluids_context_get_active_tile_count(&g_context);
+}
+
+float fluids_sample(const float* const quantities, float x, float y)
+{
+	return fluids_context_sample(&g_context, quantities, x, y);
+}
+
+void fluids_sample_batch(const float* const q, const float* const xs,
+	const float* const ys, float* const out, int n)
+{
+	fluids_context_sample_batch(&g_context, q, xs, ys, out, n);
+}
+
+void fluids_sample_vector_batch(const float* const u, const float* const v,
+	const float* const xs, const float* const ys, float* const out_u,
+	float* const out_v, int n)
+{
+	fluids_context_sample_vector_batch(&g_context, u, v, xs, ys, out_u,
+		out_v, n);
+}
+
+float* fluids_malloc(float c)
+{
+	return fluids_context_malloc(&g_context, c);
+}
+
+fluids_arena_t* fluids_arena_create(int field_count, int flags)
+{
+	return fluids_context_arena_create(&g_context, field_count, flags);
+}
+
+void fluids_set(float* const q, float c)
+{
+	fluids_context_set(&g_context, q, c);
+}
+
+void fluids_set_with_function(float* const q,
+	float (*fn)(float x, float y, void* const vp), void* const vp)
+{
+	fluids_context_set_with_function(&g_context, q, fn, vp);
+}
+
+void fluids_extrapolate(float* const q, float* const q_prev)
+{
+	fluids_context_extrapolate(&g_context, q, q_prev);
+}
+
+void fluids_add_source_uniform(float* const q, float s, float alpha)
+{
+	fluids_context_add_source_uniform(&g_context, q, s, alpha);
+}
+
+void fluids_add_source_clamped(float* const q, const float* const source,
+	float alpha, float q_min, float q_max)
+{
+	fluids_context_add_source_clamped(&g_context, q, source, alpha, q_min,
+		q_max);
+}
+
+void fluids_add_source(float* const q, const float* const source, 
+	float alpha)
+{
+	fluids_context_add_source(&g_context, q, source, alpha);
+}
+
+void fluids_add_source_with_target(float* const q, const float* const source,
+	float q_target)
+{
+	fluids_context_add_source_with_target(&g_context, q, source, q_target);
+}
+
+void fluids_advect(float* const q, const float* const q_prev, 
+	const float* const u, const float* v, int boundary, float dt)
+{
+	fluids_context_advect(&g_context, q, q_prev, u, v, boundary, dt);
+}
+
+void fluids_advect_many(float* const* const qs, 
+	const float* const* const q_prevs, int field_count, 
+	const float* const u, const float* const v, 
+	const int* const boundaries, float dt)
+{
+	fluids_context_advect_many(&g_context, qs, q_prevs, field_count, u, v,
+		boundaries, dt);
+}
+
+void fluids_diffuse_many(float* const* const qs, 
+	const float* const* const q_prevs, int field_count, float diff,
+	int iteration_count, const int* const boundaries, float dt)
+{
+	fluids_context_diffuse_many(&g_context, qs, q_prevs, field_count, diff,
+		iteration_count, boundaries, dt);
+}
+
+void fluids_diffuse(float* const q, const float* const q_prev,  float diff, 
+	int iteration_count, int boundary, float dt) 
+{
+	fluids_context_diffuse(&g_context, q, q_prev, diff, iteration_count,
+		boundary, dt);
+}
+
+fluids_solver_result_t fluids_diffuse_to_tolerance(float* const q, 
+	const float* const q_prev, float diff, 
+	const fluids_tolerance_t* const tolerance, int boundary, float dt)
+{
+	return fluids_context_diffuse_to_tolerance(&g_context, q, q_prev, diff,
+		tolerance, boundary, dt);
+}
+
+void fluids_transport(float* const q, float* const q_prev, 
+	const fluids_source_t* const source, const float* const u, 
+	const float* const v, float diff, int iteration_count, int boundary,
+	float dt)
+{
+	fluids_context_transport(&g_context, q, q_prev, source, u, v, diff,
+		iteration_count, boundary, dt);
+}
+
+fluids_half_t* fluids_malloc_half(float c, int format)
+{
+	return fluids_context_malloc_half(&g_context, c, format);
+}
+
+void fluids_half_to_float(float* const q, const fluids_half_t* const h,
+	int format)
+{
+	fluids_context_half_to_float(&g_context, q, h, format);
+}
+
+void fluids_float_to_half(fluids_half_t* const h, const float* const q,
+	int format)
+{
+	fluids_context_float_to_half(&g_context, h, q, format);
+}
+
+void fluids_add_source_half(fluids_half_t* const q,
+	const float* const source, float alpha, int format)
+{
+	fluids_context_add_source_half(&g_context, q, source, alpha, format);
+}
+
+void fluids_advect_half(fluids_half_t* const q,
+	const fluids_half_t* const q_prev, const float* const u,
+	const float* const v, int format, int boundary, float dt)
+{
+	fluids_context_advect_half(&g_context, q, q_prev, u, v, format,
+		boundary, dt);
+}
+
+void fluids_diffuse_half(fluids_half_t* const q,
+	const fluids_half_t* const q_prev, float diff, int format,
+	int boundary, float dt)
+{
+	fluids_context_diffuse_half(&g_context, q, q_prev, diff, format,
+		boundary, dt);
+}
+
+void fluids_project(float* const u, float* const v, int boundary_u, 
+	int boundary_v, float* const p, float* const div, int iteration_count)
+{
+	fluids_context_project(&g_context, u, v, boundary_u, boundary_v, p, div,
+		iteration_count);
+}
+
+fluids_solver_result_t fluids_project_pcg(float* const u, float* const v,
+	int boundary_u, int boundary_v, float* const p, float* const div,
+	float tolerance, int max_iteration_count)
+{
+	return fluids_context_project_pcg(&g_context, u, v, boundary_u, 
+		boundary_v, p, div, tolerance, max_iteration_count);
+}
+
+fluids_solver_result_t fluids_project_to_tolerance(float* const u, 
+	float* const v, int boundary_u, int boundary_v, float* const p,
+	float* const div, const fluids_tolerance_t* const tolerance)
+{
+	return fluids_context_project_to_tolerance(&g_context, u, v, 
+		boundary_u, boundary_v, p, div, tolerance);
+}
+
+void fluids_add_buoyancy(float* const v, const float* const smoke_dens, 
+	const float* const temperatures, float alpha, float beta, 
+	float temp_ambient, float dt)
+{
+	fluids_context_add_buoyancy(&g_context, v, smoke_dens, temperatures, 
+		alpha, beta, temp_ambient, dt);
+}
+
+void fluids_add_vorticity_confinement(float* const u, float* const v,
+	float* const vorticity, float* const nvg_x, float* const nvg_y,
+	float eps, float dt)
+{
+	fluids_context_add_vorticity_confinement(&g_context, u, v, vorticity,
+		nvg_x, nvg_y, eps, dt);
+}
+
+float fluids_get_max_divergence(const float* const u, const float* const v,
+	float* const div)
+{
+	return fluids_context_get_max_divergence(&g_context, u, v, div);
+}
@@ -18,6 +18,50 @@ extern "C"
 /* Initializes the fluid subsystem. */ 
 void fluids_initialize();
 
+/* Releases internal buffers of the fluid subsystem (e.g. solver storage). */
+void fluids_finalize();
+
+/* Sets the number of threads the grid routines are split across, including
+** the calling thread. 0 uses one thread per processor, 1 (default) runs 
+** everything on the calling thread. Grids of less than 200 x 200 cells are 
+** always processed on the calling thread. The threads are shared by all 
+** contexts (see below), a routine that finds them busy runs on the calling
+** thread. */
+void fluids_set_thread_count(int thread_count);
+
+/* Gets the name of the instruction set the grid routines are vectorized 
+** with: "avx512", "avx2", "sse4.2" or "scalar". The widest one supported is
+** chosen by fluids_initialize. */
+const char* fluids_get_simd_path();
+
+/******************************************************************************
+** Fluid Context
+******************************************************************************/
+/* The grid, the solver settings and the solver storage of a simulation. The
+** routines below operate on a default context. Each of them has a variant
+** fluids_context_* taking the context as first argument, declared at the 
+** end of this file, e.g. fluids_context_advect(ctx, ...) for 
+** fluids_advect(...). Simulations on different contexts may run at the 
+** same time on different threads, the routines of a single context may 
+** not. fluids_initialize is called once before and fluids_set_thread_count
+** is called while no simulation runs. A context keeps the work arrays of
+** the routines between calls. A routine whose work arrays cannot be
+** allocated takes a path that needs less storage, or returns without
+** changing its output. */
+typedef struct fluids_context fluids_context_t;
+
+/* Creates a context with the settings the default context starts with: a
+** 100 x 100 grid of spacing 0.01 at the origin and the default solvers.
+** Returns NULL if the context cannot be allocated. */
+fluids_context_t* fluids_context_create();
+
+/* Releases a context created with fluids_context_create and its solver
+** storage. */
+void fluids_context_destroy(fluids_context_t* const ctx);
+
+/* Gets the default context. */
+fluids_context_t* fluids_get_context();
+
 /******************************************************************************
 ** Fluid Grid
 ******************************************************************************/
@@ -25,12 +69,40 @@ void fluids_initialize();
 void fluids_set_grid(float origin_x, float origin_y, float dx, 
 	int sample_count_i, int sample_count_j);
 
+/* Sets the width of a halo of cells around each field, 0 (default) for 
+** none. The halo holds copies of the nearest boundary cell and is updated
+** whenever the boundary is, so the advection and fluids_sample read up to
+** [width] cells beyond the grid without clamping their stencils. Points 
+** further out are moved onto the halo. A field then has count_j + 2 [width]
+** rows of count_i + 2 [width] values, cell (i, j) is at 
+** fluids_get_index(i, j). Fields are allocated after setting the halo. */
+void fluids_set_halo(int width);
+
+/* Gets the index of cell (i, j) in a field, including the halo cells at
+** -width <= i < 0 etc. */
+int fluids_get_index(int i, int j);
+
 /* Samples a discrete quantity field at a point (x, y) in space. Uses bilinear
 ** interpolation */ 
 float fluids_sample(const float* const quantities, float x, float y);
 
+/* Samples a field [q] at the [n] points (xs[k], ys[k]) and stores the
+** values in [out]. Same as fluids_sample for points within the grid (to
+** rounding), points outside are moved onto the grid, or onto the halo. The
+** points are processed a vector at a time. */
+void fluids_sample_batch(const float* const q, const float* const xs,
+	const float* const ys, float* const out, int n);
+
+/* Samples the velocity field ([u], [v]) at the [n] points (xs[k], ys[k]),
+** as fluids_sample_batch does, but with one stencil per point for both
+** components. */
+void fluids_sample_vector_batch(const float* const u, const float* const v,
+	const float* const xs, const float* const ys, float* const out_u,
+	float* const out_v, int n);
+
 /* Creates an array for storing a discrete quantity field, sample on [grid]. 
-** Initializes all samples to [c]. */ 
+** Initializes all samples to [c]. The array starts at a 64 byte boundary 
+** and is released with free. */ 
 float* fluids_malloc(float c); 
 
 /* Sets values of q to c */
@@ -40,6 +112,43 @@ void fluids_set(float* const q, float c);
 void fluids_set_with_function(float* const q,
 	float (*fn)(float x, float y, void* const vp), void* const vp);
 
+/* Linearly extrapolates the quantity field [q] of the current step using the
+** field [q_prev] of the previous step, i.e. q = 2 q - q_prev. [q_prev] is 
+** set to the old values of [q]. */
+void fluids_extrapolate(float* const q, float* const q_prev);
+
+/******************************************************************************
+** Field Arenas
+******************************************************************************/
+/* Storage for a fixed number of fields of the grid in a single allocation,
+** released as a whole. Each field starts at a 64 byte boundary and is 
+** padded to whole cache lines, i.e. vectors of 16 floats. The rows of a 
+** field are not padded, fields keep the layout of fluids_malloc. */
+typedef struct fluids_arena fluids_arena_t;
+
+enum {
+	/* Backs the arena with 2 MB pages if the system provides them, which
+	** cuts the TLB misses of the scattered reads of the advection on 
+	** large grids. The arena size is rounded up to whole huge pages. */
+	FLUIDS_ARENA_HUGE_PAGES = 1
+};
+
+/* Creates an arena for [field_count] fields of the current grid. [flags] is
+** 0 or FLUIDS_ARENA_HUGE_PAGES. Returns NULL if the memory cannot be 
+** allocated or mapped. */
+fluids_arena_t* fluids_arena_create(int field_count, int flags);
+
+/* Releases an arena and all fields it handed out. */
+void fluids_arena_destroy(fluids_arena_t* const arena);
+
+/* Same as fluids_malloc, but takes the next free field of [arena]. Returns
+** NULL if all fields are in use. The field is not released with free. */
+float* fluids_arena_malloc(fluids_arena_t* const arena, float c);
+
+/* Marks all fields of [arena] free. Fields handed out before are invalid
+** and their storage is reused by the next calls to fluids_arena_malloc. */
+void fluids_arena_reset(fluids_arena_t* const arena);
+
 /******************************************************************************
 ** Fluid Source
 ******************************************************************************/
@@ -72,6 +181,27 @@ void fluids_add_source_clamped(float* const q, const float* const source,
 void fluids_add_source_with_target(float* const q, const float* const source, 
 	float q_target);
 
+enum {
+	FLUIDS_SOURCE_UNIFORM = 0,	/* fluids_add_source_uniform */
+	FLUIDS_SOURCE_ADD,		/* fluids_add_source */
+	FLUIDS_SOURCE_CLAMPED,		/* fluids_add_source_clamped */
+	FLUIDS_SOURCE_TARGET		/* fluids_add_source_with_target */
+};
+
+/* A source applied by fluids_transport. [type] selects the equation of
+** the corresponding fluids_add_source function, the remaining fields are 
+** its arguments. [source] is unused by uniform sources, [s] is used by 
+** uniform sources only. */
+typedef struct fluids_source {
+	int type;
+	const float* source;
+	float s;
+	float alpha;
+	float q_min;
+	float q_max;
+	float q_target;
+} fluids_source_t;
+
 /******************************************************************************
 ** Fluid Boundary Handling
 ******************************************************************************/
@@ -85,32 +215,327 @@ enum {
 	FLUIDS_BOUNDARY_REFLECT_V
 };
 
+/******************************************************************************
+** Obstacles
+******************************************************************************/
+/* Marks solid cells within the grid. [mask] has a bit per cell, the cell 
+** (i, j) is solid if bit n % 8 of [mask][n / 8] is set, where 
+** n = j * sample_count_i + i. Boundary cells are not affected. NULL 
+** (default) removes all obstacles, as does setting the grid. The fluid 
+** cells are gathered into runs along the rows once, [mask] is not kept.
+**
+** Advection, diffusion, transport, projection and fluids_get_max_divergence
+** then update the fluid cells only. Solid cells next to fluid cells are 
+** handled like boundary cells: each is set to the mean of its fluid 
+** neighbors, scaled as the boundary handling prescribes for a boundary cell
+** next to that neighbor. Other solid cells keep their values. The solvers
+** keep their algorithm and solve the system of the fluid cells, with the
+** solid neighbors of a cell entering as the boundary handling prescribes:
+** FLUIDS_SOLVER_MULTIGRID restricts the mask to its coarse levels,
+** FLUIDS_SOLVER_PCG builds its MIC(0) preconditioner from the fluid cells,
+** FLUIDS_SOLVER_ADI solves along the runs of fluid cells and the sweeps of
+** FLUIDS_SOLVER_GAUSS_SEIDEL and FLUIDS_SOLVER_SOR run in red-black order.
+** FLUIDS_SOLVER_SPECTRAL projects with conjugate gradients preconditioned by
+** the spectral solve of the grid without obstacles, at most
+** cell_count_i + cell_count_j iterations to a residual of 1e-5 times the
+** largest divergence. The iteration counts keep their meaning, mixed
+** precision and temporal blocking do not apply. Ensembles ignore the
+** obstacles of their context. */
+void fluids_set_obstacles(const unsigned char* const mask);
+
+/******************************************************************************
+** Sparse Tiles
+******************************************************************************/
+/* Enables sparse mode with square tiles of [size] x [size] cells, 0
+** (default) disables it. In sparse mode, advection, diffusion, transport and
+** the sources update only the inner cells of the active tiles, the cells of
+** other tiles keep their values. As with obstacles, the diffusion solvers
+** keep their algorithm and solve the system of these cells, the cells next
+** to them entering with their values. The projection and the remaining
+** routines still update the whole grid. While all tiles are active, the
+** routines take the same paths as without tiles. All tiles start active,
+** setting the grid activates them again. */
+void fluids_set_tiles(int size);
+
+/* Updates the active tiles from [field_count] fields [qs] and the velocity
+** field ([u], [v]), once per step. An active tile stays active if a value
+** of a field or a velocity component in it exceeds [threshold] in
+** magnitude, then the tiles next to the remaining ones, diagonals included,
+** become active. Inactive tiles are not scanned, so the work scales with
+** the active area. A departure point of the advection should hence be
+** less than a tile away from its cell. Sources belong to [qs] as well,
+** since a tile once inactive does not wake up by itself. [u] and [v] may be
+** NULL. */
+void fluids_update_tiles(const float* const* const qs, int field_count,
+	const float* const u, const float* const v, float threshold);
+
+/* Gets the number of active tiles, 0 if sparse mode is disabled. */
+int fluids_get_active_tile_count();
+
+/******************************************************************************
+** Linear Solvers
+******************************************************************************/
+enum {
+	/* A single Jacobi step on the implicit diffusion system. Default solver
+	** of fluids_diffuse. */
+	FLUIDS_SOLVER_JACOBI = 0,
+	/* Lexicographic Gauss-Seidel sweeps. Default solver of 
+	** fluids_project. */
+	FLUIDS_SOLVER_GAUSS_SEIDEL,
+	/* Geometric multigrid with red-black Gauss-Seidel smoothing. Iteration
+	** counts passed to fluids_project and fluids_diffuse are interpreted as
+	** the number of multigrid cycles. */
+	FLUIDS_SOLVER_MULTIGRID,
+	/* Conjugate gradients with a modified incomplete Cholesky (MIC(0))
+	** preconditioner. Pressure only. fluids_project treats the iteration
+	** count as an upper bound and stops once the residual is small 
+	** relative to the divergence. */
+	FLUIDS_SOLVER_PCG,
+	/* Red-black ordered successive over-relaxation. The cells of each
+	** color are independent of each other. */
+	FLUIDS_SOLVER_SOR,
+	/* Direct solve of the pressure equation by discrete cosine transforms
+	** of the inner cells. Pressure only. The iteration count is ignored.
+	** Fastest for grids whose inner cell counts have small prime factors
+	** only, e.g. 2^n + 2 cells. */
+	FLUIDS_SOLVER_SPECTRAL,
+	/* Alternating direction implicit diffusion. Solves a tridiagonal 
+	** system per row, then per column (Thomas algorithm). Diffusion only,
+	** unconditionally stable. The iteration count passed to fluids_diffuse
+	** is the number of sub-steps the time step is split into. */
+	FLUIDS_SOLVER_ADI
+};
+
+enum {
+	FLUIDS_MULTIGRID_V_CYCLE = 1,
+	FLUIDS_MULTIGRID_W_CYCLE = 2
+};
+
+/* Reports how an iterative solve ended. */
+typedef struct fluids_solver_result {
+	int iteration_count;	/* iterations (or cycles) executed */
+	float residual;		/* max. norm of the final residual */
+} fluids_solver_result_t;
+
+/* Convergence criterion of an iterative solve. A solve stops as soon as the
+** max. norm of the residual drops to [absolute] or to [relative] times the
+** max. norm of the right hand side, or after [max_iteration_count] 
+** iterations. The residual is evaluated every [check_interval] iterations
+** (every multigrid cycle, every conjugate gradient iteration). */
+typedef struct fluids_tolerance {
+	float absolute;
+	float relative;
+	int max_iteration_count;
+	int check_interval;
+} fluids_tolerance_t;
+
+/* Selects the solver used by fluids_project for the pressure equation. Valid
+** solvers are FLUIDS_SOLVER_GAUSS_SEIDEL, FLUIDS_SOLVER_MULTIGRID, 
+** FLUIDS_SOLVER_PCG, FLUIDS_SOLVER_SOR and FLUIDS_SOLVER_SPECTRAL. */
+void fluids_set_pressure_solver(int solver);
+
+/* Selects the solver used by fluids_diffuse. Valid solvers are 
+** FLUIDS_SOLVER_JACOBI, FLUIDS_SOLVER_MULTIGRID, FLUIDS_SOLVER_SOR and
+** FLUIDS_SOLVER_ADI. */
+void fluids_set_diffusion_solver(int solver);
+
+/* Sets the over-relaxation factor [omega] in (0, 2) of FLUIDS_SOLVER_SOR. 
+** With [omega] = 0 (default) the projection uses the optimal factor for the
+** grid and diffusion uses 1, i.e. red-black Gauss-Seidel. The optimal factor
+** of the diffusion system overshoots within a few sweeps. */
+void fluids_set_sor_omega(float omega);
+
+/* Enables or disables warm starts of the pressure solve. With warm starts,
+** fluids_project keeps the values of [p] as initial guess instead of setting
+** them to zero. Use a separate [p] for each projection of a step; the 
+** solution of the last step can be extrapolated with fluids_extrapolate. */
+void fluids_set_warm_start(int enabled);
+
+/* Configures the multigrid solver. [level_count] is the maximum number of
+** grid levels including the finest one (0 coarsens as far as the grid
+** allows). [smooth_count] is the number of smoothing sweeps done before and
+** after each coarse grid correction. [cycle] is one of 
+** FLUIDS_MULTIGRID_V_CYCLE or FLUIDS_MULTIGRID_W_CYCLE. */
+void fluids_set_multigrid(int level_count, int smooth_count, int cycle);
+
+/* Sets the number of Gauss-Seidel, SOR and Jacobi sweeps done in a single
+** pass over the grid (temporal blocking). Each sweep follows the previous 
+** one a row behind, so a row is updated [sweep_count] times while the few
+** rows around it stay in cache. Results are the same as with separate 
+** sweeps. Blocked sweeps run on the calling thread and pay off when the 
+** grid does not fit in cache. 0 or 1 (default) sweeps the whole grid for 
+** each iteration. */
+void fluids_set_temporal_blocking(int sweep_count);
+
+/* Enables mixed precision pressure solves for FLUIDS_SOLVER_GAUSS_SEIDEL
+** and FLUIDS_SOLVER_SOR. fluids_project then splits its iterations into
+** [round_count] rounds of iterative refinement. A round computes the
+** residual of the pressure in float, runs the sweeps on a correction with
+** the residual and the correction stored in half precision of [format]
+** (FLUIDS_HALF_*) and adds the correction to the pressure in float. The
+** sweeps move half the data of float sweeps, the rounds keep their
+** rounding errors from accumulating: the pressure converges as with float
+** sweeps, to within the precision of [format] per round. The larger the
+** grid, the less a round gains from the few bits of a correction: bf16
+** rounds fall behind float sweeps from about 64 x 64 cells and stop
+** converging at about 128 x 128, fp16 rounds hold up beyond. Gauss-Seidel
+** sweeps run in red-black order, temporal blocking does not apply. With
+** obstacles, or if the half precision fields cannot be allocated, the
+** sweeps stay float. 0 rounds (default) disable mixed precision. */
+void fluids_set_mixed_precision(int round_count, int format);
+
 /******************************************************************************
 ** Fluid Advection
 ******************************************************************************/
+/* Advection schemes. */
+enum {
+	/* Samples the field bilinearly at the departure point of each cell.
+	** Default. */
+	FLUIDS_ADVECTION_SEMI_LAGRANGIAN = 0,
+
+	/* Advects forward, then back from the result, and corrects the
+	** forward step by half the error the round trip shows. The result is
+	** clamped to the values the forward step samples, so no new extrema
+	** arise. Keeps detail the semi-Lagrangian scheme smears over a few
+	** cells, at about three times its cost. Takes a semi-Lagrangian
+	** step if its work arrays cannot be allocated. */
+	FLUIDS_ADVECTION_MACCORMACK
+};
+
+/* Selects the scheme of fluids_advect, fluids_advect_many and
+** fluids_transport. The ensemble routines advect semi-Lagrangian. */
+void fluids_set_advection(int scheme);
+
 /* Advects all quantities in [q_prev] according to a velocity field (u, v)
 ** for a time step [dt] and stores the results in [q]. [q_prev] and (u, v) are 
 ** assumed to be sampled on the same [grid]. */ 
 void fluids_advect(float* const q, const float* const q_prev,
 	const float* const u, const float* v, int boundary, float dt);
 
+/* Advects [field_count] quantities with the same velocity field (u, v), as
+** fluids_advect does for each pair [qs][f], [q_prevs][f] with boundary 
+** handling [boundaries][f]. The departure points are computed once per cell
+** and shared by all fields. No [qs][f] may be one of [q_prevs], [u] or 
+** [v]. */
+void fluids_advect_many(float* const* const qs, 
+	const float* const* const q_prevs, int field_count, 
+	const float* const u, const float* const v, 
+	const int* const boundaries, float dt);
+
 /******************************************************************************
 ** Fluid Diffusion
 ******************************************************************************/
 /* Diffuses the values in [q_prev] according to some diffusion rate [diff] for
-** time step [dt] and stores the result in [q]. */ 
+** time step [dt] and stores the result in [q]. The solver is selected with
+** fluids_set_diffusion_solver. */ 
 void fluids_diffuse(float* const q, const float* const q_prev, 
 	float diff, int iteration_count, int boundary, float dt);
 
+/* Diffuses [field_count] quantities with the same rate [diff], as 
+** fluids_diffuse does for each pair [qs][f], [q_prevs][f] with boundary 
+** handling [boundaries][f]. Jacobi and ADI sweep all fields in the same
+** pass over the grid, the other solvers diffuse one field after the 
+** other. */
+void fluids_diffuse_many(float* const* const qs, 
+	const float* const* const q_prevs, int field_count, float diff,
+	int iteration_count, const int* const boundaries, float dt);
+
+/* Same as fluids_diffuse, but iterates the selected solver until 
+** [tolerance] is met. A Jacobi solve does proper Jacobi iterations here
+** rather than the single step of fluids_diffuse. Returns the number of
+** iterations executed and the residual reached. */
+fluids_solver_result_t fluids_diffuse_to_tolerance(float* const q, 
+	const float* const q_prev, float diff, 
+	const fluids_tolerance_t* const tolerance, int boundary, float dt);
+
+/******************************************************************************
+** Fluid Transport
+******************************************************************************/
+/* Applies [source] to [q_prev], advects the result according to (u, v) and
+** diffuses it with rate [diff], as the sequence fluids_add_source_*, 
+** fluids_advect, fluids_diffuse would, and stores the result in [q]. With 
+** the Jacobi diffusion solver the three stages run in a single pass over 
+** the grid, row by row, and no intermediate field is stored. [q_prev] has
+** the source applied afterwards, or holds the advected field with the 
+** other solvers. [source] may be NULL. */
+void fluids_transport(float* const q, float* const q_prev, 
+	const fluids_source_t* const source, const float* const u, 
+	const float* const v, float diff, int iteration_count, int boundary,
+	float dt);
+
+/******************************************************************************
+** Half Precision Fields
+******************************************************************************/
+/* Storage formats of half precision fields. A half precision field takes
+** half the memory of a float field and the routines below move half the
+** data, e.g. for passive quantities such as smoke density. They convert
+** the values to float, compute as their float counterparts do and round
+** the results to nearest once. The velocity fields stay float. */
+enum {
+	/* IEEE 754 binary16: 11 significant bits, magnitudes up to 65504 and
+	** down to 6e-5 (6e-8 with subnormals). */
+	FLUIDS_HALF_FP16 = 0,
+
+	/* bfloat16: 8 significant bits and the range of float. */
+	FLUIDS_HALF_BF16
+};
+
+/* A value of a half precision field. */
+typedef unsigned short fluids_half_t;
+
+/* Creates a half precision field of [format] with all values set to [c].
+** The array starts at a 64 byte boundary and is released with free. */
+fluids_half_t* fluids_malloc_half(float c, int format);
+
+/* Converts a half precision field [h] of [format] to the field [q] and
+** back, e.g. to render or initialize a field. */
+void fluids_half_to_float(float* const q, const fluids_half_t* const h,
+	int format);
+void fluids_float_to_half(fluids_half_t* const h, const float* const q,
+	int format);
+
+/* Same as fluids_add_source for a half precision field [q] of [format]. */
+void fluids_add_source_half(fluids_half_t* const q,
+	const float* const source, float alpha, int format);
+
+/* Same as fluids_advect with FLUIDS_ADVECTION_SEMI_LAGRANGIAN for half
+** precision fields [q] and [q_prev] of [format]. */
+void fluids_advect_half(fluids_half_t* const q,
+	const fluids_half_t* const q_prev, const float* const u,
+	const float* const v, int format, int boundary, float dt);
+
+/* Same as fluids_diffuse with FLUIDS_SOLVER_JACOBI, i.e. a single Jacobi
+** step from [q_prev], for half precision fields [q] and [q_prev] of
+** [format]. */
+void fluids_diffuse_half(fluids_half_t* const q,
+	const fluids_half_t* const q_prev, float diff, int format,
+	int boundary, float dt);
+
 /******************************************************************************
 ** Fluid Projection
 ******************************************************************************/
 /* Makes the velocity field ([u], [v]) divergence free. [div] and [p] are 
 ** utility arrays that store the divergence of the velocity field before
-** projection and the pressure. */ 
+** projection and the pressure. The pressure solver is selected with 
+** fluids_set_pressure_solver. */ 
 void fluids_project(float* const u, float* const v, int boundary_u, 
 	int boundary_v, float* const p, float* const div, int iteration_count);
 
+/* Same as fluids_project, but solves for the pressure with preconditioned
+** conjugate gradients until the max. norm of the residual (in units of 
+** [div]) drops to [tolerance] or [max_iteration_count] iterations are done. 
+** Returns the number of iterations used and the final residual. */
+fluids_solver_result_t fluids_project_pcg(float* const u, float* const v,
+	int boundary_u, int boundary_v, float* const p, float* const div,
+	float tolerance, int max_iteration_count);
+
+/* Same as fluids_project, but iterates the selected pressure solver until
+** [tolerance] is met. Returns the number of iterations executed and the 
+** residual (in units of [div]) reached. */
+fluids_solver_result_t fluids_project_to_tolerance(float* const u, 
+	float* const v, int boundary_u, int boundary_v, float* const p,
+	float* const div, const fluids_tolerance_t* const tolerance);
+
 /******************************************************************************
 ** Buoyancy
 ******************************************************************************/
@@ -145,6 +570,201 @@ void fluids_add_vorticity_confinement(float* const u, float* const v,
 float fluids_get_max_divergence(const float* const u, const float* const v,
 	float* const div);
 
+/******************************************************************************
+** Ensembles
+******************************************************************************/
+/* A number of simulations on the same grid, stepped in lockstep. Ensemble
+** fields interleave the instances in groups of FLUIDS_ENSEMBLE_LANE_COUNT: 
+** a group stores the values of its instances of a cell next to each other,
+** so the routines below update them in the same vector instructions. This
+** pays off for many small grids, e.g. variants of a scene with different 
+** parameters, which are too small to vectorize well on their own. With c
+** cells per grid, the value of instance k at cell (i, j) is at
+**
+** 	q[FLUIDS_ENSEMBLE_LANE_COUNT * (c * g + sample_count_i * j + i) + e]
+**
+** where g = k / FLUIDS_ENSEMBLE_LANE_COUNT is its group and 
+** e = k % FLUIDS_ENSEMBLE_LANE_COUNT its lane. The instance count is padded
+** to whole groups. Parameters given as arrays hold a value per instance. */
+#define FLUIDS_ENSEMBLE_LANE_COUNT 16
+typedef struct fluids_ensemble fluids_ensemble_t;
+
+/* Creates an ensemble of [instance_count] simulations on the grid of [ctx],
+** which also provides the threads. The grid of [ctx] may not change while
+** the ensemble exists. Returns NULL if the ensemble cannot be allocated. */
+fluids_ensemble_t* fluids_ensemble_create(fluids_context_t* const ctx,
+	int instance_count);
+
+/* Releases an ensemble. Its fields are released with free. */
+void fluids_ensemble_destroy(fluids_ensemble_t* const ens);
+
+/* Creates an ensemble field with all values set to [c]. */
+float* fluids_ensemble_malloc(const fluids_ensemble_t* const ens, float c);
+
+/* Copies the field [q_instance] of a single simulation to instance
+** [instance] of the ensemble field [q], and back. */
+void fluids_ensemble_set_instance(const fluids_ensemble_t* const ens,
+	float* const q, int instance, const float* const q_instance);
+void fluids_ensemble_get_instance(const fluids_ensemble_t* const ens,
+	const float* const q, int instance, float* const q_instance);
+
+/* Same as fluids_add_source for each instance, with the field [source]
+** shared by all instances and an amount [alpha] per instance. */
+void fluids_ensemble_add_source(fluids_ensemble_t* const ens, float* const q,
+	const float* const source, const float* const alpha);
+
+/* Same as fluids_advect for each instance. */
+void fluids_ensemble_advect(fluids_ensemble_t* const ens, float* const q,
+	const float* const q_prev, const float* const u, const float* const v,
+	int boundary, float dt);
+
+/* Same as fluids_diffuse with FLUIDS_SOLVER_JACOBI for each instance, with
+** a rate [diff] per instance. */
+void fluids_ensemble_diffuse(fluids_ensemble_t* const ens, float* const q,
+	const float* const q_prev, const float* const diff, int boundary,
+	float dt);
+
+/* Same as fluids_project with FLUIDS_SOLVER_GAUSS_SEIDEL and without warm
+** starts for each instance. */
+void fluids_ensemble_project(fluids_ensemble_t* const ens, float* const u,
+	float* const v, int boundary_u, int boundary_v, float* const p,
+	float* const div, int iteration_count);
+
+/* Same as fluids_add_buoyancy for each instance, with [alpha] and [beta]
+** per instance. */
+void fluids_ensemble_add_buoyancy(fluids_ensemble_t* const ens,
+	float* const v, const float* const smoke_dens,
+	const float* const temperatures, const float* const alpha,
+	const float* const beta, float temp_ambient, float dt);
+
+/* Same as fluids_add_vorticity_confinement for each instance, with [eps]
+** per instance. */
+void fluids_ensemble_add_vorticity_confinement(fluids_ensemble_t* const ens,
+	float* const u, float* const v, float* const vorticity,
+	float* const nvg_x, float* const nvg_y, const float* const eps,
+	float dt);
+
+/******************************************************************************
+** Context Variants
+******************************************************************************/
+/* Same as the routines above without the fluids_context_ prefix, for the
+** simulation [ctx]. */
+void fluids_context_set_grid(fluids_context_t* const ctx, float origin_x, 
+	float origin_y, float dx, int sample_count_i, int sample_count_j);
+void fluids_context_set_halo(fluids_context_t* const ctx, int width);
+int fluids_context_get_index(fluids_context_t* const ctx, int i, int j);
+void fluids_context_set_obstacles(fluids_context_t* const ctx, 
+	const unsigned char* const mask);
+void fluids_context_set_tiles(fluids_context_t* const ctx, int size);
+void fluids_context_update_tiles(fluids_context_t* const ctx,
+	const float* const* const qs, int field_count, const float* const u,
+	const float* const v, float threshold);
+int fluids_context_get_active_tile_count(fluids_context_t* const ctx);
+float fluids_context_sample(fluids_context_t* const ctx, 
+	const float* const quantities, float x, float y);
+void fluids_context_sample_batch(fluids_context_t* const ctx,
+	const float* const q, const float* const xs, const float* const ys,
+	float* const out, int n);
+void fluids_context_sample_vector_batch(fluids_context_t* const ctx,
+	const float* const u, const float* const v, const float* const xs,
+	const float* const ys, float* const out_u, float* const out_v, int n);
+float* fluids_context_malloc(fluids_context_t* const ctx, float c);
+fluids_arena_t* fluids_context_arena_create(fluids_context_t* const ctx, 
+	int field_count, int flags);
+void fluids_context_set(fluids_context_t* const ctx, float* const q, float c);
+void fluids_context_set_with_function(fluids_context_t* const ctx, 
+	float* const q, float (*fn)(float x, float y, void* const vp), 
+	void* const vp);
+void fluids_context_extrapolate(fluids_context_t* const ctx, float* const q,
+	float* const q_prev);
+
+void fluids_context_add_source_uniform(fluids_context_t* const ctx, 
+	float* const q, float s, float alpha);
+void fluids_context_add_source(fluids_context_t* const ctx, float* const q,
+	const float* const source, float alpha);
+void fluids_context_add_source_clamped(fluids_context_t* const ctx, 
+	float* const q, const float* const source, float alpha, float q_min,
+	float q_max);
+void fluids_context_add_source_with_target(fluids_context_t* const ctx, 
+	float* const q, const float* const source, float q_target);
+
+void fluids_context_set_pressure_solver(fluids_context_t* const ctx, 
+	int solver);
+void fluids_context_set_diffusion_solver(fluids_context_t* const ctx, 
+	int solver);
+void fluids_context_set_sor_omega(fluids_context_t* const ctx, float omega);
+void fluids_context_set_warm_start(fluids_context_t* const ctx, int enabled);
+void fluids_context_set_multigrid(fluids_context_t* const ctx, 
+	int level_count, int smooth_count, int cycle);
+void fluids_context_set_temporal_blocking(fluids_context_t* const ctx, 
+	int sweep_count);
+void fluids_context_set_mixed_precision(fluids_context_t* const ctx,
+	int round_count, int format);
+
+void fluids_context_set_advection(fluids_context_t* const ctx, int scheme);
+void fluids_context_advect(fluids_context_t* const ctx, float* const q, 
+	const float* const q_prev, const float* const u, const float* v, 
+	int boundary, float dt);
+void fluids_context_advect_many(fluids_context_t* const ctx, 
+	float* const* const qs, const float* const* const q_prevs, 
+	int field_count, const float* const u, const float* const v, 
+	const int* const boundaries, float dt);
+
+fluids_half_t* fluids_context_malloc_half(fluids_context_t* const ctx,
+	float c, int format);
+void fluids_context_half_to_float(fluids_context_t* const ctx,
+	float* const q, const fluids_half_t* const h, int format);
+void fluids_context_float_to_half(fluids_context_t* const ctx,
+	fluids_half_t* const h, const float* const q, int format);
+void fluids_context_add_source_half(fluids_context_t* const ctx,
+	fluids_half_t* const q, const float* const source, float alpha,
+	int format);
+void fluids_context_advect_half(fluids_context_t* const ctx,
+	fluids_half_t* const q, const fluids_half_t* const q_prev,
+	const float* const u, const float* const v, int format, int boundary,
+	float dt);
+void fluids_context_diffuse_half(fluids_context_t* const ctx,
+	fluids_half_t* const q, const fluids_half_t* const q_prev, float diff,
+	int format, int boundary, float dt);
+
+void fluids_context_diffuse(fluids_context_t* const ctx, float* const q, 
+	const float* const q_prev, float diff, int iteration_count, 
+	int boundary, float dt);
+void fluids_context_diffuse_many(fluids_context_t* const ctx, 
+	float* const* const qs, const float* const* const q_prevs, 
+	int field_count, float diff, int iteration_count, 
+	const int* const boundaries, float dt);
+fluids_solver_result_t fluids_context_diffuse_to_tolerance(
+	fluids_context_t* const ctx, float* const q, const float* const q_prev,
+	float diff, const fluids_tolerance_t* const tolerance, int boundary, 
+	float dt);
+
+void fluids_context_transport(fluids_context_t* const ctx, float* const q, 
+	float* const q_prev, const fluids_source_t* const source, 
+	const float* const u, const float* const v, float diff, 
+	int iteration_count, int boundary, float dt);
+
+void fluids_context_project(fluids_context_t* const ctx, float* const u, 
+	float* const v, int boundary_u, int boundary_v, float* const p, 
+	float* const div, int iteration_count);
+fluids_solver_result_t fluids_context_project_pcg(fluids_context_t* const ctx,
+	float* const u, float* const v, int boundary_u, int boundary_v, 
+	float* const p, float* const div, float tolerance, 
+	int max_iteration_count);
+fluids_solver_result_t fluids_context_project_to_tolerance(
+	fluids_context_t* const ctx, float* const u, float* const v, 
+	int boundary_u, int boundary_v, float* const p, float* const div, 
+	const fluids_tolerance_t* const tolerance);
+
+void fluids_context_add_buoyancy(fluids_context_t* const ctx, float* const v,
+	const float* const smoke_dens, const float* const temperatures, 
+	float alpha, float beta, float temp_ambient, float dt);
+void fluids_context_add_vorticity_confinement(fluids_context_t* const ctx, 
+	float* const u, float* const v, float* const vorticity, 
+	float* const nvg_x, float* const nvg_y, float eps, float dt);
+float fluids_context_get_max_divergence(fluids_context_t* const ctx, 
+	const float* const u, const float* const v, float* const div);
+
 #ifdef __cplusplus
 }
 #endif
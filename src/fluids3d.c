@@ -0,0 +1,735 @@
+/* posix_memalign in strict ISO C modes */
+#define _POSIX_C_SOURCE 200112L
+
+#include "fluids3d.h"
+#include "threads.h"
+#include "simd.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <math.h>
+
+#define PI 3.14159265358979323846
+
+/* grid */
+
+#define IDX(i, j, k) \
+	(ctx->cell_count_i * (ctx->cell_count_j * (k) + (j)) + (i))
+#define PLANE_SIZE (ctx->cell_count_i * ctx->cell_count_j)
+#define VALUE_COUNT ((size_t)PLANE_SIZE * ctx->cell_count_k)
+
+/* red-black sweeps */
+
+#define SLAB_PLANE_COUNT 8	/* planes swept in one pass per slab */
+
+struct fluids3d_context {
+	/* grid */
+	float origin_x;
+	float origin_y;
+	float origin_z;
+	float dx;
+	int cell_count_i;
+	int cell_count_j;
+	int cell_count_k;
+
+	/* solvers */
+	float sor_omega;	/* 0 = optimal for the grid */
+
+	/* vorticity confinement, NULL until first used */
+	float* curl;		/* the three components, one after the other */
+
+	const struct simd_kernels* kernels;
+};
+
+/* threading */
+
+#define PARALLEL_MIN_CELL_COUNT 40000	/* smaller grids run serially */
+
+typedef void (*band_fn_t)(fluids3d_context_t* const ctx, int begin, int end,
+	int thread, void* const vp);
+
+/* a band function of a context, as passed to the thread pool */
+struct band_job {
+	band_fn_t fn;
+	fluids3d_context_t* ctx;
+	void* vp;
+};
+
+static void run_band_job(int begin, int end, int thread, void* const vp)
+{
+	const struct band_job* const job = vp;
+
+	(*job->fn)(job->ctx, begin, end, thread, job->vp);
+}
+
+/* Runs [fn] for bands of the planes (or slabs) [begin, end) on the worker
+** threads. Grids of less than PARALLEL_MIN_CELL_COUNT cells run on the
+** calling thread. */
+static void parallel_for(fluids3d_context_t* const ctx, band_fn_t fn,
+	void* const vp, int begin, int end)
+{
+	struct band_job job = { fn, ctx, vp };
+
+	if (VALUE_COUNT < PARALLEL_MIN_CELL_COUNT) {
+		(*fn)(ctx, begin, end, 0, vp);
+		return;
+	}
+
+	threads_for(run_band_job, &job, begin, end);
+}
+
+/* the inner planes */
+static void parallel_for_planes(fluids3d_context_t* const ctx, band_fn_t fn,
+	void* const vp)
+{
+	parallel_for(ctx, fn, vp, 1, ctx->cell_count_k - 1);
+}
+
+/* boundary handling */
+
+/* Factors the nearest inner value is scaled with on the faces i = 0,
+** count_i - 1, the faces j = 0, count_j - 1 and the faces k = 0,
+** count_k - 1. */
+static const float g_boundary_factors[][3] = {
+	{ 1.0, 1.0, 1.0 },	/* FLUIDS3D_BOUNDARY_NN */
+	{ -1.0, 1.0, 1.0 },	/* FLUIDS3D_BOUNDARY_REFLECT_U */
+	{ 1.0, -1.0, 1.0 },	/* FLUIDS3D_BOUNDARY_REFLECT_V */
+	{ 1.0, 1.0, -1.0 }	/* FLUIDS3D_BOUNDARY_REFLECT_W */
+};
+
+/* Sets the boundary rows and columns of plane [k] from their inner
+** neighbors in the plane, the edges along k to the mean of their two
+** neighbors in the plane. */
+static void set_boundary_plane(fluids3d_context_t* const ctx, float* const q,
+	int k, int boundary)
+{
+	int i = 0, j = 0;
+	int ni = ctx->cell_count_i, nj = ctx->cell_count_j;
+	float f_i = g_boundary_factors[boundary][0];
+	float f_j = g_boundary_factors[boundary][1];
+
+	for (i = 1; i < ni - 1; i++) {
+		q[IDX(i, 0, k)] = f_j * q[IDX(i, 1, k)];
+		q[IDX(i, nj - 1, k)] = f_j * q[IDX(i, nj - 2, k)];
+	}
+
+	for (j = 1; j < nj - 1; j++) {
+		q[IDX(0, j, k)] = f_i * q[IDX(1, j, k)];
+		q[IDX(ni - 1, j, k)] = f_i * q[IDX(ni - 2, j, k)];
+	}
+
+	q[IDX(0, 0, k)] = 0.5 * (q[IDX(0, 1, k)] + q[IDX(1, 0, k)]);
+	q[IDX(ni - 1, 0, k)] = 0.5 * (q[IDX(ni - 1, 1, k)] +
+		q[IDX(ni - 2, 0, k)]);
+	q[IDX(0, nj - 1, k)] = 0.5 * (q[IDX(0, nj - 2, k)] +
+		q[IDX(1, nj - 1, k)]);
+	q[IDX(ni - 1, nj - 1, k)] = 0.5 * (q[IDX(ni - 2, nj - 1, k)] +
+		q[IDX(ni - 1, nj - 2, k)]);
+}
+
+/* Sets the face k = [k] from the plane [k_in] next to it. Its inner cells
+** are scaled copies, its border cells (edges and corners of the grid) the
+** mean of their neighbors in the face and in plane [k_in]. */
+static void set_boundary_face(fluids3d_context_t* const ctx, float* const q,
+	int k, int k_in, int boundary)
+{
+	int i = 0, j = 0;
+	int ni = ctx->cell_count_i, nj = ctx->cell_count_j;
+	float f_k = g_boundary_factors[boundary][2];
+
+	for (j = 1; j < nj - 1; j++) {
+		for (i = 1; i < ni - 1; i++) {
+			q[IDX(i, j, k)] = f_k * q[IDX(i, j, k_in)];
+		}
+	}
+
+	for (i = 1; i < ni - 1; i++) {
+		q[IDX(i, 0, k)] = 0.5 * (q[IDX(i, 1, k)] + q[IDX(i, 0, k_in)]);
+		q[IDX(i, nj - 1, k)] = 0.5 * (q[IDX(i, nj - 2, k)] +
+			q[IDX(i, nj - 1, k_in)]);
+	}
+
+	for (j = 1; j < nj - 1; j++) {
+		q[IDX(0, j, k)] = 0.5 * (q[IDX(1, j, k)] + q[IDX(0, j, k_in)]);
+		q[IDX(ni - 1, j, k)] = 0.5 * (q[IDX(ni - 2, j, k)] +
+			q[IDX(ni - 1, j, k_in)]);
+	}
+
+	q[IDX(0, 0, k)] = (q[IDX(1, 0, k)] + q[IDX(0, 1, k)] +
+		q[IDX(0, 0, k_in)]) / 3.0;
+	q[IDX(ni - 1, 0, k)] = (q[IDX(ni - 2, 0, k)] + q[IDX(ni - 1, 1, k)] +
+		q[IDX(ni - 1, 0, k_in)]) / 3.0;
+	q[IDX(0, nj - 1, k)] = (q[IDX(1, nj - 1, k)] + q[IDX(0, nj - 2, k)] +
+		q[IDX(0, nj - 1, k_in)]) / 3.0;
+	q[IDX(ni - 1, nj - 1, k)] = (q[IDX(ni - 2, nj - 1, k)] +
+		q[IDX(ni - 1, nj - 2, k)] + q[IDX(ni - 1, nj - 1, k_in)]) / 3.0;
+}
+
+struct boundary_args {
+	float* q;
+	int boundary;
+};
+
+static void set_boundary_planes(fluids3d_context_t* const ctx, int k_begin,
+	int k_end, int thread, void* const vp)
+{
+	const struct boundary_args* const a = vp;
+	int k = 0;
+
+	for (k = k_begin; k < k_end; k++) {
+		set_boundary_plane(ctx, a->q, k, a->boundary);
+	}
+}
+
+/* Sets the boundary cells of [q], the faces along i and j of the inner
+** planes first, then the faces along k. */
+static void set_boundary(fluids3d_context_t* const ctx, float* const q,
+	int boundary)
+{
+	struct boundary_args a = { q, boundary };
+	int nk = ctx->cell_count_k;
+
+	parallel_for_planes(ctx, set_boundary_planes, &a);
+	set_boundary_face(ctx, q, 0, 1, boundary);
+	set_boundary_face(ctx, q, nk - 1, nk - 2, boundary);
+}
+
+/* context */
+
+fluids3d_context_t* fluids3d_context_create(float origin_x, float origin_y,
+	float origin_z, float dx, int sample_count_i, int sample_count_j,
+	int sample_count_k)
+{
+	fluids3d_context_t* ctx = calloc(1, sizeof(*ctx));
+
+	if (!ctx) {
+		return NULL;
+	}
+
+	ctx->origin_x = origin_x;
+	ctx->origin_y = origin_y;
+	ctx->origin_z = origin_z;
+	ctx->dx = dx;
+	ctx->cell_count_i = sample_count_i;
+	ctx->cell_count_j = sample_count_j;
+	ctx->cell_count_k = sample_count_k;
+	ctx->kernels = simd_select();
+	return ctx;
+}
+
+void fluids3d_context_destroy(fluids3d_context_t* const ctx)
+{
+	if (!ctx) {
+		return;
+	}
+
+	free(ctx->curl);
+	free(ctx);
+}
+
+void fluids3d_set_sor_omega(fluids3d_context_t* const ctx, float omega)
+{
+	ctx->sor_omega = omega;
+}
+
+/* grid */
+
+int fluids3d_get_index(const fluids3d_context_t* const ctx, int i, int j,
+	int k)
+{
+	return IDX(i, j, k);
+}
+
+float fluids3d_sample(const fluids3d_context_t* const ctx,
+	const float* const q, float x, float y, float z)
+{
+	int i = 0, j = 0, k = 0, di = 0, dj = 0, dk = 0, idx = 0;
+	int ni = ctx->cell_count_i, nj = ctx->cell_count_j;
+	int nk = ctx->cell_count_k;
+	float fx, fy, fz, q00, q10, q01, q11, q0, q1;
+	float x0 = x - ctx->origin_x;
+	float y0 = y - ctx->origin_y;
+	float z0 = z - ctx->origin_z;
+
+	/* Compute the cell (x, y, z) lies in, clamped to the grid, and the
+	** offsets of its neighbors (0 at the border) */
+	i = x0 / ctx->dx;
+	j = y0 / ctx->dx;
+	k = z0 / ctx->dx;
+	i = i < 0 ? 0 : (i > ni - 1 ? ni - 1 : i);
+	j = j < 0 ? 0 : (j > nj - 1 ? nj - 1 : j);
+	k = k < 0 ? 0 : (k > nk - 1 ? nk - 1 : k);
+	di = i + 1 > ni - 1 ? 0 : 1;
+	dj = j + 1 > nj - 1 ? 0 : ni;
+	dk = k + 1 > nk - 1 ? 0 : PLANE_SIZE;
+
+	/* offset of (x, y, z) in the cell relative to the grid spacing */
+	fx = (x0 - i * ctx->dx) / ctx->dx;
+	fy = (y0 - j * ctx->dx) / ctx->dx;
+	fz = (z0 - k * ctx->dx) / ctx->dx;
+
+	/* interpolate in float, same as the advection kernels */
+	idx = IDX(i, j, k);
+	q00 = q[idx] + fx * (q[idx + di] - q[idx]);
+	q10 = q[idx + dj] + fx * (q[idx + dj + di] - q[idx + dj]);
+	q01 = q[idx + dk] + fx * (q[idx + dk + di] - q[idx + dk]);
+	q11 = q[idx + dk + dj] + fx * (q[idx + dk + dj + di] -
+		q[idx + dk + dj]);
+	q0 = q00 + fy * (q10 - q00);
+	q1 = q01 + fy * (q11 - q01);
+	return q0 + fz * (q1 - q0);
+}
+
+float* fluids3d_malloc(const fluids3d_context_t* const ctx, float c)
+{
+	size_t value_count = VALUE_COUNT;
+	size_t i = 0;
+	void* vp = NULL;
+	float* qp;
+
+	if (posix_memalign(&vp, ARENA_ALIGNMENT, sizeof(*qp) * value_count)) {
+		return NULL;
+	}
+
+	qp = vp;
+
+	for (i = 0; i < value_count; i++) {
+		qp[i] = c;
+	}
+
+	return qp;
+}
+
+void fluids3d_set(const fluids3d_context_t* const ctx, float* const q,
+	float c)
+{
+	size_t value_count = VALUE_COUNT;
+	size_t i = 0;
+
+	for (i = 0; i < value_count; i++) {
+		q[i] = c;
+	}
+}
+
+void fluids3d_set_with_function(const fluids3d_context_t* const ctx,
+	float* const q, float (*fn)(float x, float y, float z, void* const vp),
+	void* const vp)
+{
+	int i = 0, j = 0, k = 0;
+	float x = 0.0, y = 0.0, z = 0.0;
+
+	for (k = 0; k < ctx->cell_count_k; k++) {
+		for (j = 0; j < ctx->cell_count_j; j++) {
+			for (i = 0; i < ctx->cell_count_i; i++) {
+				x = ctx->origin_x + i * ctx->dx;
+				y = ctx->origin_y + j * ctx->dx;
+				z = ctx->origin_z + k * ctx->dx;
+				q[IDX(i, j, k)] = (*fn)(x, y, z, vp);
+			}
+		}
+	}
+}
+
+/* sources and buoyancy run over whole planes */
+
+struct source_args {
+	float* q;
+	const float* source;
+	float alpha;
+};
+
+static void add_source_planes(fluids3d_context_t* const ctx, int k_begin,
+	int k_end, int thread, void* const vp)
+{
+	const struct source_args* const a = vp;
+	int idx = IDX(0, 0, k_begin);
+
+	ctx->kernels->add_source(a->q + idx, a->source + idx,
+		PLANE_SIZE * (k_end - k_begin), a->alpha);
+}
+
+void fluids3d_add_source(fluids3d_context_t* const ctx, float* const q,
+	const float* const source, float alpha)
+{
+	struct source_args a = { q, source, alpha };
+
+	parallel_for(ctx, add_source_planes, &a, 0, ctx->cell_count_k);
+}
+
+struct buoyancy_args {
+	float* v;
+	const float* smoke_dens;
+	const float* temperatures;
+	float alpha;
+	float beta;
+	float temp_ambient;
+	float dt;
+};
+
+static void add_buoyancy_planes(fluids3d_context_t* const ctx, int k_begin,
+	int k_end, int thread, void* const vp)
+{
+	const struct buoyancy_args* const a = vp;
+	int idx = IDX(0, 0, k_begin);
+
+	ctx->kernels->buoyancy(a->v + idx, a->smoke_dens + idx,
+		a->temperatures + idx, PLANE_SIZE * (k_end - k_begin),
+		a->alpha, a->beta, a->temp_ambient, a->dt);
+}
+
+void fluids3d_add_buoyancy(fluids3d_context_t* const ctx, float* const v,
+	const float* const smoke_dens, const float* const temperatures,
+	float alpha, float beta, float temp_ambient, float dt)
+{
+	struct buoyancy_args a = { v, smoke_dens, temperatures, alpha, beta,
+		temp_ambient, dt };
+
+	parallel_for(ctx, add_buoyancy_planes, &a, 0, ctx->cell_count_k);
+}
+
+/* advection */
+
+struct advect_args {
+	float* q;
+	const float* q_prev;
+	const float* u;
+	const float* v;
+	const float* w;
+	float dt;
+};
+
+static void advect_planes(fluids3d_context_t* const ctx, int k_begin,
+	int k_end, int thread, void* const vp)
+{
+	const struct advect_args* const a = vp;
+	struct simd_grid_3d grid = { ctx->origin_x, ctx->origin_y,
+		ctx->origin_z, ctx->dx, ctx->cell_count_i, ctx->cell_count_j,
+		ctx->cell_count_k };
+	int j = 0, k = 0;
+	int idx = 0;
+
+	for (k = k_begin; k < k_end; k++) {
+		for (j = 1; j < ctx->cell_count_j - 1; j++) {
+			idx = IDX(1, j, k);
+			ctx->kernels->advect_3d(a->q + idx, a->q_prev,
+				a->u + idx, a->v + idx, a->w + idx,
+				ctx->cell_count_i - 2, 1, j, k, &grid, a->dt);
+		}
+	}
+}
+
+void fluids3d_advect(fluids3d_context_t* const ctx, float* const q,
+	const float* const q_prev, const float* const u, const float* const v,
+	const float* const w, int boundary, float dt)
+{
+	struct advect_args a = { q, q_prev, u, v, w, dt };
+
+	parallel_for_planes(ctx, advect_planes, &a);
+	set_boundary(ctx, q, boundary);
+}
+
+/* red-black sweeps */
+
+struct sor_args {
+	float* x;
+	const float* b;
+	float a;	/* omega / (6 + k) */
+	float c;	/* scale of b */
+	float w;	/* 1 - omega */
+};
+
+/* updates the inner cells of plane [k] of the given color, i.e. those with
+** i + j + k = color mod 2 */
+static void sor_plane(fluids3d_context_t* const ctx,
+	const struct sor_args* const sa, int k, int color)
+{
+	int j = 0;
+	int idx = 0;
+
+	for (j = 1; j < ctx->cell_count_j - 1; j++) {
+		idx = IDX(1, j, k);
+		ctx->kernels->sor_3d(sa->x + idx, sa->b + idx,
+			ctx->cell_count_i - 2, ctx->cell_count_i, PLANE_SIZE,
+			(1 + j + k + color) % 2, sa->a, sa->c, sa->w);
+	}
+}
+
+/* the planes of slab [s] */
+static void slab_planes(fluids3d_context_t* const ctx, int s,
+	int* const k_begin, int* const k_end)
+{
+	*k_begin = 1 + s * SLAB_PLANE_COUNT;
+	*k_end = *k_begin + SLAB_PLANE_COUNT;
+	*k_end = *k_end > ctx->cell_count_k - 1 ? ctx->cell_count_k - 1 :
+		*k_end;
+}
+
+/* Red cells of all planes of a slab and black cells of the planes between
+** its first and last one. The black cells of plane k - 1 follow the red
+** cells of plane k, which are all they read from the current sweep, so
+** the slab is swept once. The first and the last plane read red cells of
+** the neighboring slabs, which other threads may update meanwhile. */
+static void sor_slabs(fluids3d_context_t* const ctx, int s_begin, int s_end,
+	int thread, void* const vp)
+{
+	const struct sor_args* const sa = vp;
+	int k = 0, k_begin = 0, k_end = 0, s = 0;
+
+	for (s = s_begin; s < s_end; s++) {
+		slab_planes(ctx, s, &k_begin, &k_end);
+
+		for (k = k_begin; k < k_end; k++) {
+			sor_plane(ctx, sa, k, 0);
+
+			if (k - 1 > k_begin) {
+				sor_plane(ctx, sa, k - 1, 1);
+			}
+		}
+	}
+}
+
+/* black cells of the first and the last plane of each slab */
+static void sor_slab_ends(fluids3d_context_t* const ctx, int s_begin,
+	int s_end, int thread, void* const vp)
+{
+	const struct sor_args* const sa = vp;
+	int k_begin = 0, k_end = 0, s = 0;
+
+	for (s = s_begin; s < s_end; s++) {
+		slab_planes(ctx, s, &k_begin, &k_end);
+		sor_plane(ctx, sa, k_begin, 1);
+
+		if (k_end - 1 > k_begin) {
+			sor_plane(ctx, sa, k_end - 1, 1);
+		}
+	}
+}
+
+/* Red-black successive over-relaxation on the system
+** (6 + k) x - sum(x_nb) = c b. Each sweep updates the red cells, then the
+** black cells, which only depend on the cells of the other color, and
+** sets the boundary. The slabs are swept in parallel. */
+static void sor_red_black(fluids3d_context_t* const ctx, float* const x,
+	const float* const b, float c, float k, float omega, int boundary,
+	int sweep_count)
+{
+	int s = 0;
+	int slab_count = (ctx->cell_count_k - 2 + SLAB_PLANE_COUNT - 1) /
+		SLAB_PLANE_COUNT;
+	struct sor_args a = { x, b, omega / (6.0 + k), c, 1.0 - omega };
+
+	for (s = 0; s < sweep_count; s++) {
+		parallel_for(ctx, sor_slabs, &a, 0, slab_count);
+		parallel_for(ctx, sor_slab_ends, &a, 0, slab_count);
+		set_boundary(ctx, x, boundary);
+	}
+}
+
+/* Returns the over-relaxation factor of the pressure solve. If none is
+** set, the optimal factor is derived from the spectral radius of the
+** Jacobi iteration. */
+static float sor_omega(fluids3d_context_t* const ctx)
+{
+	float rho = 0.0;
+
+	if (ctx->sor_omega > 0.0) {
+		return ctx->sor_omega;
+	}
+
+	rho = (cosf(PI / (ctx->cell_count_i - 2)) +
+		cosf(PI / (ctx->cell_count_j - 2)) +
+		cosf(PI / (ctx->cell_count_k - 2))) / 3.0;
+	return 2.0 / (1.0 + sqrtf(1.0 - rho * rho));
+}
+
+/* diffusion */
+
+void fluids3d_diffuse(fluids3d_context_t* const ctx, float* const q,
+	const float* const q_prev, float diff, int iteration_count,
+	int boundary, float dt)
+{
+	size_t value_count = VALUE_COUNT;
+	size_t i = 0;
+	float r = diff * dt / (ctx->dx * ctx->dx);
+
+	for (i = 0; i < value_count; i++) {
+		q[i] = q_prev[i];
+	}
+
+	/* (1 + 6r) q - r sum(q_nb) = q_prev, scaled by 1 / r */
+	if (r > 0.0) {
+		sor_red_black(ctx, q, q_prev, 1.0 / r, 1.0 / r, 1.0, boundary,
+			iteration_count);
+	}
+}
+
+/* projection */
+
+struct project_args {
+	float* u;
+	float* v;
+	float* w;
+	float* p;
+	float* div;
+	float s;	/* scale of the divergence */
+	float maxs[THREADS_MAX_COUNT];
+};
+
+static void divergence_planes(fluids3d_context_t* const ctx, int k_begin,
+	int k_end, int thread, void* const vp)
+{
+	struct project_args* const a = vp;
+	int j = 0, k = 0;
+	int idx = 0;
+	float m = 0.0;
+
+	for (k = k_begin; k < k_end; k++) {
+		for (j = 1; j < ctx->cell_count_j - 1; j++) {
+			idx = IDX(1, j, k);
+			m = ctx->kernels->divergence_3d(a->div + idx,
+				a->u + idx, a->v + idx, a->w + idx,
+				ctx->cell_count_i - 2, ctx->cell_count_i,
+				PLANE_SIZE, a->s);
+			a->maxs[thread] = m > a->maxs[thread] ? m :
+				a->maxs[thread];
+		}
+	}
+}
+
+static void subtract_gradient_planes(fluids3d_context_t* const ctx,
+	int k_begin, int k_end, int thread, void* const vp)
+{
+	const struct project_args* const a = vp;
+	int j = 0, k = 0;
+	int idx = 0;
+
+	for (k = k_begin; k < k_end; k++) {
+		for (j = 1; j < ctx->cell_count_j - 1; j++) {
+			idx = IDX(1, j, k);
+			ctx->kernels->subtract_gradient_3d(a->u + idx,
+				a->v + idx, a->w + idx, a->p + idx,
+				ctx->cell_count_i - 2, ctx->cell_count_i,
+				PLANE_SIZE, 0.5 / ctx->dx);
+		}
+	}
+}
+
+void fluids3d_project(fluids3d_context_t* const ctx, float* const u,
+	float* const v, float* const w, float* const p, float* const div,
+	int iteration_count)
+{
+	struct project_args a = { u, v, w, p, div, -0.5 * ctx->dx };
+
+	/* compute the (scaled) divergence */
+	parallel_for_planes(ctx, divergence_planes, &a);
+	set_boundary(ctx, div, FLUIDS3D_BOUNDARY_NN);
+
+	/* compute pressure */
+	fluids3d_set(ctx, p, 0.0);
+	sor_red_black(ctx, p, div, 1.0, 0.0, sor_omega(ctx),
+		FLUIDS3D_BOUNDARY_NN, iteration_count);
+
+	/* subtract the pressure gradient */
+	parallel_for_planes(ctx, subtract_gradient_planes, &a);
+	set_boundary(ctx, u, FLUIDS3D_BOUNDARY_REFLECT_U);
+	set_boundary(ctx, v, FLUIDS3D_BOUNDARY_REFLECT_V);
+	set_boundary(ctx, w, FLUIDS3D_BOUNDARY_REFLECT_W);
+}
+
+float fluids3d_get_max_divergence(fluids3d_context_t* const ctx,
+	const float* const u, const float* const v, const float* const w,
+	float* const div)
+{
+	int t = 0;
+	float max_div = 0.0;
+	struct project_args a = { (float*)u, (float*)v, (float*)w, NULL, div,
+		0.5 / ctx->dx };
+
+	parallel_for_planes(ctx, divergence_planes, &a);
+
+	for (t = 0; t < THREADS_MAX_COUNT; t++) {
+		max_div = a.maxs[t] > max_div ? a.maxs[t] : max_div;
+	}
+
+	return max_div;
+}
+
+/* vorticity confinement */
+
+struct vorticity_args {
+	float* u;
+	float* v;
+	float* w;
+	float* cx;
+	float* cy;
+	float* cz;
+	float* cm;
+	float a;
+	float b;
+};
+
+static void curl_planes(fluids3d_context_t* const ctx, int k_begin,
+	int k_end, int thread, void* const vp)
+{
+	const struct vorticity_args* const a = vp;
+	int j = 0, k = 0;
+	int idx = 0;
+
+	for (k = k_begin; k < k_end; k++) {
+		for (j = 1; j < ctx->cell_count_j - 1; j++) {
+			idx = IDX(1, j, k);
+			ctx->kernels->curl_3d(a->cx + idx, a->cy + idx,
+				a->cz + idx, a->cm + idx, a->u + idx,
+				a->v + idx, a->w + idx, ctx->cell_count_i - 2,
+				ctx->cell_count_i, PLANE_SIZE, a->a);
+		}
+	}
+}
+
+static void vorticity_force_planes(fluids3d_context_t* const ctx,
+	int k_begin, int k_end, int thread, void* const vp)
+{
+	const struct vorticity_args* const a = vp;
+	int j = 0, k = 0;
+	int idx = 0;
+
+	for (k = k_begin; k < k_end; k++) {
+		for (j = 1; j < ctx->cell_count_j - 1; j++) {
+			idx = IDX(1, j, k);
+			ctx->kernels->vorticity_force_3d(a->u + idx,
+				a->v + idx, a->w + idx, a->cx + idx,
+				a->cy + idx, a->cz + idx, a->cm + idx,
+				ctx->cell_count_i - 2, ctx->cell_count_i,
+				PLANE_SIZE, a->a, a->b);
+		}
+	}
+}
+
+void fluids3d_add_vorticity_confinement(fluids3d_context_t* const ctx,
+	float* const u, float* const v, float* const w, float* const vorticity,
+	float eps, float dt)
+{
+	size_t value_count = VALUE_COUNT;
+	void* vp = NULL;
+	struct vorticity_args a = { u, v, w, NULL, NULL, NULL, vorticity,
+		1.0 / (2.0 * ctx->dx), eps * dt * ctx->dx };
+
+	if (!ctx->curl) {
+		if (posix_memalign(&vp, ARENA_ALIGNMENT,
+			3 * sizeof(float) * value_count)) {
+			return;
+		}
+
+		ctx->curl = vp;
+	}
+
+	a.cx = ctx->curl;
+	a.cy = ctx->curl + value_count;
+	a.cz = ctx->curl + 2 * value_count;
+
+	/* compute vorticity, its magnitude gets a boundary for the gradient */
+	parallel_for_planes(ctx, curl_planes, &a);
+	set_boundary(ctx, vorticity, FLUIDS3D_BOUNDARY_NN);
+
+	/* add contribution of vorticity confinement to the velocity */
+	parallel_for_planes(ctx, vorticity_force_planes, &a);
+}
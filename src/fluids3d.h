@@ -0,0 +1,148 @@
+/*******************************************************************************
+** fluids3d.h
+**
+** Declares the "Stable Fluids" routines of fluids.h for three dimensional
+** grids.
+**
+** Some notes:
+** 	- Fluid quantity fields are float arrays of whole planes of cells,
+** 	  cell (i, j, k) is at fluids3d_get_index(ctx, i, j, k)
+** 	- The routines are split across the threads of fluids_set_thread_count
+** 	  for grids of 40000 cells or more
+*******************************************************************************/
+#ifndef FLUIDS3D_H
+#define FLUIDS3D_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/******************************************************************************
+** Fluid Context
+******************************************************************************/
+/* The grid and the work arrays of a simulation. As with fluids_context_t,
+** simulations on different contexts may run at the same time on different
+** threads, the routines of a single context may not. */
+typedef struct fluids3d_context fluids3d_context_t;
+
+/* Creates a context for a grid of [sample_count_i] x [sample_count_j] x
+** [sample_count_k] cells of spacing [dx] at ([origin_x], [origin_y],
+** [origin_z]). The outermost cells are the boundary of the grid, as with
+** fluids_set_grid. */
+fluids3d_context_t* fluids3d_context_create(float origin_x, float origin_y,
+	float origin_z, float dx, int sample_count_i, int sample_count_j,
+	int sample_count_k);
+
+/* Releases a context and its work arrays. */
+void fluids3d_context_destroy(fluids3d_context_t* const ctx);
+
+/******************************************************************************
+** Fluid Grid
+******************************************************************************/
+/* Gets the index of cell (i, j, k) in a field. */
+int fluids3d_get_index(const fluids3d_context_t* const ctx, int i, int j,
+	int k);
+
+/* Samples a field [q] at a point (x, y, z) in space. Uses trilinear
+** interpolation. */
+float fluids3d_sample(const fluids3d_context_t* const ctx,
+	const float* const q, float x, float y, float z);
+
+/* Creates a field with all values set to [c]. The array starts at a 64 byte
+** boundary and is released with free. */
+float* fluids3d_malloc(const fluids3d_context_t* const ctx, float c);
+
+/* Sets values of [q] to [c]. */
+void fluids3d_set(const fluids3d_context_t* const ctx, float* const q,
+	float c);
+
+/* Sets the values of [q] using a function [fn] of the cell positions. */
+void fluids3d_set_with_function(const fluids3d_context_t* const ctx,
+	float* const q, float (*fn)(float x, float y, float z, void* const vp),
+	void* const vp);
+
+/******************************************************************************
+** Boundary Handling
+******************************************************************************/
+/* Boundary handling of a field, see FLUIDS_BOUNDARY_*. The boundary cells
+** copy their inner neighbor, the velocity component normal to a boundary
+** is negated instead. */
+enum {
+	FLUIDS3D_BOUNDARY_NN = 0,
+	FLUIDS3D_BOUNDARY_REFLECT_U,
+	FLUIDS3D_BOUNDARY_REFLECT_V,
+	FLUIDS3D_BOUNDARY_REFLECT_W
+};
+
+/******************************************************************************
+** Solver Settings
+******************************************************************************/
+/* Sets the over-relaxation factor [omega] in (0, 2) of the pressure solve.
+** With [omega] = 0 (default) the optimal factor for the grid is used. */
+void fluids3d_set_sor_omega(fluids3d_context_t* const ctx, float omega);
+
+/******************************************************************************
+** Sources
+******************************************************************************/
+/* Adds a source to [q], i.e. q += [alpha] s for each cell. */
+void fluids3d_add_source(fluids3d_context_t* const ctx, float* const q,
+	const float* const source, float alpha);
+
+/******************************************************************************
+** Fluid Advection, Diffusion and Projection
+******************************************************************************/
+/* Advects [q_prev] according to the velocity field (u, v, w) for a time
+** step [dt] and stores the result in [q], sampled trilinearly. */
+void fluids3d_advect(fluids3d_context_t* const ctx, float* const q,
+	const float* const q_prev, const float* const u, const float* const v,
+	const float* const w, int boundary, float dt);
+
+/* Diffuses [q_prev] with rate [diff] for a time step [dt] and stores the
+** result in [q]. Runs [iteration_count] red-black Gauss-Seidel sweeps on
+** the implicit system, starting from [q_prev]. */
+void fluids3d_diffuse(fluids3d_context_t* const ctx, float* const q,
+	const float* const q_prev, float diff, int iteration_count,
+	int boundary, float dt);
+
+/* Makes the velocity field ([u], [v], [w]) divergence free, as
+** fluids_project does with the boundaries FLUIDS3D_BOUNDARY_REFLECT_*.
+** [div] and [p] store the divergence before projection and the pressure,
+** which is solved for with [iteration_count] sweeps of red-black SOR. A
+** sweep passes over the grid once: the grid is cut into slabs of planes,
+** and the black cells of a plane are updated right after the red cells of
+** the plane above it, while the planes are still in cache. */
+void fluids3d_project(fluids3d_context_t* const ctx, float* const u,
+	float* const v, float* const w, float* const p, float* const div,
+	int iteration_count);
+
+/******************************************************************************
+** Buoyancy and Vorticity Confinement
+******************************************************************************/
+/* Same as fluids_add_buoyancy, the buoyancy acts on [v]. */
+void fluids3d_add_buoyancy(fluids3d_context_t* const ctx, float* const v,
+	const float* const smoke_dens, const float* const temperatures,
+	float alpha, float beta, float temp_ambient, float dt);
+
+/* Adds vorticity confinement to the velocity field ([u], [v], [w]), with
+** the force eps dx (N x omega) of the vorticity omega = curl(u, v, w) and
+** the normalized gradient N of its magnitude. The magnitude is stored in
+** [vorticity], the vorticity itself is kept in the context. */
+void fluids3d_add_vorticity_confinement(fluids3d_context_t* const ctx,
+	float* const u, float* const v, float* const w, float* const vorticity,
+	float eps, float dt);
+
+/******************************************************************************
+** Statistics
+******************************************************************************/
+/* Gets the max. divergence of the velocity field ([u], [v], [w]). Stores the
+** divergence per cell in [div]. */
+float fluids3d_get_max_divergence(fluids3d_context_t* const ctx,
+	const float* const u, const float* const v, const float* const w,
+	float* const div);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard: FLUIDS3D_H */
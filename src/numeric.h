@@ -0,0 +1,13 @@
+/* numeric constants the solvers share */
+#ifndef NUMERIC_H
+#define NUMERIC_H
+
+#include <float.h>
+
+/* a small float. mainly to avoid division by zero */
+#define EPS FLT_MIN
+
+#define MIC_TUNING 0.97		/* modified incomplete Cholesky blend */
+#define MIC_SAFETY 0.25		/* fallback to incomplete Cholesky below */
+
+#endif /* end of include guard: NUMERIC_H */
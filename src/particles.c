@@ -1,134 +1,444 @@
 #include "particles.h"
 #include "fluids.h"
+#include "threads.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <math.h>
 
-static float* g_positions = NULL;
-static float* g_lifetimes = NULL;
-static float g_particle_lifetime = 1.0;		/* particle lifetime in sec */
-static unsigned int g_particle_count = 0;
-static unsigned int g_particle_capacity = 0;
-static unsigned int g_start_index = 0;		/* reference to the beginning
-						** of a particles quantity array
-						*/
-
-static float g_emitter_x = 0.0;
-static float g_emitter_y = 0.0;
-static float g_emitter_r = 1.0;
-
-/* reallocates positions for [n] new particles if needed. */
-static void particles_realloc(unsigned int n)
-{
-	if (!g_positions) {
-		g_positions = calloc(n, 2 * n * sizeof(*g_positions));
-		g_lifetimes = calloc(n, sizeof(*g_lifetimes));
-		g_particle_capacity = n;
+struct particles_context {
+	float* xs;
+	float* ys;
+	float* lifetimes;
+	float* xs_back;			/* compaction targets */
+	float* ys_back;
+	float* lifetimes_back;
+	unsigned int* block_counts;	/* live particles per block, then
+					** their offsets */
+	float particle_lifetime;	/* particle lifetime in sec */
+	unsigned int particle_count;	/* live and expired particles */
+	unsigned int live_count;
+	unsigned int particle_capacity;
+	unsigned int compaction_interval;
+	unsigned int step_count;	/* steps since the last compaction */
+	float emitter_x;
+	float emitter_y;
+	float emitter_r;
+};
+
+#define PARTICLES_BATCH_COUNT 256	/* particles sampled at a time */
+#define PARTICLES_BLOCK_COUNT 16384	/* particles per block of the
+					** compaction */
+#define PARTICLES_PARALLEL_MIN_COUNT 40000	/* fewer particles run
+						** serially */
+
+/* no particles, lifetime 1 sec., compaction every step, unit emitter at the
+** origin */
+#define CONTEXT_DEFAULTS { NULL, NULL, NULL, NULL, NULL, NULL, NULL, 1.0, \
+	0, 0, 0, 1, 0, 0.0, 0.0, 1.0 }
+
+static const particles_context_t g_context_defaults = CONTEXT_DEFAULTS;
+
+/* the context of the routines without context argument */
+static particles_context_t g_context = CONTEXT_DEFAULTS;
+
+/* Gets the number of blocks of [n] particles. */
+static unsigned int block_count(unsigned int n)
+{
+	return (n + PARTICLES_BLOCK_COUNT - 1) / PARTICLES_BLOCK_COUNT;
+}
+
+/* reallocates the arrays for [n] new particles if needed. */
+static void particles_realloc(particles_context_t* const ctx, unsigned int n)
+{
+	if (ctx->particle_count + n <= ctx->particle_capacity) {
+		return;
 	}
-	
-	while ((g_particle_count + n) > g_particle_capacity) {
-		g_particle_capacity *= 2;
-		g_positions = realloc(g_positions,
-			sizeof(*g_positions) * 2 * g_particle_capacity);
-		g_lifetimes = realloc(g_lifetimes,
-			g_particle_capacity * sizeof(*g_lifetimes));
+
+	if (ctx->particle_capacity == 0) {
+		ctx->particle_capacity = n;
+	}
+
+	while ((ctx->particle_count + n) > ctx->particle_capacity) {
+		ctx->particle_capacity *= 2;
 	}
-	
-	assert(g_positions);
-	assert(g_lifetimes);
+
+	ctx->xs = realloc(ctx->xs,
+		ctx->particle_capacity * sizeof(*ctx->xs));
+	ctx->ys = realloc(ctx->ys,
+		ctx->particle_capacity * sizeof(*ctx->ys));
+	ctx->lifetimes = realloc(ctx->lifetimes,
+		ctx->particle_capacity * sizeof(*ctx->lifetimes));
+	ctx->block_counts = realloc(ctx->block_counts,
+		block_count(ctx->particle_capacity) *
+		sizeof(*ctx->block_counts));
+
+	/* reallocated with the next compaction */
+	free(ctx->xs_back);
+	free(ctx->ys_back);
+	free(ctx->lifetimes_back);
+	ctx->xs_back = NULL;
+	ctx->ys_back = NULL;
+	ctx->lifetimes_back = NULL;
+
+	assert(ctx->xs);
+	assert(ctx->ys);
+	assert(ctx->lifetimes);
+	assert(ctx->block_counts);
 	return;
 }
 
+/* Runs [fn] for the blocks of the [particle_count] particles of [ctx], on
+** the worker threads of fluids_set_thread_count for many particles. */
+static void particles_for(particles_context_t* const ctx,
+	void (*fn)(int begin, int end, int thread, void* const vp),
+	void* const vp)
+{
+	int n = block_count(ctx->particle_count);
+
+	if (ctx->particle_count < PARTICLES_PARALLEL_MIN_COUNT) {
+		(*fn)(0, n, 0, vp);
+		return;
+	}
+
+	threads_for(fn, vp, 0, n);
+}
+
 void particles_initialize()
 {
 
 }
 
-void particles_set_emitter(float x, float y, float r)
+particles_context_t* particles_context_create()
 {
-	g_emitter_x = x;
-	g_emitter_y = y;
-	g_emitter_r = r;
+	particles_context_t* ctx = malloc(sizeof(*ctx));
+
+	if (!ctx) {
+		return NULL;
+	}
+
+	*ctx = g_context_defaults;
+	return ctx;
 }
 
-void particles_set_lifetime(float lifetime)
+static void particles_free(particles_context_t* const ctx)
 {
-	g_particle_lifetime = lifetime;
+	free(ctx->xs);
+	free(ctx->ys);
+	free(ctx->lifetimes);
+	free(ctx->xs_back);
+	free(ctx->ys_back);
+	free(ctx->lifetimes_back);
+	free(ctx->block_counts);
 }
 
-void particles_emit(unsigned int particle_count)
+void particles_context_destroy(particles_context_t* const ctx)
+{
+	particles_free(ctx);
+	free(ctx);
+}
+
+particles_context_t* particles_get_context()
+{
+	return &g_context;
+}
+
+void particles_context_set_emitter(particles_context_t* const ctx, float x, 
+	float y, float r)
+{
+	ctx->emitter_x = x;
+	ctx->emitter_y = y;
+	ctx->emitter_r = r;
+}
+
+void particles_context_set_lifetime(particles_context_t* const ctx, 
+	float lifetime)
 {
-	float dx = sqrtf(g_emitter_r * g_emitter_r / particle_count);
-	float x0 = g_emitter_x;
-	float y0 = g_emitter_y;
+	ctx->particle_lifetime = lifetime;
+}
+
+void particles_context_set_compaction_interval(particles_context_t* const ctx,
+	unsigned int step_count)
+{
+	ctx->compaction_interval = step_count;
+}
+
+void particles_context_emit(particles_context_t* const ctx, 
+	unsigned int particle_count)
+{
+	float r = ctx->emitter_r;
+	float dx = 0.0;
+	float x0 = ctx->emitter_x;
+	float y0 = ctx->emitter_y;
 	float x, y;
 	unsigned int i = 0, j = 0;
-	unsigned int max = ceilf(2.0 * g_emitter_r / dx);
+	unsigned int max = 0;
 	unsigned int idx = 0;
-	
-	particles_realloc(max * max);
-	
+
+	if (particle_count == 0) {
+		return;
+	}
+
+	dx = sqrtf(r * r / particle_count);
+	max = ceilf(2.0 * r / dx);
+	particles_realloc(ctx, max * max);
+
 	for (i = 0; i < max; i++) {
 		for (j = 0; j < max; j++) {
-			idx = (g_start_index + g_particle_count) %
-				g_particle_capacity;
-			x = i * dx - g_emitter_r;
-			y = j * dx - g_emitter_r;
-			
-			if ((x * x + y * y) <= (g_emitter_r * g_emitter_r)) {
-				g_positions[2 * idx + 0] = x0 + x;
-				g_positions[2 * idx + 1] = y0 + y;
-				g_lifetimes[idx] = g_particle_lifetime;
-				g_particle_count++;
+			idx = ctx->particle_count;
+			x = i * dx - r;
+			y = j * dx - r;
+
+			if ((x * x + y * y) <= (r * r)) {
+				ctx->xs[idx] = x0 + x;
+				ctx->ys[idx] = y0 + y;
+				ctx->lifetimes[idx] = ctx->particle_lifetime;
+				ctx->particle_count++;
+				ctx->live_count++;
 			}
 		}
 	}
 }
 
-float* particles_get_positions()
+float* particles_context_get_x_positions(particles_context_t* const ctx)
 {
-	return g_positions;
+	return ctx->xs;
 }
 
-float* particles_get_lifetimes()
+float* particles_context_get_y_positions(particles_context_t* const ctx)
 {
-	return g_lifetimes;
+	return ctx->ys;
 }
 
-unsigned int particles_get_count()
+float* particles_context_get_lifetimes(particles_context_t* const ctx)
 {
-	return g_particle_capacity;
+	return ctx->lifetimes;
 }
 
-void particles_advect(const float* const u, const float* const v, float dt)
+unsigned int particles_context_get_count(particles_context_t* const ctx)
 {
-	unsigned int i = 0;
-	float vel_x, vel_y;
-	unsigned int idx = 0;
-	unsigned int si = g_start_index;
-	
-	for (i = 0; i < g_particle_count; i++) {
-		idx = (si + i) % g_particle_capacity;
-		
-		vel_x = fluids_sample(u, g_positions[2 *idx + 0],
-			g_positions[2 * idx + 1]);
-		vel_y = fluids_sample(v, g_positions[2 * idx + 0],
-			g_positions[2 * idx + 1]);
-		g_positions[2 * idx + 0] += vel_x * dt;
-		g_positions[2 * idx + 1] += vel_y * dt;
-		g_lifetimes[idx] -= dt;
-		
-		if (g_lifetimes[idx] < 0.0) {
-			g_start_index = (g_start_index + 1) %
-				g_particle_capacity;
-			g_particle_count--;
+	return ctx->particle_count;
+}
+
+unsigned int particles_context_get_live_count(particles_context_t* const ctx)
+{
+	return ctx->live_count;
+}
+
+struct advect_args {
+	particles_context_t* ctx;
+	fluids_context_t* fluids;
+	const float* u;
+	const float* v;
+	float dt;
+};
+
+static void advect_blocks(int b_begin, int b_end, int thread,
+	void* const vp)
+{
+	const struct advect_args* const a = vp;
+	particles_context_t* const ctx = a->ctx;
+	unsigned int b = 0, i = 0, k = 0, end = 0, n = 0, live = 0;
+	float vel_x[PARTICLES_BATCH_COUNT], vel_y[PARTICLES_BATCH_COUNT];
+
+	for (b = b_begin; b < (unsigned int)b_end; b++) {
+		end = (b + 1) * PARTICLES_BLOCK_COUNT;
+		end = end < ctx->particle_count ? end : ctx->particle_count;
+		live = 0;
+
+		for (k = b * PARTICLES_BLOCK_COUNT; k < end; k += n) {
+			n = end - k < PARTICLES_BATCH_COUNT ? end - k :
+				PARTICLES_BATCH_COUNT;
+			fluids_context_sample_vector_batch(a->fluids, a->u,
+				a->v, ctx->xs + k, ctx->ys + k, vel_x, vel_y,
+				n);
+
+			for (i = 0; i < n; i++) {
+				ctx->xs[k + i] += vel_x[i] * a->dt;
+				ctx->ys[k + i] += vel_y[i] * a->dt;
+				ctx->lifetimes[k + i] -= a->dt;
+				live += ctx->lifetimes[k + i] >= 0.0;
+			}
 		}
+
+		ctx->block_counts[b] = live;
+	}
+}
+
+void particles_context_advect(particles_context_t* const ctx, 
+	fluids_context_t* const fluids, const float* const u, 
+	const float* const v, float dt)
+{
+	struct advect_args a = { ctx, fluids, u, v, dt };
+	unsigned int b = 0;
+
+	particles_for(ctx, advect_blocks, &a);
+	ctx->live_count = 0;
+
+	for (b = 0; b < block_count(ctx->particle_count); b++) {
+		ctx->live_count += ctx->block_counts[b];
+	}
+
+	ctx->step_count++;
+
+	if (ctx->compaction_interval > 0 &&
+		ctx->step_count >= ctx->compaction_interval) {
+		particles_context_compact(ctx);
 	}
 }
 
+/* copies the live particles of each block to their offset in the back
+** arrays */
+static void compact_blocks(int b_begin, int b_end, int thread,
+	void* const vp)
+{
+	particles_context_t* const ctx = vp;
+	unsigned int b = 0, k = 0, end = 0, idx = 0;
+
+	for (b = b_begin; b < (unsigned int)b_end; b++) {
+		end = (b + 1) * PARTICLES_BLOCK_COUNT;
+		end = end < ctx->particle_count ? end : ctx->particle_count;
+		idx = ctx->block_counts[b];
+
+		for (k = b * PARTICLES_BLOCK_COUNT; k < end; k++) {
+			if (ctx->lifetimes[k] < 0.0) {
+				continue;
+			}
+
+			ctx->xs_back[idx] = ctx->xs[k];
+			ctx->ys_back[idx] = ctx->ys[k];
+			ctx->lifetimes_back[idx] = ctx->lifetimes[k];
+			idx++;
+		}
+	}
+}
+
+/* counts the live particles of each block */
+static void count_blocks(int b_begin, int b_end, int thread, void* const vp)
+{
+	particles_context_t* const ctx = vp;
+	unsigned int b = 0, k = 0, end = 0, live = 0;
+
+	for (b = b_begin; b < (unsigned int)b_end; b++) {
+		end = (b + 1) * PARTICLES_BLOCK_COUNT;
+		end = end < ctx->particle_count ? end : ctx->particle_count;
+		live = 0;
+
+		for (k = b * PARTICLES_BLOCK_COUNT; k < end; k++) {
+			live += ctx->lifetimes[k] >= 0.0;
+		}
+
+		ctx->block_counts[b] = live;
+	}
+}
+
+void particles_context_compact(particles_context_t* const ctx)
+{
+	unsigned int b = 0, offset = 0, live = 0;
+	float* t = NULL;
+
+	ctx->step_count = 0;
+
+	if (ctx->particle_count == 0) {
+		return;
+	}
+
+	if (!ctx->xs_back) {
+		ctx->xs_back = malloc(ctx->particle_capacity *
+			sizeof(*ctx->xs_back));
+		ctx->ys_back = malloc(ctx->particle_capacity *
+			sizeof(*ctx->ys_back));
+		ctx->lifetimes_back = malloc(ctx->particle_capacity *
+			sizeof(*ctx->lifetimes_back));
+		assert(ctx->xs_back);
+		assert(ctx->ys_back);
+		assert(ctx->lifetimes_back);
+	}
+
+	/* particles emitted since the last step are counted as well, the
+	** live counts of the blocks turn into their offsets */
+	particles_for(ctx, count_blocks, ctx);
+
+	for (b = 0; b < block_count(ctx->particle_count); b++) {
+		live = ctx->block_counts[b];
+		ctx->block_counts[b] = offset;
+		offset += live;
+	}
+
+	particles_for(ctx, compact_blocks, ctx);
+
+	t = ctx->xs;
+	ctx->xs = ctx->xs_back;
+	ctx->xs_back = t;
+	t = ctx->ys;
+	ctx->ys = ctx->ys_back;
+	ctx->ys_back = t;
+	t = ctx->lifetimes;
+	ctx->lifetimes = ctx->lifetimes_back;
+	ctx->lifetimes_back = t;
+	ctx->particle_count = offset;
+	ctx->live_count = offset;
+}
+
 void particles_finalize()
 {
-	free(g_positions);
-	free(g_lifetimes);
-}
\ No newline at end of file
+	particles_free(&g_context);
+	g_context = g_context_defaults;
+}
+
+/* default context */
+
+void particles_set_emitter(float x, float y, float r)
+{
+	particles_context_set_emitter(&g_context, x, y, r);
+}
+
+void particles_set_lifetime(float lifetime)
+{
+	particles_context_set_lifetime(&g_context, lifetime);
+}
+
+void particles_set_compaction_interval(unsigned int step_count)
+{
+	particles_context_set_compaction_interval(&g_context, step_count);
+}
+
+void particles_emit(unsigned int particle_count)
+{
+	particles_context_emit(&g_context, particle_count);
+}
+
+float* particles_get_x_positions()
+{
+	return particles_context_get_x_positions(&g_context);
+}
+
+float* particles_get_y_positions()
+{
+	return particles_context_get_y_positions(&g_context);
+}
+
+float* particles_get_lifetimes()
+{
+	return particles_context_get_lifetimes(&g_context);
+}
+
+unsigned int particles_get_count()
+{
+	return particles_context_get_count(&g_context);
+}
+
+unsigned int particles_get_live_count()
+{
+	return particles_context_get_live_count(&g_context);
+}
+
+void particles_advect(const float* const u, const float* const v, float dt)
+{
+	particles_context_advect(&g_context, fluids_get_context(), u, v, dt);
+}
+
+void particles_compact()
+{
+	particles_context_compact(&g_context);
+}
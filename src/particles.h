@@ -2,6 +2,8 @@
 #ifndef PARTICLES_H
 #define PARTICLES_H
 
+#include "fluids.h"
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -17,26 +19,85 @@ void particles_set_emitter(float x, float y, float r);
 /* Sets the lifetime a particles initialized with. */
 void particles_set_lifetime(float lifetime);
 
+/* Sets the number of steps between compactions, see particles_compact. 1
+** (default) compacts after each particles_advect, 0 only on calls of
+** particles_compact. */
+void particles_set_compaction_interval(unsigned int step_count);
+
 /* Emits approx. [particle_count] particles within the emitter region. */
 void particles_emit(unsigned int particle_count);
 
-/* Gets the positions of the particles. Particle positons in both dimensions are
-** tightly packed in a float array. */
-float* particles_get_positions();
+/* Gets the x and y coordinates of the particles. Particle i is at
+** (x[i], y[i]) with lifetime lifetimes[i], for i < particles_get_count().
+** The arrays may move with particles_emit and particles_compact. */
+float* particles_get_x_positions();
+float* particles_get_y_positions();
 
 /* Gets the lifetime for each particle */
 float* particles_get_lifetimes();
 
-/* Get the current amount of particles in the system. */
+/* Gets the number of particles in the arrays. These are the live particles
+** and, until the next compaction, the expired ones, whose lifetime is
+** negative. */
 unsigned int particles_get_count();
 
+/* Gets the number of live particles. */
+unsigned int particles_get_live_count();
+
 /* Advects particles according to an underlying velocity field ([u], [v]) for
-** a timestep [dt]. */
+** a timestep [dt]. The velocity is sampled with fluids_sample_vector_batch
+** and the particles are split across the threads of
+** fluids_set_thread_count. */
 void particles_advect(const float* const u, const float* const v, float dt);
 
+/* Removes the expired particles, moving the live particles to the front of
+** the arrays in their order. */
+void particles_compact();
+
 /* Cleans up, when the particle subsystem is done. */
 void particles_finalize();
 
+/******************************************************************************
+** Particle Context
+******************************************************************************/
+/* The particles and the emitter of a simulation. The routines above operate
+** on a default context and advect its particles on the grid of the default
+** fluid context. Particles of different contexts may be emitted and 
+** advected at the same time on different threads. */
+typedef struct particles_context particles_context_t;
+
+/* Creates a context without particles. Returns NULL if the context cannot
+** be allocated. */
+particles_context_t* particles_context_create();
+
+/* Releases a context created with particles_context_create and its 
+** particles. */
+void particles_context_destroy(particles_context_t* const ctx);
+
+/* Gets the default context. */
+particles_context_t* particles_get_context();
+
+/* Same as the routines above without the particles_context_ prefix, for the
+** particles of [ctx]. particles_context_advect samples (u, v) on the grid of
+** [fluids]. */
+void particles_context_set_emitter(particles_context_t* const ctx, float x, 
+	float y, float r);
+void particles_context_set_lifetime(particles_context_t* const ctx, 
+	float lifetime);
+void particles_context_emit(particles_context_t* const ctx, 
+	unsigned int particle_count);
+void particles_context_set_compaction_interval(particles_context_t* const ctx,
+	unsigned int step_count);
+float* particles_context_get_x_positions(particles_context_t* const ctx);
+float* particles_context_get_y_positions(particles_context_t* const ctx);
+float* particles_context_get_lifetimes(particles_context_t* const ctx);
+unsigned int particles_context_get_count(particles_context_t* const ctx);
+unsigned int particles_context_get_live_count(particles_context_t* const ctx);
+void particles_context_advect(particles_context_t* const ctx, 
+	fluids_context_t* const fluids, const float* const u, 
+	const float* const v, float dt);
+void particles_context_compact(particles_context_t* const ctx);
+
 #ifdef __cplusplus
 }
 #endif
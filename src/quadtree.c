@@ -0,0 +1,1310 @@
+/* posix_memalign in strict ISO C modes */
+#define _POSIX_C_SOURCE 200112L
+
+#include "quadtree.h"
+#include "arena.h"
+#include "threads.h"
+#include "numeric.h"
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINK_MAX_COUNT 8		/* two neighbors per side at most */
+#define PARALLEL_MIN_LEAF_COUNT 40000	/* smaller trees run serially */
+#define SCRATCH_FIELD_COUNT 6
+
+/* sides of a leaf, children are numbered 2 * (row) + (column) */
+enum {
+	SIDE_LEFT = 0,
+	SIDE_RIGHT,
+	SIDE_BOTTOM,
+	SIDE_TOP
+};
+
+/* how a leaf of an adapted tree takes its values from the old tree */
+enum {
+	REMAP_KEEP = 0,		/* from leaf [src] */
+	REMAP_SPLIT,		/* from quadrant [quadrant] of leaf [src] */
+	REMAP_MERGE		/* mean of the children of node [src] */
+};
+
+struct node {
+	int child;	/* first of the four children, -1 for a leaf */
+	int leaf;	/* index of the values of a leaf, -1 for inner nodes */
+};
+
+struct leaf {
+	float x;	/* center */
+	float y;
+	float size;
+	int level;	/* 0 for the root cells */
+	int i;		/* position among the cells of its level */
+	int j;
+	int node;
+	int link_count;
+};
+
+/* a face between two leaves, as seen from one of them */
+struct link {
+	int leaf;	/* the neighbor */
+	int side;
+	float length;	/* of the face */
+	float weight;	/* length / distance of the centers */
+};
+
+struct remap {
+	int kind;
+	int src;
+	int quadrant;
+};
+
+struct quadtree {
+	float origin_x;		/* lower left corner of the domain */
+	float origin_y;
+	float dx;		/* size of the finest leaves */
+	int level_count;
+	int root_count_i;
+	int root_count_j;
+	struct node* nodes;	/* the roots first, row by row */
+	int node_count;
+	struct leaf* leaves;
+	struct link* links;	/* LINK_MAX_COUNT per leaf */
+	int leaf_count;
+	float* scratch;		/* SCRATCH_FIELD_COUNT fields */
+};
+
+/* leaf loops */
+
+typedef void (*leaves_fn_t)(int begin, int end, int thread, void* const vp);
+
+/* runs [fn] for [leaf_count] leaves in parallel, in a single band on the
+** calling thread for small trees */
+static void parallel_for_leaves(leaves_fn_t fn, void* const vp,
+	int leaf_count)
+{
+	if (leaf_count < PARALLEL_MIN_LEAF_COUNT) {
+		fn(0, leaf_count, 0, vp);
+		return;
+	}
+
+	threads_for(fn, vp, 0, leaf_count);
+}
+
+static double reduce_sum(const double* const sums)
+{
+	int t = 0;
+	double sum = 0.0;
+
+	for (t = 0; t < THREADS_MAX_COUNT; t++) {
+		sum += sums[t];
+	}
+
+	return sum;
+}
+
+static float reduce_max(const float* const maxs)
+{
+	int t = 0;
+	float m = 0.0;
+
+	for (t = 0; t < THREADS_MAX_COUNT; t++) {
+		m = maxs[t] > m ? maxs[t] : m;
+	}
+
+	return m;
+}
+
+static float* field_alloc(int leaf_count)
+{
+	void* vp = NULL;
+
+	if (posix_memalign(&vp, ARENA_ALIGNMENT, sizeof(float) *
+		(leaf_count > 0 ? leaf_count : 1))) {
+		return NULL;
+	}
+
+	return vp;
+}
+
+/* topology */
+
+/* finds the node of level [level] or the leaf above it that covers cell
+** ([i], [j]) of that level */
+static int locate(const quadtree_t* const qt, int i, int j, int level)
+{
+	int n = qt->root_count_i * (j >> level) + (i >> level);
+	int l = 0, b = 0;
+
+	for (l = 1; l <= level && qt->nodes[n].child >= 0; l++) {
+		b = level - l;
+		n = qt->nodes[n].child + ((i >> b) & 1) + 2 * ((j >> b) & 1);
+	}
+
+	return n;
+}
+
+/* finds the leaf a point lies in, points outside are moved onto the
+** domain */
+static int locate_point(const quadtree_t* const qt, float x, float y)
+{
+	int top = qt->level_count - 1;
+	int ni = qt->root_count_i << top, nj = qt->root_count_j << top;
+	int i = (int)floorf((x - qt->origin_x) / qt->dx);
+	int j = (int)floorf((y - qt->origin_y) / qt->dx);
+
+	i = i < 0 ? 0 : (i > ni - 1 ? ni - 1 : i);
+	j = j < 0 ? 0 : (j > nj - 1 ? nj - 1 : j);
+	return qt->nodes[locate(qt, i, j, top)].leaf;
+}
+
+/* fills the leaf table from the nodes below [n], a node of cell ([i],
+** [j]) of level [level] */
+static void index_node(quadtree_t* const qt, int n, int level, int i, int j)
+{
+	const struct node* const node = qt->nodes + n;
+	struct leaf* leaf = NULL;
+	int k = 0;
+
+	if (node->child >= 0) {
+		for (k = 0; k < 4; k++) {
+			index_node(qt, node->child + k, level + 1,
+				2 * i + (k & 1), 2 * j + (k >> 1));
+		}
+		return;
+	}
+
+	leaf = qt->leaves + node->leaf;
+	leaf->size = qt->dx * (1 << (qt->level_count - 1 - level));
+	leaf->x = qt->origin_x + (i + 0.5) * leaf->size;
+	leaf->y = qt->origin_y + (j + 0.5) * leaf->size;
+	leaf->level = level;
+	leaf->i = i;
+	leaf->j = j;
+	leaf->node = n;
+}
+
+static void add_link(quadtree_t* const qt, int c, int nb, int side,
+	float length)
+{
+	struct leaf* const leaf = qt->leaves + c;
+	struct link* const l = qt->links + LINK_MAX_COUNT * c +
+		leaf->link_count++;
+	float distance = 0.5 * (leaf->size + qt->leaves[nb].size);
+
+	l->leaf = nb;
+	l->side = side;
+	l->length = length;
+	l->weight = length / distance;
+}
+
+/* finds the faces of the leaves in [begin, end). a neighbor of the same
+** size or larger shares the whole side, the side is split between two
+** neighbors of half the size otherwise */
+static void links_leaves(int begin, int end, int thread, void* const vp)
+{
+	static const int di[4] = { -1, 1, 0, 0 };
+	static const int dj[4] = { 0, 0, -1, 1 };
+	static const int facing[4][2] = { { 1, 3 }, { 0, 2 }, { 2, 3 },
+		{ 0, 1 } };
+	quadtree_t* const qt = vp;
+	const struct leaf* leaf = NULL;
+	int c = 0, s = 0, i = 0, j = 0, n = 0, k = 0, child = 0;
+
+	for (c = begin; c < end; c++) {
+		leaf = qt->leaves + c;
+		qt->leaves[c].link_count = 0;
+
+		for (s = 0; s < 4; s++) {
+			i = leaf->i + di[s];
+			j = leaf->j + dj[s];
+
+			if (i < 0 || j < 0 ||
+				i >= (qt->root_count_i << leaf->level) ||
+				j >= (qt->root_count_j << leaf->level)) {
+				continue;
+			}
+
+			n = locate(qt, i, j, leaf->level);
+
+			if (qt->nodes[n].child < 0) {
+				add_link(qt, c, qt->nodes[n].leaf, s,
+					leaf->size);
+				continue;
+			}
+
+			for (k = 0; k < 2; k++) {
+				child = qt->nodes[n].child + facing[s][k];
+				assert(qt->nodes[child].child < 0);
+				add_link(qt, c, qt->nodes[child].leaf, s,
+					0.5 * leaf->size);
+			}
+		}
+	}
+}
+
+/* allocates the per-leaf storage of [leaf_count] leaves. on failure none
+** is kept and 0 is returned */
+static int leaves_alloc(int leaf_count, struct leaf** const leaves,
+	struct link** const links, float** const scratch)
+{
+	*leaves = malloc(sizeof(**leaves) * leaf_count);
+	*links = malloc(sizeof(**links) * LINK_MAX_COUNT * leaf_count);
+	*scratch = field_alloc(SCRATCH_FIELD_COUNT * leaf_count);
+
+	if (!*leaves || !*links || !*scratch) {
+		free(*leaves);
+		free(*links);
+		free(*scratch);
+		*leaves = NULL;
+		*links = NULL;
+		*scratch = NULL;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* indexes the leaves of the nodes and finds their faces. the per-leaf
+** storage is sized for the leaves already */
+static void tree_update(quadtree_t* const qt)
+{
+	int n = 0, root_count = qt->root_count_i * qt->root_count_j;
+
+	for (n = 0; n < root_count; n++) {
+		index_node(qt, n, 0, n % qt->root_count_i,
+			n / qt->root_count_i);
+	}
+
+	parallel_for_leaves(links_leaves, qt, qt->leaf_count);
+}
+
+quadtree_t* quadtree_create(float origin_x, float origin_y, float dx,
+	int sample_count_i, int sample_count_j, int level_count)
+{
+	quadtree_t* qt = calloc(1, sizeof(*qt));
+	int root_size = 1 << (level_count - 1);
+	int n = 0;
+
+	if (!qt) {
+		return NULL;
+	}
+
+	/* the finest leaves are centered at the samples of the grid */
+	qt->origin_x = origin_x - 0.5 * dx;
+	qt->origin_y = origin_y - 0.5 * dx;
+	qt->dx = dx;
+	qt->level_count = level_count;
+	qt->root_count_i = (sample_count_i + root_size - 1) / root_size;
+	qt->root_count_j = (sample_count_j + root_size - 1) / root_size;
+	qt->node_count = qt->root_count_i * qt->root_count_j;
+	qt->nodes = malloc(sizeof(*qt->nodes) * qt->node_count);
+
+	if (!qt->nodes || !leaves_alloc(qt->node_count, &qt->leaves,
+		&qt->links, &qt->scratch)) {
+		quadtree_destroy(qt);
+		return NULL;
+	}
+
+	for (n = 0; n < qt->node_count; n++) {
+		qt->nodes[n].child = -1;
+		qt->nodes[n].leaf = n;
+	}
+
+	qt->leaf_count = qt->node_count;
+	tree_update(qt);
+	return qt;
+}
+
+void quadtree_destroy(quadtree_t* const qt)
+{
+	free(qt->nodes);
+	free(qt->leaves);
+	free(qt->links);
+	free(qt->scratch);
+	free(qt);
+}
+
+int quadtree_get_leaf_count(const quadtree_t* const qt)
+{
+	return qt->leaf_count;
+}
+
+void quadtree_get_leaf(const quadtree_t* const qt, int leaf, float* const x,
+	float* const y, float* const size)
+{
+	*x = qt->leaves[leaf].x;
+	*y = qt->leaves[leaf].y;
+	*size = qt->leaves[leaf].size;
+}
+
+/* fields */
+
+float* quadtree_malloc(const quadtree_t* const qt, float c)
+{
+	float* q = field_alloc(qt->leaf_count);
+	int k = 0;
+
+	if (!q) {
+		return NULL;
+	}
+
+	for (k = 0; k < qt->leaf_count; k++) {
+		q[k] = c;
+	}
+
+	return q;
+}
+
+void quadtree_set_with_function(const quadtree_t* const qt, float* const q,
+	float (*fn)(float x, float y, void* const vp), void* const vp)
+{
+	int k = 0;
+
+	for (k = 0; k < qt->leaf_count; k++) {
+		q[k] = (*fn)(qt->leaves[k].x, qt->leaves[k].y, vp);
+	}
+}
+
+/* gradients */
+
+/* the gradient of [q] at leaf [c] from the differences across its faces.
+** with [walls], a side without faces counts as a face without difference,
+** as for the pressure, otherwise the opposite side is taken alone */
+static void gradient(const quadtree_t* const qt, const float* const q,
+	int c, int walls, float* const gx, float* const gy)
+{
+	const struct link* const links = qt->links + LINK_MAX_COUNT * c;
+	float s[4] = { 0.0, 0.0, 0.0, 0.0 };
+	float len[4] = { 0.0, 0.0, 0.0, 0.0 };
+	float size = qt->leaves[c].size;
+	float lx = 2.0 * size, ly = 2.0 * size;
+	int k = 0;
+
+	for (k = 0; k < qt->leaves[c].link_count; k++) {
+		s[links[k].side] += links[k].weight * (q[links[k].leaf] - q[c]);
+		len[links[k].side] += links[k].length;
+	}
+
+	if (!walls) {
+		lx = len[SIDE_LEFT] + len[SIDE_RIGHT] + EPS;
+		ly = len[SIDE_BOTTOM] + len[SIDE_TOP] + EPS;
+	}
+
+	*gx = (s[SIDE_RIGHT] - s[SIDE_LEFT]) / lx;
+	*gy = (s[SIDE_TOP] - s[SIDE_BOTTOM]) / ly;
+}
+
+/* the gradient of [q] at leaf [c], scaled down so that the linear
+** reconstruction within the leaf stays within the values of the leaf and
+** its neighbors (Barth-Jespersen) */
+static void limited_gradient(const quadtree_t* const qt, const float* const q,
+	int c, float* const gx, float* const gy)
+{
+	const struct link* const links = qt->links + LINK_MAX_COUNT * c;
+	float q_min = q[c], q_max = q[c], d = 0.0, phi = 1.0;
+	int k = 0;
+
+	gradient(qt, q, c, 0, gx, gy);
+
+	for (k = 0; k < qt->leaves[c].link_count; k++) {
+		q_min = fminf(q_min, q[links[k].leaf]);
+		q_max = fmaxf(q_max, q[links[k].leaf]);
+	}
+
+	/* largest deviation, at a corner of the leaf */
+	d = 0.5 * qt->leaves[c].size * (fabsf(*gx) + fabsf(*gy));
+
+	if (d > 0.0) {
+		phi = fminf(phi, (q_max - q[c]) / d);
+		phi = fminf(phi, (q[c] - q_min) / d);
+		*gx *= phi;
+		*gy *= phi;
+	}
+}
+
+float quadtree_sample(const quadtree_t* const qt, const float* const q,
+	float x, float y)
+{
+	int c = locate_point(qt, x, y);
+	const struct leaf* const leaf = qt->leaves + c;
+	float gx = 0.0, gy = 0.0, h = 0.5 * leaf->size;
+
+	limited_gradient(qt, q, c, &gx, &gy);
+	x = fminf(fmaxf(x, leaf->x - h), leaf->x + h);
+	y = fminf(fmaxf(y, leaf->y - h), leaf->y + h);
+	return q[c] + gx * (x - leaf->x) + gy * (y - leaf->y);
+}
+
+struct resample_args {
+	const quadtree_t* qt;
+	const float* q;
+};
+
+static float resample_fn(float x, float y, void* const vp)
+{
+	const struct resample_args* const a = vp;
+
+	return quadtree_sample(a->qt, a->q, x, y);
+}
+
+void quadtree_resample(const quadtree_t* const qt, const float* const q,
+	fluids_context_t* const ctx, float* const grid_q)
+{
+	struct resample_args a = { qt, q };
+
+	fluids_context_set_with_function(ctx, grid_q, resample_fn, &a);
+}
+
+/* adaptation */
+
+struct indicator_args {
+	const quadtree_t* qt;
+	const quadtree_refinement_t* r;
+	float* e;
+};
+
+/* the largest change across each leaf relative to its threshold */
+static void indicator_leaves(int begin, int end, int thread, void* const vp)
+{
+	const struct indicator_args* const a = vp;
+	const quadtree_refinement_t* const r = a->r;
+	float size = 0.0, e = 0.0, gx = 0.0, gy = 0.0;
+	int c = 0, f = 0;
+
+	for (c = begin; c < end; c++) {
+		size = a->qt->leaves[c].size;
+		e = 0.0;
+
+		if (r->vorticity) {
+			e = fabsf(r->vorticity[c]) * size /
+				(r->vorticity_threshold + EPS);
+		}
+
+		for (f = 0; f < r->field_count; f++) {
+			gradient(a->qt, r->fields[f], c, 0, &gx, &gy);
+			e = fmaxf(e, sqrtf(gx * gx + gy * gy) * size /
+				(r->thresholds[f] + EPS));
+		}
+
+		a->e[c] = e;
+	}
+}
+
+/* marks the leaves to split by indicators [e] and the leaves below
+** [min_level], then the coarser neighbors of marked leaves, until
+** neighbors differ by one level at most after splitting. [stack] holds
+** a value per leaf. returns the number of leaves marked */
+static int mark_split(const quadtree_t* const qt, const float* const e,
+	int min_level, int* const stack, unsigned char* const split)
+{
+	const struct link* links = NULL;
+	int top = 0, c = 0, k = 0, nb = 0, count = 0;
+	int max_level = qt->level_count - 1;
+
+	for (c = 0; c < qt->leaf_count; c++) {
+		if ((e[c] > 1.0 || qt->leaves[c].level < min_level) &&
+			qt->leaves[c].level < max_level) {
+			split[c] = 1;
+			stack[top++] = c;
+			count++;
+		}
+	}
+
+	while (top > 0) {
+		c = stack[--top];
+		links = qt->links + LINK_MAX_COUNT * c;
+
+		for (k = 0; k < qt->leaves[c].link_count; k++) {
+			nb = links[k].leaf;
+
+			if (!split[nb] &&
+				qt->leaves[nb].level < qt->leaves[c].level) {
+				split[nb] = 1;
+				stack[top++] = nb;
+				count++;
+			}
+		}
+	}
+
+	return count;
+}
+
+/* marks the inner nodes of [min_level] and below whose four leaves to
+** merge. all are below the coarsening ratio and none has a neighbor that
+** would end up finer than the leaves themselves */
+static void mark_merge(const quadtree_t* const qt, const float* const e,
+	float ratio, int min_level, const unsigned char* const split,
+	unsigned char* const merge)
+{
+	const struct node* const nodes = qt->nodes;
+	const struct link* links = NULL;
+	const struct leaf* nb = NULL;
+	int n = 0, k = 0, l = 0, c = 0, child = 0, m = 0;
+
+	for (n = 0; n < qt->node_count; n++) {
+		child = nodes[n].child;
+		m = child >= 0;
+
+		for (k = 0; k < 4 && m; k++) {
+			m = nodes[child + k].child < 0;
+		}
+
+		for (k = 0; k < 4 && m; k++) {
+			c = nodes[child + k].leaf;
+			m = e[c] < ratio && !split[c] &&
+				qt->leaves[c].level > min_level;
+			links = qt->links + LINK_MAX_COUNT * c;
+
+			for (l = 0; l < qt->leaves[c].link_count && m; l++) {
+				nb = qt->leaves + links[l].leaf;
+				m = (nb->node >= child &&
+					nb->node < child + 4) ||
+					nb->level < qt->leaves[c].level ||
+					(nb->level == qt->leaves[c].level &&
+					!split[links[l].leaf]);
+			}
+		}
+
+		merge[n] = m;
+	}
+}
+
+/* the nodes of the adapted tree and where its leaves come from */
+struct rebuild {
+	const quadtree_t* qt;
+	const unsigned char* split;	/* per old leaf */
+	const unsigned char* merge;	/* per old node */
+	struct node* nodes;
+	int node_count;
+	int node_capacity;
+	struct remap* remaps;
+	int leaf_count;
+	int leaf_capacity;
+};
+
+static int rebuild_alloc_children(struct rebuild* const rb)
+{
+	assert(rb->node_count + 4 <= rb->node_capacity);
+	rb->node_count += 4;
+	return rb->node_count - 4;
+}
+
+static void rebuild_leaf(struct rebuild* const rb, int n, int kind, int src,
+	int quadrant)
+{
+	struct remap* const remap = rb->remaps + rb->leaf_count;
+
+	assert(rb->leaf_count < rb->leaf_capacity);
+	remap->kind = kind;
+	remap->src = src;
+	remap->quadrant = quadrant;
+	rb->nodes[n].child = -1;
+	rb->nodes[n].leaf = rb->leaf_count++;
+}
+
+/* builds node [n] of the adapted tree from node [old] of the old one. the
+** leaves are numbered depth first, so the leaves of a node are close in
+** memory */
+static void rebuild_node(struct rebuild* const rb, int old, int n)
+{
+	const struct node* const node = rb->qt->nodes + old;
+	int child = 0, k = 0;
+
+	if (node->child < 0 && rb->split[node->leaf]) {
+		child = rebuild_alloc_children(rb);
+		rb->nodes[n].child = child;
+		rb->nodes[n].leaf = -1;
+
+		for (k = 0; k < 4; k++) {
+			rebuild_leaf(rb, child + k, REMAP_SPLIT, node->leaf, k);
+		}
+	} else if (node->child < 0) {
+		rebuild_leaf(rb, n, REMAP_KEEP, node->leaf, 0);
+	} else if (rb->merge[old]) {
+		rebuild_leaf(rb, n, REMAP_MERGE, node->child, 0);
+	} else {
+		child = rebuild_alloc_children(rb);
+		rb->nodes[n].child = child;
+		rb->nodes[n].leaf = -1;
+
+		for (k = 0; k < 4; k++) {
+			rebuild_node(rb, node->child + k, child + k);
+		}
+	}
+}
+
+struct remap_args {
+	const quadtree_t* qt;
+	const struct remap* remaps;
+	const float* q;
+	float* q_new;
+};
+
+static void remap_leaves(int begin, int end, int thread, void* const vp)
+{
+	const struct remap_args* const a = vp;
+	const quadtree_t* const qt = a->qt;
+	const struct remap* remap = NULL;
+	const float* const q = a->q;
+	float gx = 0.0, gy = 0.0, h = 0.0;
+	int c = 0, child = 0;
+
+	for (c = begin; c < end; c++) {
+		remap = a->remaps + c;
+
+		switch (remap->kind) {
+		case REMAP_KEEP:
+			a->q_new[c] = q[remap->src];
+			break;
+
+		case REMAP_SPLIT:
+			/* quadrant centers are a quarter leaf off the center */
+			limited_gradient(qt, q, remap->src, &gx, &gy);
+			h = 0.25 * qt->leaves[remap->src].size;
+			a->q_new[c] = q[remap->src] +
+				gx * h * (2 * (remap->quadrant & 1) - 1) +
+				gy * h * (2 * (remap->quadrant >> 1) - 1);
+			break;
+
+		case REMAP_MERGE:
+			child = remap->src;
+			a->q_new[c] = 0.25 * (q[qt->nodes[child].leaf] +
+				q[qt->nodes[child + 1].leaf] +
+				q[qt->nodes[child + 2].leaf] +
+				q[qt->nodes[child + 3].leaf]);
+			break;
+		}
+	}
+}
+
+int quadtree_adapt(quadtree_t* const qt,
+	const quadtree_refinement_t* const refinement, float** const fields,
+	int field_count)
+{
+	struct indicator_args ia = { qt, refinement, qt->scratch };
+	unsigned char* split = calloc(qt->leaf_count, 1);
+	unsigned char* merge = calloc(qt->node_count, 1);
+	int* stack = malloc(sizeof(*stack) * qt->leaf_count);
+	float** q_news = calloc(field_count > 0 ? field_count : 1,
+		sizeof(*q_news));
+	struct rebuild rb = { qt, split, merge };
+	struct remap_args ra = { qt };
+	struct leaf* leaves = qt->leaves;
+	struct link* links = qt->links;
+	float* scratch = qt->scratch;
+	int n = 0, f = 0, split_count = 0, ok = split && merge && stack &&
+		q_news;
+	int root_count = qt->root_count_i * qt->root_count_j;
+
+	if (ok) {
+		parallel_for_leaves(indicator_leaves, &ia, qt->leaf_count);
+		split_count = mark_split(qt, ia.e, refinement->min_level,
+			stack, split);
+
+		if (refinement->coarsen_ratio > 0.0) {
+			mark_merge(qt, ia.e, refinement->coarsen_ratio,
+				refinement->min_level, split, merge);
+		}
+
+		/* a split adds four nodes and three leaves, merges only
+		** remove some */
+		rb.node_capacity = qt->node_count + 4 * split_count;
+		rb.nodes = malloc(sizeof(*rb.nodes) * rb.node_capacity);
+		rb.node_count = root_count;
+		rb.leaf_capacity = qt->leaf_count + 3 * split_count;
+		rb.remaps = malloc(sizeof(*rb.remaps) * rb.leaf_capacity);
+		ok = rb.nodes && rb.remaps;
+	}
+
+	if (ok) {
+		for (n = 0; n < root_count; n++) {
+			rebuild_node(&rb, n, n);
+		}
+
+		/* everything the new tree needs, so a failure leaves the tree
+		** and the fields as they are */
+		for (f = 0; f < field_count && ok; f++) {
+			q_news[f] = field_alloc(rb.leaf_count);
+			ok = q_news[f] != NULL;
+		}
+
+		if (ok && rb.leaf_count != qt->leaf_count) {
+			ok = leaves_alloc(rb.leaf_count, &leaves, &links,
+				&scratch);
+		}
+	}
+
+	if (ok) {
+		/* carry the fields over while the old leaves are still in
+		** place */
+		ra.remaps = rb.remaps;
+
+		for (f = 0; f < field_count; f++) {
+			ra.q = fields[f];
+			ra.q_new = q_news[f];
+			parallel_for_leaves(remap_leaves, &ra, rb.leaf_count);
+			free(fields[f]);
+			fields[f] = q_news[f];
+		}
+
+		if (leaves != qt->leaves) {
+			free(qt->leaves);
+			free(qt->links);
+			free(qt->scratch);
+			qt->leaves = leaves;
+			qt->links = links;
+			qt->scratch = scratch;
+		}
+
+		free(qt->nodes);
+		qt->nodes = rb.nodes;
+		qt->node_count = rb.node_count;
+		qt->leaf_count = rb.leaf_count;
+		tree_update(qt);
+	} else {
+		for (f = 0; q_news && f < field_count; f++) {
+			free(q_news[f]);
+		}
+
+		free(rb.nodes);
+	}
+
+	free(rb.remaps);
+	free(q_news);
+	free(stack);
+	free(split);
+	free(merge);
+	return ok;
+}
+
+/* sources and forces */
+
+struct source_args {
+	float* q;
+	const float* source;
+	const float* t;
+	float alpha;
+	float beta;
+	float temp_ambient;
+	float dt;
+};
+
+static void source_leaves(int begin, int end, int thread, void* const vp)
+{
+	const struct source_args* const a = vp;
+	int c = 0;
+
+	for (c = begin; c < end; c++) {
+		a->q[c] += a->alpha * a->source[c];
+	}
+}
+
+void quadtree_add_source(const quadtree_t* const qt, float* const q,
+	const float* const source, float alpha)
+{
+	struct source_args a = { q, source, NULL, alpha };
+
+	parallel_for_leaves(source_leaves, &a, qt->leaf_count);
+}
+
+static void buoyancy_leaves(int begin, int end, int thread, void* const vp)
+{
+	const struct source_args* const a = vp;
+	int c = 0;
+
+	for (c = begin; c < end; c++) {
+		a->q[c] -= a->dt * (a->alpha * a->source[c] -
+			a->beta * (a->t[c] - a->temp_ambient));
+	}
+}
+
+void quadtree_add_buoyancy(const quadtree_t* const qt, float* const v,
+	const float* const smoke_dens, const float* const temperatures,
+	float alpha, float beta, float temp_ambient, float dt)
+{
+	struct source_args a = { v, smoke_dens, temperatures, alpha, beta,
+		temp_ambient, dt };
+
+	parallel_for_leaves(buoyancy_leaves, &a, qt->leaf_count);
+}
+
+struct vorticity_args {
+	const quadtree_t* qt;
+	float* u;
+	float* v;
+	float* vorticity;
+	float* magnitude;
+	float b;	/* eps * dt */
+};
+
+static void vorticity_leaves(int begin, int end, int thread, void* const vp)
+{
+	const struct vorticity_args* const a = vp;
+	float ux = 0.0, uy = 0.0, vx = 0.0, vy = 0.0;
+	int c = 0;
+
+	for (c = begin; c < end; c++) {
+		gradient(a->qt, a->u, c, 0, &ux, &uy);
+		gradient(a->qt, a->v, c, 0, &vx, &vy);
+		a->vorticity[c] = vx - uy;
+		a->magnitude[c] = fabsf(vx - uy);
+	}
+}
+
+static void vorticity_force_leaves(int begin, int end, int thread,
+	void* const vp)
+{
+	const struct vorticity_args* const a = vp;
+	float gx = 0.0, gy = 0.0, gm = 0.0, b = 0.0;
+	int c = 0;
+
+	for (c = begin; c < end; c++) {
+		gradient(a->qt, a->magnitude, c, 0, &gx, &gy);
+		gm = sqrtf(gx * gx + gy * gy) + EPS;
+		b = a->b * a->qt->leaves[c].size * a->vorticity[c];
+		a->u[c] += b * gy / gm;
+		a->v[c] -= b * gx / gm;
+	}
+}
+
+void quadtree_add_vorticity_confinement(quadtree_t* const qt,
+	float* const u, float* const v, float* const vorticity, float eps,
+	float dt)
+{
+	struct vorticity_args a = { qt, u, v, vorticity, qt->scratch,
+		eps * dt };
+
+	parallel_for_leaves(vorticity_leaves, &a, qt->leaf_count);
+	parallel_for_leaves(vorticity_force_leaves, &a, qt->leaf_count);
+}
+
+/* advection */
+
+struct advect_args {
+	const quadtree_t* qt;
+	float* q;
+	const float* q_prev;
+	const float* u;
+	const float* v;
+	float* gx;
+	float* gy;
+	float dt;
+};
+
+static void reconstruct_leaves(int begin, int end, int thread,
+	void* const vp)
+{
+	const struct advect_args* const a = vp;
+	int c = 0;
+
+	for (c = begin; c < end; c++) {
+		limited_gradient(a->qt, a->q_prev, c, a->gx + c, a->gy + c);
+	}
+}
+
+static void advect_leaves(int begin, int end, int thread, void* const vp)
+{
+	const struct advect_args* const a = vp;
+	const quadtree_t* const qt = a->qt;
+	const struct leaf* leaf = NULL;
+	float x = 0.0, y = 0.0;
+	int c = 0, d = 0;
+
+	for (c = begin; c < end; c++) {
+		x = qt->leaves[c].x - a->dt * a->u[c];
+		y = qt->leaves[c].y - a->dt * a->v[c];
+		d = locate_point(qt, x, y);
+		leaf = qt->leaves + d;
+		x = fminf(fmaxf(x, leaf->x - 0.5 * leaf->size),
+			leaf->x + 0.5 * leaf->size);
+		y = fminf(fmaxf(y, leaf->y - 0.5 * leaf->size),
+			leaf->y + 0.5 * leaf->size);
+		a->q[c] = a->q_prev[d] + a->gx[d] * (x - leaf->x) +
+			a->gy[d] * (y - leaf->y);
+	}
+}
+
+void quadtree_advect(quadtree_t* const qt, float* const q,
+	const float* const q_prev, const float* const u, const float* const v,
+	float dt)
+{
+	struct advect_args a = { qt, q, q_prev, u, v, qt->scratch,
+		qt->scratch + qt->leaf_count, dt };
+
+	/* the slopes of all leaves first, departure points are shared */
+	parallel_for_leaves(reconstruct_leaves, &a, qt->leaf_count);
+	parallel_for_leaves(advect_leaves, &a, qt->leaf_count);
+}
+
+/* implicit systems
+**
+** 	(sigma h^2 + kappa sum_f w_f) x_c - kappa sum_f w_f x_f = b_c
+**
+** where h is the size of leaf c, f runs over the faces of c and x_f is the
+** value on the other side, w_f = face length / distance of the centers.
+** solved by conjugate gradients with a MIC(0) preconditioner, factored in
+** the order of the leaves as the uniform grid does in the order of its
+** rows */
+
+struct solve_args {
+	const quadtree_t* qt;
+	float* x;
+	const float* b;
+	float* r;
+	float* z;
+	float* d;
+	float* ad;
+	float* precon;	/* inverse diagonal of the factor */
+	float sigma;
+	float kappa;
+	float alpha;
+	float beta;
+	double sums[THREADS_MAX_COUNT];
+	float maxs[THREADS_MAX_COUNT];
+};
+
+static float diagonal(const struct solve_args* const a, int c)
+{
+	const struct link* const links = a->qt->links + LINK_MAX_COUNT * c;
+	float size = a->qt->leaves[c].size, w = 0.0;
+	int k = 0;
+
+	for (k = 0; k < a->qt->leaves[c].link_count; k++) {
+		w += links[k].weight;
+	}
+
+	return a->sigma * size * size + a->kappa * w;
+}
+
+/* builds the factor. a fill-in entry between two later neighbors of a leaf
+** is dropped and, blended by MIC_TUNING, added to the diagonal. [upper]
+** receives the sum of the entries of each row right of the diagonal */
+static void precon_build(const struct solve_args* const a,
+	float* const upper)
+{
+	const quadtree_t* const qt = a->qt;
+	const struct link* links = NULL;
+	float* const pc = a->precon;
+	float diag = 0.0, e = 0.0, a_cf = 0.0, t = 0.0, sum = 0.0;
+	int c = 0, k = 0, f = 0;
+
+	for (c = 0; c < qt->leaf_count; c++) {
+		links = qt->links + LINK_MAX_COUNT * c;
+		diag = diagonal(a, c);
+		e = diag;
+		sum = 0.0;
+
+		for (k = 0; k < qt->leaves[c].link_count; k++) {
+			f = links[k].leaf;
+			a_cf = -a->kappa * links[k].weight;
+
+			if (f > c) {
+				sum += a_cf;
+				continue;
+			}
+
+			t = a_cf * pc[f];
+			e -= t * t + MIC_TUNING * a_cf * pc[f] * pc[f] *
+				(upper[f] - a_cf);
+		}
+
+		if (e < MIC_SAFETY * diag) {
+			e = diag;
+		}
+
+		upper[c] = sum;
+		pc[c] = e > 0.0 ? 1.0 / sqrtf(e) : 0.0;
+	}
+}
+
+/* z = M^-1 r with M = L L^T the MIC(0) factorization. returns r . z */
+static double precon_apply(const struct solve_args* const a)
+{
+	const quadtree_t* const qt = a->qt;
+	const struct link* links = NULL;
+	const float* const pc = a->precon;
+	float* const z = a->z;
+	float s = 0.0;
+	double rz = 0.0;
+	int c = 0, k = 0, f = 0;
+
+	for (c = 0; c < qt->leaf_count; c++) {
+		links = qt->links + LINK_MAX_COUNT * c;
+		s = a->r[c];
+
+		for (k = 0; k < qt->leaves[c].link_count; k++) {
+			f = links[k].leaf;
+			s += f < c ? a->kappa * links[k].weight * pc[f] * z[f] :
+				0.0;
+		}
+
+		z[c] = pc[c] * s;
+	}
+
+	for (c = qt->leaf_count - 1; c >= 0; c--) {
+		links = qt->links + LINK_MAX_COUNT * c;
+		s = 0.0;
+
+		for (k = 0; k < qt->leaves[c].link_count; k++) {
+			f = links[k].leaf;
+			s += f > c ? a->kappa * links[k].weight * z[f] : 0.0;
+		}
+
+		z[c] = pc[c] * (z[c] + pc[c] * s);
+		rz += a->r[c] * z[c];
+	}
+
+	return rz;
+}
+
+/* the sum of kappa w_f x_f over the faces of leaf [c] */
+static float neighbor_sum(const struct solve_args* const a,
+	const float* const x, int c)
+{
+	const struct link* const links = a->qt->links + LINK_MAX_COUNT * c;
+	float s = 0.0;
+	int k = 0;
+
+	for (k = 0; k < a->qt->leaves[c].link_count; k++) {
+		s += links[k].weight * x[links[k].leaf];
+	}
+
+	return a->kappa * s;
+}
+
+/* r = b - A x */
+static void residual_leaves(int begin, int end, int thread, void* const vp)
+{
+	struct solve_args* const a = vp;
+	float size = 0.0, r_max = 0.0;
+	int c = 0;
+
+	for (c = begin; c < end; c++) {
+		size = a->qt->leaves[c].size;
+		a->r[c] = a->b[c] - diagonal(a, c) * a->x[c] +
+			neighbor_sum(a, a->x, c);
+		r_max = fmaxf(r_max, fabsf(a->r[c]) / (size * size));
+	}
+
+	a->maxs[thread] = r_max;
+}
+
+/* ad = A d */
+static void apply_leaves(int begin, int end, int thread, void* const vp)
+{
+	struct solve_args* const a = vp;
+	double dad = 0.0;
+	int c = 0;
+
+	for (c = begin; c < end; c++) {
+		a->ad[c] = diagonal(a, c) * a->d[c] - neighbor_sum(a, a->d, c);
+		dad += a->d[c] * a->ad[c];
+	}
+
+	a->sums[thread] = dad;
+}
+
+/* x += alpha d, r -= alpha A d */
+static void update_leaves(int begin, int end, int thread, void* const vp)
+{
+	struct solve_args* const a = vp;
+	float size = 0.0, r_max = 0.0;
+	int c = 0;
+
+	for (c = begin; c < end; c++) {
+		size = a->qt->leaves[c].size;
+		a->x[c] += a->alpha * a->d[c];
+		a->r[c] -= a->alpha * a->ad[c];
+		r_max = fmaxf(r_max, fabsf(a->r[c]) / (size * size));
+	}
+
+	a->maxs[thread] = r_max;
+}
+
+/* d = z + beta d */
+static void direction_leaves(int begin, int end, int thread, void* const vp)
+{
+	struct solve_args* const a = vp;
+	int c = 0;
+
+	for (c = begin; c < end; c++) {
+		a->d[c] = a->z[c] + a->beta * a->d[c];
+	}
+}
+
+/* solves for [x], starting with its values. the residual is in units of
+** [b] / h^2, i.e. of the right hand side per area */
+static fluids_solver_result_t solve(quadtree_t* const qt, float* const x,
+	const float* const b, float sigma, float kappa, float tolerance,
+	int max_iteration_count)
+{
+	float* const scratch = qt->scratch;
+	int n = qt->leaf_count;
+	struct solve_args a = { qt, x, b, scratch, scratch + n,
+		scratch + 2 * n, scratch + 3 * n, scratch + 5 * n, sigma,
+		kappa };
+	fluids_solver_result_t result = { 0, 0.0 };
+	double rz = 0.0, rz_new = 0.0, dad = 0.0;
+
+	/* the row sums of the factorization are kept in z meanwhile */
+	precon_build(&a, a.z);
+	parallel_for_leaves(residual_leaves, &a, n);
+	result.residual = reduce_max(a.maxs);
+	rz = precon_apply(&a);
+	memcpy(a.d, a.z, sizeof(*a.d) * n);
+
+	while (result.iteration_count < max_iteration_count &&
+		result.residual > tolerance) {
+		memset(a.sums, 0, sizeof(a.sums));
+		parallel_for_leaves(apply_leaves, &a, n);
+		dad = reduce_sum(a.sums);
+
+		if (dad <= 0.0) {
+			break;
+		}
+
+		a.alpha = rz / dad;
+		memset(a.maxs, 0, sizeof(a.maxs));
+		parallel_for_leaves(update_leaves, &a, n);
+		result.residual = reduce_max(a.maxs);
+		result.iteration_count++;
+
+		rz_new = precon_apply(&a);
+		a.beta = rz > 0.0 ? rz_new / rz : 0.0;
+		rz = rz_new;
+		parallel_for_leaves(direction_leaves, &a, n);
+	}
+
+	return result;
+}
+
+/* diffusion */
+
+struct mass_args {
+	const quadtree_t* qt;
+	const float* q;
+	float* b;
+};
+
+static void mass_leaves(int begin, int end, int thread, void* const vp)
+{
+	const struct mass_args* const a = vp;
+	float size = 0.0;
+	int c = 0;
+
+	for (c = begin; c < end; c++) {
+		size = a->qt->leaves[c].size;
+		a->b[c] = size * size * a->q[c];
+	}
+}
+
+void quadtree_diffuse(quadtree_t* const qt, float* const q,
+	const float* const q_prev, float diff, int iteration_count, float dt)
+{
+	float* const b = qt->scratch + 4 * qt->leaf_count;
+	struct mass_args a = { qt, q_prev, b };
+
+	parallel_for_leaves(mass_leaves, &a, qt->leaf_count);
+
+	if (q != q_prev) {
+		memcpy(q, q_prev, sizeof(*q) * qt->leaf_count);
+	}
+
+	solve(qt, q, b, 1.0, diff * dt, 0.0, iteration_count);
+}
+
+/* projection */
+
+struct project_args {
+	const quadtree_t* qt;
+	float* u;
+	float* v;
+	const float* p;
+	float* div;
+	float* b;
+	float mean;
+	double sums[THREADS_MAX_COUNT];
+};
+
+/* the divergence of each leaf from the velocities at its faces, linearly
+** interpolated between the centers. no flow passes the walls */
+static void divergence_leaves(int begin, int end, int thread, void* const vp)
+{
+	struct project_args* const a = vp;
+	const quadtree_t* const qt = a->qt;
+	const struct link* links = NULL;
+	const float* q = NULL;
+	float size = 0.0, nb = 0.0, q_face = 0.0, flux = 0.0;
+	double sum = 0.0;
+	int c = 0, k = 0, f = 0, side = 0;
+
+	for (c = begin; c < end; c++) {
+		links = qt->links + LINK_MAX_COUNT * c;
+		size = qt->leaves[c].size;
+		flux = 0.0;
+
+		for (k = 0; k < qt->leaves[c].link_count; k++) {
+			f = links[k].leaf;
+			side = links[k].side;
+			nb = qt->leaves[f].size;
+			q = side == SIDE_LEFT || side == SIDE_RIGHT ?
+				a->u : a->v;
+			q_face = (q[c] * nb + q[f] * size) / (size + nb);
+			flux += side == SIDE_LEFT || side == SIDE_BOTTOM ?
+				-links[k].length * q_face :
+				links[k].length * q_face;
+		}
+
+		a->div[c] = flux / (size * size);
+		a->b[c] = -flux;
+		sum += a->b[c];
+	}
+
+	a->sums[thread] = sum;
+}
+
+static void subtract_mean_leaves(int begin, int end, int thread,
+	void* const vp)
+{
+	struct project_args* const a = vp;
+	int c = 0;
+
+	for (c = begin; c < end; c++) {
+		a->b[c] -= a->mean;
+	}
+}
+
+static void subtract_gradient_leaves(int begin, int end, int thread,
+	void* const vp)
+{
+	const struct project_args* const a = vp;
+	float gx = 0.0, gy = 0.0;
+	int c = 0;
+
+	for (c = begin; c < end; c++) {
+		gradient(a->qt, a->p, c, 1, &gx, &gy);
+		a->u[c] -= gx;
+		a->v[c] -= gy;
+	}
+}
+
+fluids_solver_result_t quadtree_project(quadtree_t* const qt, float* const u,
+	float* const v, float* const p, float* const div, float tolerance,
+	int max_iteration_count)
+{
+	struct project_args a = { qt, u, v, p, div,
+		qt->scratch + 4 * qt->leaf_count };
+	fluids_solver_result_t result;
+
+	parallel_for_leaves(divergence_leaves, &a, qt->leaf_count);
+
+	/* the walls make the system singular, its right hand side has to sum
+	** up to 0. the sum of the fluxes does up to rounding */
+	a.mean = reduce_sum(a.sums) / qt->leaf_count;
+	parallel_for_leaves(subtract_mean_leaves, &a, qt->leaf_count);
+
+	result = solve(qt, p, a.b, 0.0, 1.0, tolerance, max_iteration_count);
+	parallel_for_leaves(subtract_gradient_leaves, &a, qt->leaf_count);
+	return result;
+}
@@ -0,0 +1,142 @@
+/* adaptive quadtree of cells, refined where the flow has detail */
+#ifndef QUADTREE_H
+#define QUADTREE_H
+
+#include "fluids.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* A multi-resolution grid over the same kind of domain fluids_set_grid
+** describes. The domain is split into square root cells, each of which is
+** split into four quadrants recursively, down to cells of the spacing of
+** the grid. The leaves of this tree are the cells of the simulation: a
+** field holds one value per leaf, taken at its center, so a field of a
+** tree with few fine leaves is a fraction of the size of a field of the
+** uniform grid. Neighboring leaves differ by one level at most.
+**
+** The routines below mirror those of the uniform grid. Fields are
+** advected semi-Lagrangian, with a slope-limited linear reconstruction
+** within each leaf. Diffusion and projection discretize the fluxes through
+** the faces between leaves and solve with conjugate gradients, incomplete
+** Cholesky preconditioned in leaf order. The domain boundary is a wall: no
+** flux of a quantity and no velocity through it, as FLUIDS_BOUNDARY_NN and
+** FLUIDS_BOUNDARY_REFLECT_U, FLUIDS_BOUNDARY_REFLECT_V do. The grid routines
+** are split across the threads of fluids_set_thread_count for trees of 40000
+** leaves or more. */
+typedef struct quadtree quadtree_t;
+
+/* Criteria of quadtree_adapt. A leaf is refined if the change of a field
+** across the leaf, i.e. the magnitude of its gradient times the leaf size,
+** exceeds the threshold of the field, or if the magnitude of [vorticity]
+** times the leaf size exceeds [vorticity_threshold]. Four sibling leaves
+** are merged if the changes are below [coarsen_ratio] times the thresholds
+** in each of them. Merging doubles the size of a leaf, so [coarsen_ratio]
+** stays below 0.5 to keep the merged leaf from being split again, 0 keeps
+** all leaves. Leaves of a level below [min_level] are split regardless and
+** leaves of [min_level] are not merged, e.g. to resolve the sources from
+** the start. [vorticity] and [fields] may be NULL, the vorticity is the
+** one quadtree_add_vorticity_confinement stores. */
+typedef struct quadtree_refinement {
+	const float* vorticity;
+	float vorticity_threshold;
+	const float* const* fields;	/* e.g. smoke density, temperature */
+	const float* thresholds;	/* one per field */
+	int field_count;
+	float coarsen_ratio;
+	int min_level;			/* 0 for the root leaves */
+} quadtree_refinement_t;
+
+/* Creates a tree over the domain of [sample_count_i] x [sample_count_j]
+** cells of spacing [dx] at ([origin_x], [origin_y]), as passed to
+** fluids_set_grid, with [level_count] levels of refinement. The finest
+** leaves are cells of spacing [dx], the coarsest (root) leaves are
+** 2^(level_count - 1) times as large. The cell counts are rounded up to
+** whole root cells. The tree starts with the root leaves only. Returns
+** NULL if the tree cannot be allocated. */
+quadtree_t* quadtree_create(float origin_x, float origin_y, float dx,
+	int sample_count_i, int sample_count_j, int level_count);
+
+/* Releases a tree. Its fields are released with free. */
+void quadtree_destroy(quadtree_t* const qt);
+
+/* Gets the number of leaves, i.e. of values per field. */
+int quadtree_get_leaf_count(const quadtree_t* const qt);
+
+/* Gets the center ([x], [y]) and the edge length [size] of leaf [leaf]. */
+void quadtree_get_leaf(const quadtree_t* const qt, int leaf, float* const x,
+	float* const y, float* const size);
+
+/* Creates a field of the current leaves with all values set to [c]. The
+** array starts at a 64 byte boundary and is released with free. Returns
+** NULL if the field cannot be allocated. */
+float* quadtree_malloc(const quadtree_t* const qt, float c);
+
+/* Sets the value of each leaf of [q] to [fn] at the leaf center. */
+void quadtree_set_with_function(const quadtree_t* const qt, float* const q,
+	float (*fn)(float x, float y, void* const vp), void* const vp);
+
+/* Samples a field [q] at a point (x, y) from the linear reconstruction of
+** the leaf the point lies in. Points outside are moved onto the domain. */
+float quadtree_sample(const quadtree_t* const qt, const float* const q,
+	float x, float y);
+
+/* Samples a field [q] at the cells of the grid of [ctx] and stores the
+** result in the grid field [grid_q], e.g. for rendering. */
+void quadtree_resample(const quadtree_t* const qt, const float* const q,
+	fluids_context_t* const ctx, float* const grid_q);
+
+/* Refines and coarsens the leaves by the criteria [refinement], a level at
+** most per call. The [field_count] fields [fields] are carried over to the
+** new leaves: a split leaf passes its linear reconstruction on to its
+** quadrants, merged leaves pass on their mean, so the integral of a field
+** is kept. The arrays are replaced, i.e. the pointers in [fields] are
+** updated and the old arrays released. All fields of the tree are listed,
+** fields that are not are invalid afterwards. The criteria may refer to
+** listed fields. Returns 0 and leaves the tree and the fields unchanged
+** if the new leaves cannot be allocated, 1 otherwise. */
+int quadtree_adapt(quadtree_t* const qt,
+	const quadtree_refinement_t* const refinement, float** const fields,
+	int field_count);
+
+/* Same as fluids_add_source, i.e. q += [alpha] s for each leaf. */
+void quadtree_add_source(const quadtree_t* const qt, float* const q,
+	const float* const source, float alpha);
+
+/* Same as fluids_advect. [q] may not be one of [q_prev], [u] or [v]. */
+void quadtree_advect(quadtree_t* const qt, float* const q,
+	const float* const q_prev, const float* const u, const float* const v,
+	float dt);
+
+/* Same as fluids_diffuse, implicitly. [iteration_count] conjugate gradient
+** iterations are run, the system is well conditioned for small time
+** steps and a few iterations suffice. */
+void quadtree_diffuse(quadtree_t* const qt, float* const q,
+	const float* const q_prev, float diff, int iteration_count, float dt);
+
+/* Same as fluids_project_pcg. [p] holds the initial guess of the pressure,
+** e.g. the pressure of the last step. Returns the number of iterations
+** used and the final residual (in units of [div]). */
+fluids_solver_result_t quadtree_project(quadtree_t* const qt, float* const u,
+	float* const v, float* const p, float* const div, float tolerance,
+	int max_iteration_count);
+
+/* Same as fluids_add_buoyancy. */
+void quadtree_add_buoyancy(const quadtree_t* const qt, float* const v,
+	const float* const smoke_dens, const float* const temperatures,
+	float alpha, float beta, float temp_ambient, float dt);
+
+/* Same as fluids_add_vorticity_confinement, the force of a leaf scales
+** with its size. [vorticity] is set to the vorticity of ([u], [v]) before
+** the force is added, which quadtree_adapt may refine by. */
+void quadtree_add_vorticity_confinement(quadtree_t* const qt,
+	float* const u, float* const v, float* const vorticity, float eps,
+	float dt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard: QUADTREE_H */
@@ -0,0 +1,1255 @@
+#include "simd.h"
+#include "numeric.h"
+#include <math.h>
+
+/* scalar kernels */
+
+static void diffuse(float* const q, const float* const q_prev, int n, int ni,
+	float a, float r)
+{
+	int k = 0;
+	float s = 0.0;
+
+	for (k = 0; k < n; k++) {
+		s = q_prev[k + 1] + q_prev[k - 1] + q_prev[k + ni] +
+			q_prev[k - ni];
+		q[k] = a * (q_prev[k] + r * s);
+	}
+}
+
+static float divergence(float* const div, const float* const u,
+	const float* const v, int n, int ni, float s)
+{
+	int k = 0;
+	float m = 0.0;
+
+	for (k = 0; k < n; k++) {
+		div[k] = s * (u[k + 1] - u[k - 1] + v[k + ni] - v[k - ni]);
+		m = div[k] > m ? div[k] : m;
+	}
+
+	return m;
+}
+
+static void subtract_gradient(float* const u, float* const v,
+	const float* const p, int n, int ni, float s)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		u[k] -= s * (p[k + 1] - p[k - 1]);
+		v[k] -= s * (p[k + ni] - p[k - ni]);
+	}
+}
+
+static void vorticity(float* const w, const float* const u,
+	const float* const v, int n, int ni, float a)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		w[k] = a * ((v[k + 1] - v[k - 1]) - (u[k + ni] - u[k - ni]));
+	}
+}
+
+static void vorticity_gradient(float* const nx, float* const ny,
+	const float* const w, int n, int ni, float a)
+{
+	int k = 0;
+	float gx, gy, gm;
+
+	for (k = 0; k < n; k++) {
+		gx = a * (fabsf(w[k + 1]) - fabsf(w[k - 1]));
+		gy = a * (fabsf(w[k + ni]) - fabsf(w[k - ni]));
+		gm = sqrtf(gx * gx + gy * gy);
+		nx[k] = gx / (gm + EPS);
+		ny[k] = gy / (gm + EPS);
+	}
+}
+
+static void vorticity_force(float* const u, float* const v,
+	const float* const w, const float* const nx, const float* const ny,
+	int n, float b)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		u[k] += b * w[k] * ny[k];
+		v[k] -= b * w[k] * nx[k];
+	}
+}
+
+static void buoyancy(float* const v, const float* const d,
+	const float* const t, int n, float alpha, float beta, float t_ambient,
+	float dt)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		v[k] -= dt * (alpha * d[k] - beta * (t[k] - t_ambient));
+	}
+}
+
+static float max_abs(const float* const q, int n)
+{
+	int k = 0;
+	float m = 0.0;
+
+	for (k = 0; k < n; k++) {
+		m = fabsf(q[k]) > m ? fabsf(q[k]) : m;
+	}
+
+	return m;
+}
+
+static void add_scalar(float* const q, int n, float s)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		q[k] += s;
+	}
+}
+
+static void add_source(float* const q, const float* const s, int n,
+	float alpha)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		q[k] += alpha * s[k];
+	}
+}
+
+static void add_source_clamped(float* const q, const float* const s, int n,
+	float alpha, float q_min, float q_max)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		q[k] += alpha * s[k];
+		q[k] = q[k] > q_max ? q_max : q[k];
+		q[k] = q[k] < q_min ? q_min : q[k];
+	}
+}
+
+static void add_source_with_target(float* const q, const float* const s,
+	int n, float q_target)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		q[k] += (q_target - q[k]) * s[k];
+	}
+}
+
+static void advect(float* const q, const float* const q_prev,
+	const float* const u, const float* const v, int n, int i, int j,
+	const struct simd_grid* const grid, float dt)
+{
+	int k = 0, ci = 0, cj = 0, ci1 = 0, cj1 = 0;
+	int ni = grid->cell_count_i, nj = grid->cell_count_j;
+	float dx = grid->dx;
+	float x, y, fx, fy, q0, q1;
+
+	for (k = 0; k < n; k++) {
+		x = grid->origin_x + (i + k) * dx - dt * u[k] - grid->origin_x;
+		y = grid->origin_y + j * dx - dt * v[k] - grid->origin_y;
+		ci = x / dx;
+		cj = y / dx;
+		ci = ci < 0 ? 0 : (ci > ni - 1 ? ni - 1 : ci);
+		cj = cj < 0 ? 0 : (cj > nj - 1 ? nj - 1 : cj);
+		ci1 = ci + 1 > ni - 1 ? ni - 1 : ci + 1;
+		cj1 = cj + 1 > nj - 1 ? nj - 1 : cj + 1;
+		fx = (x - ci * dx) / dx;
+		fy = (y - cj * dx) / dx;
+
+		q0 = q_prev[ni * cj + ci] + fx * (q_prev[ni * cj + ci1] -
+			q_prev[ni * cj + ci]);
+		q1 = q_prev[ni * cj1 + ci] + fx * (q_prev[ni * cj1 + ci1] -
+			q_prev[ni * cj1 + ci]);
+		q[k] = q0 + fy * (q1 - q0);
+	}
+}
+
+/* offsets the weight arrays of [w] by [k] cells */
+static struct simd_weights weights_offset(const struct simd_weights* const w,
+	int k)
+{
+	struct simd_weights o = { w->idx + k, w->di + k, w->dj + k, w->fx + k,
+		w->fy + k };
+
+	return o;
+}
+
+static void backtrace(const struct simd_weights* const w,
+	const float* const u, const float* const v, int n, int i, int j,
+	const struct simd_grid* const grid, float dt)
+{
+	int k = 0, ci = 0, cj = 0, ci1 = 0, cj1 = 0;
+	int ni = grid->cell_count_i, nj = grid->cell_count_j;
+	float dx = grid->dx;
+	float x, y;
+
+	for (k = 0; k < n; k++) {
+		x = grid->origin_x + (i + k) * dx - dt * u[k] - grid->origin_x;
+		y = grid->origin_y + j * dx - dt * v[k] - grid->origin_y;
+		ci = x / dx;
+		cj = y / dx;
+		ci = ci < 0 ? 0 : (ci > ni - 1 ? ni - 1 : ci);
+		cj = cj < 0 ? 0 : (cj > nj - 1 ? nj - 1 : cj);
+		ci1 = ci + 1 > ni - 1 ? ni - 1 : ci + 1;
+		cj1 = cj + 1 > nj - 1 ? nj - 1 : cj + 1;
+		w->idx[k] = ni * cj + ci;
+		w->di[k] = ci1 - ci;
+		w->dj[k] = ni * (cj1 - cj);
+		w->fx[k] = (x - ci * dx) / dx;
+		w->fy[k] = (y - cj * dx) / dx;
+	}
+}
+
+static void interpolate(float* const q, const float* const q_prev,
+	const struct simd_weights* const w, int n)
+{
+	int k = 0;
+	const float* p = q_prev;
+	float q0, q1;
+
+	for (k = 0; k < n; k++) {
+		p = q_prev + w->idx[k];
+		q0 = p[0] + w->fx[k] * (p[w->di[k]] - p[0]);
+		q1 = p[w->dj[k]] + w->fx[k] * (p[w->di[k] + w->dj[k]] -
+			p[w->dj[k]]);
+		q[k] = q0 + w->fy[k] * (q1 - q0);
+	}
+}
+
+static void maccormack(float* const q, const float* const q_fwd,
+	const float* const q_back, const float* const q_prev,
+	const float* const q_stencil, const struct simd_weights* const w,
+	int n)
+{
+	int k = 0;
+	const float* p = q_stencil;
+	float lo, hi, r;
+
+	for (k = 0; k < n; k++) {
+		p = q_stencil + w->idx[k];
+		lo = fminf(fminf(p[0], p[w->di[k]]),
+			fminf(p[w->dj[k]], p[w->di[k] + w->dj[k]]));
+		hi = fmaxf(fmaxf(p[0], p[w->di[k]]),
+			fmaxf(p[w->dj[k]], p[w->di[k] + w->dj[k]]));
+		r = q_fwd[k] + 0.5 * (q_prev[k] - q_back[k]);
+		q[k] = fminf(fmaxf(r, lo), hi);
+	}
+}
+
+static void advect_halo(float* const q, const float* const q_prev,
+	const float* const u, const float* const v, int n, int i, int j,
+	const struct simd_grid* const grid, float dt)
+{
+	int k = 0, ci = 0, cj = 0;
+	int pitch = grid->pitch;
+	float dx = grid->dx;
+	float lo = -grid->halo * dx;
+	float hi_x = (grid->cell_count_i - 2 + grid->halo) * dx;
+	float hi_y = (grid->cell_count_j - 2 + grid->halo) * dx;
+	float x, y, fx, fy, q0, q1;
+	const float* p = q_prev;
+
+	for (k = 0; k < n; k++) {
+		x = grid->origin_x + (i + k) * dx - dt * u[k] - grid->origin_x;
+		y = grid->origin_y + j * dx - dt * v[k] - grid->origin_y;
+		x = fminf(fmaxf(x, lo), hi_x);
+		y = fminf(fmaxf(y, lo), hi_y);
+		ci = x / dx;
+		cj = y / dx;
+		fx = (x - ci * dx) / dx;
+		fy = (y - cj * dx) / dx;
+		p = q_prev + pitch * cj + ci;
+
+		q0 = p[0] + fx * (p[1] - p[0]);
+		q1 = p[pitch] + fx * (p[pitch + 1] - p[pitch]);
+		q[k] = q0 + fy * (q1 - q0);
+	}
+}
+
+static void backtrace_halo(const struct simd_weights* const w,
+	const float* const u, const float* const v, int n, int i, int j,
+	const struct simd_grid* const grid, float dt)
+{
+	int k = 0, ci = 0, cj = 0;
+	int pitch = grid->pitch;
+	float dx = grid->dx;
+	float lo = -grid->halo * dx;
+	float hi_x = (grid->cell_count_i - 2 + grid->halo) * dx;
+	float hi_y = (grid->cell_count_j - 2 + grid->halo) * dx;
+	float x, y;
+
+	for (k = 0; k < n; k++) {
+		x = grid->origin_x + (i + k) * dx - dt * u[k] - grid->origin_x;
+		y = grid->origin_y + j * dx - dt * v[k] - grid->origin_y;
+		x = fminf(fmaxf(x, lo), hi_x);
+		y = fminf(fmaxf(y, lo), hi_y);
+		ci = x / dx;
+		cj = y / dx;
+		w->idx[k] = pitch * cj + ci;
+		w->di[k] = 1;
+		w->dj[k] = pitch;
+		w->fx[k] = (x - ci * dx) / dx;
+		w->fy[k] = (y - cj * dx) / dx;
+	}
+}
+
+static void sample(float* const q, float* const r, const float* const q_prev,
+	const float* const r_prev, const float* const x, const float* const y,
+	int n, const struct simd_grid* const grid)
+{
+	int k = 0, ci = 0, cj = 0, h = grid->halo, pitch = grid->pitch;
+	int ci_max = grid->cell_count_i - 2 + h;
+	int cj_max = grid->cell_count_j - 2 + h;
+	float inv = 1.0 / grid->dx;
+	float s, t, fx, fy, q0, q1;
+	const float* p = q_prev;
+
+	for (k = 0; k < n; k++) {
+		/* in cells, shifted by the halo to truncate towards -inf */
+		s = fminf(fmaxf((x[k] - grid->origin_x) * inv, -h), ci_max + 1);
+		t = fminf(fmaxf((y[k] - grid->origin_y) * inv, -h), cj_max + 1);
+		ci = (int)(s + h) - h;
+		cj = (int)(t + h) - h;
+		ci = ci < ci_max ? ci : ci_max;
+		cj = cj < cj_max ? cj : cj_max;
+		fx = s - ci;
+		fy = t - cj;
+
+		p = q_prev + pitch * cj + ci;
+		q0 = p[0] + fx * (p[1] - p[0]);
+		q1 = p[pitch] + fx * (p[pitch + 1] - p[pitch]);
+		q[k] = q0 + fy * (q1 - q0);
+
+		if (r) {
+			p = r_prev + pitch * cj + ci;
+			q0 = p[0] + fx * (p[1] - p[0]);
+			q1 = p[pitch] + fx * (p[pitch + 1] - p[pitch]);
+			r[k] = q0 + fy * (q1 - q0);
+		}
+	}
+}
+
+static void thomas_forward(float* const x, const float* const x_prev, int n,
+	float r, float f)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		x[k] = (x[k] + r * x_prev[k]) * f;
+	}
+}
+
+static void thomas_backward(float* const x, const float* const x_next, int n,
+	float rf)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		x[k] += rf * x_next[k];
+	}
+}
+
+/* scalar lane kernels. each loops over the cells and the lanes of a cell,
+** k is the index of the value of lane e in cell c */
+
+static void lanes_diffuse(float* const q, const float* const q_prev, int n,
+	int lanes, int ni, const float* const a, const float* const r)
+{
+	int c = 0, e = 0, k = 0;
+	int si = lanes, sj = ni * lanes;
+	float s = 0.0;
+
+	for (c = 0; c < n; c++) {
+		for (e = 0; e < lanes; e++) {
+			k = c * lanes + e;
+			s = q_prev[k + si] + q_prev[k - si] + q_prev[k + sj] +
+				q_prev[k - sj];
+			q[k] = a[e] * (q_prev[k] + r[e] * s);
+		}
+	}
+}
+
+static void lanes_divergence(float* const div, const float* const u,
+	const float* const v, int n, int lanes, int ni, float s)
+{
+	int k = 0;
+	int si = lanes, sj = ni * lanes;
+
+	for (k = 0; k < n * lanes; k++) {
+		div[k] = s * (u[k + si] - u[k - si] + v[k + sj] - v[k - sj]);
+	}
+}
+
+static void lanes_gauss_seidel(float* const p, const float* const div, int n,
+	int lanes, int ni)
+{
+	int k = 0;
+	int si = lanes, sj = ni * lanes;
+
+	for (k = 0; k < n * lanes; k++) {
+		p[k] = (div[k] + p[k + si] + p[k - si] + p[k + sj] +
+			p[k - sj]) * 0.25;
+	}
+}
+
+static void lanes_subtract_gradient(float* const u, float* const v,
+	const float* const p, int n, int lanes, int ni, float s)
+{
+	int k = 0;
+	int si = lanes, sj = ni * lanes;
+
+	for (k = 0; k < n * lanes; k++) {
+		u[k] -= s * (p[k + si] - p[k - si]);
+		v[k] -= s * (p[k + sj] - p[k - sj]);
+	}
+}
+
+static void lanes_vorticity(float* const w, const float* const u,
+	const float* const v, int n, int lanes, int ni, float a)
+{
+	int k = 0;
+	int si = lanes, sj = ni * lanes;
+
+	for (k = 0; k < n * lanes; k++) {
+		w[k] = a * ((v[k + si] - v[k - si]) - (u[k + sj] - u[k - sj]));
+	}
+}
+
+static void lanes_vorticity_gradient(float* const nx, float* const ny,
+	const float* const w, int n, int lanes, int ni, float a)
+{
+	int k = 0;
+	int si = lanes, sj = ni * lanes;
+	float gx, gy, gm;
+
+	for (k = 0; k < n * lanes; k++) {
+		gx = a * (fabsf(w[k + si]) - fabsf(w[k - si]));
+		gy = a * (fabsf(w[k + sj]) - fabsf(w[k - sj]));
+		gm = sqrtf(gx * gx + gy * gy);
+		nx[k] = gx / (gm + EPS);
+		ny[k] = gy / (gm + EPS);
+	}
+}
+
+static void lanes_vorticity_force(float* const u, float* const v,
+	const float* const w, const float* const nx, const float* const ny,
+	int n, int lanes, const float* const b)
+{
+	int c = 0, e = 0, k = 0;
+
+	for (c = 0; c < n; c++) {
+		for (e = 0; e < lanes; e++) {
+			k = c * lanes + e;
+			u[k] += b[e] * w[k] * ny[k];
+			v[k] -= b[e] * w[k] * nx[k];
+		}
+	}
+}
+
+static void lanes_buoyancy(float* const v, const float* const d,
+	const float* const t, int n, int lanes, const float* const alpha,
+	const float* const beta, float t_ambient, float dt)
+{
+	int c = 0, e = 0, k = 0;
+
+	for (c = 0; c < n; c++) {
+		for (e = 0; e < lanes; e++) {
+			k = c * lanes + e;
+			v[k] -= dt * (alpha[e] * d[k] - beta[e] *
+				(t[k] - t_ambient));
+		}
+	}
+}
+
+static void lanes_add_source(float* const q, const float* const s, int n,
+	int lanes, const float* const alpha)
+{
+	int c = 0, e = 0;
+
+	for (c = 0; c < n; c++) {
+		for (e = 0; e < lanes; e++) {
+			q[c * lanes + e] += alpha[e] * s[c];
+		}
+	}
+}
+
+static void lanes_advect(float* const q, const float* const q_prev,
+	const float* const u, const float* const v, int n, int lanes, int i,
+	int j, const struct simd_grid* const grid, float dt)
+{
+	int c = 0, e = 0, k = 0, ci = 0, cj = 0, ci1 = 0, cj1 = 0;
+	int ni = grid->cell_count_i, nj = grid->cell_count_j;
+	float dx = grid->dx;
+	float x, y, fx, fy, q0, q1;
+	const float* p00;
+	const float* p01;
+
+	for (c = 0; c < n; c++) {
+		for (e = 0; e < lanes; e++) {
+			k = c * lanes + e;
+			x = grid->origin_x + (i + c) * dx - dt * u[k] -
+				grid->origin_x;
+			y = grid->origin_y + j * dx - dt * v[k] -
+				grid->origin_y;
+			ci = x / dx;
+			cj = y / dx;
+			ci = ci < 0 ? 0 : (ci > ni - 1 ? ni - 1 : ci);
+			cj = cj < 0 ? 0 : (cj > nj - 1 ? nj - 1 : cj);
+			ci1 = ci + 1 > ni - 1 ? ni - 1 : ci + 1;
+			cj1 = cj + 1 > nj - 1 ? nj - 1 : cj + 1;
+			fx = (x - ci * dx) / dx;
+			fy = (y - cj * dx) / dx;
+
+			p00 = q_prev + e + lanes * ni * cj;
+			p01 = q_prev + e + lanes * ni * cj1;
+			q0 = p00[lanes * ci] + fx * (p00[lanes * ci1] -
+				p00[lanes * ci]);
+			q1 = p01[lanes * ci] + fx * (p01[lanes * ci1] -
+				p01[lanes * ci]);
+			q[k] = q0 + fy * (q1 - q0);
+		}
+	}
+}
+
+/* half precision conversion, with the float scalings the vector kernels
+** use. fp16 values are rescaled from exponent bias 15 to 127 by 2^112,
+** which takes care of subnormals as well. */
+
+union simd_bits {
+	float f;
+	unsigned int u;
+};
+
+float simd_half_to_float(unsigned short h, int format)
+{
+	union simd_bits x, scale;
+
+	if (format == SIMD_HALF_BF16) {
+		x.u = (unsigned int)h << 16;
+		return x.f;
+	}
+
+	scale.u = (254 - 15) << 23;
+	x.u = (unsigned int)(h & 0x7fff) << 13;
+	x.f *= scale.f;
+
+	/* infinity or NaN */
+	if (x.f >= 65536.0) {
+		x.u |= 255 << 23;
+	}
+
+	x.u |= (unsigned int)(h & 0x8000) << 16;
+	return x.f;
+}
+
+unsigned short simd_float_to_half(float f, int format)
+{
+	union simd_bits x = { f }, half;
+	unsigned int sign = 0;
+
+	if (format == SIMD_HALF_BF16) {
+		x.u += 0x7fff + ((x.u >> 16) & 1);
+		return x.u >> 16;
+	}
+
+	sign = (x.u >> 16) & 0x8000;
+	x.u &= 0x7fffffff;
+
+	/* overflow, infinity or NaN */
+	if (x.u >= 0x47800000) {
+		return sign | (x.u > 0x7f800000 ? 0x7e00 : 0x7c00);
+	}
+
+	/* subnormal, the addition of 0.5 rounds to its last place */
+	if (x.u < 0x38800000) {
+		half.u = 126 << 23;
+		x.f += half.f;
+		return sign | (x.u - half.u);
+	}
+
+	x.u += ((unsigned int)(15 - 127) << 23) + 0xfff + ((x.u >> 13) & 1);
+	return sign | (x.u >> 13);
+}
+
+/* scalar half precision kernels */
+
+static void half_to_float(float* const q, const unsigned short* const h,
+	int n, int format)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		q[k] = simd_half_to_float(h[k], format);
+	}
+}
+
+static void float_to_half(unsigned short* const h, const float* const q,
+	int n, int format)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		h[k] = simd_float_to_half(q[k], format);
+	}
+}
+
+static void diffuse_half(unsigned short* const q,
+	const unsigned short* const q_prev, int n, int ni, float a, float r,
+	int format)
+{
+	int k = 0;
+	float s = 0.0;
+
+	for (k = 0; k < n; k++) {
+		s = simd_half_to_float(q_prev[k + 1], format) +
+			simd_half_to_float(q_prev[k - 1], format) +
+			simd_half_to_float(q_prev[k + ni], format) +
+			simd_half_to_float(q_prev[k - ni], format);
+		q[k] = simd_float_to_half(a * (simd_half_to_float(q_prev[k],
+			format) + r * s), format);
+	}
+}
+
+static void interpolate_half(unsigned short* const q,
+	const unsigned short* const q_prev,
+	const struct simd_weights* const w, int n, int format)
+{
+	int k = 0;
+	const unsigned short* p = q_prev;
+	float q00, q10, q01, q11, q0, q1;
+
+	for (k = 0; k < n; k++) {
+		p = q_prev + w->idx[k];
+		q00 = simd_half_to_float(p[0], format);
+		q10 = simd_half_to_float(p[w->di[k]], format);
+		q01 = simd_half_to_float(p[w->dj[k]], format);
+		q11 = simd_half_to_float(p[w->di[k] + w->dj[k]], format);
+		q0 = q00 + w->fx[k] * (q10 - q00);
+		q1 = q01 + w->fx[k] * (q11 - q01);
+		q[k] = simd_float_to_half(q0 + w->fy[k] * (q1 - q0), format);
+	}
+}
+
+static void add_source_half(unsigned short* const q, const float* const s,
+	int n, float alpha, int format)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		q[k] = simd_float_to_half(simd_half_to_float(q[k], format) +
+			alpha * s[k], format);
+	}
+}
+
+static void sor_half(unsigned short* const x, const unsigned short* const b,
+	int n, int ni, int first, float a, float c, float w, int format)
+{
+	int k = 0;
+	float s = 0.0;
+
+	for (k = first; k < n; k += 2) {
+		s = simd_half_to_float(x[k + 1], format) +
+			simd_half_to_float(x[k - 1], format) +
+			simd_half_to_float(x[k + ni], format) +
+			simd_half_to_float(x[k - ni], format);
+		x[k] = simd_float_to_half(w * simd_half_to_float(x[k], format) +
+			a * (c * simd_half_to_float(b[k], format) + s), format);
+	}
+}
+
+static float residual_half(unsigned short* const r, const float* const x,
+	const float* const b, int n, int ni, float c, float d, float s,
+	int format)
+{
+	int k = 0;
+	float m = 0.0, res = 0.0;
+
+	for (k = 0; k < n; k++) {
+		res = c * b[k] - d * x[k] + x[k + 1] + x[k - 1] + x[k + ni] +
+			x[k - ni];
+		r[k] = simd_float_to_half(s * res, format);
+		m = fabsf(res) > m ? fabsf(res) : m;
+	}
+
+	return m;
+}
+
+static void add_half(float* const q, const unsigned short* const h, int n,
+	float alpha, int format)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		q[k] += alpha * simd_half_to_float(h[k], format);
+	}
+}
+
+/* scalar 3d kernels */
+
+#define SIMD_SOR_BLOCK 256	/* cells per block of the vector red-black
+				** kernels */
+
+/* 1, 0, 1, ... from which the vector kernels load the masks of the cells
+** of a red-black sweep */
+static const float simd_alternate[SIMD_MAX_WIDTH + 1] = {
+	1.0, 0.0, 1.0, 0.0, 1.0, 0.0, 1.0, 0.0,
+	1.0, 0.0, 1.0, 0.0, 1.0, 0.0, 1.0, 0.0, 1.0
+};
+
+/* 0, ..., 0, 1, ..., 1 from which the vector kernels load the masks of the
+** last cells of a row */
+static const float simd_tail[2 * SIMD_MAX_WIDTH] = {
+	0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0,
+	0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0,
+	1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0,
+	1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0
+};
+
+static void sor_3d(float* const x, const float* const b, int n, int ni,
+	int nij, int first, float a, float c, float w)
+{
+	int k = 0;
+	float s = 0.0;
+
+	for (k = first; k < n; k += 2) {
+		s = x[k + 1] + x[k - 1] + x[k + ni] + x[k - ni] + x[k + nij] +
+			x[k - nij];
+		x[k] = w * x[k] + a * (c * b[k] + s);
+	}
+}
+
+static float divergence_3d(float* const div, const float* const u,
+	const float* const v, const float* const w, int n, int ni, int nij,
+	float s)
+{
+	int k = 0;
+	float m = 0.0;
+
+	for (k = 0; k < n; k++) {
+		div[k] = s * (u[k + 1] - u[k - 1] + v[k + ni] - v[k - ni] +
+			w[k + nij] - w[k - nij]);
+		m = div[k] > m ? div[k] : m;
+	}
+
+	return m;
+}
+
+static void subtract_gradient_3d(float* const u, float* const v,
+	float* const w, const float* const p, int n, int ni, int nij, float s)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		u[k] -= s * (p[k + 1] - p[k - 1]);
+		v[k] -= s * (p[k + ni] - p[k - ni]);
+		w[k] -= s * (p[k + nij] - p[k - nij]);
+	}
+}
+
+static void curl_3d(float* const cx, float* const cy, float* const cz,
+	float* const cm, const float* const u, const float* const v,
+	const float* const w, int n, int ni, int nij, float a)
+{
+	int k = 0;
+
+	for (k = 0; k < n; k++) {
+		cx[k] = a * ((w[k + ni] - w[k - ni]) -
+			(v[k + nij] - v[k - nij]));
+		cy[k] = a * ((u[k + nij] - u[k - nij]) -
+			(w[k + 1] - w[k - 1]));
+		cz[k] = a * ((v[k + 1] - v[k - 1]) -
+			(u[k + ni] - u[k - ni]));
+		cm[k] = sqrtf(cx[k] * cx[k] + cy[k] * cy[k] + cz[k] * cz[k]);
+	}
+}
+
+static void vorticity_force_3d(float* const u, float* const v, float* const w,
+	const float* const cx, const float* const cy, const float* const cz,
+	const float* const cm, int n, int ni, int nij, float a, float b)
+{
+	int k = 0;
+	float gx, gy, gz, gm;
+
+	for (k = 0; k < n; k++) {
+		gx = a * (cm[k + 1] - cm[k - 1]);
+		gy = a * (cm[k + ni] - cm[k - ni]);
+		gz = a * (cm[k + nij] - cm[k - nij]);
+		gm = sqrtf(gx * gx + gy * gy + gz * gz) + EPS;
+		gx = gx / gm;
+		gy = gy / gm;
+		gz = gz / gm;
+		u[k] += b * (gy * cz[k] - gz * cy[k]);
+		v[k] += b * (gz * cx[k] - gx * cz[k]);
+		w[k] += b * (gx * cy[k] - gy * cx[k]);
+	}
+}
+
+static void advect_3d(float* const q, const float* const q_prev,
+	const float* const u, const float* const v, const float* const w,
+	int n, int i, int j, int k, const struct simd_grid_3d* const grid,
+	float dt)
+{
+	int c = 0, ci = 0, cj = 0, ck = 0, di = 0, dj = 0, dk = 0, idx = 0;
+	int ni = grid->cell_count_i, nj = grid->cell_count_j;
+	int nk = grid->cell_count_k;
+	float dx = grid->dx;
+	float x, y, z, fx, fy, fz, q00, q10, q01, q11, q0, q1;
+
+	for (c = 0; c < n; c++) {
+		x = grid->origin_x + (i + c) * dx - dt * u[c] - grid->origin_x;
+		y = grid->origin_y + j * dx - dt * v[c] - grid->origin_y;
+		z = grid->origin_z + k * dx - dt * w[c] - grid->origin_z;
+		ci = x / dx;
+		cj = y / dx;
+		ck = z / dx;
+		ci = ci < 0 ? 0 : (ci > ni - 1 ? ni - 1 : ci);
+		cj = cj < 0 ? 0 : (cj > nj - 1 ? nj - 1 : cj);
+		ck = ck < 0 ? 0 : (ck > nk - 1 ? nk - 1 : ck);
+		di = ci + 1 > ni - 1 ? 0 : 1;
+		dj = cj + 1 > nj - 1 ? 0 : ni;
+		dk = ck + 1 > nk - 1 ? 0 : ni * nj;
+		fx = (x - ci * dx) / dx;
+		fy = (y - cj * dx) / dx;
+		fz = (z - ck * dx) / dx;
+
+		idx = (ck * nj + cj) * ni + ci;
+		q00 = q_prev[idx] + fx * (q_prev[idx + di] - q_prev[idx]);
+		q10 = q_prev[idx + dj] + fx * (q_prev[idx + dj + di] -
+			q_prev[idx + dj]);
+		q01 = q_prev[idx + dk] + fx * (q_prev[idx + dk + di] -
+			q_prev[idx + dk]);
+		q11 = q_prev[idx + dk + dj] + fx * (q_prev[idx + dk + dj + di] -
+			q_prev[idx + dk + dj]);
+		q0 = q00 + fy * (q10 - q00);
+		q1 = q01 + fy * (q11 - q01);
+		q[c] = q0 + fz * (q1 - q0);
+	}
+}
+
+const struct simd_kernels simd_scalar_kernels = {
+	"scalar",
+	diffuse,
+	divergence,
+	subtract_gradient,
+	vorticity,
+	vorticity_gradient,
+	vorticity_force,
+	buoyancy,
+	max_abs,
+	add_scalar,
+	add_source,
+	add_source_clamped,
+	add_source_with_target,
+	advect,
+	backtrace,
+	interpolate,
+	maccormack,
+	advect_halo,
+	backtrace_halo,
+	sample,
+	thomas_forward,
+	thomas_backward,
+	lanes_diffuse,
+	lanes_divergence,
+	lanes_gauss_seidel,
+	lanes_subtract_gradient,
+	lanes_vorticity,
+	lanes_vorticity_gradient,
+	lanes_vorticity_force,
+	lanes_buoyancy,
+	lanes_add_source,
+	lanes_advect,
+	half_to_float,
+	float_to_half,
+	diffuse_half,
+	interpolate_half,
+	add_source_half,
+	sor_half,
+	residual_half,
+	add_half,
+	sor_3d,
+	divergence_3d,
+	subtract_gradient_3d,
+	curl_3d,
+	vorticity_force_3d,
+	advect_3d
+};
+
+/* x86 vector kernels. each instruction set is enabled per function, the
+** file itself is compiled for the baseline architecture */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SIMD_X86 1
+#include <immintrin.h>
+
+/* SSE4.2, 4 lanes */
+
+#define NAME "sse4.2"
+#define TARGET __attribute__((target("sse4.2")))
+#define FN(name) name##_sse42
+#define W 4
+#define V __m128
+#define VI __m128i
+#define LOAD _mm_loadu_ps
+#define STORE _mm_storeu_ps
+#define SET1 _mm_set1_ps
+#define ADD _mm_add_ps
+#define SUB _mm_sub_ps
+#define MUL _mm_mul_ps
+#define DIV _mm_div_ps
+#define MIN _mm_min_ps
+#define MAX _mm_max_ps
+#define SQRT _mm_sqrt_ps
+#define ABS(a) _mm_andnot_ps(_mm_set1_ps(-0.0), a)
+#define SET1I _mm_set1_epi32
+#define ADDI _mm_add_epi32
+#define MULLOI _mm_mullo_epi32
+#define MINI _mm_min_epi32
+#define MAXI _mm_max_epi32
+#define CVTT _mm_cvttps_epi32
+#define LOADI(p) _mm_loadu_si128((const __m128i*)(p))
+#define STOREI(p, a) _mm_storeu_si128((__m128i*)(p), a)
+#define SUBI _mm_sub_epi32
+#define CVTI _mm_cvtepi32_ps
+#define RAMPI _mm_setr_epi32(0, 1, 2, 3)
+#define GATHER(base, idx) gather_sse42(base, idx)
+#define SLLI _mm_slli_epi32
+#define SRLI _mm_srli_epi32
+#define ANDI _mm_and_si128
+#define CASTIPS _mm_castsi128_ps
+#define CASTPSI _mm_castps_si128
+#define LOADH(p) _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(p)))
+#define STOREH(p, a) _mm_storel_epi64((__m128i*)(p), _mm_packus_epi32(a, a))
+#define GATHERH(base, idx) gather_bits_sse42(base, idx)
+#define LOAD_FP16(p) fp16_to_ps_sse42(LOADH(p))
+#define STORE_FP16(p, a) store_fp16_sse42(p, a)
+#define GATHER_FP16(base, idx) fp16_to_ps_sse42(GATHERH(base, idx))
+
+/* SSE has no gather instruction */
+static TARGET __m128 gather_sse42(const float* const base, __m128i idx)
+{
+	int k[4];
+
+	_mm_storeu_si128((__m128i*)k, idx);
+	return _mm_setr_ps(base[k[0]], base[k[1]], base[k[2]], base[k[3]]);
+}
+
+static TARGET __m128i gather_bits_sse42(const unsigned short* const base,
+	__m128i idx)
+{
+	int k[4];
+
+	_mm_storeu_si128((__m128i*)k, idx);
+	return _mm_setr_epi32(base[k[0]], base[k[1]], base[k[2]], base[k[3]]);
+}
+
+/* SSE has no F16C either, the conversion of simd_half_to_float on 4 zero
+** extended values */
+static TARGET __m128 fp16_to_ps_sse42(__m128i h)
+{
+	__m128i bits = _mm_slli_epi32(_mm_and_si128(h,
+		_mm_set1_epi32(0x7fff)), 13);
+	__m128i sign = _mm_slli_epi32(_mm_and_si128(h,
+		_mm_set1_epi32(0x8000)), 16);
+	__m128 f = _mm_mul_ps(_mm_castsi128_ps(bits),
+		_mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23)));
+	__m128 inf = _mm_and_ps(_mm_cmpge_ps(f, _mm_set1_ps(65536.0)),
+		_mm_castsi128_ps(_mm_set1_epi32(255 << 23)));
+
+	return _mm_or_ps(_mm_or_ps(f, inf), _mm_castsi128_ps(sign));
+}
+
+static TARGET void store_fp16_sse42(unsigned short* const p, __m128 a)
+{
+	float t[4];
+
+	_mm_storeu_ps(t, a);
+	float_to_half(p, t, 4, SIMD_HALF_FP16);
+}
+
+#include "simd_kernels.inc"
+
+#undef NAME
+#undef TARGET
+#undef FN
+#undef W
+#undef V
+#undef VI
+#undef LOAD
+#undef STORE
+#undef SET1
+#undef ADD
+#undef SUB
+#undef MUL
+#undef DIV
+#undef MIN
+#undef MAX
+#undef SQRT
+#undef ABS
+#undef SET1I
+#undef ADDI
+#undef MULLOI
+#undef MINI
+#undef MAXI
+#undef CVTT
+#undef LOADI
+#undef STOREI
+#undef SUBI
+#undef CVTI
+#undef RAMPI
+#undef GATHER
+#undef SLLI
+#undef SRLI
+#undef ANDI
+#undef CASTIPS
+#undef CASTPSI
+#undef LOADH
+#undef STOREH
+#undef GATHERH
+#undef LOAD_FP16
+#undef STORE_FP16
+#undef GATHER_FP16
+
+/* AVX2, 8 lanes */
+
+#define NAME "avx2"
+#define TARGET __attribute__((target("avx2,f16c")))
+#define FN(name) name##_avx2
+#define W 8
+#define V __m256
+#define VI __m256i
+#define LOAD _mm256_loadu_ps
+#define STORE _mm256_storeu_ps
+#define SET1 _mm256_set1_ps
+#define ADD _mm256_add_ps
+#define SUB _mm256_sub_ps
+#define MUL _mm256_mul_ps
+#define DIV _mm256_div_ps
+#define MIN _mm256_min_ps
+#define MAX _mm256_max_ps
+#define SQRT _mm256_sqrt_ps
+#define ABS(a) _mm256_andnot_ps(_mm256_set1_ps(-0.0), a)
+#define SET1I _mm256_set1_epi32
+#define ADDI _mm256_add_epi32
+#define MULLOI _mm256_mullo_epi32
+#define MINI _mm256_min_epi32
+#define MAXI _mm256_max_epi32
+#define CVTT _mm256_cvttps_epi32
+#define LOADI(p) _mm256_loadu_si256((const __m256i*)(p))
+#define STOREI(p, a) _mm256_storeu_si256((__m256i*)(p), a)
+#define SUBI _mm256_sub_epi32
+#define CVTI _mm256_cvtepi32_ps
+#define RAMPI _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)
+#define GATHER(base, idx) _mm256_i32gather_ps(base, idx, 4)
+#define SLLI _mm256_slli_epi32
+#define SRLI _mm256_srli_epi32
+#define ANDI _mm256_and_si256
+#define CASTIPS _mm256_castsi256_ps
+#define CASTPSI _mm256_castps_si256
+#define LOADH(p) _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(p)))
+#define STOREH(p, a) _mm_storeu_si128((__m128i*)(p), narrow_avx2(a))
+#define GATHERH(base, idx) gather_bits_avx2(base, idx)
+#define LOAD_FP16(p) _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(p)))
+#define STORE_FP16(p, a) _mm_storeu_si128((__m128i*)(p), \
+	_mm256_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT))
+#define GATHER_FP16(base, idx) _mm256_cvtph_ps(narrow_avx2(GATHERH(base, idx)))
+
+/* packs 8 zero extended 16 bit values */
+static TARGET __m128i narrow_avx2(__m256i a)
+{
+	return _mm256_castsi256_si128(_mm256_permute4x64_epi64(
+		_mm256_packus_epi32(a, a), 0x08));
+}
+
+/* zero extended 16 bit values base[idx]. The gather loads 4 bytes a lane,
+** so each lane loads the value before its own, but at index 0, and shifts
+** the wanted one down: no lane reads past base[idx]. */
+static TARGET __m256i gather_bits_avx2(const unsigned short* const base,
+	__m256i idx)
+{
+	__m256i first = _mm256_max_epi32(_mm256_sub_epi32(idx,
+		_mm256_set1_epi32(1)), _mm256_setzero_si256());
+	__m256i shift = _mm256_slli_epi32(_mm256_sub_epi32(idx, first), 4);
+
+	return _mm256_and_si256(_mm256_srlv_epi32(_mm256_i32gather_epi32(
+		(const int*)base, first, 2), shift), _mm256_set1_epi32(0xffff));
+}
+
+#include "simd_kernels.inc"
+
+#undef NAME
+#undef TARGET
+#undef FN
+#undef W
+#undef V
+#undef VI
+#undef LOAD
+#undef STORE
+#undef SET1
+#undef ADD
+#undef SUB
+#undef MUL
+#undef DIV
+#undef MIN
+#undef MAX
+#undef SQRT
+#undef ABS
+#undef SET1I
+#undef ADDI
+#undef MULLOI
+#undef MINI
+#undef MAXI
+#undef CVTT
+#undef LOADI
+#undef STOREI
+#undef SUBI
+#undef CVTI
+#undef RAMPI
+#undef GATHER
+#undef SLLI
+#undef SRLI
+#undef ANDI
+#undef CASTIPS
+#undef CASTPSI
+#undef LOADH
+#undef STOREH
+#undef GATHERH
+#undef LOAD_FP16
+#undef STORE_FP16
+#undef GATHER_FP16
+
+/* AVX-512, 16 lanes */
+
+#define NAME "avx512"
+#define TARGET __attribute__((target("avx512f")))
+#define FN(name) name##_avx512
+#define W 16
+#define V __m512
+#define VI __m512i
+#define LOAD _mm512_loadu_ps
+#define STORE _mm512_storeu_ps
+#define SET1 _mm512_set1_ps
+#define ADD _mm512_add_ps
+#define SUB _mm512_sub_ps
+#define MUL _mm512_mul_ps
+#define DIV _mm512_div_ps
+#define MIN _mm512_min_ps
+#define MAX _mm512_max_ps
+#define SQRT _mm512_sqrt_ps
+#define ABS(a) _mm512_castsi512_ps(_mm512_and_si512( \
+	_mm512_castps_si512(a), _mm512_set1_epi32(0x7fffffff)))
+#define SET1I _mm512_set1_epi32
+#define ADDI _mm512_add_epi32
+#define MULLOI _mm512_mullo_epi32
+#define MINI _mm512_min_epi32
+#define MAXI _mm512_max_epi32
+#define CVTT _mm512_cvttps_epi32
+#define LOADI(p) _mm512_loadu_si512(p)
+#define STOREI(p, a) _mm512_storeu_si512(p, a)
+#define SUBI _mm512_sub_epi32
+#define CVTI _mm512_cvtepi32_ps
+#define RAMPI _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, \
+	12, 13, 14, 15)
+#define GATHER(base, idx) _mm512_i32gather_ps(idx, base, 4)
+#define SLLI _mm512_slli_epi32
+#define SRLI _mm512_srli_epi32
+#define ANDI _mm512_and_si512
+#define CASTIPS _mm512_castsi512_ps
+#define CASTPSI _mm512_castps_si512
+#define LOADH(p) _mm512_cvtepu16_epi32(_mm256_loadu_si256( \
+	(const __m256i*)(p)))
+#define STOREH(p, a) _mm256_storeu_si256((__m256i*)(p), \
+	_mm512_cvtepi32_epi16(a))
+#define GATHERH(base, idx) gather_bits_avx512(base, idx)
+#define LOAD_FP16(p) _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(p)))
+#define STORE_FP16(p, a) _mm256_storeu_si256((__m256i*)(p), \
+	_mm512_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT))
+#define GATHER_FP16(base, idx) _mm512_cvtph_ps(_mm512_cvtepi32_epi16( \
+	GATHERH(base, idx)))
+
+/* see gather_bits_avx2 */
+static TARGET __m512i gather_bits_avx512(const unsigned short* const base,
+	__m512i idx)
+{
+	__m512i first = _mm512_max_epi32(_mm512_sub_epi32(idx,
+		_mm512_set1_epi32(1)), _mm512_setzero_si512());
+	__m512i shift = _mm512_slli_epi32(_mm512_sub_epi32(idx, first), 4);
+
+	return _mm512_and_si512(_mm512_srlv_epi32(_mm512_i32gather_epi32(
+		first, (const int*)base, 2), shift), _mm512_set1_epi32(0xffff));
+}
+
+#include "simd_kernels.inc"
+
+#undef NAME
+#undef TARGET
+#undef FN
+#undef W
+#undef V
+#undef VI
+#undef LOAD
+#undef STORE
+#undef SET1
+#undef ADD
+#undef SUB
+#undef MUL
+#undef DIV
+#undef MIN
+#undef MAX
+#undef SQRT
+#undef ABS
+#undef SET1I
+#undef ADDI
+#undef MULLOI
+#undef MINI
+#undef MAXI
+#undef CVTT
+#undef LOADI
+#undef STOREI
+#undef SUBI
+#undef CVTI
+#undef RAMPI
+#undef GATHER
+#undef SLLI
+#undef SRLI
+#undef ANDI
+#undef CASTIPS
+#undef CASTPSI
+#undef LOADH
+#undef STOREH
+#undef GATHERH
+#undef LOAD_FP16
+#undef STORE_FP16
+#undef GATHER_FP16
+
+#endif /* x86 */
+
+const struct simd_kernels* simd_select()
+{
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f")) {
+		return &kernels_avx512;
+	}
+
+	/* the half precision kernels convert with F16C */
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c")) {
+		return &kernels_avx2;
+	}
+
+	if (__builtin_cpu_supports("sse4.2")) {
+		return &kernels_sse42;
+	}
+#endif
+
+	return &simd_scalar_kernels;
+}
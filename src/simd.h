@@ -0,0 +1,290 @@
+/* vectorized row kernels of the grid routines, selected at runtime */
+#ifndef SIMD_H
+#define SIMD_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Grid parameters of the advection kernels. */
+struct simd_grid {
+	float origin_x;
+	float origin_y;
+	float dx;
+	int cell_count_i;
+	int cell_count_j;
+	int pitch;	/* row stride of q_prev in the halo kernels */
+	int halo;	/* cells around the grid in the halo kernels */
+};
+
+/* Departure points of [n] cells, shared by fields advected with the same
+** velocity. The bilinear stencil of a cell starts at q_prev[idx] and
+** extends by di cells along i and dj cells along j (0 at the clamped grid
+** border). */
+struct simd_weights {
+	int* idx;
+	int* di;
+	int* dj;
+	float* fx;
+	float* fy;
+};
+
+/* Storage formats of half precision values, the same as FLUIDS_HALF_*. */
+enum {
+	SIMD_HALF_FP16 = 0,
+	SIMD_HALF_BF16
+};
+
+/* Grid parameters of the 3d advection kernel. */
+struct simd_grid_3d {
+	float origin_x;
+	float origin_y;
+	float origin_z;
+	float dx;
+	int cell_count_i;
+	int cell_count_j;
+	int cell_count_k;
+};
+
+/* Each kernel processes [n] consecutive cells starting at the given
+** pointers. Stencil kernels read the neighbors at +-1 and +-[ni], the row
+** stride of the grid. */
+struct simd_kernels {
+	const char* name;
+
+	/* q = a (q_prev + r sum(q_prev_nb)) */
+	void (*diffuse)(float* const q, const float* const q_prev, int n,
+		int ni, float a, float r);
+
+	/* div = s (du + dv) with central differences. Returns the max. of
+	** the computed values and 0. */
+	float (*divergence)(float* const div, const float* const u,
+		const float* const v, int n, int ni, float s);
+
+	/* u -= s dp/di, v -= s dp/dj with central differences */
+	void (*subtract_gradient)(float* const u, float* const v,
+		const float* const p, int n, int ni, float s);
+
+	/* w = a (dv/di - du/dj) with central differences */
+	void (*vorticity)(float* const w, const float* const u,
+		const float* const v, int n, int ni, float a);
+
+	/* normalized gradient (nx, ny) of |w| */
+	void (*vorticity_gradient)(float* const nx, float* const ny,
+		const float* const w, int n, int ni, float a);
+
+	/* u += b w ny, v -= b w nx */
+	void (*vorticity_force)(float* const u, float* const v,
+		const float* const w, const float* const nx,
+		const float* const ny, int n, float b);
+
+	/* v -= dt (alpha d - beta (t - t_ambient)) */
+	void (*buoyancy)(float* const v, const float* const d,
+		const float* const t, int n, float alpha, float beta,
+		float t_ambient, float dt);
+
+	/* Returns the max. of |q| and 0 */
+	float (*max_abs)(const float* const q, int n);
+
+	/* q += s */
+	void (*add_scalar)(float* const q, int n, float s);
+
+	/* q += alpha s */
+	void (*add_source)(float* const q, const float* const s, int n,
+		float alpha);
+
+	/* q = clamp(q + alpha s, q_min, q_max) */
+	void (*add_source_clamped)(float* const q, const float* const s, int n,
+		float alpha, float q_min, float q_max);
+
+	/* q += (q_target - q) s */
+	void (*add_source_with_target)(float* const q, const float* const s,
+		int n, float q_target);
+
+	/* semi-Lagrangian advection of the cells (i, j), ..., (i + n - 1, j):
+	** q = q_prev sampled bilinearly at (x, y) - dt (u, v) */
+	void (*advect)(float* const q, const float* const q_prev,
+		const float* const u, const float* const v, int n, int i,
+		int j, const struct simd_grid* const grid, float dt);
+
+	/* the departure points of the advection kernel */
+	void (*backtrace)(const struct simd_weights* const w,
+		const float* const u, const float* const v, int n, int i,
+		int j, const struct simd_grid* const grid, float dt);
+
+	/* q = q_prev sampled at the departure points [w] */
+	void (*interpolate)(float* const q, const float* const q_prev,
+		const struct simd_weights* const w, int n);
+
+	/* q = q_fwd + (q_prev - q_back) / 2, clamped to the values of
+	** [q_stencil] at the stencils of the departure points [w] */
+	void (*maccormack)(float* const q, const float* const q_fwd,
+		const float* const q_back, const float* const q_prev,
+		const float* const q_stencil,
+		const struct simd_weights* const w, int n);
+
+	/* advect and backtrace for a grid surrounded by [halo] cells holding
+	** copies of the nearest boundary cell. [q_prev] points at cell (0, 0),
+	** departure points are moved onto the halo instead of clamping the 
+	** stencil, which then always extends by 1 and [pitch] cells. */
+	void (*advect_halo)(float* const q, const float* const q_prev,
+		const float* const u, const float* const v, int n, int i,
+		int j, const struct simd_grid* const grid, float dt);
+	void (*backtrace_halo)(const struct simd_weights* const w,
+		const float* const u, const float* const v, int n, int i,
+		int j, const struct simd_grid* const grid, float dt);
+
+	/* q = q_prev sampled bilinearly at the points (x[k], y[k]), and
+	** r = r_prev unless [r] is NULL, with one stencil per point. Points
+	** are moved onto the grid, or onto the halo of [halo] cells, and
+	** [q_prev] and [r_prev] point at cell (0, 0). */
+	void (*sample)(float* const q, float* const r,
+		const float* const q_prev, const float* const r_prev,
+		const float* const x, const float* const y, int n,
+		const struct simd_grid* const grid);
+
+	/* steps of the Thomas algorithm for [n] independent lines, a cell of
+	** each: x = (x + r x_prev) f in the forward elimination and
+	** x += rf x_next in the back substitution */
+	void (*thomas_forward)(float* const x, const float* const x_prev,
+		int n, float r, float f);
+	void (*thomas_backward)(float* const x, const float* const x_next,
+		int n, float rf);
+
+	/* lane kernels, see below */
+
+	void (*lanes_diffuse)(float* const q, const float* const q_prev,
+		int n, int lanes, int ni, const float* const a,
+		const float* const r);
+	void (*lanes_divergence)(float* const div, const float* const u,
+		const float* const v, int n, int lanes, int ni, float s);
+
+	/* p = (div + sum(p_nb)) / 4, cell after cell */
+	void (*lanes_gauss_seidel)(float* const p, const float* const div,
+		int n, int lanes, int ni);
+	void (*lanes_subtract_gradient)(float* const u, float* const v,
+		const float* const p, int n, int lanes, int ni, float s);
+	void (*lanes_vorticity)(float* const w, const float* const u,
+		const float* const v, int n, int lanes, int ni, float a);
+	void (*lanes_vorticity_gradient)(float* const nx, float* const ny,
+		const float* const w, int n, int lanes, int ni, float a);
+	void (*lanes_vorticity_force)(float* const u, float* const v,
+		const float* const w, const float* const nx,
+		const float* const ny, int n, int lanes, const float* const b);
+	void (*lanes_buoyancy)(float* const v, const float* const d,
+		const float* const t, int n, int lanes,
+		const float* const alpha, const float* const beta,
+		float t_ambient, float dt);
+
+	/* q += alpha s with one source value s per cell for all lanes */
+	void (*lanes_add_source)(float* const q, const float* const s, int n,
+		int lanes, const float* const alpha);
+	void (*lanes_advect)(float* const q, const float* const q_prev,
+		const float* const u, const float* const v, int n, int lanes,
+		int i, int j, const struct simd_grid* const grid, float dt);
+
+	/* half precision kernels, see below */
+
+	/* q = h, h = q rounded to nearest even */
+	void (*half_to_float)(float* const q, const unsigned short* const h,
+		int n, int format);
+	void (*float_to_half)(unsigned short* const h, const float* const q,
+		int n, int format);
+	void (*diffuse_half)(unsigned short* const q,
+		const unsigned short* const q_prev, int n, int ni, float a,
+		float r, int format);
+	void (*interpolate_half)(unsigned short* const q,
+		const unsigned short* const q_prev,
+		const struct simd_weights* const w, int n, int format);
+	void (*add_source_half)(unsigned short* const q, const float* const s,
+		int n, float alpha, int format);
+
+	/* x = w x + a (c b + sum(x_nb)) for every other cell, starting with
+	** cell [first] (0 or 1) */
+	void (*sor_half)(unsigned short* const x,
+		const unsigned short* const b, int n, int ni, int first,
+		float a, float c, float w, int format);
+
+	/* r = s (c b - (d x - sum(x_nb))) with float [x] and [b]. Returns
+	** the max. of |c b - (d x - sum(x_nb))| and 0. */
+	float (*residual_half)(unsigned short* const r, const float* const x,
+		const float* const b, int n, int ni, float c, float d, float s,
+		int format);
+
+	/* q += alpha h with float [q] */
+	void (*add_half)(float* const q, const unsigned short* const h, int n,
+		float alpha, int format);
+
+	/* 3d kernels, see below */
+
+	/* x = w x + a (c b + sum(x_nb)) for every other cell, starting with
+	** cell [first] (0 or 1) */
+	void (*sor_3d)(float* const x, const float* const b, int n, int ni,
+		int nij, int first, float a, float c, float w);
+
+	/* div = s (du + dv + dw) with central differences. Returns the max.
+	** of the computed values and 0. */
+	float (*divergence_3d)(float* const div, const float* const u,
+		const float* const v, const float* const w, int n, int ni,
+		int nij, float s);
+
+	/* (u, v, w) -= s grad(p) with central differences */
+	void (*subtract_gradient_3d)(float* const u, float* const v,
+		float* const w, const float* const p, int n, int ni, int nij,
+		float s);
+
+	/* (cx, cy, cz) = a curl(u, v, w) with central differences, cm = its
+	** magnitude */
+	void (*curl_3d)(float* const cx, float* const cy, float* const cz,
+		float* const cm, const float* const u, const float* const v,
+		const float* const w, int n, int ni, int nij, float a);
+
+	/* (u, v, w) += b N x (cx, cy, cz), N the normalized gradient of cm
+	** (scaled by a) */
+	void (*vorticity_force_3d)(float* const u, float* const v,
+		float* const w, const float* const cx, const float* const cy,
+		const float* const cz, const float* const cm, int n, int ni,
+		int nij, float a, float b);
+
+	/* semi-Lagrangian advection of the cells (i, j, k), ...,
+	** (i + n - 1, j, k): q = q_prev sampled trilinearly at
+	** (x, y, z) - dt (u, v, w) */
+	void (*advect_3d)(float* const q, const float* const q_prev,
+		const float* const u, const float* const v,
+		const float* const w, int n, int i, int j, int k,
+		const struct simd_grid_3d* const grid, float dt);
+};
+
+/* The lane kernels compute the same as the kernels of the same name for
+** [lanes] independent grids stored interleaved, i.e. cell after cell with
+** the [lanes] values of a cell next to each other. Each processes the [n]
+** consecutive cells starting at the given pointers, a cell's neighbors are
+** [lanes] and [ni] * [lanes] values away. Parameters given as arrays hold a
+** value per lane. [lanes] is a multiple of SIMD_MAX_WIDTH. */
+#define SIMD_MAX_WIDTH 16	/* floats in a vector of the widest kernels */
+
+/* The half precision kernels compute the same as the kernels of the same
+** name for values stored in half precision of [format]. The values are
+** converted to float on load and rounded once when stored. */
+
+/* Converts a half precision value of [format] to float and back. */
+float simd_half_to_float(unsigned short h, int format);
+unsigned short simd_float_to_half(float f, int format);
+
+/* The 3d kernels process [n] consecutive cells of a row of a grid of whole
+** planes, a cell's neighbors are 1, [ni] and [nij] values away, [ni] cells
+** per row and [nij] cells per plane. */
+
+/* Portable kernels, used on every architecture. */
+extern const struct simd_kernels simd_scalar_kernels;
+
+/* Returns the kernels for the widest instruction set the processor and
+** operating system support. */
+const struct simd_kernels* simd_select();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard: SIMD_H */
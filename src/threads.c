@@ -0,0 +1,176 @@
+#include "threads.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* polls before a waiting thread goes to sleep. most loops of a simulation
+** step are dispatched right after each other */
+#define SPIN_COUNT 20000
+
+typedef void (*band_fn_t)(int begin, int end, int thread, void* const vp);
+
+static int g_thread_count = 1;
+static pthread_t g_workers[THREADS_MAX_COUNT];
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t g_busy = PTHREAD_MUTEX_INITIALIZER;	/* held while
+								** a job runs */
+static pthread_cond_t g_wake = PTHREAD_COND_INITIALIZER;	/* new job */
+static pthread_cond_t g_done = PTHREAD_COND_INITIALIZER;	/* all bands
+								** finished */
+static unsigned int g_generation = 0;	/* incremented for each job */
+static unsigned int g_start_generation = 0;	/* generation seen by new
+						** workers */
+static int g_pending = 0;		/* bands not finished yet */
+static int g_quit = 0;
+
+/* the current job */
+static band_fn_t g_fn = NULL;
+static void* g_vp = NULL;
+static int g_begin = 0;
+static int g_end = 0;
+
+static void run_band(int thread)
+{
+	int n = g_end - g_begin;
+	int begin = g_begin + (int)((long long)n * thread / g_thread_count);
+	int end = g_begin + (int)((long long)n * (thread + 1) / g_thread_count);
+
+	if (begin < end) {
+		(*g_fn)(begin, end, thread, g_vp);
+	}
+}
+
+static void* worker(void* arg)
+{
+	int thread = (int)(intptr_t)arg;
+	int s = 0;
+	unsigned int seen = g_start_generation;
+
+	for (;;) {
+		for (s = 0; s < SPIN_COUNT; s++) {
+			if (__atomic_load_n(&g_generation, __ATOMIC_ACQUIRE) !=
+				seen) {
+				break;
+			}
+		}
+
+		pthread_mutex_lock(&g_mutex);
+
+		while (g_generation == seen && !g_quit) {
+			pthread_cond_wait(&g_wake, &g_mutex);
+		}
+
+		seen = g_generation;
+		pthread_mutex_unlock(&g_mutex);
+
+		if (g_quit) {
+			return NULL;
+		}
+
+		run_band(thread);
+
+		if (__atomic_sub_fetch(&g_pending, 1, __ATOMIC_ACQ_REL) == 0) {
+			pthread_mutex_lock(&g_mutex);
+			pthread_cond_signal(&g_done);
+			pthread_mutex_unlock(&g_mutex);
+		}
+	}
+}
+
+static void stop_workers()
+{
+	int t = 0;
+
+	pthread_mutex_lock(&g_mutex);
+	g_quit = 1;
+	pthread_cond_broadcast(&g_wake);
+	pthread_mutex_unlock(&g_mutex);
+
+	for (t = 1; t < g_thread_count; t++) {
+		pthread_join(g_workers[t], NULL);
+	}
+
+	g_quit = 0;
+	g_thread_count = 1;
+}
+
+void threads_set_count(int thread_count)
+{
+	int t = 0;
+
+	if (thread_count <= 0) {
+		thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	thread_count = thread_count < 1 ? 1 : thread_count;
+	thread_count = thread_count > THREADS_MAX_COUNT ?
+		THREADS_MAX_COUNT : thread_count;
+
+	if (thread_count == g_thread_count) {
+		return;
+	}
+
+	stop_workers();
+	g_thread_count = thread_count;
+	g_start_generation = g_generation;
+
+	for (t = 1; t < g_thread_count; t++) {
+		if (pthread_create(&g_workers[t], NULL, worker,
+			(void*)(intptr_t)t)) {
+			/* run with the workers we got */
+			g_thread_count = t;
+			break;
+		}
+	}
+}
+
+int threads_get_count()
+{
+	return g_thread_count;
+}
+
+void threads_for(void (*fn)(int begin, int end, int thread, void* const vp),
+	void* const vp, int begin, int end)
+{
+	int s = 0;
+
+	/* the workers may be busy with the job of another thread */
+	if (g_thread_count == 1 || end - begin < g_thread_count ||
+		pthread_mutex_trylock(&g_busy)) {
+		(*fn)(begin, end, 0, vp);
+		return;
+	}
+
+	g_fn = fn;
+	g_vp = vp;
+	g_begin = begin;
+	g_end = end;
+	g_pending = g_thread_count - 1;
+
+	pthread_mutex_lock(&g_mutex);
+	__atomic_add_fetch(&g_generation, 1, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&g_wake);
+	pthread_mutex_unlock(&g_mutex);
+
+	run_band(0);
+
+	for (s = 0; s < SPIN_COUNT; s++) {
+		if (__atomic_load_n(&g_pending, __ATOMIC_ACQUIRE) == 0) {
+			break;
+		}
+	}
+
+	if (s == SPIN_COUNT) {
+		pthread_mutex_lock(&g_mutex);
+
+		while (__atomic_load_n(&g_pending, __ATOMIC_ACQUIRE) > 0) {
+			pthread_cond_wait(&g_done, &g_mutex);
+		}
+
+		pthread_mutex_unlock(&g_mutex);
+	}
+
+	pthread_mutex_unlock(&g_busy);
+}
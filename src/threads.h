@@ -0,0 +1,33 @@
+/* persistent pool of worker threads that split loops into contiguous bands */
+#ifndef THREADS_H
+#define THREADS_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define THREADS_MAX_COUNT 64
+
+/* Sets the number of threads loops are split across, including the calling
+** thread. [thread_count] = 0 uses one thread per online processor, 1 runs
+** everything on the calling thread and stops the workers. */
+void threads_set_count(int thread_count);
+
+/* Gets the number of threads loops are split across. */
+int threads_get_count();
+
+/* Splits [begin, end) into one contiguous band per thread and calls [fn] for
+** each band in parallel. [fn] is passed the band, the index of the thread
+** in [0, threads_get_count()) and [vp]. Returns once all bands are done. 
+** Callers on different threads may share the pool; while the workers run 
+** the bands of one caller, the others process [begin, end) on their own 
+** thread as a single band. */
+void threads_for(void (*fn)(int begin, int end, int thread, void* const vp),
+	void* const vp, int begin, int end);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard: THREADS_H */
@@ -0,0 +1,115 @@
+/* Diffuses a random field with FLUIDS_SOLVER_SOR and compares it with the
+** solution of the implicit diffusion system converged by multigrid. The
+** error has to shrink with every doubling of the sweep count, and the
+** diffused values have to stay within the range of the initial ones.
+**
+** gcc -std=gnu99 -O2 -Isrc tests/diffuse_sor.c src/fluids.c src/simd.c
+**     src/threads.c src/dct.c src/arena.c -lm -lpthread */
+#include "fluids.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define CELL_COUNT 130
+#define MAX_SWEEP_COUNT 256
+
+static float max_error(fluids_context_t* const ctx, const float* const q,
+	const float* const q_ref)
+{
+	int i = 0, j = 0, n = 0;
+	float e = 0.0;
+
+	for (j = 1; j < CELL_COUNT - 1; j++) {
+		for (i = 1; i < CELL_COUNT - 1; i++) {
+			n = fluids_context_get_index(ctx, i, j);
+			e = fmaxf(e, fabsf(q[n] - q_ref[n]));
+		}
+	}
+
+	return e;
+}
+
+static int in_range(fluids_context_t* const ctx, const float* const q)
+{
+	int i = 0, j = 0;
+	float x = 0.0;
+
+	for (j = 1; j < CELL_COUNT - 1; j++) {
+		for (i = 1; i < CELL_COUNT - 1; i++) {
+			x = q[fluids_context_get_index(ctx, i, j)];
+
+			if (x < 0.0 || x > 1.0) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+int main()
+{
+	int d = 0, i = 0, j = 0, n = 0;
+	int failure_count = 0;
+	float diffs[] = { 1e-4, 1e-3, 1e-2, 1e-1 };
+	float e = 0.0, e_prev = 0.0;
+	float* q_prev = NULL;
+	float* q = NULL;
+	float* q_ref = NULL;
+	fluids_context_t* ctx = NULL;
+	fluids_tolerance_t tolerance = { 1e-6, 0.0, 100, 1 };
+
+	fluids_initialize();
+	ctx = fluids_context_create();
+	fluids_context_set_grid(ctx, 0.0, 0.0, 1.0 / (CELL_COUNT - 2),
+		CELL_COUNT, CELL_COUNT);
+	q_prev = fluids_context_malloc(ctx, 0.0);
+	q = fluids_context_malloc(ctx, 0.0);
+	q_ref = fluids_context_malloc(ctx, 0.0);
+	srand(1);
+
+	for (j = 1; j < CELL_COUNT - 1; j++) {
+		for (i = 1; i < CELL_COUNT - 1; i++) {
+			q_prev[fluids_context_get_index(ctx, i, j)] =
+				rand() / (float)RAND_MAX;
+		}
+	}
+
+	for (d = 0; d < sizeof(diffs) / sizeof(diffs[0]); d++) {
+		fluids_context_set_diffusion_solver(ctx,
+			FLUIDS_SOLVER_MULTIGRID);
+		fluids_context_diffuse_to_tolerance(ctx, q_ref, q_prev,
+			diffs[d], &tolerance, FLUIDS_BOUNDARY_NN, 0.1);
+		fluids_context_set_diffusion_solver(ctx, FLUIDS_SOLVER_SOR);
+		e_prev = max_error(ctx, q_prev, q_ref);
+
+		for (n = 1; n <= MAX_SWEEP_COUNT; n *= 2) {
+			fluids_context_diffuse(ctx, q, q_prev, diffs[d], n,
+				FLUIDS_BOUNDARY_NN, 0.1);
+			e = max_error(ctx, q, q_ref);
+
+			if (e > e_prev + 1e-6 || !in_range(ctx, q)) {
+				printf("diff %g, %d sweeps: error %g, "
+					"previously %g\n", diffs[d], n, e,
+					e_prev);
+				failure_count++;
+			}
+
+			e_prev = e;
+		}
+
+		/* the smaller time steps converge within the sweeps */
+		if (diffs[d] <= 1e-3 && e > 1e-4) {
+			printf("diff %g: error %g after %d sweeps\n", diffs[d],
+				e, MAX_SWEEP_COUNT);
+			failure_count++;
+		}
+	}
+
+	free(q_prev);
+	free(q);
+	free(q_ref);
+	fluids_context_destroy(ctx);
+	fluids_finalize();
+	return failure_count > 0;
+}
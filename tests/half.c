@@ -0,0 +1,165 @@
+/* Converts every half precision value of both formats to float and back,
+** which has to give the same value, and advects a smooth field stored in
+** half precision. The result has to match fluids_context_advect of the
+** same values in float to within the rounding to half precision.
+**
+** gcc -std=gnu99 -O2 -Isrc tests/half.c src/fluids.c src/simd.c
+**     src/threads.c src/dct.c src/arena.c -lm -lpthread */
+#include "fluids.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define VALUE_CELL_COUNT 258	/* cells a side, room for all 2^16 values */
+#define CELL_COUNT 130
+#define PI 3.14159265358979323846
+
+static int is_nan(fluids_half_t h, int format)
+{
+	if (format == FLUIDS_HALF_FP16) {
+		return (h & 0x7c00) == 0x7c00 && (h & 0x03ff);
+	}
+
+	return (h & 0x7f80) == 0x7f80 && (h & 0x007f);
+}
+
+/* the max. relative error of rounding to [format] */
+static float half_epsilon(int format)
+{
+	return format == FLUIDS_HALF_FP16 ? ldexpf(1.0, -11) :
+		ldexpf(1.0, -8);
+}
+
+static float density(float x, float y, void* const vp)
+{
+	return 0.5 + 0.5 * sinf(2.0 * PI * x) * cosf(3.0 * PI * y);
+}
+
+static float velocity_u(float x, float y, void* const vp)
+{
+	return sinf(PI * x) * cosf(PI * y);
+}
+
+static float velocity_v(float x, float y, void* const vp)
+{
+	return -cosf(PI * x) * sinf(PI * y);
+}
+
+static int test_round_trip(fluids_context_t* const ctx, int format)
+{
+	int i = 0, j = 0, k = 0, n = 0;
+	int failure_count = 0;
+	float* q = NULL;
+	fluids_half_t* h = NULL;
+	fluids_half_t* h_back = NULL;
+
+	fluids_context_set_grid(ctx, 0.0, 0.0, 1.0, VALUE_CELL_COUNT,
+		VALUE_CELL_COUNT);
+	q = fluids_context_malloc(ctx, 0.0);
+	h = fluids_context_malloc_half(ctx, 0.0, format);
+	h_back = fluids_context_malloc_half(ctx, 0.0, format);
+
+	for (j = 0; j < VALUE_CELL_COUNT; j++) {
+		for (i = 0; i < VALUE_CELL_COUNT; i++, k++) {
+			h[fluids_context_get_index(ctx, i, j)] = k & 0xffff;
+		}
+	}
+
+	fluids_context_half_to_float(ctx, q, h, format);
+	fluids_context_float_to_half(ctx, h_back, q, format);
+
+	for (j = 0; j < VALUE_CELL_COUNT; j++) {
+		for (i = 0; i < VALUE_CELL_COUNT; i++) {
+			n = fluids_context_get_index(ctx, i, j);
+
+			if (h_back[n] != h[n] && !is_nan(h[n], format)) {
+				printf("format %d: 0x%04x comes back as "
+					"0x%04x\n", format, h[n], h_back[n]);
+				failure_count++;
+			}
+		}
+	}
+
+	free(q);
+	free(h);
+	free(h_back);
+	return failure_count;
+}
+
+static int test_advect(fluids_context_t* const ctx, int format)
+{
+	int i = 0, j = 0, n = 0;
+	int failure_count = 0;
+	float e = 0.0, e_max = 0.0;
+	float* q_prev = NULL;
+	float* q = NULL;
+	float* q_half = NULL;
+	float* u = NULL;
+	float* v = NULL;
+	fluids_half_t* h_prev = NULL;
+	fluids_half_t* h = NULL;
+
+	fluids_context_set_grid(ctx, 0.0, 0.0, 1.0 / (CELL_COUNT - 2),
+		CELL_COUNT, CELL_COUNT);
+	q_prev = fluids_context_malloc(ctx, 0.0);
+	q = fluids_context_malloc(ctx, 0.0);
+	q_half = fluids_context_malloc(ctx, 0.0);
+	u = fluids_context_malloc(ctx, 0.0);
+	v = fluids_context_malloc(ctx, 0.0);
+	h_prev = fluids_context_malloc_half(ctx, 0.0, format);
+	h = fluids_context_malloc_half(ctx, 0.0, format);
+	fluids_context_set_with_function(ctx, u, velocity_u, NULL);
+	fluids_context_set_with_function(ctx, v, velocity_v, NULL);
+	fluids_context_set_with_function(ctx, q_prev, density, NULL);
+
+	/* both start from the values half precision can hold */
+	fluids_context_float_to_half(ctx, h_prev, q_prev, format);
+	fluids_context_half_to_float(ctx, q_prev, h_prev, format);
+
+	fluids_context_advect(ctx, q, q_prev, u, v, FLUIDS_BOUNDARY_NN, 0.01);
+	fluids_context_advect_half(ctx, h, h_prev, u, v, format,
+		FLUIDS_BOUNDARY_NN, 0.01);
+	fluids_context_half_to_float(ctx, q_half, h, format);
+
+	for (j = 1; j < CELL_COUNT - 1; j++) {
+		for (i = 1; i < CELL_COUNT - 1; i++) {
+			n = fluids_context_get_index(ctx, i, j);
+			e = fabsf(q_half[n] - q[n]);
+			e_max = fmaxf(e_max, e);
+
+			if (e > half_epsilon(format) * fabsf(q[n]) + 1e-6) {
+				failure_count++;
+			}
+		}
+	}
+
+	if (failure_count > 0) {
+		printf("format %d: %d cells off the float advection, by %g "
+			"at most\n", format, failure_count, e_max);
+	}
+
+	free(q_prev);
+	free(q);
+	free(q_half);
+	free(u);
+	free(v);
+	free(h_prev);
+	free(h);
+	return failure_count;
+}
+
+int main()
+{
+	int failure_count = 0;
+	fluids_context_t* ctx = NULL;
+
+	fluids_initialize();
+	ctx = fluids_context_create();
+	failure_count += test_round_trip(ctx, FLUIDS_HALF_FP16);
+	failure_count += test_round_trip(ctx, FLUIDS_HALF_BF16);
+	failure_count += test_advect(ctx, FLUIDS_HALF_FP16);
+	failure_count += test_advect(ctx, FLUIDS_HALF_BF16);
+	fluids_context_destroy(ctx);
+	fluids_finalize();
+	return failure_count > 0;
+}
@@ -0,0 +1,137 @@
+/* Expires particles in a pattern across several compaction blocks and
+** compacts them, directly and after an advection step. Exactly the live
+** particles have to remain, in their order, with their positions and
+** lifetimes.
+**
+** gcc -std=gnu99 -O2 -Isrc tests/particles_compact.c src/particles.c
+**     src/fluids.c src/simd.c src/threads.c src/dct.c src/arena.c -lm
+**     -lpthread */
+#include "particles.h"
+#include "fluids.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PARTICLE_COUNT 100000	/* several blocks, compacted in parallel */
+#define CELL_COUNT 66
+
+/* the positions and lifetimes the live particles should have after
+** compaction */
+struct expected {
+	float* xs;
+	float* ys;
+	float* lifetimes;
+	unsigned int count;
+};
+
+/* finds the particles that live on after a step of [dt] */
+static void expect_live(particles_context_t* const ctx, float dt,
+	struct expected* const e)
+{
+	const float* const xs = particles_context_get_x_positions(ctx);
+	const float* const ys = particles_context_get_y_positions(ctx);
+	const float* const lifetimes = particles_context_get_lifetimes(ctx);
+	unsigned int k = 0, n = particles_context_get_count(ctx);
+	float lifetime = 0.0;
+
+	e->count = 0;
+
+	for (k = 0; k < n; k++) {
+		lifetime = lifetimes[k] - dt;
+
+		if (lifetime >= 0.0) {
+			e->xs[e->count] = xs[k];
+			e->ys[e->count] = ys[k];
+			e->lifetimes[e->count] = lifetime;
+			e->count++;
+		}
+	}
+}
+
+static int check_live(particles_context_t* const ctx,
+	const struct expected* const e, const char* const what)
+{
+	const float* const xs = particles_context_get_x_positions(ctx);
+	const float* const ys = particles_context_get_y_positions(ctx);
+	const float* const lifetimes = particles_context_get_lifetimes(ctx);
+	unsigned int k = 0;
+
+	if (particles_context_get_count(ctx) != e->count ||
+		particles_context_get_live_count(ctx) != e->count) {
+		printf("%s: %u particles, %u live, expected %u\n", what,
+			particles_context_get_count(ctx),
+			particles_context_get_live_count(ctx), e->count);
+		return 1;
+	}
+
+	for (k = 0; k < e->count; k++) {
+		if (xs[k] != e->xs[k] || ys[k] != e->ys[k] ||
+			lifetimes[k] != e->lifetimes[k]) {
+			printf("%s: particle %u differs\n", what, k);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main()
+{
+	int failure_count = 0;
+	unsigned int k = 0, n = 0;
+	float* lifetimes = NULL;
+	float* u = NULL;
+	float* v = NULL;
+	struct expected e;
+	particles_context_t* ctx = NULL;
+	fluids_context_t* fluids = NULL;
+
+	fluids_initialize();
+	fluids = fluids_context_create();
+	fluids_context_set_grid(fluids, -1.0, -1.0, 2.0 / (CELL_COUNT - 2),
+		CELL_COUNT, CELL_COUNT);
+	u = fluids_context_malloc(fluids, 0.0);
+	v = fluids_context_malloc(fluids, 0.0);
+	ctx = particles_context_create();
+	particles_context_set_compaction_interval(ctx, 0);
+	particles_context_emit(ctx, PARTICLE_COUNT);
+	n = particles_context_get_count(ctx);
+	e.xs = malloc(sizeof(*e.xs) * n);
+	e.ys = malloc(sizeof(*e.ys) * n);
+	e.lifetimes = malloc(sizeof(*e.lifetimes) * n);
+	srand(1);
+
+	/* expire about a third, and whole runs at the block boundaries */
+	lifetimes = particles_context_get_lifetimes(ctx);
+
+	for (k = 0; k < n; k++) {
+		lifetimes[k] = rand() % 3 == 0 || (k >= 16000 && k < 17000) ?
+			-1.0 : k;
+	}
+
+	expect_live(ctx, 0.0, &e);
+	particles_context_compact(ctx);
+	failure_count += check_live(ctx, &e, "compaction");
+
+	/* a still velocity field, so only the lifetimes change */
+	particles_context_set_compaction_interval(ctx, 1);
+	lifetimes = particles_context_get_lifetimes(ctx);
+	n = particles_context_get_count(ctx);
+
+	for (k = 0; k < n; k++) {
+		lifetimes[k] = 0.1 * (k % 7);
+	}
+
+	expect_live(ctx, 0.25, &e);
+	particles_context_advect(ctx, fluids, u, v, 0.25);
+	failure_count += check_live(ctx, &e, "advection");
+
+	free(e.xs);
+	free(e.ys);
+	free(e.lifetimes);
+	free(u);
+	free(v);
+	particles_context_destroy(ctx);
+	fluids_context_destroy(fluids);
+	fluids_finalize();
+	return failure_count > 0;
+}
@@ -0,0 +1,101 @@
+/* Projects a smooth 3D velocity field with fluids3d_project, on a grid
+** large enough to be split across threads. The divergence away from the
+** walls has to drop to a small fraction of the initial one.
+**
+** gcc -std=gnu99 -O2 -Isrc tests/project_3d.c src/fluids3d.c src/fluids.c
+**     src/simd.c src/threads.c src/dct.c src/arena.c -lm -lpthread */
+#include "fluids3d.h"
+#include "fluids.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define CELL_COUNT 50
+#define SWEEP_COUNT 512
+#define MARGIN 3		/* cells next to the walls left out */
+#define PI 3.14159265358979323846
+
+static float velocity_u(float x, float y, float z, void* const vp)
+{
+	return sinf(PI * x) * cosf(3.0 * y) * cosf(2.0 * z);
+}
+
+static float velocity_v(float x, float y, float z, void* const vp)
+{
+	return sinf(PI * y) * cosf(2.0 * x) + x * sinf(2.0 * PI * y);
+}
+
+static float velocity_w(float x, float y, float z, void* const vp)
+{
+	return sinf(PI * z) * cosf(x + y);
+}
+
+/* the max. divergence away from the walls. the central differences of
+** the divergence do not vanish next to the walls, and least of all next
+** to their edges, after a projection */
+static float inner_divergence(fluids3d_context_t* const ctx,
+	const float* const u, const float* const v, const float* const w,
+	float* const div)
+{
+	int i = 0, j = 0, k = 0;
+	float d = 0.0;
+
+	fluids3d_get_max_divergence(ctx, u, v, w, div);
+
+	for (k = MARGIN; k < CELL_COUNT - MARGIN; k++) {
+		for (j = MARGIN; j < CELL_COUNT - MARGIN; j++) {
+			for (i = MARGIN; i < CELL_COUNT - MARGIN; i++) {
+				d = fmaxf(d, fabsf(div[fluids3d_get_index(ctx,
+					i, j, k)]));
+			}
+		}
+	}
+
+	return d;
+}
+
+int main()
+{
+	int failure_count = 0;
+	float d = 0.0, d_init = 0.0;
+	float* u = NULL;
+	float* v = NULL;
+	float* w = NULL;
+	float* p = NULL;
+	float* div = NULL;
+	fluids3d_context_t* ctx = NULL;
+
+	fluids_initialize();
+	ctx = fluids3d_context_create(0.0, 0.0, 0.0, 1.0 / (CELL_COUNT - 2),
+		CELL_COUNT, CELL_COUNT, CELL_COUNT);
+	u = fluids3d_malloc(ctx, 0.0);
+	v = fluids3d_malloc(ctx, 0.0);
+	w = fluids3d_malloc(ctx, 0.0);
+	p = fluids3d_malloc(ctx, 0.0);
+	div = fluids3d_malloc(ctx, 0.0);
+	fluids3d_set_with_function(ctx, u, velocity_u, NULL);
+	fluids3d_set_with_function(ctx, v, velocity_v, NULL);
+	fluids3d_set_with_function(ctx, w, velocity_w, NULL);
+
+	/* without sweeps, the projection only reflects the velocities at the
+	** walls */
+	fluids3d_project(ctx, u, v, w, p, div, 0);
+	d_init = inner_divergence(ctx, u, v, w, div);
+	fluids3d_project(ctx, u, v, w, p, div, SWEEP_COUNT);
+	d = inner_divergence(ctx, u, v, w, div);
+
+	if (d > 0.01 * d_init) {
+		printf("divergence %g after %d sweeps, initially %g\n", d,
+			SWEEP_COUNT, d_init);
+		failure_count++;
+	}
+
+	free(u);
+	free(v);
+	free(w);
+	free(p);
+	free(div);
+	fluids3d_context_destroy(ctx);
+	fluids_finalize();
+	return failure_count > 0;
+}
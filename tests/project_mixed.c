@@ -0,0 +1,134 @@
+/* Projects a smooth velocity field with FLUIDS_SOLVER_SOR in float and with
+** mixed precision rounds of iterative refinement, with the same number of
+** sweeps. The residual of the pressure of the mixed precision solve has to
+** reach the one of the float solve.
+**
+** gcc -std=gnu99 -O2 -Isrc tests/project_mixed.c src/fluids.c src/simd.c
+**     src/threads.c src/dct.c src/arena.c -lm -lpthread */
+#include "fluids.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define PI 3.14159265358979323846
+
+struct test_case {
+	int cell_count;
+	int format;
+	int round_count;
+	int sweep_count;
+};
+
+static float velocity_u(float x, float y, void* const vp)
+{
+	return sinf(PI * x) * cosf(3.0 * y);
+}
+
+static float velocity_v(float x, float y, void* const vp)
+{
+	return sinf(PI * y) * cosf(2.0 * x) + x * sinf(2.0 * PI * y);
+}
+
+/* reflects the velocities at the walls, so no flow crosses them and the
+** pressure equation has a solution */
+static void reflect_walls(fluids_context_t* const ctx, float* const u,
+	float* const v, int cell_count)
+{
+	int k = 0, n = cell_count - 1;
+
+	for (k = 1; k < n; k++) {
+		u[fluids_context_get_index(ctx, 0, k)] =
+			-u[fluids_context_get_index(ctx, 1, k)];
+		u[fluids_context_get_index(ctx, n, k)] =
+			-u[fluids_context_get_index(ctx, n - 1, k)];
+		v[fluids_context_get_index(ctx, k, 0)] =
+			-v[fluids_context_get_index(ctx, k, 1)];
+		v[fluids_context_get_index(ctx, k, n)] =
+			-v[fluids_context_get_index(ctx, k, n - 1)];
+	}
+}
+
+/* the max. norm of the residual of the pressure equation, the divergence
+** being the scaled one fluids_context_project leaves in [div] */
+static float residual(fluids_context_t* const ctx, const float* const p,
+	const float* const div, int cell_count)
+{
+	int i = 0, j = 0, n = 0;
+	int pitch = fluids_context_get_index(ctx, 0, 1) -
+		fluids_context_get_index(ctx, 0, 0);
+	float r = 0.0;
+
+	for (j = 1; j < cell_count - 1; j++) {
+		for (i = 1; i < cell_count - 1; i++) {
+			n = fluids_context_get_index(ctx, i, j);
+			r = fmaxf(r, fabsf(div[n] - 4.0 * p[n] + p[n - 1] +
+				p[n + 1] + p[n - pitch] + p[n + pitch]));
+		}
+	}
+
+	return r;
+}
+
+static float project(fluids_context_t* const ctx,
+	const struct test_case* const c, int round_count)
+{
+	float r = 0.0;
+	float* u = NULL;
+	float* v = NULL;
+	float* p = NULL;
+	float* div = NULL;
+
+	fluids_context_set_grid(ctx, 0.0, 0.0, 1.0 / (c->cell_count - 2),
+		c->cell_count, c->cell_count);
+	u = fluids_context_malloc(ctx, 0.0);
+	v = fluids_context_malloc(ctx, 0.0);
+	p = fluids_context_malloc(ctx, 0.0);
+	div = fluids_context_malloc(ctx, 0.0);
+	fluids_context_set_with_function(ctx, u, velocity_u, NULL);
+	fluids_context_set_with_function(ctx, v, velocity_v, NULL);
+	reflect_walls(ctx, u, v, c->cell_count);
+	fluids_context_set_mixed_precision(ctx, round_count, c->format);
+	fluids_context_project(ctx, u, v, FLUIDS_BOUNDARY_REFLECT_U,
+		FLUIDS_BOUNDARY_REFLECT_V, p, div, c->sweep_count);
+	r = residual(ctx, p, div, c->cell_count);
+
+	free(u);
+	free(v);
+	free(p);
+	free(div);
+	return r;
+}
+
+int main()
+{
+	int k = 0;
+	int failure_count = 0;
+	float r = 0.0, r_float = 0.0;
+	fluids_context_t* ctx = NULL;
+	/* bf16 keeps too few bits for the corrections of large grids */
+	struct test_case cases[] = {
+		{ 130, FLUIDS_HALF_FP16, 8, 1600 },
+		{ 34, FLUIDS_HALF_FP16, 8, 400 },
+		{ 34, FLUIDS_HALF_BF16, 8, 400 }
+	};
+
+	fluids_initialize();
+	ctx = fluids_context_create();
+	fluids_context_set_pressure_solver(ctx, FLUIDS_SOLVER_SOR);
+
+	for (k = 0; k < sizeof(cases) / sizeof(cases[0]); k++) {
+		r_float = project(ctx, cases + k, 0);
+		r = project(ctx, cases + k, cases[k].round_count);
+
+		if (r > 2.0 * r_float) {
+			printf("%d cells, format %d: residual %g, %g in "
+				"float\n", cases[k].cell_count,
+				cases[k].format, r, r_float);
+			failure_count++;
+		}
+	}
+
+	fluids_context_destroy(ctx);
+	fluids_finalize();
+	return failure_count > 0;
+}
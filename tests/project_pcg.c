@@ -0,0 +1,155 @@
+/* Projects a smooth velocity field with fluids_context_project_pcg and
+** compares the result with the projection converged by multigrid. The
+** residual has to meet the tolerance, the velocities have to match and
+** the divergence left has to be a small fraction of the initial one.
+**
+** gcc -std=gnu99 -O2 -Isrc tests/project_pcg.c src/fluids.c src/simd.c
+**     src/threads.c src/dct.c src/arena.c -lm -lpthread */
+#include "fluids.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define CELL_COUNT 130
+#define MAX_ITERATION_COUNT 1000
+#define TOLERANCE 1e-7		/* relative to the initial divergence */
+#define MAX_ERROR 1e-4
+#define MARGIN 2		/* cells next to the walls left out */
+#define PI 3.14159265358979323846
+
+static float velocity_u(float x, float y, void* const vp)
+{
+	return sinf(PI * x) * cosf(3.0 * y);
+}
+
+static float velocity_v(float x, float y, void* const vp)
+{
+	return sinf(PI * y) * cosf(2.0 * x) + x * sinf(2.0 * PI * y);
+}
+
+static void copy(fluids_context_t* const ctx, float* const q,
+	const float* const q_src)
+{
+	int i = 0, j = 0, n = 0;
+
+	for (j = 0; j < CELL_COUNT; j++) {
+		for (i = 0; i < CELL_COUNT; i++) {
+			n = fluids_context_get_index(ctx, i, j);
+			q[n] = q_src[n];
+		}
+	}
+}
+
+static float max_error(fluids_context_t* const ctx, const float* const q,
+	const float* const q_ref)
+{
+	int i = 0, j = 0, n = 0;
+	float e = 0.0;
+
+	for (j = 1; j < CELL_COUNT - 1; j++) {
+		for (i = 1; i < CELL_COUNT - 1; i++) {
+			n = fluids_context_get_index(ctx, i, j);
+			e = fmaxf(e, fabsf(q[n] - q_ref[n]));
+		}
+	}
+
+	return e;
+}
+
+/* the max. divergence away from the walls. the central differences of
+** the divergence do not vanish next to the walls after a projection */
+static float inner_divergence(fluids_context_t* const ctx,
+	const float* const u, const float* const v, float* const div)
+{
+	int i = 0, j = 0;
+	float d = 0.0;
+
+	fluids_context_get_max_divergence(ctx, u, v, div);
+
+	for (j = MARGIN; j < CELL_COUNT - MARGIN; j++) {
+		for (i = MARGIN; i < CELL_COUNT - MARGIN; i++) {
+			d = fmaxf(d, fabsf(div[fluids_context_get_index(ctx,
+				i, j)]));
+		}
+	}
+
+	return d;
+}
+
+int main()
+{
+	int failure_count = 0;
+	float div_max = 0.0, div_max_init = 0.0, e = 0.0;
+	float* u_init = NULL;
+	float* v_init = NULL;
+	float* u = NULL;
+	float* v = NULL;
+	float* u_ref = NULL;
+	float* v_ref = NULL;
+	float* p = NULL;
+	float* div = NULL;
+	fluids_context_t* ctx = NULL;
+	fluids_tolerance_t tolerance = { 0.0, 1e-6, 100, 1 };
+	fluids_solver_result_t result;
+
+	fluids_initialize();
+	ctx = fluids_context_create();
+	fluids_context_set_grid(ctx, 0.0, 0.0, 1.0 / (CELL_COUNT - 2),
+		CELL_COUNT, CELL_COUNT);
+	u_init = fluids_context_malloc(ctx, 0.0);
+	v_init = fluids_context_malloc(ctx, 0.0);
+	u = fluids_context_malloc(ctx, 0.0);
+	v = fluids_context_malloc(ctx, 0.0);
+	u_ref = fluids_context_malloc(ctx, 0.0);
+	v_ref = fluids_context_malloc(ctx, 0.0);
+	p = fluids_context_malloc(ctx, 0.0);
+	div = fluids_context_malloc(ctx, 0.0);
+	fluids_context_set_with_function(ctx, u_init, velocity_u, NULL);
+	fluids_context_set_with_function(ctx, v_init, velocity_v, NULL);
+	div_max_init = inner_divergence(ctx, u_init, v_init, div);
+
+	copy(ctx, u_ref, u_init);
+	copy(ctx, v_ref, v_init);
+	fluids_context_set_pressure_solver(ctx, FLUIDS_SOLVER_MULTIGRID);
+	fluids_context_project_to_tolerance(ctx, u_ref, v_ref,
+		FLUIDS_BOUNDARY_REFLECT_U, FLUIDS_BOUNDARY_REFLECT_V, p, div,
+		&tolerance);
+
+	copy(ctx, u, u_init);
+	copy(ctx, v, v_init);
+	fluids_context_set(ctx, p, 0.0);
+	result = fluids_context_project_pcg(ctx, u, v,
+		FLUIDS_BOUNDARY_REFLECT_U, FLUIDS_BOUNDARY_REFLECT_V, p, div,
+		TOLERANCE * div_max_init, MAX_ITERATION_COUNT);
+	div_max = inner_divergence(ctx, u, v, div);
+	e = fmaxf(max_error(ctx, u, u_ref), max_error(ctx, v, v_ref));
+
+	if (result.residual > TOLERANCE * div_max_init) {
+		printf("residual %g after %d iterations\n", result.residual,
+			result.iteration_count);
+		failure_count++;
+	}
+
+	if (div_max > 0.01 * div_max_init) {
+		printf("divergence %g, initially %g\n", div_max,
+			div_max_init);
+		failure_count++;
+	}
+
+	if (e > MAX_ERROR) {
+		printf("velocities differ by %g from multigrid\n", e);
+		failure_count++;
+	}
+
+	free(u_init);
+	free(v_init);
+	free(u);
+	free(v);
+	free(u_ref);
+	free(v_ref);
+	free(p);
+	free(div);
+	fluids_context_destroy(ctx);
+	fluids_finalize();
+	return failure_count > 0;
+}
@@ -0,0 +1,150 @@
+/* Adapts a quadtree to a smoke blob over several calls of quadtree_adapt,
+** which has to keep the integrals of the fields it carries over, then
+** projects a velocity field on the adapted leaves. The residual of the
+** projection has to drop below its tolerance.
+**
+** gcc -std=gnu99 -O2 -Isrc tests/quadtree.c src/quadtree.c src/fluids.c
+**     src/simd.c src/threads.c src/dct.c src/arena.c -lm -lpthread */
+#include "quadtree.h"
+#include "fluids.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define CELL_COUNT 128
+#define LEVEL_COUNT 5
+#define STEP_COUNT 8
+#define MAX_ITERATION_COUNT 1000
+#define TOLERANCE 1e-4		/* relative to the initial residual */
+#define PI 3.14159265358979323846
+
+struct blob {
+	float x;
+	float y;
+};
+
+/* a smooth blob of smoke around ([x], [y]) */
+static float smoke(float x, float y, void* const vp)
+{
+	const struct blob* const b = vp;
+	float dx = x - b->x, dy = y - b->y;
+
+	return expf(-40.0 * (dx * dx + dy * dy));
+}
+
+static float temperature(float x, float y, void* const vp)
+{
+	return 1.0 + 0.5 * sinf(PI * x) * sinf(PI * y);
+}
+
+static float velocity_u(float x, float y, void* const vp)
+{
+	return sinf(3.0 * x) * cosf(2.0 * y) + 0.5;
+}
+
+static float velocity_v(float x, float y, void* const vp)
+{
+	return cosf(2.0 * x) * sinf(5.0 * y);
+}
+
+/* the sum of the values times the areas of the leaves */
+static double integral(const quadtree_t* const qt, const float* const q)
+{
+	int c = 0;
+	float x = 0.0, y = 0.0, size = 0.0;
+	double sum = 0.0;
+
+	for (c = 0; c < quadtree_get_leaf_count(qt); c++) {
+		quadtree_get_leaf(qt, c, &x, &y, &size);
+		sum += (double)q[c] * size * size;
+	}
+
+	return sum;
+}
+
+static int check_integral(double before, double after, const char* what,
+	int step)
+{
+	if (fabs(after - before) > 1e-5 * fabs(before)) {
+		printf("step %d: integral of %s %g, before %g\n", step, what,
+			after, before);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main()
+{
+	int step = 0;
+	int failure_count = 0;
+	double smoke_before = 0.0, temperature_before = 0.0;
+	float r_init = 0.0;
+	float* fields[2] = { NULL, NULL };
+	const float* criteria[1] = { NULL };
+	float thresholds[1] = { 0.05 };
+	float* u = NULL;
+	float* v = NULL;
+	float* p = NULL;
+	float* div = NULL;
+	struct blob b = { 0.0, -0.5 };
+	quadtree_t* qt = NULL;
+	quadtree_refinement_t refinement = { NULL, 0.0, criteria,
+		thresholds, 1, 0.2, 1 };
+	fluids_solver_result_t result;
+
+	fluids_initialize();
+	qt = quadtree_create(-1.0, -1.0, 2.0 / CELL_COUNT, CELL_COUNT,
+		CELL_COUNT, LEVEL_COUNT);
+	fields[0] = quadtree_malloc(qt, 0.0);
+	fields[1] = quadtree_malloc(qt, 0.0);
+	quadtree_set_with_function(qt, fields[1], temperature, NULL);
+
+	/* the blob rises, so leaves are split ahead of it and merged
+	** behind it */
+	for (step = 0; step < STEP_COUNT; step++) {
+		b.y = -0.5 + 0.1 * step;
+		quadtree_set_with_function(qt, fields[0], smoke, &b);
+		criteria[0] = fields[0];
+		smoke_before = integral(qt, fields[0]);
+		temperature_before = integral(qt, fields[1]);
+
+		if (!quadtree_adapt(qt, &refinement, fields, 2)) {
+			printf("step %d: cannot adapt\n", step);
+			failure_count++;
+			continue;
+		}
+
+		failure_count += check_integral(smoke_before,
+			integral(qt, fields[0]), "smoke", step);
+		failure_count += check_integral(temperature_before,
+			integral(qt, fields[1]), "temperature", step);
+	}
+
+	u = quadtree_malloc(qt, 0.0);
+	v = quadtree_malloc(qt, 0.0);
+	p = quadtree_malloc(qt, 0.0);
+	div = quadtree_malloc(qt, 0.0);
+	quadtree_set_with_function(qt, u, velocity_u, NULL);
+	quadtree_set_with_function(qt, v, velocity_v, NULL);
+	r_init = quadtree_project(qt, u, v, p, div, 0.0, 0).residual;
+	result = quadtree_project(qt, u, v, p, div, TOLERANCE * r_init,
+		MAX_ITERATION_COUNT);
+
+	if (result.residual > TOLERANCE * r_init) {
+		printf("%d leaves: residual %g after %d iterations, initially "
+			"%g\n", quadtree_get_leaf_count(qt), result.residual,
+			result.iteration_count, r_init);
+		failure_count++;
+	}
+
+	free(fields[0]);
+	free(fields[1]);
+	free(u);
+	free(v);
+	free(p);
+	free(div);
+	quadtree_destroy(qt);
+	fluids_finalize();
+	return failure_count > 0;
+}